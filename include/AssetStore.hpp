@@ -36,7 +36,6 @@ public:
 			std::vector<std::string> path{ "res/models_test/" + modelOnDisk->second.name + "." + modelOnDisk->second.extension };
 			
 			model.lodPaths = { ai.fullPath };
-			model.lodLimits = { 0 };
 
 			model.prepare(path, name);
 			model.getAvailability() |= Asset::ON_DISK;
@@ -45,6 +44,7 @@ public:
 			return true;
 		}
 	}
+	// Frees a model's GPU data, see Model::cleanupGPU
 	void unloadAsset(const std::string name); /// Should be unload assets by their handle (hash) ??
 	////
 
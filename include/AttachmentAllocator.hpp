@@ -0,0 +1,36 @@
+#pragma once
+#include "PCH.hpp"
+
+/*
+	@brief	Places attachments whose lifetimes within a frame don't overlap in the same memory
+	@note	Pure CPU bookkeeping like BufferSubAllocator, nothing touches Vulkan so it can be exercised without a device.
+			Lifetimes are the first and last step of the frame an attachment is used in, inclusive. Attachments have to
+			be placed in order of first use. Each goes into the free slot that fits it best, one that is already large
+			enough if there is one, or the one that grows least. The caller allocates each slot's memory afterwards.
+*/
+class AttachmentAllocator
+{
+public:
+	struct Slot
+	{
+		u64 size;
+		u64 alignment;
+		u32 memoryTypeBits; // Types every attachment in the slot can live in
+		u32 lastUse;
+	};
+
+	AttachmentAllocator() : placedSize(0) {}
+
+	// Returns the slot the attachment was placed in
+	u32 place(u32 firstUse, u32 lastUse, u64 size, u64 alignment, u32 memoryTypeBits);
+	void clear();
+
+	const std::vector<Slot>& getSlots() const { return slots; }
+	// Of every slot, against getPlacedSize() without aliasing
+	u64 getSlotSize() const;
+	u64 getPlacedSize() const { return placedSize; }
+
+private:
+	std::vector<Slot> slots;
+	u64 placedSize;
+};
@@ -0,0 +1,58 @@
+#pragma once
+#include "PCH.hpp"
+
+/*
+	@brief	Free-list sub-allocator for ranges of one large buffer
+	@note	Pure CPU bookkeeping, units are whatever the caller chooses (bytes, vertices, indices) and nothing touches Vulkan,
+			so it can be exercised without a device. Allocation is best-fit, neighbouring free ranges are coalesced on free.
+*/
+class BufferSubAllocator
+{
+public:
+	static const u64 INVALID_OFFSET = ~u64(0);
+
+	// A range that compact() relocated, the caller has to copy the data, patch anything pointing at srcOffset and free srcOffset
+	struct Move
+	{
+		u64 srcOffset;
+		u64 dstOffset;
+		u64 size;
+	};
+
+	BufferSubAllocator() : capacity(0), used(0) {}
+
+	void init(u64 pCapacity);
+
+	// Returns INVALID_OFFSET if no free range is large enough
+	u64 allocate(u64 size);
+	void free(u64 offset);
+
+	/*
+		@brief	Moves allocations, last first, into the lowest free range before them that can hold them
+		@note	Every destination is allocated and every source stays allocated, so the data can be copied while the old
+				range is still read and nothing overlaps. Space only comes back once the caller frees the sources
+		@param	maxSize Stops after moving this much
+		@return	Relocated ranges in descending source offset order
+	*/
+	std::vector<Move> compact(u64 maxSize);
+
+	u64 getCapacity() const { return capacity; }
+	u64 getUsed() const { return used; }
+	u64 getLargestFreeRange() const { return freeBySize.empty() ? 0 : freeBySize.rbegin()->first; }
+	u32 getFreeRangeCount() const { return u32(freeByOffset.size()); }
+	u32 getAllocationCount() const { return u32(allocations.size()); }
+
+	// 0 when all free space is one range, approaching 1 as it is split into many small ranges
+	float getFragmentation() const;
+
+private:
+	void addFreeRange(u64 offset, u64 size);
+	void removeFreeRange(std::map<u64, u64>::iterator it);
+
+	u64 capacity;
+	u64 used;
+
+	std::map<u64, u64> freeByOffset; // Offset -> size
+	std::set<std::pair<u64, u64>> freeBySize; // (size, offset), for best-fit lookup
+	std::map<u64, u64> allocations; // Offset -> size
+};
@@ -42,6 +42,9 @@ public:
 
 	glm::fvec4 getViewRays() { return glm::fvec4(viewRays[2].x, viewRays[2].y, viewRays[0].x, viewRays[0].y); }
 
+	// Incremented whenever the view or projection changes, so per-frame work can be skipped for a still camera
+	u32 getChangeCount() { return changeCount; }
+
 //private:
 
 	float ler(float a, float b, float N)
@@ -72,4 +75,6 @@ public:
 	float moveLerpFactor;
 
 	glm::fvec4 viewRays[4];
+
+	u32 changeCount;
 };
\ No newline at end of file
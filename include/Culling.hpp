@@ -0,0 +1,72 @@
+#pragma once
+#include "PCH.hpp"
+
+// Limits of the GPU culling pass, these must match the defines in res/shaders/cull.glsl
+// Instance and draw capacities are not fixed, the buffers grow with the scene (see Renderer::growDrawBuffers)
+#define CULL_MAX_VIEWS 32
+#define CULL_GROUP_SIZE 64
+
+/*
+	@brief	Entry of instanceDataBuffer, copied to visibleInstanceBuffer by culling and read by the draws through
+			gl_InstanceIndex. Must match the Instance struct of the shaders (std430)
+*/
+struct InstanceData
+{
+	u32 transformIndex;
+	u32 materialIndex; // Material::gpuIndexBase
+};
+
+// View slots. Lights that do not fit in the remaining slots share CULL_VIEW_ALL, which accepts everything
+#define CULL_VIEW_CAMERA 0
+#define CULL_VIEW_SUN_BASE 1
+#define CULL_VIEW_LIGHT_BASE 4
+#define CULL_VIEW_ALL (CULL_MAX_VIEWS - 1)
+
+// Passes of cull.glsl, selected with a push constant
+#define CULL_PASS_VISIBILITY 0
+#define CULL_PASS_SCAN_BLOCKS 1
+#define CULL_PASS_COMPACT_INSTANCES 2
+#define CULL_PASS_COMPACT_DRAWS 3
+
+/*
+	@brief	A culling view (camera frustum, light frustum or light bounds) described by six normalised planes
+	@note	A point is inside a plane when dot(plane.xyz, p) + plane.w >= 0. A view with all planes zero accepts everything
+*/
+struct CullView
+{
+	glm::fvec4 planes[6];
+
+	static CullView fromProjView(const glm::fmat4& projView);
+	static CullView fromSphere(glm::fvec3 centre, float radius);
+};
+
+/*
+	@brief	Layout of the "views" uniform buffer of cull.glsl (std140)
+*/
+struct CullViewsUBOData
+{
+	CullView views[CULL_MAX_VIEWS];
+	u32 viewCount;
+	u32 instanceCount;
+	u32 batchCount;
+	u32 shadowInstanceBase; // Instances and batches from these are only visible to shadow views, the ones before only to the camera
+	u32 shadowBatchBase;
+	u32 instanceStride; // Per view stride of the visibility and visible instance buffers, the instance capacity
+	u32 drawStride; // Per view stride of the batch and culled command buffers, the draw capacity
+	u32 blockStride; // Per view stride of the block rank buffer, the instance capacity in CULL_GROUP_SIZE blocks
+};
+
+/*
+	@brief	CPU reference implementation of cull.glsl
+	@note	Given the same inputs the output buffers are bit-exact with the ones written by the GPU. The sphere tests round
+			identically (see sphereInView) as long as no value is denormal, which Vulkan allows to be flushed. Here the
+			instance compaction walks each batch in order, cull.glsl gets the same order from prefix sums of the visibility
+			(the rank buffers, which are not outputs). The draw compaction walks the batches in order on both.
+			tests/CullingTests.cpp checks it against hand-derived values, cull.glsl itself isn't run by the tests.
+			Output buffers are laid out per view, with strides cull.instanceStride and cull.drawStride.
+	@param	batches Draw batches as written by Renderer::populateDrawCmdBuffer, each covers a range of instanceData. They are
+			in instance order, cull.glsl finds an instance's batch with a binary search
+*/
+void cullReference(const CullViewsUBOData& cull, const glm::fmat4* transforms, const InstanceData* instanceData, const glm::fvec4* instanceBounds,
+	const VkDrawIndexedIndirectCommand* batches, u32* visibility, InstanceData* visibleInstances, VkDrawIndexedIndirectCommand* batchCommands,
+	VkDrawIndexedIndirectCommand* culledCommands, u32* drawCounts);
@@ -7,7 +7,7 @@ void postMessage(std::string msg, glm::fvec3 col);
 
 struct EngineConfig
 {
-	enum Group { SSAO_Group };
+	enum Group { SSAO_Group, LOD_Group, Limits_Group };
 	enum Special { Render_Resolution };
 
 	EngineConfig() : render(changedGroups, changedSpecials) {}
@@ -15,7 +15,7 @@ struct EngineConfig
 	struct Render
 	{
 		Render() = delete;
-		Render(std::set<Group>& cg, std::set<Special>& cs) : changedGroups(cg), changedSpecials(cs), ssao(cg, cs) {}
+		Render(std::set<Group>& cg, std::set<Special>& cs) : changedGroups(cg), changedSpecials(cs), ssao(cg, cs), lod(cg, cs), limits(cg, cs) {}
 		struct SSAO
 		{
 		public:
@@ -99,6 +99,152 @@ struct EngineConfig
 			std::set<Special>& changedSpecials;
 		} ssao;
 
+		struct LOD
+		{
+		public:
+			LOD() = delete;
+			LOD(std::set<Group>& cg, std::set<Special>& cs) : changedGroups(cg), changedSpecials(cs), errorThreshold(1.f), bias(0.f), shadowBias(0.f), hysteresis(0.f) {}
+
+			// Largest projected geometric error, in pixels, that a LOD may have to be selected
+			void setErrorThreshold(float set) {
+				if (set <= 0) {
+					postMessage("Invalid LOD errorThreshold setting. Range (0,inf]", ERROR_COL);
+					return;
+				}
+				errorThreshold = set;
+				changedGroups.insert(LOD_Group);
+			}
+			float getErrorThreshold() const { return errorThreshold; }
+
+			// Each step of bias doubles (positive) or halves (negative) the error threshold
+			void setBias(float set) {
+				bias = set;
+				changedGroups.insert(LOD_Group);
+			}
+			float getBias() const { return bias; }
+
+			// Added to bias for shadow passes
+			void setShadowBias(float set) {
+				shadowBias = set;
+				changedGroups.insert(LOD_Group);
+			}
+			float getShadowBias() const { return shadowBias; }
+
+			// Fraction of the threshold an error has to move past it before the LOD switches
+			void setHysteresis(float set) {
+				if (set < 0 || set >= 1) {
+					postMessage("Invalid LOD hysteresis setting. Range [0,1)", ERROR_COL);
+					return;
+				}
+				hysteresis = set;
+				changedGroups.insert(LOD_Group);
+			}
+			float getHysteresis() const { return hysteresis; }
+
+		private:
+			float errorThreshold;
+			float bias;
+			float shadowBias;
+			float hysteresis;
+
+			std::set<Group>& changedGroups;
+			std::set<Special>& changedSpecials;
+		} lod;
+
+		/*
+			@brief	Sizes of the draw, instance and transform buffers
+			@note	The buffers start at the initial capacities and grow by growthFactor whenever the scene outgrows them,
+					up to the maximums. Raising a capacity after startup grows the buffers up front. Instances are counted
+					once for the camera and once for shadows, so a scene of N instances needs 2N
+		*/
+		struct Limits
+		{
+		public:
+			Limits() = delete;
+			Limits(std::set<Group>& cg, std::set<Special>& cs) : changedGroups(cg), changedSpecials(cs),
+				instanceCapacity(2048), drawCapacity(512), transformCapacity(8192),
+				maxInstances(1 << 21), maxDraws(1 << 16), maxTransforms(1 << 20), growthFactor(2.f) {}
+
+			void setInstanceCapacity(int set) {
+				if (set <= 0 || set > maxInstances) {
+					postMessage("Invalid Limits instanceCapacity setting. Range (0,maxInstances]", ERROR_COL);
+					return;
+				}
+				instanceCapacity = set;
+				changedGroups.insert(Limits_Group);
+			}
+			int getInstanceCapacity() const { return instanceCapacity; }
+
+			void setDrawCapacity(int set) {
+				if (set <= 0 || set > maxDraws) {
+					postMessage("Invalid Limits drawCapacity setting. Range (0,maxDraws]", ERROR_COL);
+					return;
+				}
+				drawCapacity = set;
+				changedGroups.insert(Limits_Group);
+			}
+			int getDrawCapacity() const { return drawCapacity; }
+
+			void setTransformCapacity(int set) {
+				if (set <= 0 || set > maxTransforms) {
+					postMessage("Invalid Limits transformCapacity setting. Range (0,maxTransforms]", ERROR_COL);
+					return;
+				}
+				transformCapacity = set;
+				changedGroups.insert(Limits_Group);
+			}
+			int getTransformCapacity() const { return transformCapacity; }
+
+			// Per view buffers hold maxInstances * CULL_MAX_VIEWS entries at the limit
+			void setMaxInstances(int set) {
+				if (set < instanceCapacity) {
+					postMessage("Invalid Limits maxInstances setting. Range [instanceCapacity,inf]", ERROR_COL);
+					return;
+				}
+				maxInstances = set;
+			}
+			int getMaxInstances() const { return maxInstances; }
+
+			void setMaxDraws(int set) {
+				if (set < drawCapacity) {
+					postMessage("Invalid Limits maxDraws setting. Range [drawCapacity,inf]", ERROR_COL);
+					return;
+				}
+				maxDraws = set;
+			}
+			int getMaxDraws() const { return maxDraws; }
+
+			void setMaxTransforms(int set) {
+				if (set < transformCapacity) {
+					postMessage("Invalid Limits maxTransforms setting. Range [transformCapacity,inf]", ERROR_COL);
+					return;
+				}
+				maxTransforms = set;
+			}
+			int getMaxTransforms() const { return maxTransforms; }
+
+			void setGrowthFactor(float set) {
+				if (set <= 1) {
+					postMessage("Invalid Limits growthFactor setting. Range (1,inf]", ERROR_COL);
+					return;
+				}
+				growthFactor = set;
+			}
+			float getGrowthFactor() const { return growthFactor; }
+
+		private:
+			int instanceCapacity;
+			int drawCapacity;
+			int transformCapacity;
+			int maxInstances;
+			int maxDraws;
+			int maxTransforms;
+			float growthFactor;
+
+			std::set<Group>& changedGroups;
+			std::set<Special>& changedSpecials;
+		} limits;
+
 		void setResolution(glm::ivec2 set);
 		glm::ivec2 getResolution() { return resolution; }
 
@@ -0,0 +1,25 @@
+#pragma once
+#include "PCH.hpp"
+
+/*
+	@brief	Reports the files written in one directory since it was last polled
+	@note	Backed by inotify on linux, poll() never blocks. Files are reported once they are closed after writing or
+			moved into the directory, which covers editors that save through a temporary file. Other platforms have
+			no watcher, create() fails and poll() reports nothing.
+*/
+class FileWatcher
+{
+public:
+	FileWatcher() : fd(-1), watch(-1) {}
+
+	// Returns false if the directory can't be watched
+	bool create(const std::string& directory);
+	void destroy();
+
+	// Appends the names (without the directory) of files written since the last call, each name once
+	void poll(std::vector<std::string>& changedFiles);
+
+private:
+	int fd;
+	int watch;
+};
@@ -0,0 +1,127 @@
+#pragma once
+#include "PCH.hpp"
+#include "BufferSubAllocator.hpp"
+
+// VkDeviceMemory is allocated in blocks of this size per memory type, everything smaller is sub-allocated from them
+#define GPU_BLOCK_SIZE (64ull * 1024 * 1024)
+// Requests this large get their own VkDeviceMemory rather than taking most of a block
+#define GPU_DEDICATED_THRESHOLD (GPU_BLOCK_SIZE / 2)
+// Unit the block ranges are handed out in, every sub-allocation is aligned to it
+#define GPU_ALLOCATION_GRANULARITY 256ull
+// Requests up to this size go into power of two size classes, starting at GPU_ALLOCATION_GRANULARITY
+#define GPU_SMALL_CLASS_MAX (64ull * 1024)
+// Size classes carve their slots out of slabs of this size, taken from the blocks
+#define GPU_SLAB_SIZE (4ull * 1024 * 1024)
+// Render targets this large get their own VkDeviceMemory, they are few, live long and are recreated on resize
+#define GPU_RENDER_TARGET_DEDICATED_THRESHOLD (8ull * 1024 * 1024)
+
+struct GPUAllocation
+{
+	enum Kind : u8
+	{
+		None,
+		Block,
+		Slab,
+		Dedicated
+	};
+
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	void* mapped = nullptr; // Null unless the memory is host visible, host visible memory stays mapped
+
+	Kind kind = None;
+	u32 memoryType = 0;
+	void* owner = nullptr; // Block, slab or nothing for a dedicated allocation
+	u64 range = 0; // Offset in the owner's units, as handed out
+
+	bool isValid() const { return kind != None; }
+};
+
+/*
+	@brief	Pooled VkDeviceMemory for the renderer's buffers and images
+	@note	Drivers cap the number of live VkDeviceMemory objects (often at 4096), so buffers are sub-allocated from
+			GPU_BLOCK_SIZE blocks per memory type. Small requests share slabs of one power of two size class, large ones
+			get a dedicated allocation. Host visible blocks are mapped once when they are allocated. Thread safe.
+			Optimal tiling images share the blocks with buffers, padded to bufferImageGranularity so no page holds both.
+*/
+class GPUAllocator
+{
+public:
+	struct PoolStats
+	{
+		std::string name;
+		u32 memoryType;
+		VkMemoryPropertyFlags properties;
+		u32 deviceMemoryCount; // VkDeviceMemory objects, or slabs for a size class
+		VkDeviceSize reserved;
+		VkDeviceSize used;
+		u32 allocationCount;
+	};
+
+	GPUAllocator() : device(VK_NULL_HANDLE), deviceMemoryCount(0), bufferImageGranularity(1) {}
+
+	void create(vdu::LogicalDevice* logicalDevice);
+	void destroy();
+
+	/*
+		@brief	Finds memory for requirements with at least properties
+		@return	An invalid allocation if no memory type fits or the device is out of memory
+	*/
+	GPUAllocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool dedicated = false);
+	// For an optimal tiling image. Render targets of GPU_RENDER_TARGET_DEDICATED_THRESHOLD or more are dedicated
+	GPUAllocation allocateImage(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool renderTarget);
+	void free(GPUAllocation& allocation);
+
+	// One entry per block pool, size class and dedicated pool in use
+	std::vector<PoolStats> getStats();
+	u32 getDeviceMemoryCount() const { return deviceMemoryCount; }
+
+	VkDevice getDevice() const { return device; }
+
+private:
+	struct MemoryBlock
+	{
+		VkDeviceMemory memory;
+		void* mapped;
+		BufferSubAllocator ranges; // In GPU_ALLOCATION_GRANULARITY units
+	};
+
+	struct Slab
+	{
+		GPUAllocation backing; // Range of a block the slots live in
+		std::vector<u32> freeSlots;
+		u32 slotCount;
+	};
+
+	struct SizeClass
+	{
+		std::list<Slab> slabs;
+		u32 allocationCount = 0;
+	};
+
+	struct MemoryPool
+	{
+		std::list<MemoryBlock> blocks;
+		SizeClass sizeClasses[9]; // 256 B to 64 KB
+		u32 dedicatedCount = 0;
+		VkDeviceSize dedicatedSize = 0;
+	};
+
+	s32 findMemoryType(u32 typeBits, VkMemoryPropertyFlags properties);
+
+	// These expect the mutex to be held
+	GPUAllocation allocateFromBlocks(u32 memoryType, VkDeviceSize size, VkDeviceSize alignment);
+	GPUAllocation allocateFromSizeClass(u32 memoryType, VkDeviceSize size);
+	GPUAllocation allocateDedicated(u32 memoryType, VkDeviceSize size);
+	void freeFromBlocks(GPUAllocation& allocation);
+	bool allocateDeviceMemory(u32 memoryType, VkDeviceSize size, VkDeviceMemory& memory, void*& mapped);
+	void freeDeviceMemory(VkDeviceMemory memory, void* mapped);
+
+	VkDevice device;
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	std::vector<MemoryPool> pools; // Indexed by memory type
+	u32 deviceMemoryCount;
+	VkDeviceSize bufferImageGranularity;
+	std::mutex mutex;
+};
@@ -1,5 +1,6 @@
 #pragma once
 #include "PCH.hpp"
+#include "PerFrameBuffer.hpp"
 #include "Texture.hpp"
 
 class Light
@@ -272,10 +273,9 @@ public:
 private:
 	bool matNeedsUpdate;
 	GPUData* gpuData;
-	vdu::Buffer* drawCommandsBuffer;
 
 public:
-	SpotLight() : matNeedsUpdate(true), gpuData(nullptr), drawCommandsBuffer(nullptr)
+	SpotLight() : matNeedsUpdate(true), gpuData(nullptr)
 	{
 		initTexture();
 	}
@@ -365,7 +365,6 @@ public:
 	s64 getShadowIndex() { return gpuData->getShadowIndex(); }
 	Texture* getShadowTexture() { return shadowTex; }
 	glm::fmat4& getProjView() { return gpuData->projView; }
-	vdu::Buffer* getDrawCommandsBuffer() { return drawCommandsBuffer; }
 
 	void setPosition(glm::fvec3 set)
 	{
@@ -430,7 +429,6 @@ public:
 	}
 
 	void initTexture(int resolution = 512);
-	void updateDrawCommands(u32 gpuIndex);
 
 	void updateRadius();
 	inline static float calculateRadius(float linear, float quad);
@@ -470,29 +468,9 @@ public: ///TODO: Max light count is 150, add setters etc
 		return pointLights.data() + pIndex;
 	}
 
-	void updateLightCounts()
-	{
-		u32* lc = (u32*)lightCountsBuffer.getMemory()->map();
-		lc[0] = pointLights.size();
-		lc[1] = spotLights.size();
-		lightCountsBuffer.getMemory()->unmap();
-	}
-
-	void updateAllPointLights()
-	{
-		for (auto& l : pointLights)
-			l.update();
-		PointLight::GPUData* d = (PointLight::GPUData*)pointLightsBuffer.getMemory()->map();
-		for (int i = 0; i < pointLights.size(); ++i)
-		{
-			d[i].colourQuadratic = pointLightsGPUData[i].colourQuadratic;
-			d[i].positionRadius = pointLightsGPUData[i].positionRadius;
-			d[i].linearFadesTexture = pointLightsGPUData[i].linearFadesTexture;
-			for (int j = 0; j < 5; ++j)
-				d[i].projView[j] = pointLightsGPUData[i].projView[j];
-		}
-		pointLightsBuffer.getMemory()->unmap();
-	}
+	// The light buffers are device local, these stage their contents for the next frame
+	void updateLightCounts();
+	void updateAllPointLights();
 
 	SpotLight& addSpotLight()
 	{
@@ -507,49 +485,22 @@ public: ///TODO: Max light count is 150, add setters etc
 		return spotLights.data() + pIndex;
 	}
 
-	void updateAllSpotLights()
-	{
-		for (auto& l : spotLights)
-			l.update();
-		SpotLight::GPUData* d = (SpotLight::GPUData*)spotLightsBuffer.getMemory()->map();
-		for (int i = 0; i < spotLights.size(); ++i)
-		{
-			d[i].colourQuadratic = spotLightsGPUData[i].colourQuadratic;
-			d[i].positionRadius = spotLightsGPUData[i].positionRadius;
-			d[i].linearFadesTexture = spotLightsGPUData[i].linearFadesTexture;
-			d[i].directionInner = spotLightsGPUData[i].directionInner;
-			d[i].outer = spotLightsGPUData[i].outer;
-			d[i].projView = spotLightsGPUData[i].projView;
-		}
-		spotLightsBuffer.getMemory()->unmap();
-	}
+	void updateAllSpotLights();
 
 	void updateSunLight();
 
-	void updateShadowDrawCommands()
-	{
-		int i = 0;
-		for (auto& sl : spotLights)
-		{
-			sl.updateDrawCommands(i);
-			++i;
-		}
-	}
-
-	vdu::Buffer lightCountsBuffer;
+	PerFrameBuffer lightCountsBuffer;
 
 	std::vector<PointLight> pointLights;
 	std::vector<PointLight::GPUData> pointLightsGPUData;
-	vdu::Buffer pointLightsBuffer;
+	PerFrameBuffer pointLightsBuffer;
 
 	std::vector<SpotLight> spotLights;
 	std::vector<SpotLight::GPUData> spotLightsGPUData;
-	vdu::Buffer spotLightsBuffer;
+	PerFrameBuffer spotLightsBuffer;
 
 	SunLight sunLight;
-	vdu::Buffer sunLightBuffer;
-
-	std::vector<vdu::Buffer> spotShadowDrawCommandsBuffers;
+	PerFrameBuffer sunLightBuffer;
 
 	//std::vector<SpotLight::GPUData> staticSpotLights;
 	//std::vector<PointLight::GPUData> staticPointLightsGPUData;
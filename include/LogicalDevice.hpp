@@ -0,0 +1,44 @@
+#pragma once
+#include "PCH.hpp"
+
+/*
+	@brief	vdu::Queue whose handle is fetched by LogicalDevice
+*/
+class Queue : public vdu::Queue
+{
+public:
+	Queue& operator=(const vdu::Queue& queue) { vdu::Queue::operator=(queue); return *this; }
+
+	void setHandle(VkQueue queue) { m_queue = queue; }
+};
+
+/*
+	@brief	vdu::LogicalDevice created with a chain of extension feature structures
+	@note	vdu only hands VkPhysicalDeviceFeatures to vkCreateDevice, extension features (descriptor indexing) have to be
+			chained behind VkPhysicalDeviceFeatures2. create() makes the device itself and gives vdu the handles, the
+			settings are passed on to vdu as well so everything built on the device keeps working through vdu
+*/
+class LogicalDevice : public vdu::LogicalDevice
+{
+public:
+	void addExtension(const char* name) { extensions.push_back(name); vdu::LogicalDevice::addExtension(name); }
+	void addLayer(const char* name) { layers.push_back(name); vdu::LogicalDevice::addLayer(name); }
+	// Queues of one family take its indices in the order they are added, sharing the last one if it has too few
+	void addQueue(Queue* queue, u32 family) { queues.push_back({ queue, family }); vdu::LogicalDevice::addQueue(queue); }
+	// features.pNext is chained as it is and has to stay alive until create()
+	void setEnabledDeviceFeatures(const VkPhysicalDeviceFeatures2& pFeatures) { features = pFeatures; vdu::LogicalDevice::setEnabledDeviceFeatures(pFeatures.features); }
+
+	void create(vdu::PhysicalDevice* physicalDevice);
+
+private:
+	struct QueueRequest
+	{
+		Queue* queue;
+		u32 family;
+	};
+
+	std::vector<const char*> extensions;
+	std::vector<const char*> layers;
+	std::vector<QueueRequest> queues;
+	VkPhysicalDeviceFeatures2 features = {};
+};
@@ -0,0 +1,29 @@
+#pragma once
+#include "PCH.hpp"
+#include "PooledBuffer.hpp"
+
+/*
+	@brief	Host visible buffer that stays mapped from create() to destroy()
+	@note	Writes go straight through getMapped(), there is no map/unmap per update. Without HOST_COHERENT in the
+			memory properties written ranges have to be flushed before the GPU reads them, flush() is a no-op otherwise.
+			Synchronising with frames still reading the buffer is up to the caller.
+*/
+class MappedBuffer : public PooledBuffer
+{
+public:
+	MappedBuffer() : coherent(true), atomSize(1) {}
+
+	void create(GPUAllocator* pAllocator, VkBufferUsageFlags usage, VkDeviceSize pSize,
+		VkMemoryPropertyFlags memoryProperties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+	// Copies data to offset and flushes it
+	void write(VkDeviceSize offset, const void* data, VkDeviceSize writeSize);
+	// Makes host writes to the range visible to the device, rounded out to the non coherent atom size
+	void flush(VkDeviceSize offset = 0, VkDeviceSize flushSize = VK_WHOLE_SIZE);
+
+	void* getMapped(VkDeviceSize offset = 0) { return static_cast<char*>(allocation.mapped) + offset; }
+
+private:
+	bool coherent;
+	VkDeviceSize atomSize;
+};
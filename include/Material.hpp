@@ -9,6 +9,8 @@ struct Material : public Asset
 	//Material(const std::string& name) { std::vector<std::string> paths; prepare(paths, name); }
 	Material(const std::string& name) { std::vector<std::string> paths; }
 	u32 gpuIndexBase = 0;
+	// Shaded from data.pbrData alone, without textures (see MaterialRecord)
+	bool flat = false;
 
 	union MaterialData {
 		MaterialData() {}
@@ -31,6 +33,7 @@ struct Material : public Asset
 	{
 		data = rhs.data;
 		gpuIndexBase = rhs.gpuIndexBase;
+		flat = rhs.flat;
 		//albedoSpec = rhs.albedoSpec;
 		//normalRough = rhs.normalRough;
 		
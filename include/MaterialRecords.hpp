@@ -0,0 +1,41 @@
+#pragma once
+#include "PCH.hpp"
+
+/*
+	@brief	Entry of the material record buffer, read by gbuffer.glsl at Material::gpuIndexBase / 2. Must match its
+			MaterialRecord struct (std430). Flat materials are shaded from it in the same pass as textured ones
+*/
+struct MaterialRecord
+{
+	glm::fvec3 colour;
+	float metallic;
+	float roughness;
+	u32 textured;
+	glm::fvec2 PADDING;
+
+	// What a material is drawn as until it is loaded, its textures are never read
+	static MaterialRecord flatWhite() { return { glm::fvec3(1), 0.f, 1.f, 0, glm::fvec2(0) }; }
+};
+
+/*
+	@brief	CPU copy of the material record buffer, one record per material
+	@note	Pure CPU bookkeeping, nothing touches Vulkan so it can be exercised without a device. The buffer grows with
+			the materials. Records that were never written are flat white, and so is every record past the end: read()
+			does what gbuffer.glsl does with a material whose record the buffer hasn't grown to yet
+*/
+class MaterialRecords
+{
+public:
+	// Keeps the records below capacity, the new ones are flat white. Never shrinks
+	void grow(u32 capacity);
+
+	void set(u32 index, const MaterialRecord& record) { records[index] = record; }
+	// The record gbuffer.glsl shades a fragment with, textureIndex is its material's gpuIndexBase
+	MaterialRecord read(u32 textureIndex) const;
+
+	u32 getCapacity() const { return u32(records.size()); }
+	const MaterialRecord* getData() const { return records.data(); }
+
+private:
+	std::vector<MaterialRecord> records;
+};
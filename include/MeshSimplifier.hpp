@@ -0,0 +1,17 @@
+#pragma once
+#include "PCH.hpp"
+#include "Model.hpp"
+
+// Quadrics of open edges are scaled by this so borders are much more expensive to move than surfaces
+#define BORDER_QUADRIC_WEIGHT 10.0
+
+/*
+	@brief	Simplifies a triangle mesh with quadric error metric edge collapses (Garland & Heckbert)
+	@note	Each collapse moves a vertex onto one of its neighbours, so vertex attributes are kept unchanged.
+			Open edges are weighted so mesh borders stay in place, and vertices split along UV or normal
+			seams are never moved so no cracks open between them.
+	@param	targetIndexCount Simplification stops once the mesh has this many indices or fewer, or no legal collapse is left
+	@return	Square root of the largest quadric error of an applied collapse, an estimate of the model space geometric error
+*/
+float simplifyMesh(const Vertex* vertices, u32 vertexCount, const u32* indices, u32 indexCount, u32 targetIndexCount,
+	std::vector<Vertex>& outVertices, std::vector<u32>& outIndices);
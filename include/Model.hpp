@@ -121,6 +121,13 @@ struct Vertex2D
 	}
 };
 
+// Models imported with a single mesh get this many LODs (including the source mesh) generated at load
+#define MODEL_GENERATED_LOD_COUNT 4
+// Each generated LOD targets this fraction of the previous one's triangles
+#define MODEL_GENERATED_LOD_RATIO 0.5f
+// No LOD is generated below this many triangles
+#define MODEL_GENERATED_LOD_MIN_TRIANGLES 64
+
 class Model : public Asset
 {
 public:
@@ -139,13 +146,32 @@ public:
 
 	std::vector<TriangleMesh> modelLODs;
 	std::vector<std::string> lodPaths;
-	std::vector<u32> lodLimits;
+	std::vector<float> lodErrors; // Model space geometric error of each LOD, non-decreasing
 	std::string physicsInfoFilePath;
 
+	// Model space bounding sphere of the first LOD, centre in xyz and radius in w
+	glm::fvec4 boundingSphere;
+
 	::Material* material;
 
 	void loadToRAM(void* pCreateStruct = 0, AllocFunc alloc = malloc);
 	void loadToGPU(void* pCreateStruct = 0);
+	void cleanupGPU();
+
+	/*
+		@brief	Generates simplified LODs from the first (source) LOD and fills lodErrors
+		@note	Levels are simplified in parallel and cached on disk, keyed by the source file's size and modification time
+	*/
+	void generateLODs();
+	bool loadLODCache(const std::string& cachePath, u64 sourceSize, s64 sourceTime);
+	void saveLODCache(const std::string& cachePath, u64 sourceSize, s64 sourceTime);
+
+	/*
+		@brief	Picks the coarsest LOD whose geometric error projects to no more than errorThreshold pixels
+		@param	pixelsPerUnit Screen pixels covered by one world unit at the instance's distance
+		@param	currentLOD The LOD chosen last time, switching away from it requires the error to cross the threshold by the hysteresis fraction
+	*/
+	u32 selectLOD(float pixelsPerUnit, u32 currentLOD, float errorThreshold, float hysteresis) const;
 };
 
 class ModelInstance
@@ -155,6 +181,7 @@ public:
 	{
 		transform[0] = t;
 		transform[1] = t;
+		++changeVersion;
 	}
 
 	std::string name;
@@ -168,6 +195,15 @@ public:
 	Material* material;
 	PhysicsObject* physicsObject;
 
+	// Bumped whenever the transform or material of this instance changes. Culling and buffer updates
+	// remember the last version they processed, so unchanged instances are skipped entirely
+	u32 changeVersion = 1;
+	u32 culledVersion = 0; // Last version seen by World::frustumCulling
+	u32 uploadedVersion = 0; // Last version written to the GPU transform buffer
+	u32 lodIndex = 0; // LOD selected by the last culling pass
+	u32 shadowLodIndex = 0; // LOD selected by the last culling pass for shadow passes
+	Material* culledMaterial = nullptr; // Material seen by the last culling pass, used to detect batch changes
+
 	void setModel(Model* m);
 	void setMaterial(Material* pMaterial);
 	Transform& getTransform() { return transform[0]; }
@@ -220,6 +220,8 @@
 
 #include <queue>
 
+#include <deque>
+
 #include <array>
 
 /// Algorithms includes
@@ -256,4 +258,6 @@
 
 #include <thread>
 
-#include <mutex>
\ No newline at end of file
+#include <mutex>
+
+#include <condition_variable>
\ No newline at end of file
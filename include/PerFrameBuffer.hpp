@@ -0,0 +1,24 @@
+#pragma once
+#include "PCH.hpp"
+#include "PooledBuffer.hpp"
+
+/*
+	@brief	Device local buffer with a copy per frame in flight, the passes of a frame read the copy of its frame slot
+	@note	Only written through Renderer::stageFrameData, which writes the current slot's copy. The other copies catch up
+			from the copy before theirs as their frames come up, see Renderer::recordFrameCopies
+*/
+class PerFrameBuffer
+{
+public:
+	void create(GPUAllocator* allocator, VkBufferUsageFlags usage, VkDeviceSize size, u32 frames);
+	void destroy();
+
+	// Moves the copies into retired and leaves the buffer empty, for recreating it while frames in flight still read the old copies
+	void retire(std::vector<PooledBuffer>& retired);
+
+	VkBuffer getHandle(u32 frame) const { return copies[frame].getHandle(); }
+	VkDeviceSize getSize() const { return copies.empty() ? 0 : copies[0].getSize(); }
+
+private:
+	std::vector<PooledBuffer> copies;
+};
@@ -0,0 +1,130 @@
+#pragma once
+#include "PCH.hpp"
+
+class ShaderSpec;
+
+/*
+	@brief	Values of a pipeline's specialization constants (layout(constant_id = id) in GLSL), given to every stage
+	@note	Every constant is 32 bits, int, uint, float and bool alike
+*/
+class SpecializationConstants
+{
+public:
+	void set(u32 id, u32 value);
+	void set(u32 id, s32 value) { set(id, u32(value)); }
+	void set(u32 id, float value);
+	void clear() { entries.clear(); data.clear(); }
+
+	// Null without constants, points into this object
+	const VkSpecializationInfo* getInfo();
+
+private:
+	std::vector<VkSpecializationMapEntry> entries;
+	std::vector<u32> data;
+	VkSpecializationInfo info;
+};
+
+/*
+	@brief	Vertex buffer bindings and the attributes read from them
+*/
+class VertexInputState
+{
+public:
+	void addBinding(const VkVertexInputBindingDescription& binding) { bindings.push_back(binding); }
+	void addAttributes(const std::vector<VkVertexInputAttributeDescription>& pAttributes) { attributes.insert(attributes.end(), pAttributes.begin(), pAttributes.end()); }
+
+	const std::vector<VkVertexInputBindingDescription>& getBindings() const { return bindings; }
+	const std::vector<VkVertexInputAttributeDescription>& getAttributes() const { return attributes; }
+
+private:
+	std::vector<VkVertexInputBindingDescription> bindings;
+	std::vector<VkVertexInputAttributeDescription> attributes;
+};
+
+/*
+	@brief	Graphics pipeline built from a ShaderSpec's stages
+	@note	Created here rather than by vdu::GraphicsPipeline, which only takes a vdu::ShaderProgram. Defaults to
+			triangle lists, clockwise front faces (the projection isn't flipped for Vulkan's y axis), depth test and
+			write with LESS and no blending. destroy() also forgets the settings, they are set again before the next create().
+*/
+class GraphicsPipeline
+{
+public:
+	GraphicsPipeline();
+
+	void addViewport(const VkViewport& viewport, const VkRect2D& scissor);
+	void setVertexInputState(VertexInputState* state) { vertexInputState = state; }
+	void setShaderProgram(ShaderSpec* pShader) { shader = pShader; }
+	void setPipelineLayout(VkPipelineLayout pLayout) { layout = pLayout; }
+	void setRenderPass(VkRenderPass pRenderPass, u32 colourAttachmentCount);
+	// The render pass has to be set first, attachments without a state don't blend
+	void setColourBlendState(u32 attachment, const VkPipelineColorBlendAttachmentState& state) { colourBlendStates[attachment] = state; }
+	void setDepthTest(VkBool32 enable) { depthTest = enable; }
+	void setMaxDepthBounds(float pMaxDepthBounds) { maxDepthBounds = pMaxDepthBounds; }
+	void setCullMode(VkCullModeFlags pCullMode) { cullMode = pCullMode; }
+	void addDynamicState(VkDynamicState state) { dynamicStates.push_back(state); }
+	template<typename T>
+	void setSpecializationConstant(u32 id, T value) { specialization.set(id, value); }
+
+	// cache may be VK_NULL_HANDLE
+	void create(vdu::LogicalDevice* logicalDevice, VkPipelineCache cache);
+	// Creates the pipeline again with the same settings from the shader's current stages. Returns the old pipeline
+	// for the caller to destroy once no command buffer in flight uses it
+	VkPipeline recreate(VkPipelineCache cache);
+	void destroy();
+
+	VkPipeline getHandle() const { return pipeline; }
+
+private:
+	void build(VkPipelineCache cache);
+	void reset();
+
+	VkDevice device;
+	VkPipeline pipeline;
+
+	ShaderSpec* shader;
+	VertexInputState* vertexInputState;
+	VkPipelineLayout layout;
+	VkRenderPass renderPass;
+	std::vector<VkViewport> viewports;
+	std::vector<VkRect2D> scissors;
+	std::vector<VkPipelineColorBlendAttachmentState> colourBlendStates;
+	std::vector<VkDynamicState> dynamicStates;
+	VkBool32 depthTest;
+	float maxDepthBounds;
+	VkCullModeFlags cullMode;
+	SpecializationConstants specialization;
+};
+
+/*
+	@brief	Compute pipeline built from a ShaderSpec's compute stage
+*/
+class ComputePipeline
+{
+public:
+	ComputePipeline() : device(VK_NULL_HANDLE), pipeline(VK_NULL_HANDLE), shader(nullptr), layout(VK_NULL_HANDLE) {}
+
+	void setShaderProgram(ShaderSpec* pShader) { shader = pShader; }
+	void setPipelineLayout(VkPipelineLayout pLayout) { layout = pLayout; }
+	template<typename T>
+	void setSpecializationConstant(u32 id, T value) { specialization.set(id, value); }
+
+	// cache may be VK_NULL_HANDLE
+	void create(vdu::LogicalDevice* logicalDevice, VkPipelineCache cache);
+	// See GraphicsPipeline::recreate
+	VkPipeline recreate(VkPipelineCache cache);
+	// Also forgets the specialization constants
+	void destroy();
+
+	VkPipeline getHandle() const { return pipeline; }
+
+private:
+	void build(VkPipelineCache cache);
+
+	VkDevice device;
+	VkPipeline pipeline;
+
+	ShaderSpec* shader;
+	VkPipelineLayout layout;
+	SpecializationConstants specialization;
+};
@@ -0,0 +1,26 @@
+#pragma once
+#include "PCH.hpp"
+#include "GPUAllocator.hpp"
+
+/*
+	@brief	Buffer whose memory is sub-allocated from a GPUAllocator instead of owning a VkDeviceMemory
+	@note	Used wherever the renderer only needs the handle. Large buffers are given dedicated memory by the allocator
+*/
+class PooledBuffer
+{
+public:
+	PooledBuffer() : allocator(nullptr), buffer(VK_NULL_HANDLE), size(0) {}
+
+	void create(GPUAllocator* pAllocator, VkBufferUsageFlags usage, VkDeviceSize pSize, VkMemoryPropertyFlags memoryProperties, bool dedicated = false);
+	void destroy();
+
+	VkBuffer getHandle() const { return buffer; }
+	VkDeviceSize getSize() const { return size; }
+	const GPUAllocation& getAllocation() const { return allocation; }
+
+protected:
+	GPUAllocator* allocator;
+	GPUAllocation allocation;
+	VkBuffer buffer;
+	VkDeviceSize size;
+};
@@ -0,0 +1,144 @@
+#pragma once
+#include "PCH.hpp"
+
+/*
+	@brief	A frame declared as passes and the resources they read and write
+	@note	compile() derives what used to be wired by hand in Renderer::render. Passes nothing presented depends on are
+			culled. Every remaining dependency becomes one semaphore per frame in flight, waited on at the stage the
+			reading pass declared, and dependencies already implied through another pass are dropped. Passes are
+			submitted in declaration order to the queue they ask for, the pass writing the swapchain only once an image
+			has been acquired. Layout transitions stay in the passes' render passes and command buffers, so a pass has to
+			declare the stages those run at along with its other accesses.
+			Resources have one copy shared by every frame in flight. A pass writing them first waits, with a barrier on
+			its queue, for every stage any pass declared on them, so the previous frame is done with the old contents.
+			Aliased resources share memory and count as one resource for both, see alias().
+			Every pass is bracketed by timestamps, readTimings() hands them to the profiler under the pass name.
+*/
+class RenderGraph
+{
+public:
+	typedef u32 Resource;
+
+	enum QueueType
+	{
+		Graphics,
+		Compute // Falls back to graphics without a separate compute queue. Resources it shares must be concurrent
+	};
+
+	enum ResourceType
+	{
+		Image, // Writers may transition the layout, the barrier before them waits with every stage
+		Buffer
+	};
+
+	struct Access
+	{
+		Resource resource;
+		VkPipelineStageFlags stage;
+	};
+
+	struct Pass
+	{
+		// Adds the pass's command buffers to the submission, imageIndex is the acquired swapchain image
+		typedef std::function<void(u32 frame, u32 imageIndex, vdu::QueueSubmission& submission)> Commands;
+
+		Pass& read(Resource resource, VkPipelineStageFlags stage) { reads.push_back({ resource, stage }); return *this; }
+		Pass& write(Resource resource, VkPipelineStageFlags stage) { writes.push_back({ resource, stage }); return *this; }
+		Pass& setCommands(Commands pCommands) { commands = pCommands; return *this; }
+		// Recreates whatever depends on the render resolution, see RenderGraph::resize
+		Pass& setResize(std::function<void(void)> pResize) { resize = pResize; return *this; }
+
+		std::string name;
+		QueueType queue;
+		std::vector<Access> reads;
+		std::vector<Access> writes;
+		Commands commands;
+		std::function<void(void)> resize;
+
+		// Set by compile
+		bool culled;
+		bool writesSwapchain;
+		u32 timestampQuery; // First of the pass's two queries within a frame's range
+		std::vector<vdu::CommandBuffer> timestampBegin; // Per frame in flight
+		std::vector<vdu::CommandBuffer> timestampEnd;
+		std::vector<bool> timed; // Per frame in flight, the queries were submitted and not read yet
+		u64 lastTime; // Nanoseconds
+	};
+
+	RenderGraph() : graphicsQueue(nullptr), computeQueue(nullptr), swapchain(nullptr), swapchainResource(~0u), timedPassCount(0),
+		timestampPeriod(1.f), device(VK_NULL_HANDLE), framesInFlight(0) {}
+
+	Resource addResource(const std::string& name, ResourceType type = Image);
+	// Acquired and presented by execute(). recreate is called by resize() before any pass
+	Resource addSwapchain(const std::string& name, vdu::Swapchain* pSwapchain, std::function<void(void)> recreate);
+	// b's memory is reused by a. A pass writing either waits for the passes since the last write to either to be done
+	void alias(Resource a, Resource b);
+	// The reference stays valid as more passes are added
+	Pass& addPass(const std::string& name, QueueType queue = Graphics);
+
+	// compute may be null
+	void setQueues(vdu::Queue* graphics, vdu::Queue* compute);
+
+	/*
+		@brief	Culls, orders and links the declared passes and creates their semaphores and timestamp queries
+		@note	A pass depends on the last pass declared before it that wrote a resource it reads or writes, and on the
+				passes since then that read a resource it writes, so passes have to be declared in execution order
+	*/
+	void compile(vdu::LogicalDevice* logicalDevice, vdu::CommandPool* commandPool, u32 pFramesInFlight);
+	// Destroys everything compile() created and forgets the declarations
+	void destroy();
+
+	/*
+		@brief	Submits the frame slot's passes and presents, the last submission signals fence
+		@return	False if no swapchain image could be acquired. The slot's semaphores are still waited on and the fence signalled
+	*/
+	bool execute(u32 frame, vdu::Fence& fence);
+
+	// Hands the slot's pass timings to the profiler, call once its fence has signalled
+	void readTimings(u32 frame);
+
+	// Recreates the swapchain, then each pass's resolution dependant objects in declaration order. No frame may be in flight
+	void resize();
+
+	bool isCulled(const std::string& passName);
+
+	std::string toDot();
+	std::string toJSON();
+
+private:
+	struct Dependency
+	{
+		u32 from;
+		u32 to;
+		VkPipelineStageFlags waitStage;
+		std::vector<Resource> resources;
+		std::vector<vdu::Semaphore> semaphores; // Per frame in flight
+	};
+
+	void record(u32 passIndex, u32 frame, u32 imageIndex, vdu::QueueSubmission& submission);
+	vdu::Queue* getQueue(QueueType type);
+	std::string getQueueName(QueueType type);
+
+	std::vector<std::string> resources;
+	std::vector<ResourceType> resourceTypes;
+	std::vector<Resource> resourceMemory; // The resource each one's memory is tracked under, itself unless aliased
+	std::deque<Pass> passes;
+	std::vector<Dependency> dependencies;
+
+	vdu::Queue* graphicsQueue;
+	vdu::Queue* computeQueue;
+
+	vdu::Swapchain* swapchain;
+	Resource swapchainResource;
+	std::function<void(void)> recreateSwapchain;
+	std::vector<vdu::Semaphore> imageAvailableSemaphores;
+	std::vector<vdu::Semaphore> renderFinishedSemaphores;
+
+	// timedPassCount * 2 queries per frame in flight
+	vdu::QueryPool queryPool;
+	u32 timedPassCount;
+	float timestampPeriod;
+
+	VkDevice device;
+	u32 framesInFlight;
+};
@@ -5,9 +5,22 @@
 #include "Texture.hpp"
 #include "Lights.hpp"
 #include "ShaderSpecs.hpp"
+#include "Pipeline.hpp"
+#include "LogicalDevice.hpp"
 #include "UIText.hpp"
 #include "UIElement.hpp"
 #include "UIRenderer.hpp"
+#include "Culling.hpp"
+#include "MaterialRecords.hpp"
+#include "AttachmentAllocator.hpp"
+#include "BufferSubAllocator.hpp"
+#include "GPUAllocator.hpp"
+#include "PooledBuffer.hpp"
+#include "PerFrameBuffer.hpp"
+#include "MappedBuffer.hpp"
+#include "StagingRing.hpp"
+#include "RenderGraph.hpp"
+#include "FileWatcher.hpp"
 
 struct CameraUBOData {
 	glm::fmat4 view;
@@ -20,9 +33,26 @@ struct CameraUBOData {
 #define VERTEX_BUFFER_SIZE u64(128) * u64(1024) * u64(1024) // 128 MB
 #define INDEX_BUFFER_BASE VERTEX_BUFFER_SIZE
 #define INDEX_BUFFER_SIZE u64(32) * u64(1024) * u64(1024) // 32 MB
+// The vertex/index buffer is compacted between frames once this fraction of its free space is outside the largest hole
+#define VERTEX_INDEX_COMPACTION_THRESHOLD 0.5f
+// Most vertex and most index data compaction moves in one frame
+#define VERTEX_INDEX_COMPACTION_BYTES_PER_FRAME u64(4) * u64(1024) * u64(1024) // 4 MB
 
-#define USED_GBUFFER texturedGBufferAttachments
-//#define USED_GBUFFER flatGBufferAttachments
+// Frames the CPU may record ahead of the GPU. Objects written or re-recorded every frame exist once per frame
+#define FRAMES_IN_FLIGHT 2
+
+// Most textures the gBuffer's material texture array is sized for, two per material (see Material::gpuIndexBase and
+// gbuffer.glsl). The array takes the device's update after bind limit below this, some drivers report UINT32_MAX
+#define MATERIAL_TEXTURE_LIMIT (1u << 20)
+// Records the material record buffer starts with, one per material whether it is textured or flat (see MaterialRecord).
+// It grows with the materials up to materialTextureCapacity / 2
+#define MATERIAL_RECORD_INITIAL_CAPACITY 512
+
+// Most lights pbr.glsl shades per tile and light type, lowered to fit the device's compute shared memory
+#define PBR_MAX_LIGHTS_PER_TILE 256
+
+// Smallest host visible device local heap counted as resizable BAR rather than the fixed 256 MB window
+#define REBAR_MIN_HEAP_SIZE u64(512) * u64(1024) * u64(1024) // 512 MB
 
 /*
 	@brief	Collates Vulkan objects and controls rendering pipeline
@@ -30,7 +60,14 @@ struct CameraUBOData {
 class Renderer
 {
 public:
-	Renderer() : vertexInputByteOffset(0), indexInputByteOffset(0), gBufferDescriptorSetNeedsUpdate(true), gBufferNoTexDescriptorSetNeedsUpdate(true) {}
+	Renderer() : gBufferPipelineLayout(VK_NULL_HANDLE), gBufferDescriptorSetNeedsUpdate(true),
+		materialTextureSetLayout(VK_NULL_HANDLE), materialTexturePool(VK_NULL_HANDLE), materialTextureSet(), materialTextureCapacity(0),
+		gBufferCommands({ GBuffer_Descriptors_Input, Draw_Buffers_Input, Render_Size_Input }),
+		shadowCommands({ Shadow_Pipeline_Input, Shadow_Descriptors_Input, Draw_Buffers_Input }),
+		ssaoCommands({ SSAO_Pipeline_Input, Render_Size_Input }), pbrCommands({ PBR_Descriptors_Input, Render_Size_Input }),
+		frameIndex(0), uploadBatch(nullptr), skyboxDescriptorPending(), drawBuffersVersion(0), drawBufferDescriptorVersions(), commandInputVersions(), reRecordedCommands(0), lastReRecordedCommands(0),
+		pipelineCache(VK_NULL_HANDLE), pipelineCacheWarm(false), shaderCompileRunning(false), ssaoPipeline(nullptr), ssaoPipelineKey(0),
+		ssaoVariantBuild({ 0, nullptr }), ssaoVariantBuildRunning(false) {}
 
 	// Top level
 	void initialiseDevice();
@@ -41,26 +78,35 @@ public:
 	static void renderJob();
 
 	void createShaders();
+	// Compiles every shader in parallel on the record workers
 	void compileShaders();
+	// Queues every shader for updateShaders, only those whose source changed are recompiled
 	void reloadShaders();
+	/*
+		@brief	Hot-reloads the shaders whose source files were written, called at the start of every frame
+		@note	Changed shaders are compiled on the CPU worker while frames keep rendering with the old pipelines. Once
+				compiled, the next frame waits for the frames in flight and recreates only the pipelines and commands of
+				the passes using them. Shaders changing while a batch compiles go into the next one.
+	*/
+	void updateShaders();
 
 	void updateConfigs();
 
-	enum GPUTimeStamps { 
-		BEGIN_GBUFFER,			END_GBUFFER, 
-		BEGIN_SHADOW,			END_SHADOW, 
-		BEGIN_SSAO,				END_SSAO,
-		BEGIN_PBR,				END_PBR, 
-		BEGIN_UI,				END_UI,
-		BEGIN_SCREEN,			END_SCREEN, 
-		NUM_GPU_TIMESTAMPS };
-
 	UIRenderer uiRenderer;
 
 	// Device, queues, swap chain
-	vdu::LogicalDevice logicalDevice;
-	vdu::Queue lTransferQueue;
-	vdu::Queue lGraphicsQueue;
+	LogicalDevice logicalDevice;
+	// Memory of every buffer the renderer creates, see PooledBuffer
+	GPUAllocator gpuAllocator;
+	Queue lTransferQueue;
+	Queue lGraphicsQueue;
+	Queue lComputeQueue; // For the render graph's async compute passes, only created if the device has a compute family without graphics
+
+	// Transfer and compute use their own families when the device has them, otherwise they equal graphicsQueueFamily
+	u32 graphicsQueueFamily;
+	u32 transferQueueFamily;
+	u32 computeQueueFamily;
+	VkExtent3D transferImageGranularity;
 
 	VkDevice device;
 	VkQueue transferQueue; // Queue for memory transfers (submitted to by the main thread)
@@ -69,30 +115,82 @@ public:
 	VkQueue presentQueue;
 	VkExtent2D renderResolution;
 
-	vdu::VertexInputState defaultVertexInputState;
+	VertexInputState defaultVertexInputState;
 
 	std::mutex bufferFreeMutex;
 
 	// Thread safe command pools
 	static thread_local vdu::CommandPool commandPool;
+	static thread_local vdu::CommandPool transferCommandPool;
 	// Memory pools
 	vdu::DescriptorPool descriptorPool;
 	vdu::DescriptorPool freeableDescriptorPool;
-	vdu::QueryPool queryPool;
-
-	// Semaphores
-	vdu::Semaphore imageAvailableSemaphore;
-	vdu::Semaphore gBufferFinishedSemaphore;
-	vdu::Semaphore screenFinishedSemaphore;
-	vdu::Semaphore pbrFinishedSemaphore;
-	vdu::Semaphore shadowFinishedSemaphore;
-	vdu::Semaphore overlayFinishedSemaphore;
-	vdu::Semaphore overlayCombineFinishedSemaphore;
-	vdu::Semaphore ssaoFinishedSemaphore;
-
-	// Fences
-	vdu::Fence gBufferGroupFence;
-	vdu::Fence pbrGroupFence;
+
+	// Passes of a frame, and of the console shown while the engine starts up. They own the semaphores between
+	// passes and the GPU timestamps, see createRenderGraphs
+	RenderGraph frameGraph;
+	RenderGraph consoleGraph;
+
+	// Fences, signalled once every submission of a frame has finished
+	vdu::Fence frameFences[FRAMES_IN_FLIGHT];
+
+	// Passes whose render passes are recorded in parallel, each executes one secondary command buffer per slot
+	enum SecondaryCommandSet
+	{
+		Shadow_Secondary, // A slot per point light, spot light and sun cascade
+		Overlay_Secondary, // A slot per UI group
+		Secondary_Set_Count
+	};
+
+	// Makes sure the current frame has slotCount secondary command buffers in set, call before Threading::parallelFor
+	void prepareSecondaryCommands(SecondaryCommandSet set, u32 slotCount);
+	/*
+		@brief	Begins the current frame's secondary command buffer of slot, continuing renderPass inside framebuffer
+		@note	Only from the parallelFor call slot is the index of. The buffer is allocated from that record worker's
+				commandPool when the slot is first used and re-recorded every time after that
+	*/
+	VkCommandBuffer beginSecondaryCommands(SecondaryCommandSet set, u32 slot, VkRenderPass renderPass, VkFramebuffer framebuffer);
+
+	// VK_NULL_HANDLE until recorded. Freed with the record workers' command pools
+	std::vector<VkCommandBuffer> secondaryCommandBuffers[Secondary_Set_Count][FRAMES_IN_FLIGHT];
+
+	// What recorded command buffers bake in, see invalidateCommands
+	enum CommandInput
+	{
+		Shadow_Pipeline_Input, // The shadow pipelines were recreated, the lights' secondary command buffers outlive them
+		GBuffer_Descriptors_Input, // The gBuffer descriptor set was written
+		Shadow_Descriptors_Input, // The shadow descriptor sets were written
+		SSAO_Pipeline_Input, // Another SSAO variant was selected
+		PBR_Descriptors_Input, // The PBR descriptor sets were written
+		Draw_Buffers_Input, // The draw or vertex/index buffers were recreated, or the draw counts baked into the draws changed
+		Render_Size_Input, // Attachments and framebuffers were recreated for a new render resolution
+		Command_Input_Count
+	};
+
+	/*
+		@brief	A command buffer per frame in flight, re-recorded only once one of its inputs changed since it was recorded
+		@note	Inputs only ever count up, so the sum of their versions changes whenever any of them does
+	*/
+	struct RecordedCommands
+	{
+		RecordedCommands(std::initializer_list<CommandInput> pInputs) : inputs(pInputs) { markStale(); }
+
+		// Every frame's copy is re-recorded, for command buffers that were just (re)allocated
+		void markStale() { for (auto& versions : recordedWith) versions = ~0ull; }
+
+		std::vector<CommandInput> inputs;
+		u64 recordedWith[FRAMES_IN_FLIGHT]; // Sum of the input versions each copy was recorded with
+	};
+
+	// Every command buffer recorded with input is re-recorded when its frame comes up again
+	void invalidateCommands(CommandInput input) { ++commandInputVersions[input]; }
+	u64 getInputVersions(const std::vector<CommandInput>& inputs);
+	// True if the current frame's copy of commands is stale, which it no longer is once this returns. Counts the re-record
+	bool needsRecording(RecordedCommands& commands);
+
+	u64 commandInputVersions[Command_Input_Count];
+	u32 reRecordedCommands; // Command buffers (primary and secondary) recorded for the frame being set up
+	u32 lastReRecordedCommands; // ... for the last frame
 
 	// Samplers
 	VkSampler textureSampler;
@@ -102,14 +200,28 @@ public:
 	void createLogicalDevice();
 	void createDescriptorPool();
 	static void createPerThreadCommandPools();
-	void createQueryPool();
 	void createTextureSampler();
 	void createSynchroObjects();
 	void createUBOs();
+	// Creates every pass's pipelines in parallel on the record workers, their render passes and layouts have to exist
+	void createPipelines();
+	// Declares the passes once every pipeline exists
+	void createRenderGraphs();
+
+	/*
+		@brief	Creates the pipeline cache with the data the last run saved, if it ran on the same device and driver
+		@note	Startup is profiled as "pipelinescold" or "pipelineswarm" depending on whether there was data to load
+	*/
+	void createPipelineCache();
+	// Saves the cache's data for the next run
+	void savePipelineCache();
+	void destroyPipelineCache();
+
+	VkPipelineCache pipelineCache; // Every pipeline is created with it, including those rebuilt by shader reloads
+	bool pipelineCacheWarm; // Created with data from disk
 
 	// Shaders
 	GBufferShader gBufferShader;
-	GBufferNoTexShader gBufferNoTexShader;
 	PBRShader pbrShader;
 	ScreenShader screenShader;
 	PointShadowShader pointShadowShader;
@@ -120,6 +232,31 @@ public:
 	CombineSceneShader combineSceneShader;
 	SSAOShader ssaoShader;
 	SSAOBlurShader ssaoBlurShader;
+	CullShader cullShader;
+	// Every shader compileShaders and reloadShaders handle
+	std::vector<ShaderSpec*> getShaders();
+
+	// The pipelines that are recreated together when one of their shaders changes
+	enum ShaderPass
+	{
+		GBuffer_Shader_Pass,
+		Shadow_Shader_Pass,
+		SSAO_Shader_Pass,
+		Culling_Shader_Pass,
+		PBR_Shader_Pass,
+		Screen_Shader_Pass,
+		Overlay_Shader_Pass
+	};
+
+	ShaderPass getShaderPass(ShaderSpec* shader);
+	// Recreates the pass's pipelines from the current modules, the old ones retire with the frame (see retirePipeline)
+	void rebuildShaderPass(ShaderPass pass);
+
+	FileWatcher shaderWatcher; // res/shaders
+	std::vector<ShaderSpec*> changedShaders; // Waiting for the next compile batch, only used by the GPU worker
+	std::vector<ShaderSpec*> compilingShaders; // The batch the CPU worker compiles while shaderCompileRunning
+	std::vector<ShaderSpec*> compiledShaders; // ... whose sources had changed, swapped in once the batch is done
+	std::atomic<bool> shaderCompileRunning;
 
 	/// There are probably more elegant solutions to this
 	/// A generic full rendering pipeline class would be useful
@@ -130,6 +267,29 @@ public:
 		vdu::Texture* depth;
 	};
 
+	/// --------------------
+	/// Attachments
+	/// --------------------
+
+	// Steps of a frame in submission order, the lifetimes of attachments are given in them
+	enum FrameStep
+	{
+		GBuffer_Step,
+		SSAO_Step,
+		SSAO_Blur_Step, // Horizontal, ssaoColourAttachment to ssaoBlurAttachment
+		SSAO_Final_Step, // Vertical, ssaoBlurAttachment to ssaoFinalAttachment
+		PBR_Step,
+		Overlay_Step,
+		Screen_Step
+	};
+
+	// Every pass's resolution dependant attachments, those whose lifetimes don't overlap share memory
+	void createAttachments();
+	void destroyAttachments();
+
+	AttachmentAllocator attachmentAllocator;
+	std::vector<GPUAllocation> attachmentMemory; // Per attachmentAllocator slot
+
 	/// --------------------
 	/// GBuffer pipeline
 	/// --------------------
@@ -155,14 +315,24 @@ public:
 	void destroyGBufferCommands();
 
 	// Pipeline objets
-	vdu::GraphicsPipeline gBufferPipeline;
-	vdu::PipelineLayout gBufferPipelineLayout;
+	GraphicsPipeline gBufferPipeline;
+	VkPipelineLayout gBufferPipelineLayout; // Set 0 gBufferDescriptorSet, set 1 materialTextureSet
 	
 	// Descriptors
 	vdu::DescriptorSetLayout gBufferDescriptorSetLayout;
-	vdu::DescriptorSet gBufferDescriptorSet;
+	vdu::DescriptorSet gBufferDescriptorSet[FRAMES_IN_FLIGHT];
 	bool gBufferDescriptorSetNeedsUpdate;
 
+	// Material textures, one variable sized array of materialTextureCapacity. Partially bound, so only the textures
+	// of loaded materials are ever written, and update after bind, so writing them doesn't touch the recorded gBuffer
+	// commands. Created without vdu, which has no binding flags
+	VkDescriptorSetLayout materialTextureSetLayout;
+	VkDescriptorPool materialTexturePool;
+	VkDescriptorSet materialTextureSet[FRAMES_IN_FLIGHT];
+	u32 materialTextureCapacity;
+	void createMaterialTexturePool();
+	void destroyMaterialTexturePool();
+
 	// Framebuffer and attachments
 	vdu::Framebuffer gBufferFramebuffer;
 	Texture gBufferColourAttachment;
@@ -171,66 +341,14 @@ public:
 	Texture gBufferDepthAttachment;
 	//Texture gBufferDepthLinearAttachment;
 
-	GBufferAttachments texturedGBufferAttachments = { &gBufferColourAttachment, &gBufferNormalAttachment, &gBufferPBRAttachment, &gBufferDepthAttachment };
+	GBufferAttachments gBufferAttachments = { &gBufferColourAttachment, &gBufferNormalAttachment, &gBufferPBRAttachment, &gBufferDepthAttachment };
 
 	// Render pass
 	vdu::RenderPass gBufferRenderPass;
 
 	// Command buffer
-	vdu::CommandBuffer gBufferCommandBuffer;
-	bool gBufferCmdsNeedUpdate;
-
-	/// --------------------
-	/// GBuffer no texture pipeline
-	/// --------------------
-
-	// Functions
-	void createGBufferNoTexAttachments();
-	void createGBufferNoTexRenderPass();
-	void createGBufferNoTexDescriptorSetLayouts();
-	void createGBufferNoTexPipeline();
-	void createGBufferNoTexFramebuffers();
-	void createGBufferNoTexDescriptorSets();
-	void createGBufferNoTexCommands();
-
-	void updateGBufferNoTexDescriptorSets();
-	void updateGBufferNoTexCommands();
-
-	void destroyGBufferNoTexAttachments();
-	void destroyGBufferNoTexRenderPass();
-	void destroyGBufferNoTexDescriptorSetLayouts();
-	void destroyGBufferNoTexPipeline();
-	void destroyGBufferNoTexFramebuffers();
-	void destroyGBufferNoTexDescriptorSets();
-	void destroyGBufferNoTexCommands();
-
-	// Pipeline objets
-	vdu::GraphicsPipeline gBufferNoTexPipeline;
-	vdu::PipelineLayout gBufferNoTexPipelineLayout;
-
-	// Descriptors
-	vdu::DescriptorSetLayout gBufferNoTexDescriptorSetLayout;
-	vdu::DescriptorSet gBufferNoTexDescriptorSet;
-	bool gBufferNoTexDescriptorSetNeedsUpdate;
-
-	// Framebuffer and attachments
-	vdu::Framebuffer gBufferNoTexFramebuffer;
-	Texture gBufferNoTexColourAttachment;
-	Texture gBufferNoTexNormalAttachment;
-	Texture gBufferNoTexPBRAttachment;
-	Texture gBufferNoTexDepthAttachment;
-
-	GBufferAttachments flatGBufferAttachments = { &gBufferNoTexColourAttachment, &gBufferNoTexNormalAttachment, &gBufferNoTexPBRAttachment, &gBufferNoTexDepthAttachment };
-
-	// Render pass
-	vdu::RenderPass gBufferNoTexRenderPass;
-
-	// Command buffer
-	vdu::CommandBuffer gBufferNoTexCommandBuffer;
-	bool gBufferNoTexCmdsNeedUpdate;
-
-	/// TODO: temp
-	GBufferAttachments usedGBuffer = USED_GBUFFER;
+	vdu::CommandBuffer gBufferCommandBuffer[FRAMES_IN_FLIGHT];
+	RecordedCommands gBufferCommands;
 
 	/// --------------------
 	/// Shadow pipeline
@@ -253,13 +371,13 @@ public:
 	void destroyShadowCommands();
 
 	// Pipeline objets
-	vdu::GraphicsPipeline pointShadowPipeline;
+	GraphicsPipeline pointShadowPipeline;
 	vdu::PipelineLayout pointShadowPipelineLayout;
 
-	vdu::GraphicsPipeline spotShadowPipeline;
+	GraphicsPipeline spotShadowPipeline;
 	vdu::PipelineLayout spotShadowPipelineLayout;
 
-	vdu::GraphicsPipeline sunShadowPipeline;
+	GraphicsPipeline sunShadowPipeline;
 	vdu::PipelineLayout sunShadowPipelineLayout;
 
 	// Render pass
@@ -267,14 +385,23 @@ public:
 
 	// Descriptors
 	vdu::DescriptorSetLayout shadowDescriptorSetLayout;
-	vdu::DescriptorSet shadowDescriptorSet;
+	vdu::DescriptorSet shadowDescriptorSet[FRAMES_IN_FLIGHT];
 
 	vdu::DescriptorSetLayout spotShadowDescriptorSetLayout;
-	vdu::DescriptorSet spotShadowDescriptorSet;
+	vdu::DescriptorSet spotShadowDescriptorSet[FRAMES_IN_FLIGHT];
 
 	// Command buffer
-	vdu::CommandBuffer shadowCommandBuffer;
-	VkFence shadowFence;
+	vdu::CommandBuffer shadowCommandBuffer[FRAMES_IN_FLIGHT];
+	RecordedCommands shadowCommands; // The inputs every light's secondary command buffer shares
+
+	// What a shadow slot's secondary command buffer was recorded with, besides shadowCommands' inputs
+	struct ShadowSlotKey
+	{
+		VkFramebuffer framebuffer;
+		glm::fmat4 push; // The light's push constants, padded
+		u64 inputs;
+	};
+	std::vector<ShadowSlotKey> shadowSlotKeys[FRAMES_IN_FLIGHT];
 
 	/// --------------------
 	/// SSAO pipeline
@@ -292,6 +419,19 @@ public:
 	void updateSSAODescriptorSets();
 	void updateSSAOCommands();
 
+	// Key of the SSAO settings baked into a pipeline as specialization constants
+	u64 getSSAOVariantKey();
+	// Sets up, but doesn't create, the pipeline for the SSAO settings in key
+	GraphicsPipeline* prepareSSAOVariant(u64 key);
+	// Creates the pipeline for the current SSAO settings and makes it the one the SSAO commands record
+	void createSSAOVariant();
+	// Creates the pipeline for key on a CPU worker, selectSSAOVariant picks it up once done
+	void buildSSAOVariant(u64 key);
+	// Waits for a running variant build and destroys its pipeline
+	void discardSSAOVariantBuild();
+	// Switches to the pipeline for the current SSAO settings, building it if it isn't cached
+	void selectSSAOVariant();
+
 	void destroySSAOAttachments();
 	void destroySSAORenderPass();
 	void destroySSAODescriptorSetLayouts();
@@ -301,16 +441,29 @@ public:
 	void destroySSAOCommands();
 
 	// Pipeline objets
-	vdu::GraphicsPipeline ssaoPipeline;
+	// Pipelines by getSSAOVariantKey, ssaoShader specialized with their sample count and spiral turns. Kept until the
+	// SSAO pipelines are destroyed, switching back to a setting is cheap
+	std::unordered_map<u64, GraphicsPipeline*> ssaoPipelines;
+	GraphicsPipeline* ssaoPipeline; // Recorded into the SSAO commands
+	u64 ssaoPipelineKey;
+	// The variant being built by buildSSAOVariant, the pipeline is owned by the job while ssaoVariantBuildRunning
+	struct SSAOVariantBuild
+	{
+		u64 key;
+		GraphicsPipeline* pipeline;
+	} ssaoVariantBuild;
+	std::atomic<bool> ssaoVariantBuildRunning;
+	std::mutex ssaoVariantBuildMutex;
+	std::condition_variable ssaoVariantBuilt;
 	vdu::PipelineLayout ssaoPipelineLayout;
-	vdu::VertexInputState ssaoVertexInputState;
+	VertexInputState ssaoVertexInputState;
 
-	vdu::GraphicsPipeline ssaoBlurPipeline;
+	GraphicsPipeline ssaoBlurPipeline;
 	vdu::PipelineLayout ssaoBlurPipelineLayout;
 
 	// Descriptors
 	vdu::DescriptorSetLayout ssaoDescriptorSetLayout;
-	vdu::DescriptorSet ssaoDescriptorSet;
+	vdu::DescriptorSet ssaoDescriptorSet[FRAMES_IN_FLIGHT];
 
 	vdu::DescriptorSetLayout ssaoBlurDescriptorSetLayout;
 	vdu::DescriptorSet ssaoBlurDescriptorSet;
@@ -331,7 +484,7 @@ public:
 		glm::fvec4 projInfo;
 	} ssaoConfigData;
 
-	vdu::Buffer ssaoConfigBuffer;
+	MappedBuffer ssaoConfigBuffer;
 
 	vdu::Framebuffer ssaoFramebuffer;
 	Texture ssaoColourAttachment;
@@ -347,7 +500,8 @@ public:
 	vdu::RenderPass ssaoBlurRenderPass;
 
 	// Command buffer
-	vdu::CommandBuffer ssaoCommandBuffer;
+	vdu::CommandBuffer ssaoCommandBuffer[FRAMES_IN_FLIGHT];
+	RecordedCommands ssaoCommands;
 
 	/// --------------------
 	/// PBR shading pipeline
@@ -370,18 +524,76 @@ public:
 	void destroyPBRCommands();
 
 	// Pipeline objects
-	vdu::ComputePipeline pbrPipeline;
+	ComputePipeline pbrPipeline;
 	vdu::PipelineLayout pbrPipelineLayout;
 
 	// Descriptors
 	vdu::DescriptorSetLayout pbrDescriptorSetLayout;
-	vdu::DescriptorSet pbrDescriptorSet;
+	vdu::DescriptorSet pbrDescriptorSet[FRAMES_IN_FLIGHT];
 
 	// Framebuffer and attachments
 	Texture pbrOutput;
 
 	// Command buffer
-	vdu::CommandBuffer pbrCommandBuffer;
+	vdu::CommandBuffer pbrCommandBuffer[FRAMES_IN_FLIGHT];
+	RecordedCommands pbrCommands;
+
+	/// --------------------
+	/// Culling pipeline
+	/// --------------------
+
+	// Functions
+	void createCullingDescriptorSetLayouts();
+	void createCullingPipeline();
+	void createCullingDescriptorSets();
+	void createCullingCommands();
+
+	void updateCullingDescriptorSets();
+	void updateCullingDescriptorSet(u32 frame);
+	void updateCullingViews();
+	void updateCullingCommands();
+
+	void destroyCullingDescriptorSetLayouts();
+	void destroyCullingPipeline();
+	void destroyCullingDescriptorSets();
+	void destroyCullingCommands();
+
+	// Records the draws of the batches that survived culling for one view (a CULL_VIEW_* slot)
+	void cmdDrawCulled(VkCommandBuffer cmd, u32 view);
+	u32 getPointLightCullView(u32 index);
+	u32 getSpotLightCullView(u32 index);
+	// Blocks of CULL_GROUP_SIZE instances per view in blockRankBuffer
+	u32 getCullBlockCapacity() { return (instanceCapacity + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE; }
+
+	// Pipeline objects
+	ComputePipeline cullPipeline;
+	vdu::PipelineLayout cullPipelineLayout;
+
+	// Descriptors
+	vdu::DescriptorSetLayout cullDescriptorSetLayout;
+	vdu::DescriptorSet cullDescriptorSet[FRAMES_IN_FLIGHT];
+
+	// Descriptor data
+	CullViewsUBOData cullViewsData;
+	PerFrameBuffer cullViewsUBO;
+
+	// Per instance bounding spheres (model space) in instanceDataBuffer order
+	PerFrameBuffer instanceBoundsBuffer;
+	// Per view outputs, see cullReference()
+	PooledBuffer visibilityBuffer;
+	PooledBuffer visibleInstanceBuffer;
+	PooledBuffer batchDrawCmdBuffer;
+	PooledBuffer culledDrawCmdBuffer;
+	PooledBuffer drawCountBuffer;
+	// Prefix sums of the visibility the instance compaction places instances with, see cull.glsl
+	PooledBuffer instanceRankBuffer;
+	PooledBuffer blockRankBuffer;
+
+	// VK_KHR_draw_indirect_count, null when unsupported
+	PFN_vkCmdDrawIndexedIndirectCountKHR cmdDrawIndexedIndirectCount;
+
+	// Command buffer
+	vdu::CommandBuffer cullCommandBuffer[FRAMES_IN_FLIGHT];
 
 	/// --------------------
 	/// Screen pipeline
@@ -406,8 +618,8 @@ public:
 	
 	// Pipeline objects
 	vdu::PipelineLayout screenPipelineLayout;
-	vdu::GraphicsPipeline screenPipeline;
-	vdu::VertexInputState screenVertexInputState;
+	GraphicsPipeline screenPipeline;
+	VertexInputState screenVertexInputState;
 	
 	// Descriptors
 	vdu::DescriptorSetLayout screenDescriptorSetLayout;
@@ -421,6 +633,161 @@ public:
 	vdu::CommandBufferArray screenCommandBuffers;
 	vdu::CommandBufferArray screenCommandBuffersForConsole;
 
+	/// --------------------
+	/// Frames in flight
+	/// --------------------
+
+	// Waits for the frame slot about to be recorded and gives back what its last use held
+	void beginFrame();
+	void endFrame();
+	// For the rare updates that recreate objects every frame uses (pipelines, attachments)
+	void waitForAllFrames();
+
+	/*
+		@brief	Reserves size bytes of this frame's staging memory that are copied to dst's copy for this frame slot
+				at the start of the frame
+		@return	Pointer to write the data to, or nullptr if the staging ring is full of this frame's data
+		@note	The frames in flight read their own copies, so dst never changes under them. The other copies get the
+				data as their frames come up, see recordFrameCopies
+	*/
+	void* stageFrameData(PerFrameBuffer& dst, VkDeviceSize dstOffset, VkDeviceSize size);
+
+	// A run of elements of data to copy to dst, see findDirtyRanges
+	struct DirtyRange
+	{
+		PerFrameBuffer* dst;
+		const void* src;
+		VkDeviceSize dstOffset;
+		VkDeviceSize size;
+	};
+
+	/*
+		@brief	Appends the runs of elements of data that differ from uploaded, the last contents staged to dst
+		@note	Runs closer than maxGap elements are merged into one. Nothing is staged or marked uploaded
+	*/
+	template<typename T>
+	void findDirtyRanges(PerFrameBuffer& dst, const T* data, u32 count, const std::vector<T>& uploaded, std::vector<DirtyRange>& ranges, u32 maxGap = 8)
+	{
+		// Elements past the old size were never uploaded
+		u32 known = u32(glm::min<size_t>(uploaded.size(), count));
+
+		auto dirty = [&](u32 i) -> bool { return i >= known || memcmp(&data[i], &uploaded[i], sizeof(T)) != 0; };
+
+		u32 i = 0;
+		while (i < count)
+		{
+			if (!dirty(i))
+			{
+				++i;
+				continue;
+			}
+
+			u32 lastDirty = i;
+			for (u32 j = i + 1; j < count && j - lastDirty <= maxGap; ++j)
+			{
+				if (dirty(j))
+					lastDirty = j;
+			}
+
+			ranges.push_back({ &dst, &data[i], VkDeviceSize(i) * sizeof(T), VkDeviceSize(lastDirty - i + 1) * sizeof(T) });
+			i = lastDirty + 1;
+		}
+	}
+
+	// Records the first count elements of data as staged, after the ranges findDirtyRanges found for them have been
+	template<typename T>
+	static void markUploaded(const T* data, u32 count, std::vector<T>& uploaded)
+	{
+		uploaded.resize(glm::max<size_t>(uploaded.size(), count));
+		memcpy(uploaded.data(), data, count * sizeof(T));
+	}
+
+	/*
+		@brief	Stages every range in one piece of this frame's staging memory
+		@return	False if the staging ring can't fit all of them, then none are staged
+		@note	For buffers that are only consistent as a whole, the frame either copies every range or none
+	*/
+	bool stageFrameRanges(const std::vector<DirtyRange>& ranges);
+
+	/*
+		@brief	Stages only the elements of data that differ from uploaded, the last contents staged to dst
+		@return	False if the staging ring filled before every dirty element was staged
+		@note	Runs closer than maxGap elements go up as one copy. uploaded is updated for the ranges that were staged,
+				anything left out because the ring is full differs again next frame. Clear uploaded when dst is recreated
+	*/
+	template<typename T>
+	bool streamDirtyRanges(PerFrameBuffer& dst, const T* data, u32 count, std::vector<T>& uploaded, u32 maxGap = 8)
+	{
+		std::vector<DirtyRange> ranges;
+		findDirtyRanges(dst, data, count, uploaded, ranges, maxGap);
+		uploaded.resize(glm::max<size_t>(uploaded.size(), count));
+
+		for (auto& range : ranges)
+		{
+			void* staged = stageFrameData(dst, range.dstOffset, range.size);
+			if (!staged)
+			{
+				// Forget what was never staged so it is dirty again next frame
+				uploaded.resize(size_t(range.dstOffset / sizeof(T)));
+				return false;
+			}
+
+			memcpy(staged, range.src, (size_t)range.size);
+			memcpy(&uploaded[size_t(range.dstOffset / sizeof(T))], range.src, (size_t)range.size);
+		}
+
+		return true;
+	}
+
+	void createFrameCommands();
+	/*
+		@brief	Records the copies staged for this frame into its slot's copies of the buffers, after catching them up
+				on what the other slots' frames staged since the slot was last used
+		@note	Only waits for earlier transfers, the passes of the frames in flight keep running
+	*/
+	void recordFrameCopies();
+
+	u32 frameIndex;
+	u64 frameStagingOwner;
+	u64 frameStagingSubmissions[FRAMES_IN_FLIGHT];
+
+	struct FrameCopy
+	{
+		PerFrameBuffer* dst;
+		VkBufferCopy region;
+	};
+	std::vector<FrameCopy> frameCopies; // Staged for the frame being set up
+	std::vector<FrameCopy> stagedCopies[FRAMES_IN_FLIGHT]; // Staged for each slot's last frame, replayed into the other slots
+
+	// Staged buffers are created with a copy per frame in flight, usage gets the transfer bits the frame copies need
+	void createPerFrameBuffer(PerFrameBuffer& buffer, VkBufferUsageFlags usage, VkDeviceSize size);
+	// Copies of recreated buffers the frames in flight may still read, destroyed once the current slot's fence has signalled
+	void retireBuffer(PerFrameBuffer& buffer);
+	void retireBuffer(PooledBuffer& buffer);
+	std::vector<PooledBuffer> retiredBuffers[FRAMES_IN_FLIGHT];
+
+	// Images whose upload could not be staged, the copies recorded into them run with the frame's upload batch
+	struct RetiredImage
+	{
+		VkImage image;
+		VkImageView view;
+		GPUAllocation allocation;
+	};
+	// Destroyed once the current slot's fence has signalled, like retiredBuffers
+	void retireImage(VkImage image, VkImageView view, const GPUAllocation& allocation);
+	std::vector<RetiredImage> retiredImages[FRAMES_IN_FLIGHT];
+
+	// Pipelines and command buffers replaced by a shader reload, the frames in flight keep running the old ones
+	void retirePipeline(VkPipeline pipeline);
+	std::vector<VkPipeline> retiredPipelines[FRAMES_IN_FLIGHT];
+	std::vector<vdu::CommandBufferArray> retiredCommandBuffers[FRAMES_IN_FLIGHT];
+
+	// Everything retired while the slot was last recorded, except the buffers
+	void destroyRetiredObjects(u32 slot);
+
+	// First command buffer of every frame, holds the staged copies
+	vdu::CommandBuffer frameCopyCommandBuffer[FRAMES_IN_FLIGHT];
+
 	/// ------------------------
 	/// Scene combine pipeline
 	/// ------------------------
@@ -430,51 +797,144 @@ public:
 
 
 	// GPU Memory management
-	// Joint vertex/index buffer
-	/// TODO: We need a better allocator/deallocator
-	// It should keep track of free memory which may be "holes" (after removing memory from middle of buffer) and allocate if new additions fit
-	// If we want to compact data (not sure if this will be worth the effort) we'd have to keep track of which memory regions are used by which models
+	// Joint vertex/index buffer, sub-allocated per model LOD in units of vertices and indices
 
-	vdu::Buffer screenQuadBuffer;
+	PooledBuffer screenQuadBuffer;
+
+	// Every CPU -> GPU upload is staged through this, see StagingUpload
+	StagingRing stagingRing;
+
+	// True if most of VRAM is host visible (resizable BAR, or unified memory). The staging ring is placed there
+	// so streamed data crosses the bus once, as it is written, and the copies stay within device memory
+	bool hasReBarMemory();
+
+	// Buffers the GPU reads live in device local memory and are only written through stageFrameData or a StagingUpload
+	void createDeviceLocalBuffer(PooledBuffer& buffer, VkBufferUsageFlags usage, VkDeviceSize size);
+
+	// Uploads recorded on the GPU worker go into one batch that is submitted once per frame, with one fence
+	StagingUpload* uploadBatch;
+	StagingUpload& getUploadBatch();
+	void submitUploadBatch();
 	
-	vdu::Buffer vertexIndexBuffer;
-	u64 vertexInputByteOffset;
-	u64 indexInputByteOffset;
-	void pushModelDataToGPU(Model& model);
+	PooledBuffer vertexIndexBuffer;
+	BufferSubAllocator vertexAllocator;
+	BufferSubAllocator indexAllocator;
+	bool pushModelDataToGPU(Model& model);
+	// The ranges are only released by releaseFreedModelData, once the GPU can no longer be using them
+	void freeModelDataFromGPU(Model& model);
+	void releaseFreedModelData(std::vector<std::pair<u64, u64>>& freed);
+	std::vector<std::pair<u64, u64>> freedModelData; // (first vertex, first index) of each freed LOD, either can be INVALID_OFFSET
+	// Ranges freed while a frame was recorded, released once that frame's fence has signalled
+	std::vector<std::pair<u64, u64>> retiredModelData[FRAMES_IN_FLIGHT];
+	// Models that did not fit while space was still being freed, beginFrame pushes them again
+	std::vector<Model*> modelsAwaitingSpace;
+	// Textures that could not be staged while the frame's data held the staging ring, beginFrame loads them again
+	std::vector<Texture*> texturesAwaitingSpace;
+
+	/*
+		@brief	Moves up to VERTEX_INDEX_COMPACTION_BYTES_PER_FRAME of model data into holes nearer the start of the
+				vertex/index regions and patches the models' LOD offsets
+		@note	The copies are recorded with the next frame's copies and the old ranges retire with that frame, nothing waits on the GPU
+		@return	True if anything moved
+	*/
+	bool compactVertexIndexBuffer();
+	std::vector<VkBufferCopy> vertexIndexMoves; // Recorded by recordFrameCopies
 	void createDataBuffers();
 
+	// Materials whose textures or flat values changed, written to materialTextureSet and materialRecordBuffer by the next updateMaterialDescriptors
+	void queueMaterialDescriptorUpdate(Material* material);
+	/*
+		@brief	Stages the records of the dirty materials and writes their textures to the current slot's materialTextureSet
+		@note	The other slots' sets are written when their frames come up, no frame in flight has its set changed
+	*/
 	void updateMaterialDescriptors();
-	void updateFlatMaterialBuffer();
+	/*
+		@brief	Recreates materialRecordBuffer for at least records materials, its contents are streamed again in full
+		@return	False if the material texture array can't hold that many materials
+		@note	Retired like the draw buffers, the current slot's gBuffer set is pointed at the new one by updateDrawBufferDescriptors
+	*/
+	bool growMaterialRecordBuffer(u32 records);
+
+	std::vector<Material*> dirtyMaterials;
+	std::mutex dirtyMaterialsMutex;
+	// Textured materials whose textures each slot's gBuffer set still has to be given
+	std::vector<Material*> pendingMaterialDescriptors[FRAMES_IN_FLIGHT];
+	// Writes the loaded skybox to each slot's PBR set as its frame comes up
 	void updateSkyboxDescriptor();
+	bool skyboxDescriptorPending[FRAMES_IN_FLIGHT];
 
 	void addFenceDelayedAction(vdu::Fence* fe, std::function<void(void)> action);
 	void executeFenceDelayedActions();
 	static thread_local std::unordered_map<vdu::Fence*, std::function<void(void)>> fenceDelayedActions;
 
 	// End GPU mem management
-	void initialiseQueryPool();
 
 	// Draw buffers
-	vdu::Buffer drawCmdBuffer;
+	// Instances are batched by (model, LOD, material); each batch is one indirect command whose instances index
+	// instanceDataBuffer through gl_InstanceIndex, see InstanceData
+	// Batches [0, shadowDrawBase) are drawn by the camera, the rest by shadow passes (see EngineConfig::Render::LOD)
+	PerFrameBuffer drawCmdBuffer;
+	PerFrameBuffer instanceDataBuffer;
+	u32 drawCount;
+	u32 shadowDrawBase;
+	u32 drawInstanceCount;
+	u32 shadowInstanceBase;
+	// The staging ring had no room for the last draw list. The buffers and the counts above still describe the
+	// previous draw list until all of it can be staged in one frame
+	bool drawUploadPending;
 	void populateDrawCmdBuffer();
+	// What was last staged to the draw buffers, so only the batches and instances that changed are streamed
+	std::vector<VkDrawIndexedIndirectCommand> uploadedDrawCmds;
+	std::vector<InstanceData> uploadedInstanceData;
+	std::vector<glm::fvec4> uploadedInstanceBounds;
+
+	// Entries the draw, culling and transform buffers are sized for. They grow with the scene up to the maximums
+	// in EngineConfig::Render::Limits, every buffer is recreated empty so the caller stages its full contents again
+	u32 instanceCapacity;
+	u32 drawCapacity;
+	u32 transformCapacity;
+	// Return false if the limits don't allow the growth, the buffers are left as they are. The old buffers are
+	// retired, nothing waits for the frames in flight
+	bool growDrawBuffers(u32 instances, u32 draws);
+	bool growTransformBuffer(u32 transforms);
+	void createDrawBuffers();
+	void destroyDrawBuffers();
+	/*
+		@brief	Points the current slot's descriptor sets that read the draw or transform buffers at the current ones
+		@note	Called every frame before anything is recorded, only writes the sets when the buffers were recreated
+				since the slot last had them written
+	*/
+	void updateDrawBufferDescriptors();
+	u64 drawBuffersVersion; // Bumped when the draw, transform or material record buffers are recreated
+	u64 drawBufferDescriptorVersions[FRAMES_IN_FLIGHT];
 
 	// Uniform buffers
 	CameraUBOData cameraUBOData;
-	vdu::Buffer cameraUBO;
-	vdu::Buffer transformUBO;
-	vdu::Buffer flatPBRUBO;
+	PerFrameBuffer cameraUBO;
+	PerFrameBuffer transformBuffer;
+	PerFrameBuffer materialRecordBuffer;
+	// Every record the buffer holds, only the ones that changed are streamed (see streamDirtyRanges)
+	MaterialRecords materialRecords;
+	std::vector<MaterialRecord> uploadedMaterialRecords;
+
+	// Written by the physics thread under physToEngineMutex, streamed into transformBuffer by streamTransforms
+	std::vector<glm::fmat4> transformData;
+	std::vector<u32> dirtyTransforms;
 
 	LightManager lightManager;
 	
 	void setImageLayout(VkCommandBuffer cmdbuffer, Texture& tex, VkImageLayout oldImageLayout, VkImageLayout newImageLayout, VkPipelineStageFlags srcStageMask, VkPipelineStageFlags dstStageMask);
 	void setImageLayout(vdu::CommandBuffer* cmdbuffer, Texture& tex, VkImageLayout oldImageLayout, VkImageLayout newImageLayout, VkPipelineStageFlags srcStageMask, VkPipelineStageFlags dstStageMask);
 
+	// Command buffers for lTransferQueue, copies only when the transfer family is dedicated
 	void beginTransferCommands(vdu::CommandBuffer& cmd);
+	void beginGraphicsCommands(vdu::CommandBuffer& cmd);
 	void endTransferCommands(vdu::CommandBuffer& cmd, vdu::QueueSubmission& submission);
 	void submitTransferCommands(vdu::QueueSubmission& submission, vdu::Fence fence = vdu::Fence());
 
 	void updateCameraBuffer();
 	void updateTransformBuffer();
+	void streamTransforms();
 	void updateSSAOConfigBuffer();
 };
 
@@ -0,0 +1,55 @@
+#pragma once
+#include "PCH.hpp"
+
+/*
+	@brief	FIFO sub-allocator for a ring buffer whose space is given back in submission order
+	@note	Pure CPU bookkeeping like BufferSubAllocator, nothing touches Vulkan so it can be exercised without a device.
+			Space is handed out at the head and given back at the tail once the submission that reads it is released.
+			Allocations belong to an owner until it submits them. Not thread safe, StagingRing locks around it
+*/
+class RingAllocator
+{
+public:
+	static const u64 INVALID_OFFSET = ~u64(0);
+
+	RingAllocator() : capacity(0), head(0), tail(0) {}
+
+	void init(u64 pCapacity);
+
+	/*
+		@brief	Reserves size bytes for owner, contiguous and aligned to alignment
+		@return	Offset into the buffer, or INVALID_OFFSET if the ring is full. getOldestSubmission() tells what to wait for
+	*/
+	u64 allocate(u64 owner, u64 size, u64 alignment);
+
+	// Ties every allocation of owner made since its last submit to submission, which has to be non-zero and unique
+	void submit(u64 owner, u64 submission);
+	// Gives back the space of submission and of every released one before it, releasing twice is harmless
+	void release(u64 submission);
+
+	// Submission holding the tail of the ring, 0 if the ring is empty or the tail still belongs to an owner that has not submitted
+	u64 getOldestSubmission() const { return blocks.empty() ? 0 : blocks.front().submission; }
+
+	u64 getCapacity() const { return capacity; }
+	u64 getUsed() const { return head - tail; }
+
+private:
+	struct Block
+	{
+		u64 owner;
+		u64 end; // Ring position (not wrapped) one past the block
+		u64 submission; // 0 until the owner submits
+	};
+
+	// Pops released blocks off the tail
+	void retire();
+
+	u64 capacity;
+
+	// Positions grow forever, the buffer offset is position % capacity
+	u64 head;
+	u64 tail;
+
+	std::deque<Block> blocks;
+	std::unordered_set<u64> pendingSubmissions; // Submitted and not released
+};
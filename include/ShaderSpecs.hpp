@@ -2,122 +2,200 @@
 #include "PCH.hpp"
 #include "Engine.hpp"
 
-class CombineOverlaysShader : public vdu::ShaderProgram
+/*
+	@brief	A program compiled from one GLSL file into a module per stage, each stage sees its name defined (VERTEX,
+			GEOMETRY, FRAGMENT or COMPUTE)
+	@note	Compiled SPIR-V is cached in cache/shaders, keyed on the source, every file it includes and the
+			compiler's version, so only programs whose key changed are compiled again. The modules are created
+			here rather than through vdu::ShaderProgram, which only builds them from GLSL.
+*/
+class ShaderSpec
 {
 public:
-	CombineOverlaysShader()
+	ShaderSpec(const std::string& pSourceName) : sourceName(pSourceName), device(VK_NULL_HANDLE), compiledHash(0), hasPending(false) {}
+
+	void create(vdu::LogicalDevice* logicalDevice) { device = logicalDevice->getHandle(); }
+	void destroy();
+
+	// Builds the modules from the cached SPIR-V, or compiles and caches it
+	void compileSource();
+	/*
+		@brief	Compiles the source if it or its includes changed since the modules were last built
+		@note	Only leaves the SPIR-V for swapPending, nothing pipeline creation reads is touched so it may run on a
+				worker while pipelines are created from the current modules
+		@return	True if there is SPIR-V to swap in
+	*/
+	bool compileIfChanged();
+	// Replaces the modules with the ones compileIfChanged built, on the thread creating the pipelines
+	void swapPending();
+
+	// fileName is a name within res/shaders, as reported by a FileWatcher on it
+	bool readsSource(const std::string& fileName) const;
+
+	// Hash of the source and includes the modules were last built from
+	u64 getCompiledHash() const { return compiledHash; }
+
+	// For pipeline creation, a pipeline doesn't need the modules once it is created. Settings baked into a pipeline
+	// are specialization constants, see SpecializationConstants
+	const std::vector<VkPipelineShaderStageCreateInfo>& getStages() const { return stages; }
+
+protected:
+	void addModule(VkShaderStageFlagBits stage) { modules.push_back({ stage, VK_NULL_HANDLE }); }
+
+private:
+	struct Module
+	{
+		VkShaderStageFlagBits stage;
+		VkShaderModule module;
+	};
+
+	typedef std::vector<std::vector<u32>> ModuleCode;
+
+	// SPIR-V and what it was built from
+	struct Build
+	{
+		ModuleCode code;
+		std::vector<std::string> includes;
+		u64 hash;
+	};
+
+	// Loads or compiles the SPIR-V, onlyIfChanged skips it when the source and includes are the ones last built
+	bool build(bool onlyIfChanged, Build& result) const;
+	void apply(const Build& result);
+	// Reads the source and the names of the files it includes, directly or not, and hashes their contents
+	bool readSources(std::string& source, std::vector<std::string>& sourceIncludes, u64& hash) const;
+	u64 makeCacheKey(u64 sourceHash) const;
+	bool loadCache(u64 key, ModuleCode& code) const;
+	void saveCache(u64 key, const ModuleCode& code) const;
+	bool compile(const std::string& source, ModuleCode& code) const;
+	void createModules(const ModuleCode& code);
+	void destroyModules();
+
+	std::string sourceName;
+	VkDevice device;
+	std::vector<Module> modules;
+	std::vector<VkPipelineShaderStageCreateInfo> stages;
+	std::vector<std::string> includes; // Of the source the modules were built from
+	u64 compiledHash;
+	Build pending; // Left by compileIfChanged for swapPending
+	bool hasPending;
+};
+
+class CombineOverlaysShader : public ShaderSpec
+{
+public:
+	CombineOverlaysShader() : ShaderSpec("combineOverlays.glsl")
 	{
-		addModule(vdu::ShaderStage::Vertex, Engine::workingDirectory + "/res/shaders/combineOverlays.glsl");
-		addModule(vdu::ShaderStage::Fragment, Engine::workingDirectory + "/res/shaders/combineOverlays.glsl");
+		addModule(VK_SHADER_STAGE_VERTEX_BIT);
+		addModule(VK_SHADER_STAGE_FRAGMENT_BIT);
 	}
 };
 
-class SpotShadowShader : public vdu::ShaderProgram
+class SpotShadowShader : public ShaderSpec
 {
 public:
-	SpotShadowShader()
+	SpotShadowShader() : ShaderSpec("spotShadow.glsl")
 	{
-		addModule(vdu::ShaderStage::Vertex, Engine::workingDirectory + "/res/shaders/spotShadow.glsl");
-		addModule(vdu::ShaderStage::Fragment, Engine::workingDirectory + "/res/shaders/spotShadow.glsl");
+		addModule(VK_SHADER_STAGE_VERTEX_BIT);
+		addModule(VK_SHADER_STAGE_FRAGMENT_BIT);
 	}
 };
 
-class PointShadowShader : public vdu::ShaderProgram
+class PointShadowShader : public ShaderSpec
 {
 public:
-	PointShadowShader()
+	PointShadowShader() : ShaderSpec("pointShadow.glsl")
 	{
-		addModule(vdu::ShaderStage::Vertex, Engine::workingDirectory + "/res/shaders/pointShadow.glsl");
-		addModule(vdu::ShaderStage::Geometry, Engine::workingDirectory + "/res/shaders/pointShadow.glsl");
-		addModule(vdu::ShaderStage::Fragment, Engine::workingDirectory + "/res/shaders/pointShadow.glsl");
+		addModule(VK_SHADER_STAGE_VERTEX_BIT);
+		addModule(VK_SHADER_STAGE_GEOMETRY_BIT);
+		addModule(VK_SHADER_STAGE_FRAGMENT_BIT);
 	}
 };
 
-class SunShadowShader : public vdu::ShaderProgram
+class SunShadowShader : public ShaderSpec
 {
 public:
-	SunShadowShader()
+	SunShadowShader() : ShaderSpec("sunShadow.glsl")
 	{
-		addModule(vdu::ShaderStage::Vertex, Engine::workingDirectory + "/res/shaders/sunShadow.glsl");
-		addModule(vdu::ShaderStage::Fragment, Engine::workingDirectory + "/res/shaders/sunShadow.glsl");
+		addModule(VK_SHADER_STAGE_VERTEX_BIT);
+		addModule(VK_SHADER_STAGE_FRAGMENT_BIT);
 	}
 };
 
-class ScreenShader : public vdu::ShaderProgram
+class ScreenShader : public ShaderSpec
 {
 public:
-	ScreenShader()
+	ScreenShader() : ShaderSpec("screen.glsl")
 	{
-		addModule(vdu::ShaderStage::Vertex, Engine::workingDirectory + "/res/shaders/screen.glsl");
-		addModule(vdu::ShaderStage::Fragment, Engine::workingDirectory + "/res/shaders/screen.glsl");
+		addModule(VK_SHADER_STAGE_VERTEX_BIT);
+		addModule(VK_SHADER_STAGE_FRAGMENT_BIT);
 	}
 };
 
-class OverlayShader : public vdu::ShaderProgram
+class OverlayShader : public ShaderSpec
 {
 public:
-	OverlayShader()
+	OverlayShader() : ShaderSpec("overlay.glsl")
 	{
-		addModule(vdu::ShaderStage::Vertex, Engine::workingDirectory + "/res/shaders/overlay.glsl");
-		addModule(vdu::ShaderStage::Fragment, Engine::workingDirectory + "/res/shaders/overlay.glsl");
+		addModule(VK_SHADER_STAGE_VERTEX_BIT);
+		addModule(VK_SHADER_STAGE_FRAGMENT_BIT);
 	}
 };
 
-class GBufferShader : public vdu::ShaderProgram
+class GBufferShader : public ShaderSpec
 {
 public:
-	GBufferShader()
+	GBufferShader() : ShaderSpec("gbuffer.glsl")
 	{
-		addModule(vdu::ShaderStage::Vertex, Engine::workingDirectory + "/res/shaders/gBuffer.glsl");
-		addModule(vdu::ShaderStage::Fragment, Engine::workingDirectory + "/res/shaders/gBuffer.glsl");
+		addModule(VK_SHADER_STAGE_VERTEX_BIT);
+		addModule(VK_SHADER_STAGE_FRAGMENT_BIT);
 	}
 };
 
-class GBufferNoTexShader : public vdu::ShaderProgram
+class PBRShader : public ShaderSpec
 {
 public:
-	GBufferNoTexShader()
+	PBRShader() : ShaderSpec("pbr.glsl")
 	{
-		addModule(vdu::ShaderStage::Vertex, Engine::workingDirectory + "/res/shaders/gBufferNoTex.glsl");
-		addModule(vdu::ShaderStage::Fragment, Engine::workingDirectory + "/res/shaders/gBufferNoTex.glsl");
+		addModule(VK_SHADER_STAGE_COMPUTE_BIT);
 	}
 };
 
-class PBRShader : public vdu::ShaderProgram
+class CullShader : public ShaderSpec
 {
 public:
-	PBRShader()
+	CullShader() : ShaderSpec("cull.glsl")
 	{
-		addModule(vdu::ShaderStage::Compute, Engine::workingDirectory + "/res/shaders/pbr.glsl");
+		addModule(VK_SHADER_STAGE_COMPUTE_BIT);
 	}
 };
 
-class CombineSceneShader : public vdu::ShaderProgram
+class CombineSceneShader : public ShaderSpec
 {
 public:
-	CombineSceneShader()
+	CombineSceneShader() : ShaderSpec("combineScene.glsl")
 	{
-		addModule(vdu::ShaderStage::Vertex, Engine::workingDirectory + "/res/shaders/combineScene.glsl");
-		addModule(vdu::ShaderStage::Fragment, Engine::workingDirectory + "/res/shaders/combineScene.glsl");
+		addModule(VK_SHADER_STAGE_VERTEX_BIT);
+		addModule(VK_SHADER_STAGE_FRAGMENT_BIT);
 	}
 };
 
-class SSAOShader : public vdu::ShaderProgram
+class SSAOShader : public ShaderSpec
 {
 public:
-	SSAOShader()
+	SSAOShader() : ShaderSpec("ssao.glsl")
 	{
-		addModule(vdu::ShaderStage::Vertex, Engine::workingDirectory + "/res/shaders/ssao.glsl");
-		addModule(vdu::ShaderStage::Fragment, Engine::workingDirectory + "/res/shaders/ssao.glsl");
+		addModule(VK_SHADER_STAGE_VERTEX_BIT);
+		addModule(VK_SHADER_STAGE_FRAGMENT_BIT);
 	}
 };
 
-class SSAOBlurShader : public vdu::ShaderProgram
+class SSAOBlurShader : public ShaderSpec
 {
 public:
-	SSAOBlurShader()
+	SSAOBlurShader() : ShaderSpec("ssaoBlur.glsl")
 	{
-		addModule(vdu::ShaderStage::Vertex, Engine::workingDirectory + "/res/shaders/ssaoBlur.glsl");
-		addModule(vdu::ShaderStage::Fragment, Engine::workingDirectory + "/res/shaders/ssaoBlur.glsl");
+		addModule(VK_SHADER_STAGE_VERTEX_BIT);
+		addModule(VK_SHADER_STAGE_FRAGMENT_BIT);
 	}
 };
\ No newline at end of file
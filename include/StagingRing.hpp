@@ -0,0 +1,115 @@
+#pragma once
+#include "PCH.hpp"
+#include "MappedBuffer.hpp"
+#include "RingAllocator.hpp"
+
+// Size of the persistently mapped buffer every CPU -> GPU upload is staged through
+#define STAGING_RING_SIZE (64ull * 1024 * 1024)
+// Larger copies are split so one big upload can't hold the whole ring and others can stream in behind it
+#define STAGING_RING_MAX_CHUNK (STAGING_RING_SIZE / 4)
+
+class Renderer;
+
+/*
+	@brief	Persistently mapped host visible buffer that staging memory is sub-allocated from in FIFO order
+	@note	Space is handed out at the head and given back at the tail once the submission that reads it has finished,
+			so an upload is a memcpy and a copy command, nothing is allocated or mapped. Allocations belong to an owner
+			(one StagingUpload) until it submits them. The bookkeeping is a RingAllocator. Thread safe.
+*/
+class StagingRing
+{
+public:
+	static const u64 INVALID_OFFSET = RingAllocator::INVALID_OFFSET;
+
+	StagingRing() : nextOwner(1), nextSubmission(1) {}
+
+	// memoryProperties has to include HOST_VISIBLE and HOST_COHERENT, adding DEVICE_LOCAL puts the ring in VRAM
+	void create(GPUAllocator* allocator, VkDeviceSize pCapacity,
+		VkMemoryPropertyFlags memoryProperties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	void destroy();
+
+	/*
+		@brief	Reserves size bytes for owner, waiting on older submissions if the ring is full
+		@return	Offset into the buffer, or INVALID_OFFSET if the space is still held by allocations that have not been submitted
+		@note	The mutex is not held while waiting, so other threads keep allocating and releasing
+	*/
+	VkDeviceSize allocate(u64 owner, VkDeviceSize size, VkDeviceSize alignment);
+
+	// Ties every allocation of owner made since its last submit to fence, returns the id to release once it has signalled
+	u64 submit(u64 owner, VkFence fence);
+	// Must be called before the submission's fence is destroyed or reset, returns once no allocate() is waiting on it
+	void release(u64 submission);
+
+	u64 newOwner() { return nextOwner++; }
+
+	void* getMapped(VkDeviceSize offset) { return buffer.getMapped(offset); }
+	VkBuffer getHandle() { return buffer.getHandle(); }
+	VkDeviceSize getCapacity() const { return ring.getCapacity(); }
+	VkDeviceSize getUsed() const { return ring.getUsed(); }
+
+private:
+	struct PendingSubmission
+	{
+		VkFence fence;
+		u32 waiters; // allocate() calls waiting on the fence, it has to stay valid until they are done
+	};
+
+	MappedBuffer buffer;
+	VkDevice device;
+
+	RingAllocator ring;
+	std::unordered_map<u64, PendingSubmission> pendingSubmissions;
+	std::mutex mutex;
+	std::condition_variable waitersDone;
+
+	std::atomic<u64> nextOwner;
+	u64 nextSubmission;
+};
+
+/*
+	@brief	One logical upload through the staging ring, copied on the transfer queue and finished on the graphics queue
+	@note	Copies are recorded into the transfer command buffer. Anything that needs the graphics queue (layout changes
+			for sampling, mip generation) goes into the graphics command buffer, which is submitted after all transfers
+			of the upload and waits on them with a semaphore. Resources copied to are released by the transfer family
+			and acquired by the graphics family when those differ.
+			When the ring needs space back the recorded transfer commands are submitted and recording carries on in a
+			new command buffer, so always fetch the transfer command buffer again after staging data.
+*/
+class StagingUpload
+{
+public:
+	StagingUpload(Renderer* pRenderer);
+	~StagingUpload();
+
+	// Copies data into the ring, returns its offset in the ring buffer. size has to fit in STAGING_RING_MAX_CHUNK.
+	// Returns INVALID_OFFSET if the space is held by another owner's unsubmitted data, the caller tries again next frame
+	VkDeviceSize stage(const void* data, VkDeviceSize size, VkDeviceSize alignment = 16);
+
+	// Stages data and records copies into dst, split into chunks if it is larger than STAGING_RING_MAX_CHUNK.
+	// Returns false if a chunk could not be staged, the chunks before it may already be copied
+	bool copyToBuffer(PooledBuffer& dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size);
+
+	// Hands an image written by the transfer commands over to the graphics queue, its layout stays the same
+	void transferImageOwnership(VkImage image, VkImageLayout layout, const VkImageSubresourceRange& range);
+
+	vdu::CommandBuffer* getCommandBuffer() { return cmd; }
+	vdu::CommandBuffer* getGraphicsCommandBuffer() { return graphicsCmd; }
+	VkBuffer getBufferHandle();
+
+	// Submits the remaining commands, the upload can't be used afterwards
+	void submit();
+
+private:
+	void begin();
+	void flush();
+
+	void transferBufferOwnership(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size);
+
+	Renderer* renderer;
+	vdu::CommandBuffer* cmd;
+	vdu::CommandBuffer* graphicsCmd;
+	u64 owner;
+	bool hasStaged; // Ring space allocated since the last flush
+	bool finished;
+	bool ownershipTransfer; // Transfer and graphics families differ
+};
@@ -2,16 +2,22 @@
 #include "PCH.hpp"
 #include "Image.hpp"
 #include "Asset.hpp"
+#include "GPUAllocator.hpp"
+
+class StagingUpload;
 
 struct TextureCreateInfo : vdu::TextureCreateInfo
 {
-	TextureCreateInfo() : pData(nullptr), image(nullptr), genMipMaps(0), name(std::string("Unnamed texture")) {}
+	TextureCreateInfo() : pData(nullptr), image(nullptr), genMipMaps(0), aliased(false), name(std::string("Unnamed texture")) {}
 
-	TextureCreateInfo(Image* sourceImage) : pData(nullptr), image(sourceImage), genMipMaps(0), name(std::string("Unnamed texture")) {}
+	TextureCreateInfo(Image* sourceImage) : pData(nullptr), image(sourceImage), genMipMaps(0), aliased(false), name(std::string("Unnamed texture")) {}
 
 	Image* image;
 	void* pData;
 	bool genMipMaps;
+	// An attachment sharing memory with others, loadToGPU only creates the image and bindMemory() does the rest.
+	// Its contents and layout are undefined at the start of every frame
+	bool aliased;
 	std::vector<std::string> paths;
 	std::string name;
 };
@@ -29,9 +35,28 @@ public:
 	void cleanupRAM(FreeFunc fr = free);
 	void cleanupGPU();
 
+	// Hides vdu::Texture::destroy, the image's memory belongs to the renderer's GPUAllocator
+	void destroy();
+
+	// For aliased textures, binds them at offset into memory owned by the caller and creates the view
+	void bindMemory(VkDeviceMemory memory, VkDeviceSize offset);
+	VkMemoryRequirements getMemoryRequirements() const;
+
 private:
+	// Replaces vdu::Texture::create, places the image in GPUAllocator memory instead of its own VkDeviceMemory
+	void createImage();
+	void createView();
+	// Copies one tightly packed layer into mip 0 through the staging ring, a row range at a time if it is large.
+	// Returns false if the ring had no space to give, the rows before may already be copied
+	bool stageLayer(StagingUpload& upload, u32 layer, const void* data, u32 bytesPerPixel);
+	// Hands the image to the renderer to destroy after the upload recorded into it, when staging it failed
+	void abandonUpload();
+	// Every mip level and layer of the colour aspect
+	VkImageSubresourceRange getFullRange() const;
 
 	bool isMipped;
+	bool aliased;
 	u32 gpuIndex;
 	Image* img;
+	GPUAllocation allocation;
 };
@@ -29,12 +29,15 @@ protected:
 
 		void pushJob(JobBase* job);
 		bool popJob(JobBase*& job);
+		// Pops and runs one job on the calling thread, false if there was none
+		bool runNextJob();
 
 		bool allJobsFinished() { return m_totalJobsAdded == m_totalJobsFinished; }
-		void waitForAllJobsToFinish() {
-			while (!allJobsFinished())
-				std::this_thread::yield();
-		}
+		void waitForAllJobsToFinish();
+
+		// Sleeps until a job is queued or stop() returns true. Whoever makes stop() true has to call wake()
+		void waitForJob(const std::function<bool(void)>& stop);
+		void wake();
 
 		void join() { m_thread.join(); }
 
@@ -48,6 +51,8 @@ protected:
 
 		std::queue<JobBase*> m_jobsQueue;
 		std::mutex m_jobsQueueMutex;
+		std::condition_variable m_jobsArrived;
+		std::condition_variable m_jobsFinished;
 
 		std::atomic_char32_t m_totalJobsAdded;
 		std::atomic_char32_t m_totalJobsFinished;
@@ -60,7 +65,7 @@ protected:
 public:
 
 	// Construct worker threads
-	Threading(int pNumThreads);
+	Threading(int pNumThreads, int pNumAssetThreads);
 
 	// Terminate worker threads
 	~Threading();
@@ -77,12 +82,21 @@ public:
 	WorkerThread* m_diskIOWorker;
 	WorkerThread* m_gpuWorker;
 
+	// The extra threads, they record command buffers with their own command pools (see parallelFor)
+	std::vector<WorkerThread*> m_recordWorkers;
+
+	// Threads for long CPU work on loaded assets (see assetParallelFor), kept apart so it never holds up recording
+	std::vector<WorkerThread*> m_assetWorkers;
+
 	void addWorkerThread(const std::function<void(void)>& initFunc, const std::function<void(void)>& closeFunc, const std::string& name) {
 		m_workerThreads.push_back(new WorkerThread(initFunc, closeFunc, name));
 	}
 
 	std::vector<WorkerThread*> m_workerThreads;
 
+	// Idle workers sleep until a job arrives, this makes them see Engine::engineRunning has changed
+	void wakeWorkers();
+
 	// Systems add their jobs to the queue, jobs submitted with this function CANNOT submit GPU operations
 	void addCPUJob(JobBase* job);
 
@@ -97,6 +111,22 @@ public:
 	// DISK <-> RAM transfer operation will have their own thread
 	void addDiskIOJob(JobBase* job);
 
+	/*
+		@brief	Calls func(i) for every i below count on the record workers, returns once all calls have finished
+		@note	i always runs on record worker i % getRecordWorkerCount(), so anything per index that has to be externally
+				synced (a command buffer and the thread_local pool it came from) is only ever used by one thread.
+				Must not be called from a record worker
+	*/
+	void parallelFor(u32 count, const std::function<void(u32)>& func);
+
+	u32 getRecordWorkerCount() { return static_cast<u32>(m_recordWorkers.size()); }
+
+	/*
+		@brief	parallelFor on the asset workers, for jobs that can take seconds (e.g. mesh simplification)
+		@note	Must not be called from an asset worker
+	*/
+	void assetParallelFor(u32 count, const std::function<void(u32)>& func);
+
 	// Mark job for freeing memory
 	void freeJob(JobBase* job);
 
@@ -130,6 +160,12 @@ private:
 
 	// Initialise compulsory threads 
 	void initCompulsoryWorkers();
+
+	void initRecordWorkers(int count);
+
+	void initAssetWorkers(int count);
+
+	static void parallelFor(const std::vector<WorkerThread*>& workers, u32 count, const std::function<void(u32)>& func);
 };
 
 class JobBase
@@ -1,6 +1,8 @@
 #pragma once
 #include "PCH.hpp"
 
+class ShaderSpec;
+
 class UIElement
 {
 public:
@@ -10,10 +12,10 @@ public:
 	~UIElement();
 	void setName(std::string pName) { name = pName; }
 	std::string getName() { return name; }
-	virtual void render(vdu::CommandBuffer& cmd) {}
+	virtual void render(VkCommandBuffer cmd) {}
 	virtual void cleanup() {}
 	vdu::DescriptorSet& getDescriptorSet() { return descSet; }
-	vdu::ShaderProgram* getShader() { return shader; }
+	ShaderSpec* getShader() { return shader; }
 	glm::fvec4 getColour() { return colour; }
 	void setDepth(float pDepth) { depth = pDepth; depthUpdate = true; }
 	float getDepth() { return depth; }
@@ -36,7 +38,7 @@ protected:
 
 	vdu::DescriptorSet descSet;
 
-	vdu::ShaderProgram* shader;
+	ShaderSpec* shader;
 
 	float depth;
 	bool depthUpdate;
@@ -2,6 +2,7 @@
 #include "PCH.hpp"
 #include "UIElement.hpp"
 #include "Model.hpp"
+#include "MappedBuffer.hpp"
 
 class UIPolygon : public UIElement
 {
@@ -13,7 +14,7 @@ public:
 
 	void reserveBuffer(int numVerts);
 
-	void render(vdu::CommandBuffer& cmd);
+	void render(VkCommandBuffer cmd);
 
 	void cleanup();
 
@@ -25,6 +26,6 @@ private:
 	void updateDescriptorSet();
 
 	std::vector<Vertex2D> verts;
-	vdu::Buffer vertsBuffer;
+	MappedBuffer vertsBuffer;
 	Texture* texture;
 };
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include "Texture.hpp"
 #include "Model.hpp"
 #include "UIElementGroup.hpp"
+#include "Pipeline.hpp"
 
 class UIRenderer
 {
@@ -22,7 +23,8 @@ public:
 	
 	void destroyOverlayRenderPass();
 	void destroyOverlayPipeline();
-	void destroyOverlayAttachmentsFramebuffers();
+	void destroyOverlayAttachments();
+	void destroyOverlayFramebuffer();
 	void destroyOverlayDescriptorSetLayouts();
 	void destroyOverlayCommands();
 
@@ -45,11 +47,11 @@ private:
 
 	vdu::RenderPass overlayRenderPass;
 
-	vdu::GraphicsPipeline pipeline;
+	GraphicsPipeline pipeline;
 	vdu::PipelineLayout pipelineLayout;
-	vdu::CommandBuffer commandBuffer;
+	std::vector<vdu::CommandBuffer> commandBuffers; // One per frame in flight
 
-	vdu::VertexInputState vertexInputState;
+	VertexInputState vertexInputState;
 
 	vdu::Framebuffer framebuffer;
 	Texture uiTexture;
@@ -4,6 +4,7 @@
 #include "Rect.hpp"
 #include "Model.hpp"
 #include "UIElement.hpp"
+#include "MappedBuffer.hpp"
 
 class Text : public UIElement
 {
@@ -39,7 +40,7 @@ public:
 
 	void update();
 
-	void render(vdu::CommandBuffer& cmd);
+	void render(VkCommandBuffer cmd);
 
 	void cleanup();
 
@@ -60,7 +61,7 @@ public:
 	GlyphContainer* getGlyphs() { return glyphs; }
 	glm::fvec2 getCharsPosition(int index);
 
-	vdu::Buffer vertsBuffer;
+	MappedBuffer vertsBuffer;
 
 private:
 
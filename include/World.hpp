@@ -3,6 +3,9 @@
 #include "Model.hpp"
 #include "Camera.hpp"
 
+// Instances are stored in vectors of this many, which never move once allocated
+#define INSTANCES_PER_BLOCK 100
+
 class World
 {
 public:
@@ -15,14 +18,33 @@ public:
 
 	void frustumCulling(Camera* cam);
 
+	// Call when instances are added/removed or become drawable, forces the next culling pass to rebuild instancesToDraw
+	void membershipChanged() { ++membershipVersion; }
+
+	// Call when the LOD config changes, forces the next culling pass to re-select every instances LOD
+	void lodSettingsChanged() { lodSettingsDirty = true; }
+
 	std::unordered_map<std::string, ModelInstance*> modelNames; /// TODO: better hashing for big worlds
 
 	// Stores all instances in world
 	std::list<std::vector<ModelInstance>> allInstances;
+	// Slots of allInstances handed out so far, also the next transform index
+	u32 usedInstanceSlots = 0;
 
 	// Culled instances to draw (from allInstances)
 	std::vector<ModelInstance*> instancesToDraw;
 
+	// Indices into instancesToDraw whose LODs or material changed during the last culling pass
+	std::vector<u32> changedDrawRecords;
+
+	// True if the last culling pass rebuilt instancesToDraw, in which case every draw batch must be rebuilt
+	bool drawListRebuilt = false;
+
+	u32 membershipVersion = 1;
+	u32 culledMembershipVersion = 0;
+	u32 culledCameraChangeCount = 0;
+	bool lodSettingsDirty = false;
+
 	Texture* skybox;
 
 	// Instances waiting to be added. Might be waiting for load from DISK. Add to allInstances when ready
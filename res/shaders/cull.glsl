@@ -0,0 +1,290 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_compute_shader : enable
+
+// Must match the limits in Culling.hpp
+#define CULL_MAX_VIEWS 32
+#define CULL_GROUP_SIZE 64
+
+#define CULL_VIEW_CAMERA 0
+
+#define CULL_PASS_VISIBILITY 0
+#define CULL_PASS_SCAN_BLOCKS 1
+#define CULL_PASS_COMPACT_INSTANCES 2
+#define CULL_PASS_COMPACT_DRAWS 3
+
+// x = instance/block/instance and batch/view, y = view
+layout(local_size_x=CULL_GROUP_SIZE, local_size_y=1, local_size_z=1) in;
+
+struct CullView
+{
+	vec4 planes[6];
+};
+
+struct DrawCommand
+{
+	uint indexCount;
+	uint instanceCount;
+	uint firstIndex;
+	int vertexOffset;
+	uint firstInstance;
+};
+
+layout(push_constant) uniform Pass {
+	uint index;
+} pass;
+
+layout(binding = 0) uniform ViewsUBO {
+	CullView views[CULL_MAX_VIEWS];
+	uint viewCount;
+	uint instanceCount;
+	uint batchCount;
+	uint shadowInstanceBase;
+	uint shadowBatchBase;
+	uint instanceStride; // Per view stride of the visibility and visible instance buffers
+	uint drawStride; // Per view stride of the batch and culled command buffers
+	uint blockStride; // Per view stride of the block rank buffer
+} cull;
+
+layout(binding = 1) readonly buffer Transforms {
+    mat4 transform[];
+} model;
+
+// See InstanceData in Culling.hpp
+struct Instance {
+	uint transformIndex;
+	uint materialIndex;
+};
+
+layout(binding = 2) readonly buffer InstanceData {
+	Instance data[];
+} instances;
+
+layout(binding = 3) readonly buffer InstanceBounds {
+	vec4 sphere[];
+} bounds;
+
+layout(binding = 4) readonly buffer Batches {
+	DrawCommand cmd[];
+} batches;
+
+layout(binding = 5) buffer Visibility {
+	uint visible[];
+} visibility;
+
+layout(binding = 6) writeonly buffer VisibleInstances {
+	Instance data[];
+} visibleInstances;
+
+layout(binding = 7) buffer BatchCommands {
+	DrawCommand cmd[];
+} batchCommands;
+
+layout(binding = 8) writeonly buffer CulledCommands {
+	DrawCommand cmd[];
+} culledCommands;
+
+layout(binding = 9) writeonly buffer DrawCounts {
+	uint count[];
+} drawCounts;
+
+// Visible instances before each instance within its block of CULL_GROUP_SIZE
+layout(binding = 10) buffer InstanceRanks {
+	uint rank[];
+} instanceRanks;
+
+// Visible instances in each block, then after CULL_PASS_SCAN_BLOCKS visible instances before it
+layout(binding = 11) buffer BlockRanks {
+	uint rank[];
+} blockRanks;
+
+shared uint groupScan[CULL_GROUP_SIZE];
+
+// The camera sees instances and batches before the shadow bases, every other view sees the ones after
+uint rangeBegin(uint view, uint shadowBase)
+{
+	return view == CULL_VIEW_CAMERA ? 0 : shadowBase;
+}
+
+uint rangeEnd(uint view, uint shadowBase, uint count)
+{
+	return view == CULL_VIEW_CAMERA ? shadowBase : count;
+}
+
+float lengthSquared(vec3 v)
+{
+	precise float l = (v.x * v.x + v.y * v.y) + v.z * v.z;
+	return l;
+}
+
+/*
+	Same operations in the same order as the CPU reference in Culling.cpp, so the visibility is bit-exact with it.
+	Add and multiply are correctly rounded in Vulkan, but matrix products, dot() and sqrt are not specified that
+	tightly. Everything is written out term by term, precise stops the compiler fusing or reordering it, and the
+	radius is compared squared instead of taking a length
+*/
+bool sphereInView(uint view, mat4 transform, vec4 sphere)
+{
+	precise vec3 centre = ((transform[0].xyz * sphere.x + transform[1].xyz * sphere.y) + transform[2].xyz * sphere.z) + transform[3].xyz;
+	precise float scaleSquared = max(lengthSquared(transform[0].xyz), max(lengthSquared(transform[1].xyz), lengthSquared(transform[2].xyz)));
+	precise float radiusSquared = (sphere.w * sphere.w) * scaleSquared;
+
+	for (int i = 0; i < 6; ++i)
+	{
+		vec4 plane = cull.views[view].planes[i];
+		precise float distance = ((plane.x * centre.x + plane.y * centre.y) + plane.z * centre.z) + plane.w;
+		precise float distanceSquared = distance * distance;
+		if (distance < 0.0 && distanceSquared > radiusSquared)
+			return false;
+	}
+	return true;
+}
+
+/*
+	Exclusive prefix sum of value over the workgroup, total is the sum of all of them. Has to be reached by every
+	invocation of the workgroup
+*/
+uint groupExclusiveScan(uint value, out uint total)
+{
+	uint lane = gl_LocalInvocationID.x;
+	groupScan[lane] = value;
+	barrier();
+
+	for (uint offset = 1; offset < CULL_GROUP_SIZE; offset <<= 1)
+	{
+		uint add = lane >= offset ? groupScan[lane - offset] : 0u;
+		barrier();
+		groupScan[lane] += add;
+		barrier();
+	}
+
+	total = groupScan[CULL_GROUP_SIZE - 1];
+	uint rank = groupScan[lane] - value;
+	// groupScan is written again by the next call
+	barrier();
+	return rank;
+}
+
+// Visible instances of the view before instance, once CULL_PASS_SCAN_BLOCKS has run
+uint instanceRank(uint view, uint instance)
+{
+	return blockRanks.rank[view * cull.blockStride + instance / CULL_GROUP_SIZE] + instanceRanks.rank[view * cull.instanceStride + instance];
+}
+
+// Last batch in [begin, end) starting at or before instance, batches are in instance order
+uint findBatch(uint instance, uint begin, uint end)
+{
+	while (end - begin > 1)
+	{
+		uint middle = (begin + end) / 2;
+		if (batches.cmd[middle].firstInstance <= instance)
+			begin = middle;
+		else
+			end = middle;
+	}
+	return begin;
+}
+
+void main()
+{
+	uint x = gl_GlobalInvocationID.x;
+	uint view = gl_GlobalInvocationID.y;
+
+	// The view is the same for the whole workgroup, so returning on it keeps the scans' barriers in uniform control flow
+	if (pass.index == CULL_PASS_VISIBILITY)
+	{
+		if (view >= cull.viewCount)
+			return;
+
+		uint viewBase = view * cull.instanceStride;
+		bool inRange = x >= rangeBegin(view, cull.shadowInstanceBase) && x < rangeEnd(view, cull.shadowInstanceBase, cull.instanceCount);
+		uint visible = 0;
+
+		if (inRange)
+		{
+			uint transformIndex = instances.data[x].transformIndex;
+			visible = sphereInView(view, model.transform[transformIndex], bounds.sphere[x]) ? 1 : 0;
+			visibility.visible[viewBase + x] = visible;
+		}
+
+		// Instances outside the view's range count as culled
+		uint total;
+		uint rank = groupExclusiveScan(visible, total);
+		if (inRange)
+			instanceRanks.rank[viewBase + x] = rank;
+		if (gl_LocalInvocationID.x == 0)
+			blockRanks.rank[view * cull.blockStride + gl_WorkGroupID.x] = total;
+	}
+	else if (pass.index == CULL_PASS_SCAN_BLOCKS)
+	{
+		if (view >= cull.viewCount)
+			return;
+
+		// One workgroup per view, CULL_GROUP_SIZE blocks at a time
+		uint blockBase = view * cull.blockStride;
+		uint blockCount = (cull.instanceCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE;
+		uint carry = 0;
+
+		for (uint first = 0; first < blockCount; first += CULL_GROUP_SIZE)
+		{
+			uint b = first + gl_LocalInvocationID.x;
+			uint total;
+			uint rank = groupExclusiveScan(b < blockCount ? blockRanks.rank[blockBase + b] : 0u, total);
+			if (b < blockCount)
+				blockRanks.rank[blockBase + b] = carry + rank;
+			carry += total;
+		}
+	}
+	else if (pass.index == CULL_PASS_COMPACT_INSTANCES)
+	{
+		if (view >= cull.viewCount)
+			return;
+
+		uint viewBase = view * cull.instanceStride;
+		uint firstBatch = rangeBegin(view, cull.shadowBatchBase);
+		uint endBatch = rangeEnd(view, cull.shadowBatchBase, cull.batchCount);
+
+		// A visible instance goes to its rank among the visible ones of its batch, the order a walk over the batch
+		// would give, so the output is deterministic
+		if (x >= rangeBegin(view, cull.shadowInstanceBase) && x < rangeEnd(view, cull.shadowInstanceBase, cull.instanceCount) && visibility.visible[viewBase + x] != 0)
+		{
+			uint firstInstance = batches.cmd[findBatch(x, firstBatch, endBatch)].firstInstance;
+			visibleInstances.data[viewBase + firstInstance + instanceRank(view, x) - instanceRank(view, firstInstance)] = instances.data[x];
+		}
+
+		// x also indexes a batch, its visible count is the difference of the ranks at its ends
+		if (x >= firstBatch && x < endBatch)
+		{
+			DrawCommand batch = batches.cmd[x];
+			uint count = 0;
+
+			if (batch.instanceCount != 0)
+			{
+				uint last = batch.firstInstance + batch.instanceCount - 1;
+				count = instanceRank(view, last) + visibility.visible[viewBase + last] - instanceRank(view, batch.firstInstance);
+			}
+
+			batch.instanceCount = count;
+			batch.firstInstance += viewBase;
+			batchCommands.cmd[view * cull.drawStride + x] = batch;
+		}
+	}
+	else if (pass.index == CULL_PASS_COMPACT_DRAWS)
+	{
+		view = x;
+		if (view >= cull.viewCount)
+			return;
+
+		uint count = 0;
+		for (uint b = rangeBegin(view, cull.shadowBatchBase); b < rangeEnd(view, cull.shadowBatchBase, cull.batchCount); ++b)
+		{
+			DrawCommand batch = batchCommands.cmd[view * cull.drawStride + b];
+			if (batch.instanceCount != 0)
+			{
+				culledCommands.cmd[view * cull.drawStride + count] = batch;
+				++count;
+			}
+		}
+		drawCounts.count[view] = count;
+	}
+}
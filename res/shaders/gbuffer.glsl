@@ -1,5 +1,6 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : enable
 
 layout(binding = 0) uniform CameraUBO {
     mat4 view;
@@ -15,10 +16,20 @@ out gl_PerVertex {
     vec4 gl_Position;
 };
 
-layout(binding = 1) uniform TranformUBO {
-    mat4 transform[1000];
+layout(binding = 1) readonly buffer Transforms {
+    mat4 transform[];
 } model;
 
+// See InstanceData in Culling.hpp
+struct Instance {
+    uint transformIndex;
+    uint materialIndex;
+};
+
+layout(binding = 4) readonly buffer InstanceData {
+    Instance data[];
+} instances;
+
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inNormal;
 layout(location = 2) in vec2 inTexCoord;
@@ -31,8 +42,9 @@ layout(location = 4) out vec3 fragPos;
 
 void main() {
 
-	uint transformIndex = gl_InstanceIndex & 0x000FFFFF;
-	textureIndex = gl_InstanceIndex >> 20;
+	Instance instance = instances.data[gl_InstanceIndex];
+	uint transformIndex = instance.transformIndex;
+	textureIndex = instance.materialIndex;
 
     mat4 transform = model.transform[transformIndex];
 
@@ -51,7 +63,22 @@ void main() {
 
 #ifdef FRAGMENT ////////////////////////////////////////////////////
 
-layout(binding = 2) uniform sampler2D texSampler[1000];
+// Sized when the set is allocated (Renderer::materialTextureCapacity), only loaded materials' elements are written
+layout(set = 1, binding = 0) uniform sampler2D texSampler[];
+
+// See MaterialRecord in MaterialRecords.hpp, indexed by textureIndex / 2
+struct MaterialRecord {
+    vec3 colour;
+    float metallic;
+    float roughness;
+    uint textured;
+    vec2 PADDING;
+};
+
+// Grows with the materials, see Renderer::growMaterialRecordBuffer
+layout(std430, binding = 3) readonly buffer MaterialRecords {
+    MaterialRecord data[];
+} materials;
 
 layout(location = 0) in vec2 fragTexCoord;
 layout(location = 1) in vec3 fragNormal;
@@ -101,17 +128,35 @@ vec3 perturbNormal(vec3 N, vec3 V, vec2 texcoord, vec3 nTex)
 
 void main()
 {
-	vec4 albedoSpec = texture(texSampler[textureIndex], fragTexCoord);
-	vec4 normalRough = texture(texSampler[textureIndex+1], fragTexCoord);
-
-    colour = albedoSpec;
-    normal = encodeNormal(normalize(perturbNormal(normalize(fragNormal), normalize(viewVec), fragTexCoord, normalRough.xyz)));
-    //normal = encodeNormal(normalize(fragNormal));
-    //normal = encodeNormal(normalize(normalRough.xyz));
-
-    //colour = vec4(fragNormal,1.f);
-
-    pbr.x = normalRough.w; // Roughness
+	// Materials past the end of the buffer have not loaded yet, they are flat white like unloaded ones within it (see
+	// MaterialRecords::read)
+	uint recordIndex = textureIndex / 2;
+	MaterialRecord material = MaterialRecord(vec3(1.0), 0.0, 1.0, 0u, vec2(0.0));
+	if (recordIndex < uint(materials.data.length()))
+		material = materials.data[recordIndex];
+
+	// Flat materials skip the texture fetches, the branch is uniform across each draw
+	if (material.textured == 0)
+	{
+		colour = vec4(material.colour, material.metallic);
+		normal = encodeNormal(normalize(fragNormal));
+		pbr.x = material.roughness;
+	}
+	else
+	{
+		// Draws of different materials can share a subgroup in one multi draw
+		vec4 albedoSpec = texture(texSampler[nonuniformEXT(textureIndex)], fragTexCoord);
+		vec4 normalRough = texture(texSampler[nonuniformEXT(textureIndex+1)], fragTexCoord);
+
+		colour = albedoSpec;
+		normal = encodeNormal(normalize(perturbNormal(normalize(fragNormal), normalize(viewVec), fragTexCoord, normalRough.xyz)));
+		//normal = encodeNormal(normalize(fragNormal));
+		//normal = encodeNormal(normalize(normalRough.xyz));
+
+		//colour = vec4(fragNormal,1.f);
+
+		pbr.x = normalRough.w; // Roughness
+	}
 
 	const float C = 1.0;
 	const float far = 1000000.0;
@@ -13,7 +13,8 @@ layout(binding=4) uniform sampler2D gDepth;
 layout(binding=5) uniform samplerCube skybox;
 layout(binding=6, r8) uniform readonly image2D gSSAO;
 
-#define MAX_LIGHTS_PER_TILE 256
+// Specialized by the engine, see PBR_MAX_LIGHTS_PER_TILE
+layout(constant_id = 0) const uint MAX_LIGHTS_PER_TILE = 256;
 
 shared uint maxZ;
 shared uint minZ;
@@ -310,7 +311,8 @@ void main()
 		if(inFrustum)
 		{
 			uint nextTileLightIndex = atomicAdd(currentTilePointLightIndex,1);
-			tilePointLightIndices[nextTileLightIndex] = lightIndex;
+			if (nextTileLightIndex < MAX_LIGHTS_PER_TILE)
+				tilePointLightIndices[nextTileLightIndex] = lightIndex;
 		}
 	}
 
@@ -332,7 +334,8 @@ void main()
 		if (inFrustum)
 		{
 			uint nextTileLightIndex = atomicAdd(currentTileSpotLightIndex,1);
-			tileSpotLightIndices[nextTileLightIndex] = lightIndex;
+			if (nextTileLightIndex < MAX_LIGHTS_PER_TILE)
+				tileSpotLightIndices[nextTileLightIndex] = lightIndex;
 		}
 	}
 	// FRUSTUM CULLING -------------------------------------
@@ -371,7 +374,7 @@ void main()
 		vec3 F0 = vec3(0.04);
 		F0 = mix(F0, albedoSpec.rgb, metallic);
 
-		for(uint j = 0; j < currentTilePointLightIndex; ++j)
+		for(uint j = 0; j < min(currentTilePointLightIndex, MAX_LIGHTS_PER_TILE); ++j)
 		{
 			uint i = tilePointLightIndices[j];
 			vec4 lightPos = pointLights.data[i].posRad;
@@ -445,7 +448,7 @@ void main()
 			litPixel += (1.f - shadow) * ((kD * albedoSpec.rgb / PI + specular) * radiance * NdotL);
 		}
 
-		/*for(uint j = 0; j < currentTileSpotLightIndex; ++j)
+		/*for(uint j = 0; j < min(currentTileSpotLightIndex, MAX_LIGHTS_PER_TILE); ++j)
 		{
 			uint i = tileSpotLightIndices[j];
 			vec4 posRad = spotLights.data[i].posRad;
@@ -106,13 +106,23 @@ out gl_PerVertex {
 
 layout (location = 0) in vec3 p;
 
-layout(binding = 0) uniform TranformUBO {
-    mat4 transform[1000];
+layout(binding = 0) readonly buffer Transforms {
+    mat4 transform[];
 } model;
 
+// See InstanceData in Culling.hpp
+struct Instance {
+    uint transformIndex;
+    uint materialIndex;
+};
+
+layout(binding = 1) readonly buffer InstanceData {
+    Instance data[];
+} instances;
+
 void main()
 {
-	uint transformIndex = gl_InstanceIndex & 0x000FFFFF;
+	uint transformIndex = instances.data[gl_InstanceIndex].transformIndex;
 	mat4 transform = model.transform[transformIndex];
 	gl_Position = transform * vec4(p, 1.f);
 }
@@ -15,20 +15,33 @@ struct SpotLight
 	mat4 pv;
 };
 
-layout(binding = 0) uniform TranformUBO {
-    mat4 transform[1000];
+layout(binding = 0) readonly buffer Transforms {
+    mat4 transform[];
 } model;
 
 layout(binding = 1) uniform SpotLightBuffer {
 	SpotLight data[150];
 } spotLights;
 
+// See InstanceData in Culling.hpp
+struct Instance {
+    uint transformIndex;
+    uint materialIndex;
+};
+
+layout(binding = 2) readonly buffer InstanceData {
+    Instance data[];
+} instances;
+
+layout(push_constant) uniform Light {
+	uint index;
+} light;
+
 void main()
 {
-	uint transformIndex = gl_InstanceIndex & 0x000FFFFF;
+	uint transformIndex = instances.data[gl_InstanceIndex].transformIndex;
 	mat4 transform = model.transform[transformIndex];
-	uint lightIndex = gl_InstanceIndex >> 20;
-	gl_Position = spotLights.data[lightIndex].pv * transform * vec4(p, 1.f);
+	gl_Position = spotLights.data[light.index].pv * transform * vec4(p, 1.f);
 }
 
 #endif
@@ -36,12 +36,16 @@ void main()
 layout (location = 0) in vec2 TexCoord;
 layout (location = 0) out vec4 outColour;
 
-layout(binding = 0) uniform Config {
-    // Number of samples
-    int samples; // = 50
+// Specialized per pipeline by the engine so the sample loop has a constant bound, see Renderer::createSSAOVariant
+layout(constant_id = 0) const int SSAO_SAMPLES = 50;
+
+// Turns for samples, keep this and SSAO_SAMPLES coprime for best results
+layout(constant_id = 1) const int SSAO_SPIRAL_TURNS = 30;
 
-    // Turns for samples, keep this and 'samples' coprime for best results
-    int spiralTurns; // = 30 
+layout(binding = 0) uniform Config {
+    // Unused, specialized as SSAO_SAMPLES and SSAO_SPIRAL_TURNS
+    int samples;
+    int spiralTurns;
 
     // Height in pixels of a 1m object viewed from 1m away. Compute from projection matrix
     float projScale; // = 500
@@ -112,8 +116,8 @@ float LinearizeDepth(float depth)
 /** Returns a unit vector and a screen-space radius for the tap on a unit disk (the caller should scale by the actual disk radius) */
 vec2 tapLocation(int sampleNumber, float spinAngle, out float ssR){
     // Radius relative to ssR
-    float alpha = float(sampleNumber + 0.5) * (1.0 / float(config.samples));
-    float angle = alpha * (float(config.spiralTurns) * 6.28) + spinAngle;
+    float alpha = float(sampleNumber + 0.5) * (1.0 / float(SSAO_SAMPLES));
+    float angle = alpha * (float(SSAO_SPIRAL_TURNS) * 6.28) + spinAngle;
 
     ssR = alpha;
     return vec2(cos(angle), sin(angle));
@@ -243,11 +247,11 @@ void main() {
     //float ssDiskRadius =  projScale / C.z;
     
     float sum = 0.0;
-    for (int i = 0; i < config.samples; ++i) {
+    for (int i = 0; i < SSAO_SAMPLES; ++i) {
         sum += sampleAO(ssC, C, n_C, ssDiskRadius, i, randomPatternRotationAngle);
     }
 
-    float A = max(0.0, 1.0 - sum * config.intensity * (5.0 / float(config.samples)));
+    float A = max(0.0, 1.0 - sum * config.intensity * (5.0 / float(SSAO_SAMPLES)));
 
     // Bilateral box-filter over a quad for free, respecting depth edges
     // (the difference that this makes is subtle)
@@ -8,13 +8,23 @@ layout(push_constant) uniform Light {
 
 layout (location = 0) in vec3 p;
 
-layout(binding = 0) uniform TranformUBO {
-    mat4 transform[1000];
+layout(binding = 0) readonly buffer Transforms {
+    mat4 transform[];
 } model;
 
+// See InstanceData in Culling.hpp
+struct Instance {
+    uint transformIndex;
+    uint materialIndex;
+};
+
+layout(binding = 1) readonly buffer InstanceData {
+    Instance data[];
+} instances;
+
 void main()
 {
-	uint transformIndex = gl_InstanceIndex & 0x000FFFFF;
+	uint transformIndex = instances.data[gl_InstanceIndex].transformIndex;
 	mat4 transform = model.transform[transformIndex];
 	gl_Position = light.projView * transform * vec4(p, 1.f);
 	//gl_Position.z = -gl_Position.z;
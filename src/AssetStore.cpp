@@ -13,6 +13,28 @@ void AssetStore::cleanup()
 	}
 	for (auto& f : fonts)
 		f.second.cleanupGPU();
+	for (auto& m : models)
+	{
+		if (m.second.checkAvailability(Asset::ON_GPU))
+			m.second.cleanupGPU();
+	}
+}
+
+void AssetStore::unloadAsset(const std::string name)
+{
+	auto model = getModel(name);
+	if (!model)
+	{
+		DBG_WARNING("Unloading asset \"" << name << "\", only models can be unloaded");
+		return;
+	}
+
+	// The vertex/index ranges are the GPU worker's, they are released once no frame in flight draws the model.
+	// Instances keep pointing at the model and are not drawn until it is loaded again
+	Engine::threading->addGPUJob(new Job<>([model]() -> void {
+		if (model->checkAvailability(Asset::ON_GPU))
+			model->cleanupGPU();
+	}));
 }
 
 void AssetStore::loadAssets(std::string assetListFilePath)
@@ -335,55 +357,12 @@ void AssetStore::addMaterial(std::string name, glm::fvec3 albedo, float roughnes
 	u32 matIndex = materials.size();
 	materialIndices[name] = matIndex;
 
-	auto genTexName = name + "_generated_COL=(" + std::to_string(albedo.x) + "," + std::to_string(albedo.y) + "," + std::to_string(albedo.z) + ",R=" + std::to_string(roughness) + "),M=" + std::to_string(metal);
-
-	{
-		auto genTexNameAlbedoSpec = genTexName + "_AS";
-		auto& tex = textures.try_emplace(genTexNameAlbedoSpec).first->second;
-		TextureCreateInfo ci;
-		ci.genMipMaps = false;
-		ci.aspectFlags = VK_IMAGE_ASPECT_COLOR_BIT;
-		ci.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		ci.layers = 1;
-		ci.usageFlags = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-		ci.width = 1;
-		ci.height = 1;
-		u8 data[4];
-		data[0] = static_cast<u8>(albedo.x * 255.f);
-		data[1] = static_cast<u8>(albedo.y * 255.f);
-		data[2] = static_cast<u8>(albedo.z * 255.f);
-		data[3] = static_cast<u8>(metal * 255.f);
-		ci.pData = data;
-		ci.format = VK_FORMAT_R8G8B8A8_UNORM;
-
-		tex.loadToGPU(&ci);
-
-		materials[matIndex].data.textures.albedoSpec = &tex;
-	}
-	{
-		auto genTexNameNormalRough = genTexName + "_NR";
-		auto& tex = textures.try_emplace(genTexNameNormalRough).first->second;
-		TextureCreateInfo ci;
-		ci.genMipMaps = false;
-		ci.aspectFlags = VK_IMAGE_ASPECT_COLOR_BIT;
-		ci.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		ci.layers = 1;
-		ci.usageFlags = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-		ci.width = 1;
-		ci.height = 1;
-		u8 data[4];
-		data[0] = 128;
-		data[1] = 128;
-		data[2] = 255;
-		data[3] = static_cast<u8>(roughness * 255.f);
-		ci.pData = data;
-		ci.format = VK_FORMAT_R8G8B8A8_UNORM;
-
-		tex.loadToGPU(&ci);
-
-		materials[matIndex].data.textures.normalRough = &tex;
-	}
-
+	// Drawn by the gBuffer pass from its material record, no textures are generated
+	materials.try_emplace(matIndex, name);
+	materials[matIndex].flat = true;
+	materials[matIndex].data.pbrData.colour = albedo;
+	materials[matIndex].data.pbrData.metallic = metal;
+	materials[matIndex].data.pbrData.roughness = roughness;
 	materials[matIndex].gpuIndexBase = (materials.size() - 1) * 2;
 
 	Engine::threading->addMaterialMutex.unlock();
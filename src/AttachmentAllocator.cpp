@@ -0,0 +1,60 @@
+#include "PCH.hpp"
+#include "AttachmentAllocator.hpp"
+
+u32 AttachmentAllocator::place(u32 firstUse, u32 lastUse, u64 size, u64 alignment, u32 memoryTypeBits)
+{
+	placedSize += size;
+
+	// Smallest free slot that fits, otherwise the largest free one so it grows least
+	s32 best = -1;
+	for (u32 i = 0; i < slots.size(); ++i)
+	{
+		auto& slot = slots[i];
+		if (slot.lastUse >= firstUse || (slot.memoryTypeBits & memoryTypeBits) == 0)
+			continue;
+
+		if (best < 0)
+		{
+			best = s32(i);
+			continue;
+		}
+
+		u64 current = slots[best].size;
+		if (slot.size >= size)
+		{
+			if (current < size || slot.size < current)
+				best = s32(i);
+		}
+		else if (current < size && slot.size > current)
+		{
+			best = s32(i);
+		}
+	}
+
+	if (best < 0)
+	{
+		slots.push_back({ size, alignment, memoryTypeBits, lastUse });
+		return u32(slots.size() - 1);
+	}
+
+	auto& slot = slots[best];
+	slot.size = glm::max(slot.size, size);
+	slot.alignment = glm::max(slot.alignment, alignment);
+	slot.memoryTypeBits &= memoryTypeBits;
+	slot.lastUse = lastUse;
+	return u32(best);
+}
+
+void AttachmentAllocator::clear()
+{
+	slots.clear();
+	placedSize = 0;
+}
+
+u64 AttachmentAllocator::getSlotSize() const
+{
+	u64 total = 0;
+	for (auto& slot : slots)
+		total += slot.size;
+	return total;
+}
@@ -0,0 +1,122 @@
+#include "PCH.hpp"
+#include "BufferSubAllocator.hpp"
+
+void BufferSubAllocator::init(u64 pCapacity)
+{
+	capacity = pCapacity;
+	used = 0;
+	freeByOffset.clear();
+	freeBySize.clear();
+	allocations.clear();
+	addFreeRange(0, capacity);
+}
+
+u64 BufferSubAllocator::allocate(u64 size)
+{
+	if (size == 0)
+		return INVALID_OFFSET;
+
+	// Smallest free range that fits, ties go to the lowest offset
+	auto fit = freeBySize.lower_bound({ size, 0 });
+	if (fit == freeBySize.end())
+		return INVALID_OFFSET;
+
+	u64 offset = fit->second;
+	u64 rangeSize = fit->first;
+	removeFreeRange(freeByOffset.find(offset));
+
+	if (rangeSize > size)
+		addFreeRange(offset + size, rangeSize - size);
+
+	allocations[offset] = size;
+	used += size;
+	return offset;
+}
+
+void BufferSubAllocator::free(u64 offset)
+{
+	auto alloc = allocations.find(offset);
+	if (alloc == allocations.end())
+	{
+		DBG_WARNING("Freeing unallocated buffer range at " << offset);
+		return;
+	}
+
+	u64 size = alloc->second;
+	allocations.erase(alloc);
+	used -= size;
+
+	// Merge with the free ranges directly after and before
+	auto next = freeByOffset.lower_bound(offset);
+	if (next != freeByOffset.end() && next->first == offset + size)
+	{
+		size += next->second;
+		next = std::next(next);
+		removeFreeRange(std::prev(next));
+	}
+
+	if (next != freeByOffset.begin())
+	{
+		auto prev = std::prev(next);
+		if (prev->first + prev->second == offset)
+		{
+			offset = prev->first;
+			size += prev->second;
+			removeFreeRange(prev);
+		}
+	}
+
+	addFreeRange(offset, size);
+}
+
+std::vector<BufferSubAllocator::Move> BufferSubAllocator::compact(u64 maxSize)
+{
+	std::vector<Move> moves;
+	u64 moved = 0;
+
+	// Destinations are inserted before the iterator, they come up again but never find a lower range that fits
+	for (auto alloc = allocations.rbegin(); alloc != allocations.rend() && moved < maxSize; ++alloc)
+	{
+		u64 srcOffset = alloc->first;
+		u64 size = alloc->second;
+
+		auto range = freeByOffset.begin();
+		while (range != freeByOffset.end() && range->first < srcOffset && range->second < size)
+			++range;
+		if (range == freeByOffset.end() || range->first > srcOffset)
+			continue;
+
+		u64 dstOffset = range->first;
+		u64 rangeSize = range->second;
+		removeFreeRange(range);
+		if (rangeSize > size)
+			addFreeRange(dstOffset + size, rangeSize - size);
+
+		allocations[dstOffset] = size;
+		used += size;
+		moves.push_back({ srcOffset, dstOffset, size });
+		moved += size;
+	}
+
+	return moves;
+}
+
+float BufferSubAllocator::getFragmentation() const
+{
+	u64 freeSpace = capacity - used;
+	if (freeSpace == 0)
+		return 0.f;
+	return 1.f - float(getLargestFreeRange()) / float(freeSpace);
+}
+
+void BufferSubAllocator::addFreeRange(u64 offset, u64 size)
+{
+	freeByOffset[offset] = size;
+	freeBySize.insert({ size, offset });
+}
+
+void BufferSubAllocator::removeFreeRange(std::map<u64, u64>::iterator it)
+{
+	freeBySize.erase({ it->second, it->first });
+	freeByOffset.erase(it);
+}
@@ -11,6 +11,7 @@ Camera::Camera() : locked(false)
 	targetPos = glm::fvec3(0, 0, 0);
 	turnLerpFactor = 1.15;
 	moveLerpFactor = 3.f;
+	changeCount = 0;
 }
 
 void Camera::initialiseProj(float pAspect, float pFOV, float pNear, float pFar)
@@ -33,6 +34,7 @@ void Camera::recalculateProj()
 	//clip = glm::transpose(clip);
 	proj = clip * proj;
 	inverseProj = glm::inverse(proj);
+	++changeCount;
 
 	viewRays[0] = glm::fvec4(-1.f, -1.f, -1.f, 1.f);//BL
 	viewRays[1] = glm::fvec4(1.f, -1.f, -1.f, 1.f);//BR
@@ -60,7 +62,7 @@ glm::fvec3 Camera::getDirectionVector()
 
 void Camera::update()
 {
-
+	glm::fmat4 oldProjView = projView;
 
 	pos.x = ler(pos.x, targetPos.x, moveLerpFactor);
 	pos.y = ler(pos.y, targetPos.y, moveLerpFactor);
@@ -100,6 +102,9 @@ void Camera::update()
 	inverseView = glm::inverse(view);
 
 	projView = proj * view;
+
+	if (projView != oldProjView)
+		++changeCount;
 }
 
 void Camera::setFOV(float pFOV)
@@ -300,33 +300,13 @@ void Console::renderAtStartup()
 	auto& uiRenderer = renderer->uiRenderer;
 	auto& threading = Engine::threading;
 
-	finishedStartupRenderFence.reset();
-
 	window->processMessages();
 
 	uiRenderer.updateOverlayCommands();
+	renderer->submitUploadBatch();
 
-	std::vector<vdu::QueueSubmission> submissions(2);
-	
-	submissions[0].addCommands(&uiRenderer.commandBuffer);
-	submissions[0].addSignal(renderer->overlayFinishedSemaphore);
-
-	uint32_t imageIndex;
-	renderer->screenSwapchain.acquireNextImage(imageIndex, renderer->imageAvailableSemaphore);
-	
-	submissions[1].addWait(renderer->imageAvailableSemaphore, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
-	submissions[1].addWait(renderer->overlayFinishedSemaphore, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
-	submissions[1].addCommands(renderer->screenCommandBuffersForConsole.getHandle(imageIndex));
-	submissions[1].addSignal(renderer->screenFinishedSemaphore);
-
-	VK_CHECK_RESULT(renderer->lGraphicsQueue.submit(submissions, finishedStartupRenderFence));
-
-	vdu::QueuePresentation presentation;
-
-	presentation.addWait(renderer->screenFinishedSemaphore);
-	presentation.addSwapchain(renderer->screenSwapchain, imageIndex);
-
-	renderer->lGraphicsQueue.present(presentation);
+	// Rendering has not started yet, the console borrows the command buffers of the current frame slot
+	renderer->consoleGraph.execute(renderer->frameIndex, finishedStartupRenderFence);
 
 	renderer->lGraphicsQueue.waitIdle();
 
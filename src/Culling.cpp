@@ -0,0 +1,130 @@
+#include "PCH.hpp"
+#include "Culling.hpp"
+
+CullView CullView::fromProjView(const glm::fmat4& projView)
+{
+	// Gribb/Hartmann plane extraction, clip space depth is [0,1]
+	auto row = [&projView](int i) -> glm::fvec4 {
+		return glm::fvec4(projView[0][i], projView[1][i], projView[2][i], projView[3][i]);
+	};
+
+	CullView view;
+	view.planes[0] = row(3) + row(0); // Left
+	view.planes[1] = row(3) - row(0); // Right
+	view.planes[2] = row(3) + row(1); // Bottom
+	view.planes[3] = row(3) - row(1); // Top
+	view.planes[4] = row(2); // Near
+	view.planes[5] = row(3) - row(2); // Far
+
+	for (auto& p : view.planes)
+	{
+		float len = glm::length(glm::fvec3(p));
+		if (len > 0.f)
+			p /= len;
+	}
+
+	return view;
+}
+
+CullView CullView::fromSphere(glm::fvec3 centre, float radius)
+{
+	// Axis aligned box around the sphere, good enough for point light shadows
+	CullView view;
+	view.planes[0] = glm::fvec4(1, 0, 0, radius - centre.x);
+	view.planes[1] = glm::fvec4(-1, 0, 0, radius + centre.x);
+	view.planes[2] = glm::fvec4(0, 1, 0, radius - centre.y);
+	view.planes[3] = glm::fvec4(0, -1, 0, radius + centre.y);
+	view.planes[4] = glm::fvec4(0, 0, 1, radius - centre.z);
+	view.planes[5] = glm::fvec4(0, 0, -1, radius + centre.z);
+	return view;
+}
+
+// Written out term by term in the same order as cull.glsl, Culling.cpp is built without floating point contraction
+static float lengthSquared(const glm::fvec3& v)
+{
+	return (v.x * v.x + v.y * v.y) + v.z * v.z;
+}
+
+static bool sphereInView(const CullView& view, const glm::fmat4& transform, const glm::fvec4& bounds)
+{
+	glm::fvec3 centre;
+	for (int i = 0; i < 3; ++i)
+		centre[i] = ((transform[0][i] * bounds.x + transform[1][i] * bounds.y) + transform[2][i] * bounds.z) + transform[3][i];
+
+	float scaleSquared = glm::max(lengthSquared(glm::fvec3(transform[0])), glm::max(lengthSquared(glm::fvec3(transform[1])), lengthSquared(glm::fvec3(transform[2]))));
+	float radiusSquared = (bounds.w * bounds.w) * scaleSquared;
+
+	for (int i = 0; i < 6; ++i)
+	{
+		auto& plane = view.planes[i];
+		float distance = ((plane.x * centre.x + plane.y * centre.y) + plane.z * centre.z) + plane.w;
+		if (distance < 0.f && distance * distance > radiusSquared)
+			return false;
+	}
+	return true;
+}
+
+static u32 rangeBegin(u32 view, u32 shadowBase)
+{
+	return view == CULL_VIEW_CAMERA ? 0 : shadowBase;
+}
+
+static u32 rangeEnd(u32 view, u32 shadowBase, u32 count)
+{
+	return view == CULL_VIEW_CAMERA ? shadowBase : count;
+}
+
+void cullReference(const CullViewsUBOData& cull, const glm::fmat4* transforms, const InstanceData* instanceData, const glm::fvec4* instanceBounds,
+	const VkDrawIndexedIndirectCommand* batches, u32* visibility, InstanceData* visibleInstances, VkDrawIndexedIndirectCommand* batchCommands,
+	VkDrawIndexedIndirectCommand* culledCommands, u32* drawCounts)
+{
+	// CULL_PASS_VISIBILITY
+	for (u32 view = 0; view < cull.viewCount; ++view)
+	{
+		for (u32 i = rangeBegin(view, cull.shadowInstanceBase); i < rangeEnd(view, cull.shadowInstanceBase, cull.instanceCount); ++i)
+		{
+			u32 transformIndex = instanceData[i].transformIndex;
+			visibility[view * cull.instanceStride + i] = sphereInView(cull.views[view], transforms[transformIndex], instanceBounds[i]) ? 1 : 0;
+		}
+	}
+
+	// CULL_PASS_SCAN_BLOCKS and CULL_PASS_COMPACT_INSTANCES
+	for (u32 view = 0; view < cull.viewCount; ++view)
+	{
+		for (u32 b = rangeBegin(view, cull.shadowBatchBase); b < rangeEnd(view, cull.shadowBatchBase, cull.batchCount); ++b)
+		{
+			auto batch = batches[b];
+			u32 viewBase = view * cull.instanceStride;
+			u32 count = 0;
+
+			for (u32 i = batch.firstInstance; i < batch.firstInstance + batch.instanceCount; ++i)
+			{
+				if (visibility[viewBase + i] != 0)
+				{
+					visibleInstances[viewBase + batch.firstInstance + count] = instanceData[i];
+					++count;
+				}
+			}
+
+			batch.instanceCount = count;
+			batch.firstInstance += viewBase;
+			batchCommands[view * cull.drawStride + b] = batch;
+		}
+	}
+
+	// CULL_PASS_COMPACT_DRAWS
+	for (u32 view = 0; view < cull.viewCount; ++view)
+	{
+		u32 count = 0;
+		for (u32 b = rangeBegin(view, cull.shadowBatchBase); b < rangeEnd(view, cull.shadowBatchBase, cull.batchCount); ++b)
+		{
+			auto& batch = batchCommands[view * cull.drawStride + b];
+			if (batch.instanceCount != 0)
+			{
+				culledCommands[view * cull.drawStride + count] = batch;
+				++count;
+			}
+		}
+		drawCounts[view] = count;
+	}
+}
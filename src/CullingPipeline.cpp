@@ -0,0 +1,253 @@
+#include "PCH.hpp"
+#include "Renderer.hpp"
+
+void Renderer::createCullingDescriptorSetLayouts()
+{
+	auto& dsl = cullDescriptorSetLayout;
+
+	dsl.addBinding("views", vdu::DescriptorType::UniformBuffer, 0, 1, vdu::ShaderStage::Compute);
+	dsl.addBinding("transforms", vdu::DescriptorType::StorageBuffer, 1, 1, vdu::ShaderStage::Compute);
+	dsl.addBinding("instances", vdu::DescriptorType::StorageBuffer, 2, 1, vdu::ShaderStage::Compute);
+	dsl.addBinding("bounds", vdu::DescriptorType::StorageBuffer, 3, 1, vdu::ShaderStage::Compute);
+	dsl.addBinding("batches", vdu::DescriptorType::StorageBuffer, 4, 1, vdu::ShaderStage::Compute);
+	dsl.addBinding("visibility", vdu::DescriptorType::StorageBuffer, 5, 1, vdu::ShaderStage::Compute);
+	dsl.addBinding("visible_instances", vdu::DescriptorType::StorageBuffer, 6, 1, vdu::ShaderStage::Compute);
+	dsl.addBinding("batch_commands", vdu::DescriptorType::StorageBuffer, 7, 1, vdu::ShaderStage::Compute);
+	dsl.addBinding("culled_commands", vdu::DescriptorType::StorageBuffer, 8, 1, vdu::ShaderStage::Compute);
+	dsl.addBinding("draw_counts", vdu::DescriptorType::StorageBuffer, 9, 1, vdu::ShaderStage::Compute);
+	dsl.addBinding("instance_ranks", vdu::DescriptorType::StorageBuffer, 10, 1, vdu::ShaderStage::Compute);
+	dsl.addBinding("block_ranks", vdu::DescriptorType::StorageBuffer, 11, 1, vdu::ShaderStage::Compute);
+
+	dsl.create(&logicalDevice);
+}
+
+void Renderer::createCullingPipeline()
+{
+	cullPipelineLayout.addPushConstantRange({ VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(u32) });
+	cullPipelineLayout.addDescriptorSetLayout(&cullDescriptorSetLayout);
+	cullPipelineLayout.create(&logicalDevice);
+
+	cullPipeline.setShaderProgram(&cullShader);
+	cullPipeline.setPipelineLayout(cullPipelineLayout.getHandle());
+	cullPipeline.create(&logicalDevice, pipelineCache);
+}
+
+void Renderer::createCullingDescriptorSets()
+{
+	for (auto& set : cullDescriptorSet)
+		set.allocate(&logicalDevice, &cullDescriptorSetLayout, &descriptorPool);
+}
+
+void Renderer::updateCullingDescriptorSets()
+{
+	for (u32 i = 0; i < FRAMES_IN_FLIGHT; ++i)
+		updateCullingDescriptorSet(i);
+}
+
+void Renderer::updateCullingDescriptorSet(u32 frame)
+{
+	auto& set = cullDescriptorSet[frame];
+	auto updater = set.makeUpdater();
+
+	// The inputs are staged, the frame slot reads its own copies. The outputs are shared by every frame
+	auto viewsUpdate = updater->addBufferUpdate("views");
+	*viewsUpdate = { cullViewsUBO.getHandle(frame), 0, sizeof(CullViewsUBOData) };
+
+	auto transformsUpdate = updater->addBufferUpdate("transforms");
+	*transformsUpdate = { transformBuffer.getHandle(frame), 0, VK_WHOLE_SIZE };
+
+	auto instancesUpdate = updater->addBufferUpdate("instances");
+	*instancesUpdate = { instanceDataBuffer.getHandle(frame), 0, VK_WHOLE_SIZE };
+
+	auto boundsUpdate = updater->addBufferUpdate("bounds");
+	*boundsUpdate = { instanceBoundsBuffer.getHandle(frame), 0, VK_WHOLE_SIZE };
+
+	auto batchesUpdate = updater->addBufferUpdate("batches");
+	*batchesUpdate = { drawCmdBuffer.getHandle(frame), 0, VK_WHOLE_SIZE };
+
+	auto visibilityUpdate = updater->addBufferUpdate("visibility");
+	*visibilityUpdate = { visibilityBuffer.getHandle(), 0, VK_WHOLE_SIZE };
+
+	auto visibleInstancesUpdate = updater->addBufferUpdate("visible_instances");
+	*visibleInstancesUpdate = { visibleInstanceBuffer.getHandle(), 0, VK_WHOLE_SIZE };
+
+	auto batchCommandsUpdate = updater->addBufferUpdate("batch_commands");
+	*batchCommandsUpdate = { batchDrawCmdBuffer.getHandle(), 0, VK_WHOLE_SIZE };
+
+	auto culledCommandsUpdate = updater->addBufferUpdate("culled_commands");
+	*culledCommandsUpdate = { culledDrawCmdBuffer.getHandle(), 0, VK_WHOLE_SIZE };
+
+	auto drawCountsUpdate = updater->addBufferUpdate("draw_counts");
+	*drawCountsUpdate = { drawCountBuffer.getHandle(), 0, VK_WHOLE_SIZE };
+
+	auto instanceRanksUpdate = updater->addBufferUpdate("instance_ranks");
+	*instanceRanksUpdate = { instanceRankBuffer.getHandle(), 0, VK_WHOLE_SIZE };
+
+	auto blockRanksUpdate = updater->addBufferUpdate("block_ranks");
+	*blockRanksUpdate = { blockRankBuffer.getHandle(), 0, VK_WHOLE_SIZE };
+
+	set.submitUpdater(updater);
+	set.destroyUpdater(updater);
+}
+
+u32 Renderer::getPointLightCullView(u32 index)
+{
+	u32 view = CULL_VIEW_LIGHT_BASE + index;
+	return view < CULL_VIEW_ALL ? view : CULL_VIEW_ALL;
+}
+
+u32 Renderer::getSpotLightCullView(u32 index)
+{
+	u32 view = CULL_VIEW_LIGHT_BASE + (u32)lightManager.pointLights.size() + index;
+	return view < CULL_VIEW_ALL ? view : CULL_VIEW_ALL;
+}
+
+void Renderer::updateCullingViews()
+{
+	auto& views = cullViewsData.views;
+
+	views[CULL_VIEW_CAMERA] = CullView::fromProjView(Engine::camera.getProj() * Engine::camera.getView());
+
+	for (u32 i = 0; i < 3; ++i)
+		views[CULL_VIEW_SUN_BASE + i] = CullView::fromProjView(lightManager.sunLight.getProjView()[i]);
+
+	for (u32 i = 0; i < lightManager.pointLights.size(); ++i)
+	{
+		auto& l = lightManager.pointLights[i];
+		u32 view = getPointLightCullView(i);
+		if (view != CULL_VIEW_ALL)
+			views[view] = CullView::fromSphere(l.getPosition(), l.getRadius());
+	}
+
+	for (u32 i = 0; i < lightManager.spotLights.size(); ++i)
+	{
+		auto& l = lightManager.spotLights[i];
+		u32 view = getSpotLightCullView(i);
+		if (view != CULL_VIEW_ALL)
+			views[view] = CullView::fromProjView(l.getProjView());
+	}
+
+	// One view per light, the ones that did not fit share CULL_VIEW_ALL as the last view dispatched
+	u32 lightCount = u32(lightManager.pointLights.size() + lightManager.spotLights.size());
+	u32 lightViewsUsed = std::min(lightCount, u32(CULL_VIEW_ALL + 1 - CULL_VIEW_LIGHT_BASE));
+	cullViewsData.viewCount = CULL_VIEW_LIGHT_BASE + lightViewsUsed;
+
+	// CULL_VIEW_ALL accepts everything, slots past the live lights must not keep the planes of removed ones
+	for (u32 view = cullViewsData.viewCount; view < CULL_MAX_VIEWS; ++view)
+		for (auto& p : views[view].planes)
+			p = glm::fvec4(0.f);
+	for (auto& p : views[CULL_VIEW_ALL].planes)
+		p = glm::fvec4(0.f);
+
+	cullViewsData.instanceCount = drawInstanceCount;
+	cullViewsData.batchCount = drawCount;
+	cullViewsData.shadowInstanceBase = shadowInstanceBase;
+	cullViewsData.shadowBatchBase = shadowDrawBase;
+	cullViewsData.instanceStride = instanceCapacity;
+	cullViewsData.drawStride = drawCapacity;
+	cullViewsData.blockStride = getCullBlockCapacity();
+
+	void* data = stageFrameData(cullViewsUBO, 0, sizeof(CullViewsUBOData));
+	if (data)
+		memcpy(data, &cullViewsData, sizeof(CullViewsUBOData));
+}
+
+void Renderer::createCullingCommands()
+{
+	for (auto& cmd : cullCommandBuffer)
+		cmd.allocate(&logicalDevice, &commandPool);
+}
+
+void Renderer::updateCullingCommands()
+{
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+
+	auto cmd = cullCommandBuffer[frameIndex].getHandle();
+
+	// The render graph's barrier at the start of the pass waits for the previous frame's draws to finish reading our outputs
+	VK_CHECK_RESULT(vkBeginCommandBuffer(cmd, &beginInfo));
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline.getHandle());
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout.getHandle(), 0, 1, &cullDescriptorSet[frameIndex].getHandle(), 0, 0);
+
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+	auto groups = [](u32 count) -> u32 { return (count + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE; };
+
+	auto& c = cullViewsData;
+
+	u32 pass = CULL_PASS_VISIBILITY;
+	vkCmdPushConstants(cmd, cullPipelineLayout.getHandle(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(u32), &pass);
+	vkCmdDispatch(cmd, groups(c.instanceCount), c.viewCount, 1);
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	// A single workgroup per view scans the per block counts of the visibility pass
+	pass = CULL_PASS_SCAN_BLOCKS;
+	vkCmdPushConstants(cmd, cullPipelineLayout.getHandle(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(u32), &pass);
+	vkCmdDispatch(cmd, 1, c.viewCount, 1);
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	// One invocation per instance, and per batch for the batch commands
+	pass = CULL_PASS_COMPACT_INSTANCES;
+	vkCmdPushConstants(cmd, cullPipelineLayout.getHandle(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(u32), &pass);
+	vkCmdDispatch(cmd, groups(glm::max(c.instanceCount, c.batchCount)), c.viewCount, 1);
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	pass = CULL_PASS_COMPACT_DRAWS;
+	vkCmdPushConstants(cmd, cullPipelineLayout.getHandle(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(u32), &pass);
+	vkCmdDispatch(cmd, groups(c.viewCount), 1, 1);
+
+	// Later submissions on this queue (gBuffer and shadows) consume the compacted commands
+	barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	VK_CHECK_RESULT(vkEndCommandBuffer(cmd));
+}
+
+void Renderer::cmdDrawCulled(VkCommandBuffer cmd, u32 view)
+{
+	u32 firstBatch = view == CULL_VIEW_CAMERA ? 0 : shadowDrawBase;
+	u32 maxDraws = view == CULL_VIEW_CAMERA ? shadowDrawBase : drawCount - shadowDrawBase;
+
+	if (cmdDrawIndexedIndirectCount)
+	{
+		cmdDrawIndexedIndirectCount(cmd, culledDrawCmdBuffer.getHandle(), view * drawCapacity * sizeof(VkDrawIndexedIndirectCommand),
+			drawCountBuffer.getHandle(), view * sizeof(u32), maxDraws, sizeof(VkDrawIndexedIndirectCommand));
+	}
+	else
+	{
+		// Without VK_KHR_draw_indirect_count draw every batch of the view, fully culled batches have no instances
+		vkCmdDrawIndexedIndirect(cmd, batchDrawCmdBuffer.getHandle(), (view * drawCapacity + firstBatch) * sizeof(VkDrawIndexedIndirectCommand), maxDraws, sizeof(VkDrawIndexedIndirectCommand));
+	}
+}
+
+void Renderer::destroyCullingDescriptorSetLayouts()
+{
+	cullDescriptorSetLayout.destroy();
+}
+
+void Renderer::destroyCullingPipeline()
+{
+	cullPipelineLayout.destroy();
+	cullPipeline.destroy();
+}
+
+void Renderer::destroyCullingDescriptorSets()
+{
+	for (auto& set : cullDescriptorSet)
+		set.free();
+}
+
+void Renderer::destroyCullingCommands()
+{
+	for (auto& cmd : cullCommandBuffer)
+		cmd.free();
+}
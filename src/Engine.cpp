@@ -54,25 +54,28 @@ void Engine::start()
 	/*
 		Initialise worker threads (each one needs vulkan logical device before initialising its command pool)
 	*/
-	int numThreads = 0; // Extra threads to the 4 compulsory ones (MAIN thread, CPU thread, GPU submission thread, DISK IO thread)
+	// Extra threads to the 4 compulsory ones (MAIN thread, CPU thread, GPU submission thread, DISK IO thread), they record command buffers
+	int numThreads = std::max(static_cast<int>(std::thread::hardware_concurrency()) - 4, 1);
+	// Import-time mesh simplification runs on its own threads, one per generated LOD, so streaming never stalls recording
+	int numAssetThreads = MODEL_GENERATED_LOD_COUNT - 1;
 	waitForProfilerInitMutex.lock();
-	threading = new Threading(numThreads);
+	threading = new Threading(numThreads, numAssetThreads);
 
 	/*
 		Preallocating profiler tags to avoid thread clashes
 	*/
 	std::vector<std::string> profilerTags = { 
-		"init", "setuprender", "physics", "submitrender", "scripts", "qwaitidle", // CPU Tags
+		"init", "pipelinescold", "pipelineswarm", "shaders", "setuprender", "physics", "submitrender", "scripts", "qwaitidle", "culling", // CPU Tags
 		"shadowfence", "gbufferfence",
 
-		"gbuffer", "shadow", "pbr", "overlay", "screen", "commands", "cullingdrawbuffer", // GPU Tags
+		"cull", "gbuffer", "shadow", "ssao", "pbr", "overlay", "screen", "commands", "cullingdrawbuffer", // GPU Tags
 
 		"physmutex", "phystoenginemutex", "phystogpumutex", // Mutex tags
 		"transformmutex", "modeladdmutex"
 	};
 
 	int i = 0;
-	std::vector<std::thread::id> threadIDs(numThreads+4);
+	std::vector<std::thread::id> threadIDs(threading->m_workerThreads.size() + 1);
 	threadIDs[i] = std::this_thread::get_id(); // Main thread can use profiler
 	++i;
 	for (auto& thread : threading->m_workerThreads) {
@@ -166,9 +169,9 @@ void Engine::start()
 	*/
 
 	renderer->updateGBufferDescriptorSets();
-	renderer->updateGBufferNoTexDescriptorSets();
 	renderer->updateShadowDescriptorSets();
-	renderer->updatePBRDescriptorSets(renderer->usedGBuffer);
+	renderer->updateCullingDescriptorSets();
+	renderer->updatePBRDescriptorSets(renderer->gBufferAttachments);
 	renderer->updateSSAODescriptorSets();
 
 	initialised = 1;
@@ -224,7 +227,6 @@ void Engine::start()
 		renderer->updateScreenCommands();
 		renderer->updatePBRCommands();
 		renderer->updateGBufferCommands();
-		renderer->updateGBufferNoTexCommands();
 		renderer->updateShadowCommands(); // Mutex with engine model transform update
 		renderer->updateSSAOCommands();
 		renderer->uiRenderer.updateOverlayCommands(); // Mutex with any overlay additions/removals
@@ -309,7 +311,7 @@ void Engine::eventLoop()
 		case(Event::WindowResized):
 		{
 			auto consoleSizeUpdateJobFunc = std::bind([](Console* cons) -> void {
-				renderer->gBufferGroupFence.wait();
+				renderer->waitForAllFrames();
 				console->setResolution(glm::ivec2(Engine::window->resX, 276));
 				console->postMessage("Window resized", glm::fvec3(0.2, 0.9, 0.2));
 			}, console);
@@ -481,6 +483,7 @@ void Engine::updatePerformanceStatsDisplay()
 		"---------------------------------------------------\n" +
 		"User input     : " + std::to_string(msgTime) + "ms ( " + std::to_string(msgTimeMin) + " \\ " + std::to_string(msgTimeMax) + " )\n" +
 		"Commands       : " + std::to_string(cmdsTime) + "ms ( " + std::to_string(cmdsTimeMin) + " \\ " + std::to_string(cmdsTimeMax) + " )\n" +
+		"Re-recorded    : " + std::to_string(renderer->lastReRecordedCommands) + " command buffers last frame\n" +
 		"Culling & draw : " + std::to_string(cullTime) + "ms ( " + std::to_string(cullTimeMin) + " \\ " + std::to_string(cullTimeMax) + " )\n" +
 		"Queue submit   : " + std::to_string(submitTime) + "ms ( " + std::to_string(submitTimeMin) + " \\ " + std::to_string(submitTimeMax) + " )\n" +
 		"Queue idle     : " + std::to_string(qWaitTime) + "ms ( " + std::to_string(qWaitTimeMin) + " \\ " + std::to_string(qWaitTimeMax) + " )\n" +
@@ -599,6 +602,8 @@ void Engine::createVulkanInstance()
 	vulkanInstance.addExtension(VK_KHR_SURFACE_EXTENSION_NAME);
 	vulkanInstance.addExtension(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
 	vulkanInstance.addExtension(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
+	// Extension features and limits of the physical device, see Renderer::createLogicalDevice
+	vulkanInstance.addExtension(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
 #ifdef ENABLE_VULKAN_VALIDATION
 	vulkanInstance.addDebugReportLevel(vdu::Instance::DebugReportLevel::Warning);
 	vulkanInstance.addDebugReportLevel(vdu::Instance::DebugReportLevel::Error);
@@ -624,6 +629,7 @@ void Engine::queryVulkanPhysicalDeviceDetails()
 void Engine::quit()
 {
 	DBG_INFO("Exiting");
+	threading->wakeWorkers();
 	for (auto t : threading->m_workerThreads)
 	{
 		if (t)
@@ -656,7 +662,6 @@ World Engine::world;
 AssetStore Engine::assets;
 float Engine::maxDepth;
 std::mt19937_64 Engine::rand;
-u64 Engine::gpuTimeStamps[Renderer::NUM_GPU_TIMESTAMPS];
 UIElementGroup* Engine::uiGroup;
 Console* Engine::console;
 Time Engine::frameTime(0);
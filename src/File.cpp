@@ -5,8 +5,10 @@
 
 bool File::create(std::string && pPath, Mode pFileMode)
 {
-	if (pPath.length() > 127)
+	if (pPath.length() > 127){
+		DBG_WARNING("Path too large");
 		return false;
+	}
 	meta.path = pPath;
 	meta.fileMode = pFileMode;
 
@@ -18,9 +20,11 @@ bool File::create(Mode pFileMode)
 	if (meta.path.length() == 0)
 		return false;
 
+	meta.path = Engine::workingDirectory + meta.path;
 	meta.fileMode = pFileMode;
 
 	file.open(meta.path.c_str(), (std::ios_base::openmode)meta.fileMode);
+	return file.is_open();
 }
 
 bool File::open(std::string && pPath, Mode pFileMode)
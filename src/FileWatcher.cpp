@@ -0,0 +1,72 @@
+#include "PCH.hpp"
+#include "FileWatcher.hpp"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+bool FileWatcher::create(const std::string& directory)
+{
+#ifdef __linux__
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0)
+	{
+		DBG_WARNING("Could not create an inotify instance, " << directory << " is not watched");
+		return false;
+	}
+
+	watch = inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+	if (watch < 0)
+	{
+		DBG_WARNING("Could not watch " << directory);
+		destroy();
+		return false;
+	}
+
+	return true;
+#else
+	DBG_WARNING("File watching is not supported on this platform, " << directory << " is not watched");
+	return false;
+#endif
+}
+
+void FileWatcher::destroy()
+{
+#ifdef __linux__
+	// Closing the instance removes its watch
+	if (fd >= 0)
+		close(fd);
+#endif
+	fd = -1;
+	watch = -1;
+}
+
+void FileWatcher::poll(std::vector<std::string>& changedFiles)
+{
+#ifdef __linux__
+	if (fd < 0)
+		return;
+
+	alignas(inotify_event) char buffer[4096];
+	while (true)
+	{
+		// Fails with EAGAIN once every queued event has been read
+		ssize_t length = read(fd, buffer, sizeof(buffer));
+		if (length <= 0)
+			break;
+
+		for (char* ptr = buffer; ptr < buffer + length;)
+		{
+			auto event = reinterpret_cast<inotify_event*>(ptr);
+			ptr += sizeof(inotify_event) + event->len;
+
+			if (!event->len || (event->mask & IN_ISDIR))
+				continue;
+
+			std::string name(event->name);
+			if (std::find(changedFiles.begin(), changedFiles.end(), name) == changedFiles.end())
+				changedFiles.push_back(name);
+		}
+	}
+#endif
+}
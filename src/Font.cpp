@@ -98,8 +98,6 @@ void GlyphContainer::load(u16 pCharSize, FT_Face pFace)
 
 	const int storeResolutionX = 12;
 
-	VkDeviceSize totalGlyphSetTexSize = 0;
-
 	for (char i = 0; i < NO_PRINTABLE_CHARS; ++i)
 	{
 		int x = i % storeResolutionX;
@@ -143,12 +141,19 @@ void GlyphContainer::load(u16 pCharSize, FT_Face pFace)
 		chars[i].m_data.resize(sizeAligned);
 		memcpy(chars[i].m_data.data(), pFace->glyph->bitmap.buffer, size);
 
-		totalGlyphSetTexSize += chars[i].m_data.size();
-
 		xOffset += sizes[i].x;
 	}
 
 	maxYSize += lineYSize;
+	maxXSize = lineXSize > maxXSize ? lineXSize : maxXSize;
+
+	// Pack the glyphs into one atlas so the whole texture is copied in one region
+	std::vector<u8> atlas(maxXSize * maxYSize, 0);
+	for (int i = 1; i < NO_PRINTABLE_CHARS; ++i)
+	{
+		for (int row = 0; row < sizes[i].y; ++row)
+			memcpy(&atlas[(coords[i].y + row) * maxXSize + coords[i].x], &chars[i].m_data[row * sizes[i].x], sizes[i].x);
+	}
 
 	TextureCreateInfo ci = {};
 	ci.aspectFlags = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -156,9 +161,11 @@ void GlyphContainer::load(u16 pCharSize, FT_Face pFace)
 	ci.genMipMaps = false;
 	ci.height = maxYSize;
 	ci.width = maxXSize;
-	ci.layout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	/// TODO: LAYOUT_GENERAL not necessary, need to properly handle all image layouts and transitions throughout Engine
+	ci.layout = VK_IMAGE_LAYOUT_GENERAL;
 	ci.layers = 1;
 	ci.usageFlags = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	ci.pData = atlas.data();
 
 	glyphs = new Texture;
 
@@ -171,68 +178,6 @@ void GlyphContainer::load(u16 pCharSize, FT_Face pFace)
 	/// TODO: provide mechanism for checking whether specific job finished (+ wait until finish)
 	Engine::threading->m_gpuWorker->waitForAllJobsToFinish();
 
-	const auto& r = Engine::renderer;
-
-	auto stagingBuffer = new vdu::Buffer;
-	stagingBuffer->createStaging(&r->logicalDevice, totalGlyphSetTexSize);
-
-	VkDeviceSize copyOffset = 0;
-	void* data = stagingBuffer->getMemory()->map(0, totalGlyphSetTexSize);
-	for (int i = 1; i < NO_PRINTABLE_CHARS; ++i)
-	{
-		char* dst = (char*)data; dst += copyOffset;
-		memcpy(dst, chars[i].m_data.data(), (size_t)chars[i].m_data.size());
-		copyOffset += chars[i].m_data.size();
-	}
-
-	stagingBuffer->getMemory()->unmap();
-
-	auto cmd = new vdu::CommandBuffer;
-	r->beginTransferCommands(*cmd);
-
-	copyOffset = 0;
-	for (int i = 1; i < NO_PRINTABLE_CHARS; ++i)
-	{
-		VkOffset3D offset = { coords[i].x, coords[i].y, 0 };
-		VkExtent3D extent = { sizes[i].x, sizes[i].y, 1 };
-
-		VkBufferImageCopy region = {};
-		region.bufferOffset = copyOffset;
-		region.bufferRowLength = 0;
-		region.bufferImageHeight = 0;
-		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		region.imageSubresource.mipLevel = 0;
-		region.imageSubresource.baseArrayLayer = 0;
-		region.imageSubresource.layerCount = 1;
-		region.imageOffset = offset;
-		region.imageExtent = extent;
-
-		vkCmdCopyBufferToImage(cmd->getHandle(), stagingBuffer->getHandle(), glyphs->getHandle(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-		copyOffset += chars[i].m_data.size();
-	}
-
-	auto fence = new vdu::Fence();
-	fence->create(&r->logicalDevice);
-
-	/// TODO: LAYOUT_GENERAL not necessary, need to properly handle all image layouts and transitions throughout Engine
-	r->setImageLayout(cmd, *glyphs, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
-
-	vdu::QueueSubmission submission;
-	r->endTransferCommands(*cmd, submission);
-
-	VK_CHECK_RESULT(r->lTransferQueue.submit(submission, *fence));
-
-	// Once the all GPU operations are done, the fence is signalled, and we can free the command and data buffers
-	r->addFenceDelayedAction(fence, std::bind([](vdu::CommandBuffer* cmd, vdu::Buffer* stagingBuffer, vdu::Fence* fe) -> void {
-		cmd->free();
-		stagingBuffer->destroy();
-		fe->destroy();
-		delete cmd;
-		delete stagingBuffer;
-		delete fe;
-	}, cmd, stagingBuffer, fence));
-
 	height = pFace->size->metrics.height >> 6;
 	ascender = pFace->size->metrics.ascender >> 6;
 }
@@ -11,6 +11,7 @@ void Renderer::createGBufferAttachments()
 	tci.format = VK_FORMAT_R8G8B8A8_UNORM;
 	tci.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 	tci.usageFlags = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+	tci.aliased = true;
 
 	/// Attachment (1) - Albedo RGB colour
 	gBufferColourAttachment.loadToGPU(&tci);
@@ -69,26 +70,56 @@ void Renderer::createGBufferDescriptorSetLayouts()
 	auto& dsl = gBufferDescriptorSetLayout;
 
 	dsl.addBinding("camera", vdu::DescriptorType::UniformBuffer, 0, 1, vdu::ShaderStage::Vertex | vdu::ShaderStage::Fragment);
-	dsl.addBinding("transforms", vdu::DescriptorType::UniformBuffer, 1, 1, vdu::ShaderStage::Vertex);
-	dsl.addBinding("textures", vdu::DescriptorType::CombinedImageSampler, 2, 1000, vdu::ShaderStage::Fragment);
-	dsl.addBinding("pbrdata", vdu::DescriptorType::UniformBuffer, 3, 100, vdu::ShaderStage::Fragment);
+	dsl.addBinding("transforms", vdu::DescriptorType::StorageBuffer, 1, 1, vdu::ShaderStage::Vertex);
+	dsl.addBinding("materials", vdu::DescriptorType::StorageBuffer, 3, 1, vdu::ShaderStage::Fragment);
+	dsl.addBinding("instances", vdu::DescriptorType::StorageBuffer, 4, 1, vdu::ShaderStage::Vertex);
 
 	dsl.create(&logicalDevice);
+
+	// Set 1, the material texture array
+	VkDescriptorSetLayoutBinding textures = {};
+	textures.binding = 0;
+	textures.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	textures.descriptorCount = materialTextureCapacity; // Upper bound, the sets are allocated with their count
+	textures.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	VkDescriptorBindingFlagsEXT textureFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT |
+		VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT_EXT;
+
+	VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlags = {};
+	bindingFlags.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+	bindingFlags.bindingCount = 1;
+	bindingFlags.pBindingFlags = &textureFlags;
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.pNext = &bindingFlags;
+	layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+	layoutInfo.bindingCount = 1;
+	layoutInfo.pBindings = &textures;
+
+	VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &materialTextureSetLayout));
 }
 
 void Renderer::createGBufferPipeline()
 {
-	gBufferPipelineLayout.addDescriptorSetLayout(&gBufferDescriptorSetLayout);
-	gBufferPipelineLayout.create(&logicalDevice);
+	VkDescriptorSetLayout setLayouts[] = { gBufferDescriptorSetLayout.getHandle(), materialTextureSetLayout };
+
+	VkPipelineLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	layoutInfo.setLayoutCount = 2;
+	layoutInfo.pSetLayouts = setLayouts;
+
+	VK_CHECK_RESULT(vkCreatePipelineLayout(device, &layoutInfo, nullptr, &gBufferPipelineLayout));
 
 	gBufferPipeline.addViewport({ 0.f, 0.f, (float)renderResolution.width, (float)renderResolution.height, 0.f, 1.f }, { 0, 0, renderResolution.width, renderResolution.height });
 	gBufferPipeline.setVertexInputState(&defaultVertexInputState);
 	gBufferPipeline.setShaderProgram(&gBufferShader);
-	gBufferPipeline.setPipelineLayout(&gBufferPipelineLayout);
-	gBufferPipeline.setRenderPass(&gBufferRenderPass);
+	gBufferPipeline.setPipelineLayout(gBufferPipelineLayout);
+	gBufferPipeline.setRenderPass(gBufferRenderPass.getHandle(), 3);
 	gBufferPipeline.setMaxDepthBounds(Engine::maxDepth);
 	gBufferPipeline.setCullMode(VK_CULL_MODE_BACK_BIT);
-	gBufferPipeline.create(&logicalDevice);
+	gBufferPipeline.create(&logicalDevice, pipelineCache);
 }
 
 void Renderer::createGBufferFramebuffers()
@@ -103,7 +134,44 @@ void Renderer::createGBufferFramebuffers()
 
 void Renderer::createGBufferDescriptorSets()
 {
-	gBufferDescriptorSet.allocate(&logicalDevice, &gBufferDescriptorSetLayout, &descriptorPool);
+	for (auto& set : gBufferDescriptorSet)
+		set.allocate(&logicalDevice, &gBufferDescriptorSetLayout, &descriptorPool);
+
+	// Nothing is written until materials load, partially bound elements that are never read may stay empty
+	std::array<VkDescriptorSetLayout, FRAMES_IN_FLIGHT> layouts;
+	std::array<u32, FRAMES_IN_FLIGHT> counts;
+	layouts.fill(materialTextureSetLayout);
+	counts.fill(materialTextureCapacity);
+
+	VkDescriptorSetVariableDescriptorCountAllocateInfoEXT countInfo = {};
+	countInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO_EXT;
+	countInfo.descriptorSetCount = FRAMES_IN_FLIGHT;
+	countInfo.pDescriptorCounts = counts.data();
+
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.pNext = &countInfo;
+	allocInfo.descriptorPool = materialTexturePool;
+	allocInfo.descriptorSetCount = FRAMES_IN_FLIGHT;
+	allocInfo.pSetLayouts = layouts.data();
+
+	VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, materialTextureSet));
+}
+
+void Renderer::createMaterialTexturePool()
+{
+	VkDescriptorPoolSize poolSize = {};
+	poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSize.descriptorCount = materialTextureCapacity * FRAMES_IN_FLIGHT;
+
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+	poolInfo.maxSets = FRAMES_IN_FLIGHT;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+
+	VK_CHECK_RESULT(vkCreateDescriptorPool(device, &poolInfo, nullptr, &materialTexturePool));
 }
 
 void Renderer::updateGBufferDescriptorSets()
@@ -112,64 +180,61 @@ void Renderer::updateGBufferDescriptorSets()
 		return;
 
 	gBufferDescriptorSetNeedsUpdate = false;
-	gBufferCmdsNeedUpdate = true;
+	invalidateCommands(GBuffer_Descriptors_Input);
 
 	Engine::console->postMessage("Updating gBuffer descriptor set!", glm::fvec3(0.1, 0.1, 0.9));
 
-	auto updater = gBufferDescriptorSet.makeUpdater();
-
-	auto cameraUpdate = updater->addBufferUpdate("camera");
+	// Each frame slot's set reads that slot's copies of the staged buffers
+	for (u32 i = 0; i < FRAMES_IN_FLIGHT; ++i)
+	{
+		auto& set = gBufferDescriptorSet[i];
 
-	cameraUpdate->buffer = cameraUBO.getHandle();
-	cameraUpdate->offset = 0;
-	cameraUpdate->range = VK_WHOLE_SIZE;
+		auto updater = set.makeUpdater();
 
-	auto transformsUpdate = updater->addBufferUpdate("transforms");
+		auto cameraUpdate = updater->addBufferUpdate("camera");
 
-	transformsUpdate->buffer = transformUBO.getHandle();
-	transformsUpdate->offset = 0;
-	transformsUpdate->range = 60000;
+		cameraUpdate->buffer = cameraUBO.getHandle(i);
+		cameraUpdate->offset = 0;
+		cameraUpdate->range = VK_WHOLE_SIZE;
 
-	auto texturesUpdate = updater->addImageUpdate("textures", 0, 1000);
+		auto transformsUpdate = updater->addBufferUpdate("transforms");
 
-	for (u32 i = 0; i < 1000; ++i)
-	{
-		texturesUpdate[i].sampler = textureSampler;
-		texturesUpdate[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-		texturesUpdate[i].imageView = Engine::assets.getTexture("blank")->getView();
-	}
+		transformsUpdate->buffer = transformBuffer.getHandle(i);
+		transformsUpdate->offset = 0;
+		transformsUpdate->range = VK_WHOLE_SIZE;
 
-	auto pbrUpdate = updater->addBufferUpdate("pbrdata", 0);
+		auto materialsUpdate = updater->addBufferUpdate("materials");
+		*materialsUpdate = { materialRecordBuffer.getHandle(i), 0, VK_WHOLE_SIZE };
 
-	*pbrUpdate = { flatPBRUBO.getHandle(), 0, sizeof(glm::fvec4) * 2 * 100 };
+		auto instancesUpdate = updater->addBufferUpdate("instances");
+		*instancesUpdate = { visibleInstanceBuffer.getHandle(), 0, VK_WHOLE_SIZE };
 
-	gBufferDescriptorSet.submitUpdater(updater);
-	gBufferDescriptorSet.destroyUpdater(updater);
+		set.submitUpdater(updater);
+		set.destroyUpdater(updater);
+	}
 }
 
 void Renderer::createGBufferCommands()
 {
-	gBufferCommandBuffer.allocate(&logicalDevice, &commandPool);
+	for (auto& cmd : gBufferCommandBuffer)
+		cmd.allocate(&logicalDevice, &commandPool);
+	gBufferCommands.markStale();
 }
 
 void Renderer::updateGBufferCommands()
 {
-	// We need to update gBuffer commands when:
-	//	A new model instance was added
-	//	A gBuffer descriptor set was updated
-
-	if (!gBufferCmdsNeedUpdate)
+	// Only consumes the indirect draw buffers, so it is re-recorded when one of gBufferCommands' inputs changed
+	// or the command buffers were reallocated, each frame's copy when its frame comes up again
+	if (!needsRecording(gBufferCommands))
 		return;
 
-	gBufferCmdsNeedUpdate = false;
-
 	//bufferFreeMutex.lock();
 	//gBufferCommandBuffer.reset();
 	//bufferFreeMutex.unlock();
 
 	//createGBufferCommands();
 
-	auto cmd = gBufferCommandBuffer.getHandle();
+	auto cmd = gBufferCommandBuffer[frameIndex].getHandle();
 
 	VkCommandBufferBeginInfo beginInfo = {};
 	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
@@ -177,9 +242,6 @@ void Renderer::updateGBufferCommands()
 
 	VK_CHECK_RESULT(vkBeginCommandBuffer(cmd, &beginInfo));
 
-	queryPool.cmdReset(cmd);
-	queryPool.cmdTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, BEGIN_GBUFFER);
-
 	VkRenderPassBeginInfo renderPassInfo = {};
 	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
 	renderPassInfo.renderPass = gBufferRenderPass.getHandle();
@@ -200,19 +262,18 @@ void Renderer::updateGBufferCommands()
 
 	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, gBufferPipeline.getHandle());
 
-	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, gBufferPipelineLayout.getHandle(), 0, 1, &gBufferDescriptorSet.getHandle(), 0, nullptr);
+	VkDescriptorSet sets[] = { gBufferDescriptorSet[frameIndex].getHandle(), materialTextureSet[frameIndex] };
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, gBufferPipelineLayout, 0, 2, sets, 0, nullptr);
 
 	VkBuffer vertexBuffers[] = { vertexIndexBuffer.getHandle() };
 	VkDeviceSize offsets[] = { 0 };
 	vkCmdBindVertexBuffers(cmd, 0, 1, vertexBuffers, offsets);
 	vkCmdBindIndexBuffer(cmd, vertexIndexBuffer.getHandle(), INDEX_BUFFER_BASE, VK_INDEX_TYPE_UINT32);
 
-	vkCmdDrawIndexedIndirect(cmd, drawCmdBuffer.getHandle(), 0, Engine::world.instancesToDraw.size(), sizeof(VkDrawIndexedIndirectCommand));
+	cmdDrawCulled(cmd, CULL_VIEW_CAMERA);
 
 	vkCmdEndRenderPass(cmd);
 
-	queryPool.cmdTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, END_GBUFFER);
-
 	VK_CHECK_RESULT(vkEndCommandBuffer(cmd));
 }
 
@@ -232,11 +293,14 @@ void Renderer::destroyGBufferRenderPass()
 void Renderer::destroyGBufferDescriptorSetLayouts()
 {
 	gBufferDescriptorSetLayout.destroy();
+	vkDestroyDescriptorSetLayout(device, materialTextureSetLayout, nullptr);
+	materialTextureSetLayout = VK_NULL_HANDLE;
 }
 
 void Renderer::destroyGBufferPipeline()
 {
-	gBufferPipelineLayout.destroy();
+	vkDestroyPipelineLayout(device, gBufferPipelineLayout, nullptr);
+	gBufferPipelineLayout = VK_NULL_HANDLE;
 	gBufferPipeline.destroy();
 }
 
@@ -247,10 +311,21 @@ void Renderer::destroyGBufferFramebuffers()
 
 void Renderer::destroyGBufferDescriptorSets()
 {
-	gBufferDescriptorSet.free();
+	for (auto& set : gBufferDescriptorSet)
+		set.free();
+
+	// The pool wasn't created freeable, resetting it frees the sets
+	vkResetDescriptorPool(device, materialTexturePool, 0);
+}
+
+void Renderer::destroyMaterialTexturePool()
+{
+	vkDestroyDescriptorPool(device, materialTexturePool, nullptr);
+	materialTexturePool = VK_NULL_HANDLE;
 }
 
 void Renderer::destroyGBufferCommands()
 {
-	gBufferCommandBuffer.free();
+	for (auto& cmd : gBufferCommandBuffer)
+		cmd.free();
 }
@@ -0,0 +1,350 @@
+#include "PCH.hpp"
+#include "GPUAllocator.hpp"
+#include "Engine.hpp"
+
+namespace
+{
+	// Index of the smallest power of two size class that holds size
+	u32 sizeClassIndex(VkDeviceSize size)
+	{
+		u32 index = 0;
+		for (VkDeviceSize classSize = GPU_ALLOCATION_GRANULARITY; classSize < size; classSize <<= 1)
+			++index;
+		return index;
+	}
+
+	VkDeviceSize sizeClassSize(u32 index)
+	{
+		return GPU_ALLOCATION_GRANULARITY << index;
+	}
+}
+
+void GPUAllocator::create(vdu::LogicalDevice* logicalDevice)
+{
+	device = logicalDevice->getHandle();
+	vkGetPhysicalDeviceMemoryProperties(Engine::physicalDevice->getHandle(), &memoryProperties);
+	pools.resize(memoryProperties.memoryTypeCount);
+	deviceMemoryCount = 0;
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(Engine::physicalDevice->getHandle(), &properties);
+	bufferImageGranularity = properties.limits.bufferImageGranularity;
+}
+
+void GPUAllocator::destroy()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for (u32 i = 0; i < pools.size(); ++i)
+	{
+		auto& pool = pools[i];
+
+		if (pool.dedicatedCount > 0)
+			DBG_WARNING(pool.dedicatedCount << " dedicated allocations of memory type " << i << " were never freed");
+
+		for (auto& block : pool.blocks)
+		{
+			// Slabs hold their range until they are freed, so they are not counted as leaks
+			u32 slabCount = 0;
+			for (auto& sizeClass : pool.sizeClasses)
+				for (auto& slab : sizeClass.slabs)
+					slabCount += slab.backing.owner == &block;
+
+			if (block.ranges.getAllocationCount() > slabCount)
+				DBG_WARNING(block.ranges.getAllocationCount() - slabCount << " allocations of memory type " << i << " were never freed");
+
+			freeDeviceMemory(block.memory, block.mapped);
+		}
+	}
+
+	pools.clear();
+}
+
+GPUAllocation GPUAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool dedicated)
+{
+	s32 memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+	if (memoryType < 0)
+	{
+		DBG_SEVERE("No memory type with properties " << properties << " for a " << requirements.size << " byte allocation");
+		return GPUAllocation();
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (dedicated || requirements.size >= GPU_DEDICATED_THRESHOLD)
+		return allocateDedicated(memoryType, requirements.size);
+
+	// Size classes are aligned to their own size, so they cover any alignment up to it
+	VkDeviceSize classSize = glm::max(requirements.size, requirements.alignment);
+	if (classSize <= GPU_SMALL_CLASS_MAX)
+		return allocateFromSizeClass(memoryType, classSize);
+
+	return allocateFromBlocks(memoryType, requirements.size, requirements.alignment);
+}
+
+GPUAllocation GPUAllocator::allocateImage(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool renderTarget)
+{
+	s32 memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+	if (memoryType < 0)
+	{
+		DBG_SEVERE("No memory type with properties " << properties << " for a " << requirements.size << " byte image");
+		return GPUAllocation();
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (requirements.size >= GPU_DEDICATED_THRESHOLD || (renderTarget && requirements.size >= GPU_RENDER_TARGET_DEDICATED_THRESHOLD))
+		return allocateDedicated(memoryType, requirements.size);
+
+	// Starting and ending on a granularity boundary keeps the image off any page a buffer touches. Size class slots
+	// are never used, they sit next to buffers within a slab
+	VkDeviceSize alignment = glm::max(requirements.alignment, bufferImageGranularity);
+	VkDeviceSize size = (requirements.size + bufferImageGranularity - 1) / bufferImageGranularity * bufferImageGranularity;
+	return allocateFromBlocks(memoryType, size, alignment);
+}
+
+void GPUAllocator::free(GPUAllocation& allocation)
+{
+	if (!allocation.isValid())
+		return;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	auto& pool = pools[allocation.memoryType];
+
+	switch (allocation.kind)
+	{
+	case GPUAllocation::Dedicated:
+		freeDeviceMemory(allocation.memory, allocation.mapped);
+		--pool.dedicatedCount;
+		pool.dedicatedSize -= allocation.size;
+		break;
+	case GPUAllocation::Block:
+		freeFromBlocks(allocation);
+		break;
+	case GPUAllocation::Slab:
+	{
+		auto& sizeClass = pool.sizeClasses[sizeClassIndex(allocation.size)];
+		auto slab = static_cast<Slab*>(allocation.owner);
+		slab->freeSlots.push_back(u32(allocation.range));
+		--sizeClass.allocationCount;
+
+		// Empty slabs go back to the blocks, one is kept so a class in use doesn't churn
+		if (slab->freeSlots.size() == slab->slotCount && sizeClass.slabs.size() > 1)
+		{
+			freeFromBlocks(slab->backing);
+			sizeClass.slabs.remove_if([slab](const Slab& s) -> bool { return &s == slab; });
+		}
+		break;
+	}
+	default:
+		break;
+	}
+
+	allocation = GPUAllocation();
+}
+
+std::vector<GPUAllocator::PoolStats> GPUAllocator::getStats()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::vector<PoolStats> stats;
+
+	for (u32 i = 0; i < pools.size(); ++i)
+	{
+		auto& pool = pools[i];
+		auto properties = memoryProperties.memoryTypes[i].propertyFlags;
+
+		if (!pool.blocks.empty())
+		{
+			PoolStats s = { "type " + std::to_string(i) + " blocks", i, properties, u32(pool.blocks.size()), 0, 0, 0 };
+			for (auto& block : pool.blocks)
+			{
+				s.reserved += block.ranges.getCapacity() * GPU_ALLOCATION_GRANULARITY;
+				s.used += block.ranges.getUsed() * GPU_ALLOCATION_GRANULARITY;
+				s.allocationCount += block.ranges.getAllocationCount();
+			}
+			stats.push_back(s);
+		}
+
+		for (u32 c = 0; c < 9; ++c)
+		{
+			auto& sizeClass = pool.sizeClasses[c];
+			if (sizeClass.slabs.empty())
+				continue;
+
+			PoolStats s = { "type " + std::to_string(i) + " " + std::to_string(sizeClassSize(c)) + " B slots", i, properties, u32(sizeClass.slabs.size()), 0, 0, sizeClass.allocationCount };
+			s.reserved = sizeClass.slabs.size() * GPU_SLAB_SIZE;
+			s.used = sizeClass.allocationCount * sizeClassSize(c);
+			stats.push_back(s);
+		}
+
+		if (pool.dedicatedCount > 0)
+			stats.push_back({ "type " + std::to_string(i) + " dedicated", i, properties, pool.dedicatedCount, pool.dedicatedSize, pool.dedicatedSize, pool.dedicatedCount });
+	}
+
+	return stats;
+}
+
+s32 GPUAllocator::findMemoryType(u32 typeBits, VkMemoryPropertyFlags properties)
+{
+	for (u32 i = 0; i < memoryProperties.memoryTypeCount; ++i)
+	{
+		if ((typeBits & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+			return s32(i);
+	}
+	return -1;
+}
+
+GPUAllocation GPUAllocator::allocateFromBlocks(u32 memoryType, VkDeviceSize size, VkDeviceSize alignment)
+{
+	auto& pool = pools[memoryType];
+
+	// Ranges start on a granularity boundary, larger alignments are met by over-allocating and skipping ahead
+	VkDeviceSize padding = alignment > GPU_ALLOCATION_GRANULARITY ? alignment - GPU_ALLOCATION_GRANULARITY : 0;
+	u64 units = (size + padding + GPU_ALLOCATION_GRANULARITY - 1) / GPU_ALLOCATION_GRANULARITY;
+
+	auto fromBlock = [&](MemoryBlock& block) -> GPUAllocation {
+		u64 range = block.ranges.allocate(units);
+		if (range == BufferSubAllocator::INVALID_OFFSET)
+			return GPUAllocation();
+
+		GPUAllocation a;
+		a.kind = GPUAllocation::Block;
+		a.memory = block.memory;
+		a.memoryType = memoryType;
+		a.owner = &block;
+		a.range = range;
+		a.offset = (range * GPU_ALLOCATION_GRANULARITY + alignment - 1) / alignment * alignment;
+		a.size = size;
+		a.mapped = block.mapped ? static_cast<char*>(block.mapped) + a.offset : nullptr;
+		return a;
+	};
+
+	for (auto& block : pool.blocks)
+	{
+		auto a = fromBlock(block);
+		if (a.isValid())
+			return a;
+	}
+
+	pool.blocks.emplace_back();
+	auto& block = pool.blocks.back();
+	if (!allocateDeviceMemory(memoryType, GPU_BLOCK_SIZE, block.memory, block.mapped))
+	{
+		pool.blocks.pop_back();
+		return GPUAllocation();
+	}
+	block.ranges.init(GPU_BLOCK_SIZE / GPU_ALLOCATION_GRANULARITY);
+
+	return fromBlock(block);
+}
+
+GPUAllocation GPUAllocator::allocateFromSizeClass(u32 memoryType, VkDeviceSize size)
+{
+	u32 index = sizeClassIndex(size);
+	VkDeviceSize slotSize = sizeClassSize(index);
+	auto& sizeClass = pools[memoryType].sizeClasses[index];
+
+	Slab* slab = nullptr;
+	for (auto& s : sizeClass.slabs)
+	{
+		if (!s.freeSlots.empty())
+		{
+			slab = &s;
+			break;
+		}
+	}
+
+	if (!slab)
+	{
+		auto backing = allocateFromBlocks(memoryType, GPU_SLAB_SIZE, slotSize);
+		if (!backing.isValid())
+			return GPUAllocation();
+
+		sizeClass.slabs.emplace_back();
+		slab = &sizeClass.slabs.back();
+		slab->backing = backing;
+		slab->slotCount = u32(GPU_SLAB_SIZE / slotSize);
+
+		// Handed out from the front of the slab first
+		slab->freeSlots.resize(slab->slotCount);
+		for (u32 i = 0; i < slab->slotCount; ++i)
+			slab->freeSlots[i] = slab->slotCount - 1 - i;
+	}
+
+	u32 slot = slab->freeSlots.back();
+	slab->freeSlots.pop_back();
+	++sizeClass.allocationCount;
+
+	GPUAllocation a;
+	a.kind = GPUAllocation::Slab;
+	a.memory = slab->backing.memory;
+	a.memoryType = memoryType;
+	a.owner = slab;
+	a.range = slot;
+	a.offset = slab->backing.offset + slot * slotSize;
+	a.size = slotSize;
+	a.mapped = slab->backing.mapped ? static_cast<char*>(slab->backing.mapped) + slot * slotSize : nullptr;
+	return a;
+}
+
+GPUAllocation GPUAllocator::allocateDedicated(u32 memoryType, VkDeviceSize size)
+{
+	GPUAllocation a;
+	if (!allocateDeviceMemory(memoryType, size, a.memory, a.mapped))
+		return a;
+
+	auto& pool = pools[memoryType];
+	++pool.dedicatedCount;
+	pool.dedicatedSize += size;
+
+	a.kind = GPUAllocation::Dedicated;
+	a.memoryType = memoryType;
+	a.size = size;
+	return a;
+}
+
+void GPUAllocator::freeFromBlocks(GPUAllocation& allocation)
+{
+	auto& pool = pools[allocation.memoryType];
+	auto block = static_cast<MemoryBlock*>(allocation.owner);
+	block->ranges.free(allocation.range);
+
+	// Empty blocks are given back to the driver, one is kept per memory type in use
+	if (block->ranges.getAllocationCount() == 0 && pool.blocks.size() > 1)
+	{
+		freeDeviceMemory(block->memory, block->mapped);
+		pool.blocks.remove_if([block](const MemoryBlock& b) -> bool { return &b == block; });
+	}
+}
+
+bool GPUAllocator::allocateDeviceMemory(u32 memoryType, VkDeviceSize size, VkDeviceMemory& memory, void*& mapped)
+{
+	VkMemoryAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = size;
+	allocInfo.memoryTypeIndex = memoryType;
+
+	auto result = vkAllocateMemory(device, &allocInfo, nullptr, &memory);
+	if (result != VK_SUCCESS)
+	{
+		DBG_SEVERE("Failed to allocate " << size << " bytes of memory type " << memoryType << ", " << deviceMemoryCount << " allocations are live");
+		memory = VK_NULL_HANDLE;
+		mapped = nullptr;
+		return false;
+	}
+
+	mapped = nullptr;
+	if (memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+		VK_CHECK_RESULT(vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &mapped));
+
+	++deviceMemoryCount;
+	return true;
+}
+
+void GPUAllocator::freeDeviceMemory(VkDeviceMemory memory, void* mapped)
+{
+	if (mapped)
+		vkUnmapMemory(device, memory);
+	vkFreeMemory(device, memory, nullptr);
+	--deviceMemoryCount;
+}
@@ -98,41 +98,6 @@ void SpotLight::initTexture(int resolution)
 	VK_CHECK_RESULT(vkCreateFramebuffer(Engine::renderer->device, &framebufferInfo, nullptr, shadowFBO));
 }
 
-void SpotLight::updateDrawCommands(u32 gpuIndex)
-{
-	VkDrawIndexedIndirectCommand* cmd = (VkDrawIndexedIndirectCommand*)drawCommandsBuffer->getMemory()->map();
-
-	int i = 0;
-
-	auto tIndex = ModelInstance::toGPUTransformIndex;
-
-	for (auto& m : Engine::world.instancesToDraw) /// TODO: invisible (to the player) objects will cast shadows. We need a different culling
-	{
-		glm::fvec3 modelPos = m->transform[tIndex].getTranslation();
-		float distanceToCam = glm::length(Engine::camera.getPosition() - modelPos);
-
-		/// TODO: will models have special shadow LODs ?
-		int lodIndex = 0;
-		for (auto lim : m->model->lodLimits) /// TODO: monitor for LOD/culling/world changes, dont re-populate this when not needed
-		{
-			if (distanceToCam >= lim)
-				break;
-			++lodIndex;
-		}
-
-		auto& lodMesh = m->model->modelLODs[lodIndex];
-
-		cmd[i].firstIndex = lodMesh.firstIndex;
-		cmd[i].indexCount = lodMesh.indexDataLength;
-		cmd[i].vertexOffset = lodMesh.firstVertex;
-		cmd[i].firstInstance = (gpuIndex << 20) | (m->transformIndex);
-		cmd[i].instanceCount = 1; /// TODO: do we want/need a different class for real instanced drawing ?
-		++i;
-	}
-
-	drawCommandsBuffer->getMemory()->unmap();
-}
-
 void SpotLight::updateRadius()
 {
 	matNeedsUpdate = true;
@@ -146,32 +111,17 @@ inline float SpotLight::calculateRadius(float linear, float quad)
 
 void LightManager::init()
 {
-	/// TODO: Memory flags, change to device local for performance, then we can't map and have to use staging buffer
-
-	auto memProperty = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	// Device local, every update is staged through the renderer's frame data
 	auto usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+	auto& renderer = Engine::renderer;
 
-	lightCountsBuffer.setMemoryProperty(memProperty);
-	lightCountsBuffer.setUsage(usage);
-
-	spotLightsBuffer.setMemoryProperty(memProperty);
-	spotLightsBuffer.setUsage(usage);
-
-	pointLightsBuffer.setMemoryProperty(memProperty);
-	pointLightsBuffer.setUsage(usage);
-
-	sunLightBuffer.setMemoryProperty(memProperty);
-	sunLightBuffer.setUsage(usage);
-
-	lightCountsBuffer.create(&Engine::renderer->logicalDevice, sizeof(u32) * 2);
-	spotLightsBuffer.create(&Engine::renderer->logicalDevice, sizeof(SpotLight::GPUData) * 150);
-	pointLightsBuffer.create(&Engine::renderer->logicalDevice, sizeof(PointLight::GPUData) * 150);
-	sunLightBuffer.create(&Engine::renderer->logicalDevice, sizeof(SunLight::GPUData) * 1);
+	renderer->createPerFrameBuffer(lightCountsBuffer, usage, sizeof(u32) * 2);
+	renderer->createPerFrameBuffer(spotLightsBuffer, usage, sizeof(SpotLight::GPUData) * 150);
+	renderer->createPerFrameBuffer(pointLightsBuffer, usage, sizeof(PointLight::GPUData) * 150);
+	renderer->createPerFrameBuffer(sunLightBuffer, usage, sizeof(SunLight::GPUData) * 1);
 
 	spotLightsGPUData.reserve(150);
 	pointLightsGPUData.reserve(150);
-
-	spotShadowDrawCommandsBuffers.reserve(150);
 }
 
 PointLight & LightManager::addPointLight(PointLight::GPUData& data)
@@ -191,24 +141,71 @@ SpotLight & LightManager::addSpotLight(SpotLight::GPUData& data)
 	spotLightsGPUData.push_back(data);
 	light.gpuData = &spotLightsGPUData.back();
 
-	spotShadowDrawCommandsBuffers.emplace_back();
-	auto& drawBuffer = spotShadowDrawCommandsBuffers.back();
-	drawBuffer.setMemoryProperty(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-	drawBuffer.setUsage(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
-	drawBuffer.create(&Engine::renderer->logicalDevice, sizeof(VkDrawIndexedIndirectCommand) * 1000); /// TODO: max model count, make resizable
-	light.drawCommandsBuffer = &drawBuffer;
-
 	return light;
 }
 
+void LightManager::updateLightCounts()
+{
+	u32* lc = (u32*)Engine::renderer->stageFrameData(lightCountsBuffer, 0, sizeof(u32) * 2);
+	if (!lc)
+		return;
+	lc[0] = pointLights.size();
+	lc[1] = spotLights.size();
+}
+
+void LightManager::updateAllPointLights()
+{
+	for (auto& l : pointLights)
+		l.update();
+	if (pointLights.empty())
+		return;
+
+	PointLight::GPUData* d = (PointLight::GPUData*)Engine::renderer->stageFrameData(pointLightsBuffer, 0, sizeof(PointLight::GPUData) * pointLights.size());
+	if (!d)
+		return;
+	for (int i = 0; i < pointLights.size(); ++i)
+	{
+		d[i].colourQuadratic = pointLightsGPUData[i].colourQuadratic;
+		d[i].positionRadius = pointLightsGPUData[i].positionRadius;
+		d[i].linearFadesTexture = pointLightsGPUData[i].linearFadesTexture;
+		for (int j = 0; j < 5; ++j)
+			d[i].projView[j] = pointLightsGPUData[i].projView[j];
+	}
+}
+
+void LightManager::updateAllSpotLights()
+{
+	for (auto& l : spotLights)
+		l.update();
+	if (spotLights.empty())
+		return;
+
+	SpotLight::GPUData* d = (SpotLight::GPUData*)Engine::renderer->stageFrameData(spotLightsBuffer, 0, sizeof(SpotLight::GPUData) * spotLights.size());
+	if (!d)
+		return;
+	for (int i = 0; i < spotLights.size(); ++i)
+	{
+		d[i].colourQuadratic = spotLightsGPUData[i].colourQuadratic;
+		d[i].positionRadius = spotLightsGPUData[i].positionRadius;
+		d[i].linearFadesTexture = spotLightsGPUData[i].linearFadesTexture;
+		d[i].directionInner = spotLightsGPUData[i].directionInner;
+		d[i].outer = spotLightsGPUData[i].outer;
+		d[i].projView = spotLightsGPUData[i].projView;
+	}
+}
+
 void LightManager::updateSunLight()
 {
-	SunLight::GPUData* d = (SunLight::GPUData*)sunLightBuffer.getMemory()->map();
-	d->colour.separate.colour = sunLight.getColour();
-	d->direction.separate.direction = sunLight.getDirection();
-	memcpy(&d->projView[0], sunLight.getProjView(), sizeof(glm::fmat4) * 3);
-	memcpy(&d->cascadeEnds[0], sunLight.getCascadeEnds(), sizeof(float) * 4);
-	sunLightBuffer.getMemory()->unmap();
+	SunLight::GPUData d;
+	d.colour.separate.colour = sunLight.getColour();
+	d.direction.separate.direction = sunLight.getDirection();
+	memcpy(&d.projView[0], sunLight.getProjView(), sizeof(glm::fmat4) * 3);
+	memcpy(&d.cascadeEnds[0], sunLight.getCascadeEnds(), sizeof(float) * 4);
+
+	// Written every frame, so it goes through the frame's staging memory instead of under frames still reading it
+	void* data = Engine::renderer->stageFrameData(sunLightBuffer, 0, sizeof(SunLight::GPUData));
+	if (data)
+		memcpy(data, &d, sizeof(SunLight::GPUData));
 }
 
 void SunLight::destroy()
@@ -0,0 +1,56 @@
+#include "PCH.hpp"
+#include "LogicalDevice.hpp"
+
+void LogicalDevice::create(vdu::PhysicalDevice* physicalDevice)
+{
+	u32 familyCount;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice->getHandle(), &familyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> familyProperties(familyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice->getHandle(), &familyCount, familyProperties.data());
+
+	// Every queue is created with priority 1
+	std::map<u32, u32> familyQueueCounts;
+	for (auto& request : queues)
+		familyQueueCounts[request.family] = std::min(familyQueueCounts[request.family] + 1, familyProperties[request.family].queueCount);
+
+	u32 maxQueueCount = 0;
+	for (auto& family : familyQueueCounts)
+		maxQueueCount = std::max(maxQueueCount, family.second);
+	std::vector<float> priorities(maxQueueCount, 1.f);
+
+	std::vector<VkDeviceQueueCreateInfo> queueInfos;
+	for (auto& family : familyQueueCounts)
+	{
+		VkDeviceQueueCreateInfo queueInfo = {};
+		queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+		queueInfo.queueFamilyIndex = family.first;
+		queueInfo.queueCount = family.second;
+		queueInfo.pQueuePriorities = priorities.data();
+		queueInfos.push_back(queueInfo);
+	}
+
+	features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+
+	VkDeviceCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	createInfo.pNext = &features; // pEnabledFeatures stays null, the features are in the chain
+	createInfo.queueCreateInfoCount = u32(queueInfos.size());
+	createInfo.pQueueCreateInfos = queueInfos.data();
+	createInfo.enabledExtensionCount = u32(extensions.size());
+	createInfo.ppEnabledExtensionNames = extensions.data();
+	createInfo.enabledLayerCount = u32(layers.size());
+	createInfo.ppEnabledLayerNames = layers.data();
+
+	VK_CHECK_RESULT(vkCreateDevice(physicalDevice->getHandle(), &createInfo, nullptr, &m_logicalDevice));
+	m_physicalDevice = physicalDevice;
+
+	std::map<u32, u32> nextIndices;
+	for (auto& request : queues)
+	{
+		u32 index = std::min(nextIndices[request.family]++, familyQueueCounts[request.family] - 1);
+
+		VkQueue queue;
+		vkGetDeviceQueue(m_logicalDevice, request.family, index, &queue);
+		request.queue->setHandle(queue);
+	}
+}
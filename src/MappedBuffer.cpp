@@ -0,0 +1,57 @@
+#include "PCH.hpp"
+#include "MappedBuffer.hpp"
+#include "Engine.hpp"
+
+void MappedBuffer::create(GPUAllocator* pAllocator, VkBufferUsageFlags usage, VkDeviceSize pSize, VkMemoryPropertyFlags memoryProperties)
+{
+	coherent = (memoryProperties & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+
+	if (!coherent)
+	{
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(Engine::physicalDevice->getHandle(), &properties);
+		atomSize = properties.limits.nonCoherentAtomSize;
+	}
+
+	// The allocator maps host visible memory once, so the pointer is valid for the lifetime of the buffer
+	PooledBuffer::create(pAllocator, usage, pSize, memoryProperties | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+}
+
+void MappedBuffer::write(VkDeviceSize offset, const void* data, VkDeviceSize writeSize)
+{
+	if (writeSize == 0)
+		return;
+
+	if (offset + writeSize > size)
+	{
+		DBG_SEVERE("Writing " << writeSize << " bytes at " << offset << " overflows a mapped buffer of " << size << " bytes");
+		return;
+	}
+
+	memcpy(getMapped(offset), data, (size_t)writeSize);
+	flush(offset, writeSize);
+}
+
+void MappedBuffer::flush(VkDeviceSize offset, VkDeviceSize flushSize)
+{
+	if (coherent)
+		return;
+
+	if (flushSize == VK_WHOLE_SIZE)
+		flushSize = size - offset;
+
+	// The buffer may share its memory with others, so the range is relative to the allocation and rounded out.
+	// Blocks are a multiple of the atom size, a dedicated allocation may not be and is flushed to its end instead
+	VkDeviceSize start = allocation.offset + offset;
+	VkDeviceSize end = allocation.offset + offset + flushSize;
+
+	VkMappedMemoryRange range = {};
+	range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+	range.memory = allocation.memory;
+	range.offset = start / atomSize * atomSize;
+	range.size = (end + atomSize - 1) / atomSize * atomSize - range.offset;
+	if (allocation.kind == GPUAllocation::Dedicated && range.offset + range.size > allocation.size)
+		range.size = VK_WHOLE_SIZE;
+
+	VK_CHECK_RESULT(vkFlushMappedMemoryRanges(allocator->getDevice(), 1, &range));
+}
@@ -1,8 +1,13 @@
 #include "PCH.hpp"
 #include "Material.hpp"
+#include "Engine.hpp"
+#include "Renderer.hpp"
 
 void Material::loadToRAM(void * pCreateStruct, AllocFunc alloc)
 {
+	if (flat)
+		return;
+
 	if (!data.textures.albedoSpec->checkAvailability(ON_RAM) && !data.textures.albedoSpec->checkAvailability(LOADING_TO_RAM))
 	{
 		data.textures.albedoSpec->getAvailability() |= LOADING_TO_RAM;
@@ -36,17 +41,23 @@ void Material::loadToRAM(void * pCreateStruct, AllocFunc alloc)
 
 void Material::loadToGPU(void * pCreateStruct)
 {
-	if (!data.textures.albedoSpec->checkAvailability(ON_GPU) && !data.textures.albedoSpec->checkAvailability(LOADING_TO_GPU))
+	if (!flat && !data.textures.albedoSpec->checkAvailability(ON_GPU) && !data.textures.albedoSpec->checkAvailability(LOADING_TO_GPU))
 	{
 		data.textures.albedoSpec->getAvailability() |= LOADING_TO_GPU;
 		data.textures.albedoSpec->loadToGPU();
-		availability |= AWAITING_DESCRIPTOR_UPDATE;
 	}
 
-	if (!data.textures.normalRough->checkAvailability(ON_GPU) && !data.textures.normalRough->checkAvailability(LOADING_TO_GPU))
+	if (!flat && !data.textures.normalRough->checkAvailability(ON_GPU) && !data.textures.normalRough->checkAvailability(LOADING_TO_GPU))
 	{
 		data.textures.normalRough->getAvailability() |= LOADING_TO_GPU;
 		data.textures.normalRough->loadToGPU();
+	}
+
+	// Also when another material already loaded the textures. Queued once until the renderer has written the descriptors,
+	// or for a flat material its record
+	if (!checkAvailability(AWAITING_DESCRIPTOR_UPDATE))
+	{
 		availability |= AWAITING_DESCRIPTOR_UPDATE;
+		Engine::renderer->queueMaterialDescriptorUpdate(this);
 	}
 }
@@ -0,0 +1,15 @@
+#include "PCH.hpp"
+#include "MaterialRecords.hpp"
+
+void MaterialRecords::grow(u32 capacity)
+{
+	if (capacity > records.size())
+		records.resize(capacity, MaterialRecord::flatWhite());
+}
+
+MaterialRecord MaterialRecords::read(u32 textureIndex) const
+{
+	// Two textures per material, see Material::gpuIndexBase
+	u32 recordIndex = textureIndex / 2;
+	return recordIndex < records.size() ? records[recordIndex] : MaterialRecord::flatWhite();
+}
@@ -0,0 +1,251 @@
+#include "PCH.hpp"
+#include "MeshSimplifier.hpp"
+
+namespace
+{
+	// Symmetric 4x4 matrix, upper triangle stored row by row
+	struct Quadric
+	{
+		double a[10] = {};
+
+		static Quadric fromPlane(glm::fvec3 n, float d, double weight)
+		{
+			double x = n.x, y = n.y, z = n.z, w = d;
+			Quadric q;
+			q.a[0] = x * x; q.a[1] = x * y; q.a[2] = x * z; q.a[3] = x * w;
+			q.a[4] = y * y; q.a[5] = y * z; q.a[6] = y * w;
+			q.a[7] = z * z; q.a[8] = z * w;
+			q.a[9] = w * w;
+			for (auto& e : q.a)
+				e *= weight;
+			return q;
+		}
+
+		Quadric& operator+=(const Quadric& o)
+		{
+			for (int i = 0; i < 10; ++i)
+				a[i] += o.a[i];
+			return *this;
+		}
+
+		// Sum of squared distances of p to the accumulated planes
+		double error(glm::fvec3 p) const
+		{
+			double x = p.x, y = p.y, z = p.z;
+			return a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z + 2 * a[3] * x
+				+ a[4] * y * y + 2 * a[5] * y * z + 2 * a[6] * y
+				+ a[7] * z * z + 2 * a[8] * z
+				+ a[9];
+		}
+	};
+
+	struct Collapse
+	{
+		double cost;
+		u32 from, to;
+		u32 fromVersion, toVersion; // Collapses are stale once either vertex has changed since they were queued
+
+		bool operator>(const Collapse& o) const { return cost > o.cost; }
+	};
+
+	u64 edgeKey(u32 a, u32 b)
+	{
+		return a < b ? (u64(a) << 32) | b : (u64(b) << 32) | a;
+	}
+}
+
+float simplifyMesh(const Vertex* vertices, u32 vertexCount, const u32* indices, u32 indexCount, u32 targetIndexCount,
+	std::vector<Vertex>& outVertices, std::vector<u32>& outIndices)
+{
+	u32 triangleCount = indexCount / 3;
+
+	std::vector<u32> triangles(indices, indices + triangleCount * 3);
+	std::vector<bool> triangleAlive(triangleCount, true);
+
+	std::vector<Quadric> quadrics(vertexCount);
+	std::vector<std::vector<u32>> vertexTriangles(vertexCount);
+	std::vector<u32> vertexVersion(vertexCount, 0);
+	std::vector<bool> vertexAlive(vertexCount, true);
+	std::vector<bool> vertexLocked(vertexCount, false);
+
+	auto triangleNormal = [&](u32 t) -> glm::fvec3 {
+		auto& p0 = vertices[triangles[t * 3]].pos;
+		return glm::cross(vertices[triangles[t * 3 + 1]].pos - p0, vertices[triangles[t * 3 + 2]].pos - p0);
+	};
+
+	// Vertices that share a position with another vertex sit on an attribute seam
+	{
+		std::map<std::array<float, 3>, u32> positionCount;
+		for (u32 v = 0; v < vertexCount; ++v)
+			++positionCount[{ vertices[v].pos.x, vertices[v].pos.y, vertices[v].pos.z }];
+		for (u32 v = 0; v < vertexCount; ++v)
+			vertexLocked[v] = positionCount[{ vertices[v].pos.x, vertices[v].pos.y, vertices[v].pos.z }] > 1;
+	}
+
+	// Plane quadrics of every triangle, and count the triangles using each edge
+	std::unordered_map<u64, u32> edgeUses;
+	for (u32 t = 0; t < triangleCount; ++t)
+	{
+		u32* tri = &triangles[t * 3];
+		for (int k = 0; k < 3; ++k)
+		{
+			vertexTriangles[tri[k]].push_back(t);
+			++edgeUses[edgeKey(tri[k], tri[(k + 1) % 3])];
+		}
+
+		glm::fvec3 n = triangleNormal(t);
+		float len = glm::length(n);
+		if (len == 0.f)
+			continue;
+		n /= len;
+
+		auto q = Quadric::fromPlane(n, -glm::dot(n, vertices[tri[0]].pos), 1.0);
+		for (int k = 0; k < 3; ++k)
+			quadrics[tri[k]] += q;
+	}
+
+	// Open edges get a plane perpendicular to their triangle, which keeps the border from shrinking
+	for (u32 t = 0; t < triangleCount; ++t)
+	{
+		u32* tri = &triangles[t * 3];
+		glm::fvec3 n = triangleNormal(t);
+
+		for (int k = 0; k < 3; ++k)
+		{
+			u32 a = tri[k], b = tri[(k + 1) % 3];
+			if (edgeUses[edgeKey(a, b)] != 1)
+				continue;
+
+			glm::fvec3 borderNormal = glm::cross(vertices[b].pos - vertices[a].pos, n);
+			float len = glm::length(borderNormal);
+			if (len == 0.f)
+				continue;
+			borderNormal /= len;
+
+			auto q = Quadric::fromPlane(borderNormal, -glm::dot(borderNormal, vertices[a].pos), BORDER_QUADRIC_WEIGHT);
+			quadrics[a] += q;
+			quadrics[b] += q;
+		}
+	}
+
+	std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> collapses;
+
+	// Queue the cheaper direction of an edge collapse
+	auto queueEdge = [&](u32 a, u32 b) -> void {
+		if (vertexLocked[a] && vertexLocked[b])
+			return;
+
+		Quadric q = quadrics[a];
+		q += quadrics[b];
+
+		double aToB = vertexLocked[a] ? std::numeric_limits<double>::max() : q.error(vertices[b].pos);
+		double bToA = vertexLocked[b] ? std::numeric_limits<double>::max() : q.error(vertices[a].pos);
+
+		if (aToB <= bToA)
+			collapses.push({ aToB, a, b, vertexVersion[a], vertexVersion[b] });
+		else
+			collapses.push({ bToA, b, a, vertexVersion[b], vertexVersion[a] });
+	};
+
+	for (auto& e : edgeUses)
+		queueEdge(u32(e.first >> 32), u32(e.first & 0xFFFFFFFF));
+
+	// A collapse is rejected if it would turn any remaining triangle around
+	auto collapseFlips = [&](u32 from, u32 to) -> bool {
+		for (auto t : vertexTriangles[from])
+		{
+			if (!triangleAlive[t])
+				continue;
+
+			u32* tri = &triangles[t * 3];
+			if (tri[0] == to || tri[1] == to || tri[2] == to)
+				continue;
+
+			glm::fvec3 p[3];
+			for (int k = 0; k < 3; ++k)
+				p[k] = vertices[tri[k] == from ? to : tri[k]].pos;
+
+			if (glm::dot(triangleNormal(t), glm::cross(p[1] - p[0], p[2] - p[0])) <= 0.f)
+				return true;
+		}
+		return false;
+	};
+
+	u32 liveIndexCount = triangleCount * 3;
+	double maxCost = 0.0;
+
+	while (liveIndexCount > targetIndexCount && !collapses.empty())
+	{
+		auto c = collapses.top();
+		collapses.pop();
+
+		if (!vertexAlive[c.from] || !vertexAlive[c.to])
+			continue;
+		if (vertexVersion[c.from] != c.fromVersion || vertexVersion[c.to] != c.toVersion)
+			continue;
+		if (collapseFlips(c.from, c.to))
+			continue;
+
+		for (auto t : vertexTriangles[c.from])
+		{
+			if (!triangleAlive[t])
+				continue;
+
+			u32* tri = &triangles[t * 3];
+			if (tri[0] == c.to || tri[1] == c.to || tri[2] == c.to)
+			{
+				triangleAlive[t] = false;
+				liveIndexCount -= 3;
+				continue;
+			}
+
+			for (int k = 0; k < 3; ++k)
+				if (tri[k] == c.from)
+					tri[k] = c.to;
+			vertexTriangles[c.to].push_back(t);
+		}
+
+		vertexTriangles[c.from].clear();
+		vertexAlive[c.from] = false;
+		quadrics[c.to] += quadrics[c.from];
+		++vertexVersion[c.to];
+		maxCost = glm::max(maxCost, c.cost);
+
+		// Requeue every edge around the surviving vertex with its new quadric
+		std::set<u32> neighbours;
+		for (auto t : vertexTriangles[c.to])
+		{
+			if (!triangleAlive[t])
+				continue;
+			for (int k = 0; k < 3; ++k)
+				if (triangles[t * 3 + k] != c.to)
+					neighbours.insert(triangles[t * 3 + k]);
+		}
+		for (auto n : neighbours)
+			queueEdge(c.to, n);
+	}
+
+	// Keep only the vertices still referenced
+	std::vector<u32> remap(vertexCount, ~u32(0));
+	outVertices.clear();
+	outIndices.clear();
+
+	for (u32 t = 0; t < triangleCount; ++t)
+	{
+		if (!triangleAlive[t])
+			continue;
+
+		for (int k = 0; k < 3; ++k)
+		{
+			u32 v = triangles[t * 3 + k];
+			if (remap[v] == ~u32(0))
+			{
+				remap[v] = u32(outVertices.size());
+				outVertices.push_back(vertices[v]);
+			}
+			outIndices.push_back(remap[v]);
+		}
+	}
+
+	return float(glm::sqrt(glm::max(maxCost, 0.0)));
+}
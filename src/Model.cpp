@@ -5,6 +5,7 @@
 #include "rapidxml.hpp"
 #include "File.hpp"
 #include "Threading.hpp"
+#include "MeshSimplifier.hpp"
 
 #include "assimp/Importer.hpp"
 #include "assimp/scene.h"
@@ -187,33 +188,278 @@ void Model::loadToRAM(void * pCreateStruct, AllocFunc alloc)
 		}
 	}
 
+	// Bounding sphere around the centre of the first LODs bounding box, used for GPU culling
+	if (!modelLODs.empty())
+	{
+		auto& lod = modelLODs.front();
+		glm::fvec3 min(std::numeric_limits<float>::max()), max(-std::numeric_limits<float>::max());
+		for (u32 k = 0; k < lod.vertexDataLength; ++k)
+		{
+			min = glm::min(min, lod.vertexData[k].pos);
+			max = glm::max(max, lod.vertexData[k].pos);
+		}
+
+		glm::fvec3 centre = (min + max) * 0.5f;
+		float radius = 0.f;
+		for (u32 k = 0; k < lod.vertexDataLength; ++k)
+			radius = glm::max(radius, glm::length(lod.vertexData[k].pos - centre));
+
+		boundingSphere = glm::fvec4(centre, radius);
+	}
+
+	if (modelLODs.size() == 1)
+	{
+		generateLODs();
+	}
+	else
+	{
+		// Authored LODs carry no error, estimate it as the average edge length of a sphere tesselated with the same number of triangles
+		lodErrors.clear();
+		for (auto& lod : modelLODs)
+		{
+			float triangles = glm::max(float(lod.indexDataLength / 3), 1.f);
+			float error = boundingSphere.w * glm::sqrt(4.f * glm::pi<float>() / triangles);
+			lodErrors.push_back(lodErrors.empty() ? error : glm::max(error, lodErrors.back()));
+		}
+	}
+
 	availability |= ON_RAM;
 	availability &= ~LOADING_TO_RAM;
 
 	material->loadToRAM();
 }
 
+void Model::generateLODs()
+{
+	lodErrors = { 0.f };
+
+	// Paths are relative to the working directory, like every File path
+	std::string sourcePath = Engine::workingDirectory + "/" + diskPaths.front();
+	std::string cachePath = "/cache/lod/" + name + ".lod";
+	std::error_code sizeError, timeError;
+	u64 sourceSize = fs::file_size(sourcePath, sizeError);
+	s64 sourceTime = fs::last_write_time(sourcePath, timeError).time_since_epoch().count();
+	bool cacheable = !sizeError && !timeError;
+
+	if (cacheable && loadLODCache(cachePath, sourceSize, sourceTime))
+		return;
+
+	struct SimplifiedMesh
+	{
+		u32 targetIndexCount;
+		std::vector<Vertex> vertices;
+		std::vector<u32> indices;
+		float error;
+	};
+
+	// Every level is simplified from the source mesh, so they can all run at the same time
+	auto& source = modelLODs.front();
+	std::vector<SimplifiedMesh> results;
+
+	float targetTriangles = float(source.indexDataLength / 3);
+	for (u32 i = 1; i < MODEL_GENERATED_LOD_COUNT; ++i)
+	{
+		targetTriangles *= MODEL_GENERATED_LOD_RATIO;
+		if (targetTriangles < MODEL_GENERATED_LOD_MIN_TRIANGLES)
+			break;
+
+		results.push_back(SimplifiedMesh());
+		results.back().targetIndexCount = u32(targetTriangles) * 3;
+	}
+
+	Engine::threading->assetParallelFor(u32(results.size()), [&source, &results](u32 i) -> void {
+		auto& mesh = results[i];
+		mesh.error = simplifyMesh(source.vertexData, source.vertexDataLength, source.indexData, source.indexDataLength, mesh.targetIndexCount, mesh.vertices, mesh.indices);
+	});
+
+	u32 previousIndexCount = source.indexDataLength;
+	for (auto& mesh : results)
+	{
+		// Drop levels that the simplifier could not meaningfully reduce (e.g. meshes made mostly of seams)
+		if (mesh.indices.size() > previousIndexCount * 9 / 10)
+			break;
+		previousIndexCount = u32(mesh.indices.size());
+
+		modelLODs.push_back(TriangleMesh());
+		TriangleMesh& triList = modelLODs.back();
+		triList.vertexDataLength = u32(mesh.vertices.size());
+		triList.vertexData = new Vertex[triList.vertexDataLength];
+		memcpy(triList.vertexData, mesh.vertices.data(), sizeof(Vertex) * triList.vertexDataLength);
+		triList.indexDataLength = u32(mesh.indices.size());
+		triList.indexData = new u32[triList.indexDataLength];
+		memcpy(triList.indexData, mesh.indices.data(), sizeof(u32) * triList.indexDataLength);
+
+		lodErrors.push_back(glm::max(mesh.error, lodErrors.back()));
+	}
+
+	if (cacheable)
+		saveLODCache(cachePath, sourceSize, sourceTime);
+	else
+		DBG_WARNING("Not caching LODs of " << name << ", could not stat " << sourcePath);
+}
+
+// LOD cache layout:
+//	u32 magic, u32 version, u64 source size, s64 source time,
+//	u32 MODEL_GENERATED_LOD_COUNT, float MODEL_GENERATED_LOD_RATIO, u32 MODEL_GENERATED_LOD_MIN_TRIANGLES, double BORDER_QUADRIC_WEIGHT,
+//	u32 level count
+//	per level: u32 vertex count, u32 index count, float error, Vertex[vertex count], u32[index count]
+#define LOD_CACHE_MAGIC 0x444F4C4D // "MLOD"
+#define LOD_CACHE_VERSION 2
+
+bool Model::loadLODCache(const std::string& cachePath, u64 sourceSize, s64 sourceTime)
+{
+	std::error_code error;
+	if (!fs::exists(Engine::workingDirectory + cachePath, error))
+		return false;
+
+	File file;
+	if (!file.open(std::string(cachePath), File::Mode(File::binary | File::in)))
+		return false;
+
+	u32 magic, version, lodCount, minTriangles, levelCount;
+	u64 cachedSize;
+	s64 cachedTime;
+	float ratio;
+	double borderWeight;
+	file.read(magic);
+	file.read(version);
+	file.read(cachedSize);
+	file.read(cachedTime);
+	file.read(lodCount);
+	file.read(ratio);
+	file.read(minTriangles);
+	file.read(borderWeight);
+	file.read(levelCount);
+
+	if (magic != LOD_CACHE_MAGIC || version != LOD_CACHE_VERSION || cachedSize != sourceSize || cachedTime != sourceTime)
+		return false;
+
+	// Levels simplified with other settings are stale too
+	if (lodCount != MODEL_GENERATED_LOD_COUNT || ratio != MODEL_GENERATED_LOD_RATIO || minTriangles != MODEL_GENERATED_LOD_MIN_TRIANGLES || borderWeight != BORDER_QUADRIC_WEIGHT)
+		return false;
+
+	for (u32 i = 0; i < levelCount; ++i)
+	{
+		modelLODs.push_back(TriangleMesh());
+		TriangleMesh& triList = modelLODs.back();
+
+		float error;
+		file.read(triList.vertexDataLength);
+		file.read(triList.indexDataLength);
+		file.read(error);
+
+		triList.vertexData = new Vertex[triList.vertexDataLength];
+		triList.indexData = new u32[triList.indexDataLength];
+		file.readArray(triList.vertexData, triList.vertexDataLength);
+		file.readArray(triList.indexData, triList.indexDataLength);
+
+		lodErrors.push_back(error);
+	}
+
+	if (file.atEOF())
+	{
+		DBG_WARNING("Truncated LOD cache " << cachePath);
+		for (u32 i = 0; i < levelCount; ++i)
+		{
+			delete[] modelLODs.back().vertexData;
+			delete[] modelLODs.back().indexData;
+			modelLODs.pop_back();
+		}
+		lodErrors = { 0.f };
+		return false;
+	}
+
+	return true;
+}
+
+void Model::saveLODCache(const std::string& cachePath, u64 sourceSize, s64 sourceTime)
+{
+	std::error_code error;
+	fs::create_directories(fs::path(Engine::workingDirectory + cachePath).parent_path(), error);
+
+	File file;
+	if (!file.create(std::string(cachePath), File::Mode(File::binary | File::out | File::trunc)))
+	{
+		DBG_WARNING("Could not write LOD cache " << cachePath);
+		return;
+	}
+
+	file.write<u32>(LOD_CACHE_MAGIC);
+	file.write<u32>(LOD_CACHE_VERSION);
+	file.write<u64>(sourceSize);
+	file.write<s64>(sourceTime);
+	file.write<u32>(MODEL_GENERATED_LOD_COUNT);
+	file.write<float>(MODEL_GENERATED_LOD_RATIO);
+	file.write<u32>(MODEL_GENERATED_LOD_MIN_TRIANGLES);
+	file.write<double>(BORDER_QUADRIC_WEIGHT);
+	file.write<u32>(u32(modelLODs.size() - 1));
+
+	for (u32 i = 1; i < modelLODs.size(); ++i)
+	{
+		auto& triList = modelLODs[i];
+		file.write<u32>(triList.vertexDataLength);
+		file.write<u32>(triList.indexDataLength);
+		file.write<float>(lodErrors[i]);
+		file.writeArray(triList.vertexData, triList.vertexDataLength);
+		file.writeArray(triList.indexData, triList.indexDataLength);
+	}
+}
+
+u32 Model::selectLOD(float pixelsPerUnit, u32 currentLOD, float errorThreshold, float hysteresis) const
+{
+	if (lodErrors.empty())
+		return 0;
+
+	u32 lod = glm::min(currentLOD, u32(lodErrors.size() - 1));
+
+	// Coarsen while the next LOD is comfortably under the threshold, refine while this one is clearly over it
+	while (lod + 1 < lodErrors.size() && lodErrors[lod + 1] * pixelsPerUnit <= errorThreshold * (1.f - hysteresis))
+		++lod;
+	while (lod > 0 && lodErrors[lod] * pixelsPerUnit > errorThreshold * (1.f + hysteresis))
+		--lod;
+
+	return lod;
+}
+
 void Model::loadToGPU(void * pCreateStruct)
 {
 	availability |= LOADING_TO_GPU;
 	Engine::threading->pushingModelToGPUMutex.lock();
-	Engine::renderer->pushModelDataToGPU(*this);
-	availability |= ON_GPU;
+	bool pushed = Engine::renderer->pushModelDataToGPU(*this);
+	if (pushed)
+		availability |= ON_GPU;
 	availability &= ~LOADING_TO_GPU;
 	Engine::threading->pushingModelToGPUMutex.unlock();
 
+	if (!pushed)
+		return;
+
+	Engine::world.membershipChanged(); // Instances of this model can now be drawn
+
 	material->loadToGPU();
 }
 
+void Model::cleanupGPU()
+{
+	Engine::threading->pushingModelToGPUMutex.lock();
+	Engine::renderer->freeModelDataFromGPU(*this);
+	availability &= ~ON_GPU;
+	Engine::threading->pushingModelToGPUMutex.unlock();
+
+	Engine::world.membershipChanged(); // Instances of this model can no longer be drawn
+}
+
 void ModelInstance::setModel(Model * m)
 {
 	material = m->material;
 	model = m;
+	++changeVersion;
 }
 
 void ModelInstance::setMaterial(Material* pMaterial)
 {
 	material = pMaterial;
+	++changeVersion;
 
 	auto loadJobFunc = std::bind([](Material* m) -> void {
 		m->loadToRAM();
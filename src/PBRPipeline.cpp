@@ -11,6 +11,7 @@ void Renderer::createPBRAttachments()
 	tci.layout = VK_IMAGE_LAYOUT_GENERAL;
 	//tci.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 	tci.usageFlags = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	tci.aliased = true;
 
 	pbrOutput.loadToGPU(&tci);
 }
@@ -46,155 +47,182 @@ void Renderer::createPBRPipeline()
 	pbrPipelineLayout.addDescriptorSetLayout(&pbrDescriptorSetLayout);
 	pbrPipelineLayout.create(&logicalDevice);
 
+	// The tile's point and spot light lists are u32 arrays in shared memory, next to a few counters
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(Engine::physicalDevice->getHandle(), &properties);
+	u32 sharedMemoryLights = (properties.limits.maxComputeSharedMemorySize - 64) / (2 * sizeof(u32));
+
 	pbrPipeline.setShaderProgram(&pbrShader);
-	pbrPipeline.setPipelineLayout(&pbrPipelineLayout);
-	pbrPipeline.create(&logicalDevice);
+	pbrPipeline.setPipelineLayout(pbrPipelineLayout.getHandle());
+	pbrPipeline.setSpecializationConstant(0, std::min(u32(PBR_MAX_LIGHTS_PER_TILE), sharedMemoryLights));
+	pbrPipeline.create(&logicalDevice, pipelineCache);
 }
 
 void Renderer::createPBRDescriptorSets()
 {
-	pbrDescriptorSet.allocate(&logicalDevice, &pbrDescriptorSetLayout, &descriptorPool);
+	for (auto& set : pbrDescriptorSet)
+		set.allocate(&logicalDevice, &pbrDescriptorSetLayout, &descriptorPool);
 }
 
 void Renderer::updatePBRDescriptorSets(GBufferAttachments& gbAtt)
 {
-	auto defaultUpdater = pbrDescriptorSet.makeUpdater();
+	// Each frame slot's set reads that slot's copies of the camera and light buffers
+	for (u32 frame = 0; frame < FRAMES_IN_FLIGHT; ++frame)
+	{
+		auto& set = pbrDescriptorSet[frame];
 
-	auto pointLightsUpdater = defaultUpdater->addBufferUpdate("point_lights");
-	*pointLightsUpdater = { lightManager.pointLightsBuffer.getHandle(), 0, 150 * sizeof(PointLight::GPUData) };
+		auto defaultUpdater = set.makeUpdater();
 
-	auto pointShadowsUpdater = defaultUpdater->addImageUpdate("point_shadows", 0, 150);
-	for (int i = 0; i < 150; ++i)
-	{
-		pointShadowsUpdater[i] = { shadowSampler, Engine::assets.getTexture("blankCube")->getView(), VK_IMAGE_LAYOUT_GENERAL };
-	}
+		auto pointLightsUpdater = defaultUpdater->addBufferUpdate("point_lights");
+		*pointLightsUpdater = { lightManager.pointLightsBuffer.getHandle(frame), 0, 150 * sizeof(PointLight::GPUData) };
 
-	auto spotLightsUpdater = defaultUpdater->addBufferUpdate("spot_lights");
-	*spotLightsUpdater = { lightManager.spotLightsBuffer.getHandle(), 0, 150 * sizeof(SpotLight::GPUData) };
+		auto pointShadowsUpdater = defaultUpdater->addImageUpdate("point_shadows", 0, 150);
+		for (int i = 0; i < 150; ++i)
+		{
+			pointShadowsUpdater[i] = { shadowSampler, Engine::assets.getTexture("blankCube")->getView(), VK_IMAGE_LAYOUT_GENERAL };
+		}
 
-	auto spotShadowsUpdater = defaultUpdater->addImageUpdate("spot_shadows", 0, 150);
-	for (int i = 0; i < 150; ++i)
-	{
-		spotShadowsUpdater[i] = { shadowSampler, Engine::assets.getTexture("blank")->getView(), VK_IMAGE_LAYOUT_GENERAL };
-	}
+		auto spotLightsUpdater = defaultUpdater->addBufferUpdate("spot_lights");
+		*spotLightsUpdater = { lightManager.spotLightsBuffer.getHandle(frame), 0, 150 * sizeof(SpotLight::GPUData) };
 
-	auto sunLightUpdater = defaultUpdater->addBufferUpdate("sun_light");
-	*sunLightUpdater = { lightManager.sunLightBuffer.getHandle(), 0, sizeof(SunLight::GPUData) };
+		auto spotShadowsUpdater = defaultUpdater->addImageUpdate("spot_shadows", 0, 150);
+		for (int i = 0; i < 150; ++i)
+		{
+			spotShadowsUpdater[i] = { shadowSampler, Engine::assets.getTexture("blank")->getView(), VK_IMAGE_LAYOUT_GENERAL };
+		}
 
-	auto sunShadowUpdater = defaultUpdater->addImageUpdate("sun_shadow", 0, 3);
-	for (int i = 0; i < 3; ++i)
-	{
-		sunShadowUpdater[i] = { shadowSampler, Engine::assets.getTexture("blank")->getView(), VK_IMAGE_LAYOUT_GENERAL };
-	}
+		auto sunLightUpdater = defaultUpdater->addBufferUpdate("sun_light");
+		*sunLightUpdater = { lightManager.sunLightBuffer.getHandle(frame), 0, sizeof(SunLight::GPUData) };
 
-	pbrDescriptorSet.submitUpdater(defaultUpdater);
-	pbrDescriptorSet.destroyUpdater(defaultUpdater);
+		auto sunShadowUpdater = defaultUpdater->addImageUpdate("sun_shadow", 0, 3);
+		for (int i = 0; i < 3; ++i)
+		{
+			sunShadowUpdater[i] = { shadowSampler, Engine::assets.getTexture("blank")->getView(), VK_IMAGE_LAYOUT_GENERAL };
+		}
 
-	auto updater = pbrDescriptorSet.makeUpdater();
+		set.submitUpdater(defaultUpdater);
+		set.destroyUpdater(defaultUpdater);
 
-	auto outputUpdater = updater->addImageUpdate("output");
-	*outputUpdater = { textureSampler, pbrOutput.getView(), VK_IMAGE_LAYOUT_GENERAL };
+		auto updater = set.makeUpdater();
 
-	/*auto albedoUpdater = updater->addImageUpdate("albedo");
-	*albedoUpdater = { textureSampler, gBufferColourAttachment.getView(), VK_IMAGE_LAYOUT_GENERAL };
-	
-	auto normalUpdater = updater->addImageUpdate("normal");
-	*normalUpdater = { textureSampler, gBufferNormalAttachment.getView(), VK_IMAGE_LAYOUT_GENERAL };
-	
-	auto pbrUpdater = updater->addImageUpdate("pbr");
-	*pbrUpdater = { textureSampler, gBufferPBRAttachment.getView(), VK_IMAGE_LAYOUT_GENERAL };
+		auto outputUpdater = updater->addImageUpdate("output");
+		*outputUpdater = { textureSampler, pbrOutput.getView(), VK_IMAGE_LAYOUT_GENERAL };
 
-	auto depthUpdater = updater->addImageUpdate("depth");
-	*depthUpdater = { textureSampler, gBufferDepthAttachment.getView(), VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };*/
+		/*auto albedoUpdater = updater->addImageUpdate("albedo");
+		*albedoUpdater = { textureSampler, gBufferColourAttachment.getView(), VK_IMAGE_LAYOUT_GENERAL };
+		
+		auto normalUpdater = updater->addImageUpdate("normal");
+		*normalUpdater = { textureSampler, gBufferNormalAttachment.getView(), VK_IMAGE_LAYOUT_GENERAL };
+		
+		auto pbrUpdater = updater->addImageUpdate("pbr");
+		*pbrUpdater = { textureSampler, gBufferPBRAttachment.getView(), VK_IMAGE_LAYOUT_GENERAL };
 
-	auto albedoUpdater = updater->addImageUpdate("albedo");
-	*albedoUpdater = { textureSampler, gbAtt.albedo->getView(), VK_IMAGE_LAYOUT_GENERAL };
+		auto depthUpdater = updater->addImageUpdate("depth");
+		*depthUpdater = { textureSampler, gBufferDepthAttachment.getView(), VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };*/
 
-	auto normalUpdater = updater->addImageUpdate("normal");
-	*normalUpdater = { textureSampler, gbAtt.normal->getView(), VK_IMAGE_LAYOUT_GENERAL };
+		auto albedoUpdater = updater->addImageUpdate("albedo");
+		*albedoUpdater = { textureSampler, gbAtt.albedo->getView(), VK_IMAGE_LAYOUT_GENERAL };
 
-	auto pbrUpdater = updater->addImageUpdate("pbr");
-	*pbrUpdater = { textureSampler, gbAtt.pbr->getView(), VK_IMAGE_LAYOUT_GENERAL };
+		auto normalUpdater = updater->addImageUpdate("normal");
+		*normalUpdater = { textureSampler, gbAtt.normal->getView(), VK_IMAGE_LAYOUT_GENERAL };
 
-	auto depthUpdater = updater->addImageUpdate("depth");
-	*depthUpdater = { textureSampler, gbAtt.depth->getView(), VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };
+		auto pbrUpdater = updater->addImageUpdate("pbr");
+		*pbrUpdater = { textureSampler, gbAtt.pbr->getView(), VK_IMAGE_LAYOUT_GENERAL };
 
-	auto skyboxUpdater = updater->addImageUpdate("skybox");
-	*skyboxUpdater = { skySampler, Engine::assets.getTexture("blankCube")->getView(), VK_IMAGE_LAYOUT_GENERAL };
+		auto depthUpdater = updater->addImageUpdate("depth");
+		*depthUpdater = { textureSampler, gbAtt.depth->getView(), VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };
 
-	auto ssaoUpdater = updater->addImageUpdate("ssao");
-	*ssaoUpdater = { textureSampler, ssaoFinalAttachment.getView(), VK_IMAGE_LAYOUT_GENERAL };
+		// The skybox once it is loaded, updateSkyboxDescriptor writes it when it arrives later
+		auto skybox = Engine::world.skybox;
+		auto skyboxUpdater = updater->addImageUpdate("skybox");
+		if (skybox && skybox->checkAvailability(Asset::ON_GPU) && !skybox->checkAvailability(Asset::AWAITING_DESCRIPTOR_UPDATE))
+			*skyboxUpdater = { skySampler, skybox->getView(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+		else
+			*skyboxUpdater = { skySampler, Engine::assets.getTexture("blankCube")->getView(), VK_IMAGE_LAYOUT_GENERAL };
 
-	auto lightCountsUpdater = updater->addBufferUpdate("light_counts");
-	*lightCountsUpdater = { lightManager.lightCountsBuffer.getHandle(), 0, 2 * sizeof(u32) };
+		auto ssaoUpdater = updater->addImageUpdate("ssao");
+		*ssaoUpdater = { textureSampler, ssaoFinalAttachment.getView(), VK_IMAGE_LAYOUT_GENERAL };
 
-	auto cameraUpdater = updater->addBufferUpdate("camera");
-	*cameraUpdater = { cameraUBO.getHandle(), 0, sizeof(CameraUBOData) };
+		auto lightCountsUpdater = updater->addBufferUpdate("light_counts");
+		*lightCountsUpdater = { lightManager.lightCountsBuffer.getHandle(frame), 0, 2 * sizeof(u32) };
 
-	if (lightManager.pointLights.size())
-	{
-		auto pointLightsUpdater = updater->addBufferUpdate("point_lights");
-		*pointLightsUpdater = { lightManager.pointLightsBuffer.getHandle(), 0, lightManager.pointLights.size() * sizeof(PointLight::GPUData) };
+		auto cameraUpdater = updater->addBufferUpdate("camera");
+		*cameraUpdater = { cameraUBO.getHandle(frame), 0, sizeof(CameraUBOData) };
 
-		auto pointShadowsUpdater = updater->addImageUpdate("point_shadows", 0, lightManager.pointLights.size());
-		int i = 0;
-		for (auto& s : lightManager.pointLights)
+		if (lightManager.pointLights.size())
 		{
-			pointShadowsUpdater[i] = { shadowSampler, s.getShadowTexture()->getView(), VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };
-			++i;
+			auto pointLightsUpdater = updater->addBufferUpdate("point_lights");
+			*pointLightsUpdater = { lightManager.pointLightsBuffer.getHandle(frame), 0, lightManager.pointLights.size() * sizeof(PointLight::GPUData) };
+
+			auto pointShadowsUpdater = updater->addImageUpdate("point_shadows", 0, lightManager.pointLights.size());
+			int i = 0;
+			for (auto& s : lightManager.pointLights)
+			{
+				pointShadowsUpdater[i] = { shadowSampler, s.getShadowTexture()->getView(), VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };
+				++i;
+			}
 		}
-	}
 
-	if (lightManager.spotLights.size())
-	{
-		auto spotLightsUpdater = updater->addBufferUpdate("spot_lights");
-		*spotLightsUpdater = { lightManager.spotLightsBuffer.getHandle(), 0, lightManager.spotLights.size() * sizeof(SpotLight::GPUData) };
-
-		auto spotShadowsUpdater = updater->addImageUpdate("spot_shadows", 0, lightManager.spotLights.size());
-		int i = 0;
-		for (auto& s : lightManager.spotLights)
+		if (lightManager.spotLights.size())
 		{
-			spotShadowsUpdater[i] = { shadowSampler, s.getShadowTexture()->getView(), VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };
-			++i;
+			auto spotLightsUpdater = updater->addBufferUpdate("spot_lights");
+			*spotLightsUpdater = { lightManager.spotLightsBuffer.getHandle(frame), 0, lightManager.spotLights.size() * sizeof(SpotLight::GPUData) };
+
+			auto spotShadowsUpdater = updater->addImageUpdate("spot_shadows", 0, lightManager.spotLights.size());
+			int i = 0;
+			for (auto& s : lightManager.spotLights)
+			{
+				spotShadowsUpdater[i] = { shadowSampler, s.getShadowTexture()->getView(), VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };
+				++i;
+			}
 		}
-	}
 
-	if (lightManager.sunLight.shadowTex)
-	{
-		auto sunLightUpdater = updater->addBufferUpdate("sun_light");
-		*sunLightUpdater = { lightManager.sunLightBuffer.getHandle(), 0, sizeof(SunLight::GPUData) };
-
-		auto sunShadowUpdater = updater->addImageUpdate("sun_shadow", 0, 3);
-		for (int i = 0; i < 3; ++i)
+		if (lightManager.sunLight.shadowTex)
 		{
-			sunShadowUpdater[i] = { shadowSampler, lightManager.sunLight.getShadowTexture()[i].getView(), VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };
+			auto sunLightUpdater = updater->addBufferUpdate("sun_light");
+			*sunLightUpdater = { lightManager.sunLightBuffer.getHandle(frame), 0, sizeof(SunLight::GPUData) };
+
+			auto sunShadowUpdater = updater->addImageUpdate("sun_shadow", 0, 3);
+			for (int i = 0; i < 3; ++i)
+			{
+				sunShadowUpdater[i] = { shadowSampler, lightManager.sunLight.getShadowTexture()[i].getView(), VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };
+			}
 		}
+		
+		set.submitUpdater(updater);
+		set.destroyUpdater(updater);
 	}
-	
-	pbrDescriptorSet.submitUpdater(updater);
-	pbrDescriptorSet.destroyUpdater(updater);
+
+	invalidateCommands(PBR_Descriptors_Input);
 
 }
 
 void Renderer::createPBRCommands()
 {
-	pbrCommandBuffer.allocate(&logicalDevice, &commandPool);
+	for (auto& cmd : pbrCommandBuffer)
+		cmd.allocate(&logicalDevice, &commandPool);
+	pbrCommands.markStale();
 }
 
 void Renderer::updatePBRCommands()
 {
+	// Each frame's copy binds its own descriptor set, re-recorded once that set was written
+	if (!needsRecording(pbrCommands))
+		return;
+
 	VkCommandBufferBeginInfo beginInfo = {};
 	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
 
-	auto cmd = pbrCommandBuffer.getHandle();
+	auto cmd = pbrCommandBuffer[frameIndex].getHandle();
 
 	VK_CHECK_RESULT(vkBeginCommandBuffer(cmd, &beginInfo));
 
-	queryPool.cmdTimestamp(pbrCommandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, BEGIN_PBR);
+	// Its memory was used by the SSAO blur since the last frame, see createAttachments
+	setImageLayout(cmd, pbrOutput, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
 
 	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pbrPipeline.getHandle());
-	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pbrPipelineLayout.getHandle(), 0, 1, &pbrDescriptorSet.getHandle(), 0, 0);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pbrPipelineLayout.getHandle(), 0, 1, &pbrDescriptorSet[frameIndex].getHandle(), 0, 0);
 
 	vkCmdDispatch(cmd, renderResolution.width / 16, renderResolution.height / 16, 1);
 
@@ -205,8 +233,6 @@ void Renderer::updatePBRCommands()
 
 	//setImageLayout(cmd, pbrOutput, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
 
-	queryPool.cmdTimestamp(pbrCommandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, END_PBR);
-
 	VK_CHECK_RESULT(vkEndCommandBuffer(cmd));
 }
 
@@ -228,10 +254,12 @@ void Renderer::destroyPBRPipeline()
 
 void Renderer::destroyPBRDescriptorSets()
 {
-	pbrDescriptorSet.free();
+	for (auto& set : pbrDescriptorSet)
+		set.free();
 }
 
 void Renderer::destroyPBRCommands()
 {
-	pbrCommandBuffer.free();
+	for (auto& cmd : pbrCommandBuffer)
+		cmd.free();
 }
\ No newline at end of file
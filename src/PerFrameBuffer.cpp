@@ -0,0 +1,22 @@
+#include "PCH.hpp"
+#include "PerFrameBuffer.hpp"
+
+void PerFrameBuffer::create(GPUAllocator* allocator, VkBufferUsageFlags usage, VkDeviceSize size, u32 frames)
+{
+	copies.resize(frames);
+	for (auto& copy : copies)
+		copy.create(allocator, usage, size, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+}
+
+void PerFrameBuffer::destroy()
+{
+	for (auto& copy : copies)
+		copy.destroy();
+	copies.clear();
+}
+
+void PerFrameBuffer::retire(std::vector<PooledBuffer>& retired)
+{
+	retired.insert(retired.end(), copies.begin(), copies.end());
+	copies.clear();
+}
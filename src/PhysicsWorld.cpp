@@ -69,16 +69,22 @@ void PhysicsWorld::updateAddedObjects()
 void PhysicsWorld::updateModels()
 {
 	auto tIndex = ModelInstance::toEngineTransformIndex;
+	auto prevIndex = tIndex == 0 ? 1 : 0;
 
 	btTransform t;
 	for (auto o : objects)
 	{
+		auto instance = o->instance;
 		o->rigidBody->getMotionState()->getWorldTransform(t);
 		btQuaternion q = t.getRotation();
 		btVector3 p = t.getOrigin();
-		o->instance->transform[tIndex].setTranslation(glm::fvec3(p.x(), p.y(), p.z()));
-		o->instance->transform[tIndex].setQuat(glm::fquat(q.w(), q.x(), q.y(), q.z()));
-		o->instance->transform[tIndex].updateMatrix();
+		instance->transform[tIndex].setTranslation(glm::fvec3(p.x(), p.y(), p.z()));
+		instance->transform[tIndex].setQuat(glm::fquat(q.w(), q.x(), q.y(), q.z()));
+		instance->transform[tIndex].updateMatrix();
+
+		// Sleeping or static bodies keep their version so they are not re-culled or re-uploaded
+		if (instance->transform[tIndex].getTransformMat() != instance->transform[prevIndex].getTransformMat())
+			++instance->changeVersion;
 	}
 
 	ModelInstance::toEngineTransformIndex = tIndex == 0 ? 1 : 0;
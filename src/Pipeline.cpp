@@ -0,0 +1,206 @@
+#include "PCH.hpp"
+#include "Pipeline.hpp"
+#include "ShaderSpecs.hpp"
+
+void SpecializationConstants::set(u32 id, u32 value)
+{
+	for (auto& entry : entries)
+	{
+		if (entry.constantID == id)
+		{
+			data[entry.offset / sizeof(u32)] = value;
+			return;
+		}
+	}
+
+	entries.push_back({ id, u32(data.size() * sizeof(u32)), sizeof(u32) });
+	data.push_back(value);
+}
+
+void SpecializationConstants::set(u32 id, float value)
+{
+	u32 bits;
+	memcpy(&bits, &value, sizeof(bits));
+	set(id, bits);
+}
+
+const VkSpecializationInfo* SpecializationConstants::getInfo()
+{
+	if (entries.empty())
+		return nullptr;
+
+	info.mapEntryCount = u32(entries.size());
+	info.pMapEntries = entries.data();
+	info.dataSize = data.size() * sizeof(u32);
+	info.pData = data.data();
+	return &info;
+}
+
+GraphicsPipeline::GraphicsPipeline() : device(VK_NULL_HANDLE), pipeline(VK_NULL_HANDLE)
+{
+	reset();
+}
+
+void GraphicsPipeline::addViewport(const VkViewport& viewport, const VkRect2D& scissor)
+{
+	viewports.push_back(viewport);
+	scissors.push_back(scissor);
+}
+
+void GraphicsPipeline::setRenderPass(VkRenderPass pRenderPass, u32 colourAttachmentCount)
+{
+	renderPass = pRenderPass;
+
+	VkPipelineColorBlendAttachmentState noBlend = {};
+	noBlend.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+	noBlend.blendEnable = VK_FALSE;
+	colourBlendStates.assign(colourAttachmentCount, noBlend);
+}
+
+void GraphicsPipeline::create(vdu::LogicalDevice* logicalDevice, VkPipelineCache cache)
+{
+	device = logicalDevice->getHandle();
+	build(cache);
+}
+
+VkPipeline GraphicsPipeline::recreate(VkPipelineCache cache)
+{
+	VkPipeline old = pipeline;
+	build(cache);
+	return old;
+}
+
+void GraphicsPipeline::build(VkPipelineCache cache)
+{
+	auto stages = shader->getStages();
+	for (auto& stage : stages)
+		stage.pSpecializationInfo = specialization.getInfo();
+
+	VkPipelineVertexInputStateCreateInfo vertexInput = {};
+	vertexInput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	if (vertexInputState)
+	{
+		vertexInput.vertexBindingDescriptionCount = u32(vertexInputState->getBindings().size());
+		vertexInput.pVertexBindingDescriptions = vertexInputState->getBindings().data();
+		vertexInput.vertexAttributeDescriptionCount = u32(vertexInputState->getAttributes().size());
+		vertexInput.pVertexAttributeDescriptions = vertexInputState->getAttributes().data();
+	}
+
+	VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+	inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+	VkPipelineViewportStateCreateInfo viewportState = {};
+	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewportState.viewportCount = u32(viewports.size());
+	viewportState.pViewports = viewports.data();
+	viewportState.scissorCount = u32(scissors.size());
+	viewportState.pScissors = scissors.data();
+
+	VkPipelineRasterizationStateCreateInfo rasterizer = {};
+	rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterizer.lineWidth = 1.f;
+	rasterizer.cullMode = cullMode;
+	rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+
+	VkPipelineMultisampleStateCreateInfo multisampling = {};
+	multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+	VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+	depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	depthStencil.depthTestEnable = depthTest;
+	depthStencil.depthWriteEnable = depthTest;
+	depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+	depthStencil.minDepthBounds = 0.f;
+	depthStencil.maxDepthBounds = maxDepthBounds;
+
+	VkPipelineColorBlendStateCreateInfo colourBlending = {};
+	colourBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	colourBlending.logicOpEnable = VK_FALSE;
+	colourBlending.attachmentCount = u32(colourBlendStates.size());
+	colourBlending.pAttachments = colourBlendStates.data();
+
+	VkPipelineDynamicStateCreateInfo dynamicState = {};
+	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicState.dynamicStateCount = u32(dynamicStates.size());
+	dynamicState.pDynamicStates = dynamicStates.data();
+
+	VkGraphicsPipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipelineInfo.stageCount = u32(stages.size());
+	pipelineInfo.pStages = stages.data();
+	pipelineInfo.pVertexInputState = &vertexInput;
+	pipelineInfo.pInputAssemblyState = &inputAssembly;
+	pipelineInfo.pViewportState = &viewportState;
+	pipelineInfo.pRasterizationState = &rasterizer;
+	pipelineInfo.pMultisampleState = &multisampling;
+	pipelineInfo.pDepthStencilState = &depthStencil;
+	pipelineInfo.pColorBlendState = &colourBlending;
+	pipelineInfo.pDynamicState = dynamicStates.size() ? &dynamicState : nullptr;
+	pipelineInfo.layout = layout;
+	pipelineInfo.renderPass = renderPass;
+	pipelineInfo.subpass = 0;
+
+	VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, cache, 1, &pipelineInfo, nullptr, &pipeline));
+}
+
+void GraphicsPipeline::destroy()
+{
+	if (pipeline != VK_NULL_HANDLE)
+		vkDestroyPipeline(device, pipeline, nullptr);
+	pipeline = VK_NULL_HANDLE;
+
+	reset();
+}
+
+void GraphicsPipeline::reset()
+{
+	shader = nullptr;
+	vertexInputState = nullptr;
+	layout = VK_NULL_HANDLE;
+	renderPass = VK_NULL_HANDLE;
+	viewports.clear();
+	scissors.clear();
+	colourBlendStates.clear();
+	dynamicStates.clear();
+	depthTest = VK_TRUE;
+	maxDepthBounds = 1.f;
+	cullMode = VK_CULL_MODE_NONE;
+	specialization.clear();
+}
+
+void ComputePipeline::create(vdu::LogicalDevice* logicalDevice, VkPipelineCache cache)
+{
+	device = logicalDevice->getHandle();
+	build(cache);
+}
+
+VkPipeline ComputePipeline::recreate(VkPipelineCache cache)
+{
+	VkPipeline old = pipeline;
+	build(cache);
+	return old;
+}
+
+void ComputePipeline::build(VkPipelineCache cache)
+{
+	VkComputePipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage = shader->getStages().front();
+	pipelineInfo.stage.pSpecializationInfo = specialization.getInfo();
+	pipelineInfo.layout = layout;
+
+	VK_CHECK_RESULT(vkCreateComputePipelines(device, cache, 1, &pipelineInfo, nullptr, &pipeline));
+}
+
+void ComputePipeline::destroy()
+{
+	if (pipeline != VK_NULL_HANDLE)
+		vkDestroyPipeline(device, pipeline, nullptr);
+	pipeline = VK_NULL_HANDLE;
+
+	specialization.clear();
+}
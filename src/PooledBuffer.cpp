@@ -0,0 +1,39 @@
+#include "PCH.hpp"
+#include "PooledBuffer.hpp"
+
+void PooledBuffer::create(GPUAllocator* pAllocator, VkBufferUsageFlags usage, VkDeviceSize pSize, VkMemoryPropertyFlags memoryProperties, bool dedicated)
+{
+	allocator = pAllocator;
+	size = pSize;
+
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;
+	bufferInfo.usage = usage;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VK_CHECK_RESULT(vkCreateBuffer(allocator->getDevice(), &bufferInfo, nullptr, &buffer));
+
+	VkMemoryRequirements requirements;
+	vkGetBufferMemoryRequirements(allocator->getDevice(), buffer, &requirements);
+
+	allocation = allocator->allocate(requirements, memoryProperties, dedicated);
+	if (!allocation.isValid())
+	{
+		DBG_SEVERE("Out of memory creating a " << size << " byte buffer");
+		return;
+	}
+
+	VK_CHECK_RESULT(vkBindBufferMemory(allocator->getDevice(), buffer, allocation.memory, allocation.offset));
+}
+
+void PooledBuffer::destroy()
+{
+	if (buffer == VK_NULL_HANDLE)
+		return;
+
+	vkDestroyBuffer(allocator->getDevice(), buffer, nullptr);
+	allocator->free(allocation);
+	buffer = VK_NULL_HANDLE;
+	size = 0;
+}
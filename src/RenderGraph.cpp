@@ -0,0 +1,570 @@
+#include "PCH.hpp"
+#include "RenderGraph.hpp"
+#include "Engine.hpp"
+#include "Profiler.hpp"
+
+RenderGraph::Resource RenderGraph::addResource(const std::string& name, ResourceType type)
+{
+	resources.push_back(name);
+	resourceTypes.push_back(type);
+	resourceMemory.push_back(Resource(resources.size() - 1));
+	return Resource(resources.size() - 1);
+}
+
+void RenderGraph::alias(Resource a, Resource b)
+{
+	Resource from = resourceMemory[a];
+	for (auto& memory : resourceMemory)
+	{
+		if (memory == from)
+			memory = resourceMemory[b];
+	}
+}
+
+RenderGraph::Resource RenderGraph::addSwapchain(const std::string& name, vdu::Swapchain* pSwapchain, std::function<void(void)> recreate)
+{
+	swapchain = pSwapchain;
+	recreateSwapchain = recreate;
+	swapchainResource = addResource(name);
+	return swapchainResource;
+}
+
+RenderGraph::Pass& RenderGraph::addPass(const std::string& name, QueueType queue)
+{
+	passes.emplace_back();
+	auto& pass = passes.back();
+	pass.name = name;
+	pass.queue = queue;
+	pass.culled = false;
+	pass.writesSwapchain = false;
+	pass.timestampQuery = 0;
+	pass.lastTime = 0;
+	return pass;
+}
+
+void RenderGraph::setQueues(vdu::Queue* graphics, vdu::Queue* compute)
+{
+	graphicsQueue = graphics;
+	computeQueue = compute;
+}
+
+void RenderGraph::compile(vdu::LogicalDevice* logicalDevice, vdu::CommandPool* commandPool, u32 pFramesInFlight)
+{
+	device = logicalDevice->getHandle();
+	framesInFlight = pFramesInFlight;
+
+	u32 passCount = u32(passes.size());
+	if (passCount > 64)
+	{
+		DBG_SEVERE("Render graph has " << passCount << " passes, at most 64 are supported");
+		return;
+	}
+
+	// Dependencies from the declared accesses, keyed by (from, to). Writers and readers are tracked per memory
+	std::map<std::pair<u32, u32>, Dependency> found;
+	std::vector<s32> lastWriter(resources.size(), -1);
+	std::vector<std::vector<u32>> readersSinceWrite(resources.size());
+
+	auto depend = [&](u32 from, u32 to, Resource resource, VkPipelineStageFlags stage) -> void {
+		auto& dependency = found[{ from, to }];
+		dependency.from = from;
+		dependency.to = to;
+		dependency.waitStage |= stage;
+		if (std::find(dependency.resources.begin(), dependency.resources.end(), resource) == dependency.resources.end())
+			dependency.resources.push_back(resource);
+	};
+
+	for (u32 i = 0; i < passCount; ++i)
+	{
+		auto& pass = passes[i];
+
+		for (auto& access : pass.reads)
+		{
+			Resource memory = resourceMemory[access.resource];
+			if (lastWriter[memory] < 0)
+				DBG_WARNING("Render pass " << pass.name << " reads " << resources[access.resource] << " before any pass writes it");
+			else
+				depend(u32(lastWriter[memory]), i, access.resource, access.stage);
+		}
+
+		for (auto& access : pass.writes)
+		{
+			Resource memory = resourceMemory[access.resource];
+			if (lastWriter[memory] >= 0 && u32(lastWriter[memory]) != i)
+				depend(u32(lastWriter[memory]), i, access.resource, access.stage);
+
+			// Readers have to be done with the old contents
+			for (auto reader : readersSinceWrite[memory])
+			{
+				if (reader != i)
+					depend(reader, i, access.resource, access.stage);
+			}
+
+			if (access.resource == swapchainResource)
+				pass.writesSwapchain = true;
+		}
+
+		for (auto& access : pass.reads)
+			readersSinceWrite[resourceMemory[access.resource]].push_back(i);
+
+		for (auto& access : pass.writes)
+		{
+			lastWriter[resourceMemory[access.resource]] = s32(i);
+			readersSinceWrite[resourceMemory[access.resource]].clear();
+		}
+	}
+
+	// Cull everything the swapchain doesn't depend on, dependencies always point to later passes so one sweep back is enough
+	for (auto& pass : passes)
+		pass.culled = !pass.writesSwapchain;
+
+	for (u32 i = passCount; i-- > 0;)
+	{
+		if (passes[i].culled)
+			continue;
+
+		for (auto& entry : found)
+		{
+			if (entry.second.to == i)
+				passes[entry.second.from].culled = false;
+		}
+	}
+
+	u32 swapchainPasses = 0;
+	for (auto& pass : passes)
+	{
+		swapchainPasses += pass.writesSwapchain;
+		if (pass.culled)
+			DBG_INFO("Render pass " << pass.name << " is culled, nothing presented depends on it");
+	}
+
+	if (swapchainPasses != 1)
+		DBG_SEVERE("Render graph needs exactly one pass writing the swapchain, " << swapchainPasses << " do");
+
+	// Passes each pass depends on, directly or through others
+	std::vector<u64> reaches(passCount, 0);
+	for (auto& entry : found)
+	{
+		auto& dependency = entry.second;
+		if (!passes[dependency.from].culled && !passes[dependency.to].culled)
+			reaches[dependency.to] |= (1ull << dependency.from) | reaches[dependency.from];
+	}
+
+	// Drop dependencies implied through another dependency of the same pass. Its wait stage moves to the
+	// dependencies it is implied through, so the reader still waits before the stage that needs the data
+	std::vector<Dependency*> redundant;
+	for (auto& entry : found)
+	{
+		auto& dependency = entry.second;
+		if (passes[dependency.from].culled || passes[dependency.to].culled)
+			continue;
+
+		for (auto& other : found)
+		{
+			if (other.second.to == dependency.to && other.second.from != dependency.from && !passes[other.second.from].culled
+				&& (reaches[other.second.from] & (1ull << dependency.from)))
+			{
+				redundant.push_back(&dependency);
+				break;
+			}
+		}
+	}
+
+	for (auto& entry : found)
+	{
+		auto& dependency = entry.second;
+		if (passes[dependency.from].culled || passes[dependency.to].culled)
+			continue;
+		if (std::find(redundant.begin(), redundant.end(), &dependency) != redundant.end())
+			continue;
+
+		for (auto implied : redundant)
+		{
+			if (implied->to == dependency.to && (reaches[dependency.from] & (1ull << implied->from)))
+				dependency.waitStage |= implied->waitStage;
+		}
+
+		dependencies.push_back(dependency);
+	}
+
+	for (auto& dependency : dependencies)
+	{
+		dependency.semaphores.resize(framesInFlight);
+		for (auto& semaphore : dependency.semaphores)
+			semaphore.create(logicalDevice);
+	}
+
+	imageAvailableSemaphores.resize(framesInFlight);
+	renderFinishedSemaphores.resize(framesInFlight);
+	for (u32 i = 0; i < framesInFlight; ++i)
+	{
+		imageAvailableSemaphores[i].create(logicalDevice);
+		renderFinishedSemaphores[i].create(logicalDevice);
+	}
+
+	// Stages and queues each resource's memory is used at by the live passes
+	std::vector<VkPipelineStageFlags> memoryStages(resources.size(), 0);
+	std::vector<u32> memoryQueues(resources.size(), 0);
+	for (auto& pass : passes)
+	{
+		if (pass.culled)
+			continue;
+
+		u32 queueBit = getQueue(pass.queue) == graphicsQueue ? 1 : 2;
+		for (auto* accesses : { &pass.reads, &pass.writes })
+		{
+			for (auto& access : *accesses)
+			{
+				memoryStages[resourceMemory[access.resource]] |= access.stage;
+				memoryQueues[resourceMemory[access.resource]] |= queueBit;
+			}
+		}
+	}
+
+	for (u32 r = 0; r < resources.size(); ++r)
+	{
+		if (memoryQueues[r] == 3 && r != swapchainResource)
+			DBG_WARNING("Resource " << resources[r] << " is used on both queues, frames in flight are only ordered on one");
+	}
+
+	// Timestamps, each live pass owns two queries per frame in flight and resets them itself
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(Engine::physicalDevice->getHandle(), &properties);
+	timestampPeriod = properties.limits.timestampPeriod;
+
+	timedPassCount = 0;
+	for (auto& pass : passes)
+	{
+		if (!pass.culled)
+			pass.timestampQuery = 2 * timedPassCount++;
+	}
+
+	queryPool.setQueryCount(2 * timedPassCount * framesInFlight);
+	queryPool.setQueryType(VK_QUERY_TYPE_TIMESTAMP);
+	queryPool.create(logicalDevice);
+
+	for (auto& pass : passes)
+	{
+		if (pass.culled)
+			continue;
+
+		// The previous frame's uses of what this pass overwrites, the swapchain images are ordered by their semaphores
+		VkPipelineStageFlags srcStage = 0;
+		VkPipelineStageFlags dstStage = 0;
+		for (auto& access : pass.writes)
+		{
+			if (access.resource == swapchainResource)
+				continue;
+
+			srcStage |= memoryStages[resourceMemory[access.resource]];
+			dstStage |= resourceTypes[access.resource] == Image ? VK_PIPELINE_STAGE_ALL_COMMANDS_BIT : access.stage;
+		}
+
+		// A separate compute queue can't name the graphics stages
+		if (srcStage && getQueue(pass.queue) != graphicsQueue)
+			srcStage = dstStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+		pass.timestampBegin.resize(framesInFlight);
+		pass.timestampEnd.resize(framesInFlight);
+		pass.timed.assign(framesInFlight, false);
+
+		for (u32 i = 0; i < framesInFlight; ++i)
+		{
+			u32 query = 2 * timedPassCount * i + pass.timestampQuery;
+
+			auto& begin = pass.timestampBegin[i];
+			begin.allocate(logicalDevice, commandPool);
+			begin.begin();
+			if (srcStage)
+			{
+				VkMemoryBarrier barrier = {};
+				barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+				barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+				barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+				vkCmdPipelineBarrier(begin.getHandle(), srcStage, dstStage, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+			}
+			vkCmdResetQueryPool(begin.getHandle(), queryPool.getHandle(), query, 2);
+			vkCmdWriteTimestamp(begin.getHandle(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool.getHandle(), query);
+			begin.end();
+
+			auto& end = pass.timestampEnd[i];
+			end.allocate(logicalDevice, commandPool);
+			end.begin();
+			vkCmdWriteTimestamp(end.getHandle(), VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool.getHandle(), query + 1);
+			end.end();
+		}
+	}
+}
+
+void RenderGraph::destroy()
+{
+	for (auto& dependency : dependencies)
+	{
+		for (auto& semaphore : dependency.semaphores)
+			semaphore.destroy();
+	}
+
+	for (u32 i = 0; i < imageAvailableSemaphores.size(); ++i)
+	{
+		imageAvailableSemaphores[i].destroy();
+		renderFinishedSemaphores[i].destroy();
+	}
+
+	for (auto& pass : passes)
+	{
+		for (auto& cmd : pass.timestampBegin)
+			cmd.free();
+		for (auto& cmd : pass.timestampEnd)
+			cmd.free();
+	}
+
+	queryPool.destroy();
+
+	dependencies.clear();
+	imageAvailableSemaphores.clear();
+	renderFinishedSemaphores.clear();
+	passes.clear();
+	resources.clear();
+	resourceTypes.clear();
+	resourceMemory.clear();
+	swapchain = nullptr;
+	swapchainResource = ~0u;
+	recreateSwapchain = nullptr;
+	timedPassCount = 0;
+}
+
+bool RenderGraph::execute(u32 frame, vdu::Fence& fence)
+{
+	// Everything before the swapchain pass goes in before an image is acquired, so the GPU has work while we wait for one.
+	// Consecutive passes on one queue share a vkQueueSubmit
+	std::vector<vdu::QueueSubmission> batch;
+	vdu::Queue* batchQueue = nullptr;
+	u32 swapchainPass = ~0u;
+
+	for (u32 i = 0; i < passes.size(); ++i)
+	{
+		auto& pass = passes[i];
+		if (pass.culled)
+			continue;
+
+		if (pass.writesSwapchain)
+		{
+			swapchainPass = i;
+			continue;
+		}
+
+		auto queue = getQueue(pass.queue);
+		if (queue != batchQueue && !batch.empty())
+		{
+			VK_CHECK_RESULT(batchQueue->submit(batch));
+			batch.clear();
+		}
+
+		batchQueue = queue;
+		batch.emplace_back();
+		record(i, frame, 0, batch.back());
+	}
+
+	if (!batch.empty())
+		VK_CHECK_RESULT(batchQueue->submit(batch));
+
+	u32 imageIndex;
+	auto result = swapchain->acquireNextImage(imageIndex, imageAvailableSemaphores[frame]);
+
+	fence.reset();
+
+	if (result != VK_SUCCESS)
+	{
+		DBG_SEVERE("Could not acquire next image");
+
+		// The semaphores the swapchain pass would have waited on are still waited on, so the slot can be reused
+		vdu::QueueSubmission skipSubmission;
+		for (auto& dependency : dependencies)
+		{
+			if (dependency.to == swapchainPass)
+				skipSubmission.addWait(dependency.semaphores[frame], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+		}
+		VK_CHECK_RESULT(graphicsQueue->submit(skipSubmission, fence));
+
+		return false;
+	}
+
+	VkPipelineStageFlags swapchainStage = 0;
+	for (auto& access : passes[swapchainPass].writes)
+	{
+		if (access.resource == swapchainResource)
+			swapchainStage |= access.stage;
+	}
+
+	vdu::QueueSubmission submission;
+	submission.addWait(imageAvailableSemaphores[frame], swapchainStage);
+	record(swapchainPass, frame, imageIndex, submission);
+	submission.addSignal(renderFinishedSemaphores[frame]);
+
+	VK_CHECK_RESULT(graphicsQueue->submit(submission, fence));
+
+	vdu::QueuePresentation presentation;
+	presentation.addWait(renderFinishedSemaphores[frame]);
+	presentation.addSwapchain(*swapchain, imageIndex);
+
+	VK_CHECK_RESULT(graphicsQueue->present(presentation));
+
+	return true;
+}
+
+void RenderGraph::readTimings(u32 frame)
+{
+	for (auto& pass : passes)
+	{
+		if (pass.culled || !pass.timed[frame])
+			continue;
+
+		pass.timed[frame] = false;
+
+		u64 timestamps[2];
+		auto result = vkGetQueryPoolResults(device, queryPool.getHandle(), 2 * timedPassCount * frame + pass.timestampQuery, 2,
+			sizeof(timestamps), timestamps, sizeof(u64), VK_QUERY_RESULT_64_BIT);
+		if (result != VK_SUCCESS)
+			continue;
+
+		// The profiler takes nanoseconds
+		u64 start = u64(double(timestamps[0]) * timestampPeriod);
+		u64 end = u64(double(timestamps[1]) * timestampPeriod);
+		pass.lastTime = end - start;
+
+		PROFILE_GPU_ADD_TIME(pass.name, start, end);
+	}
+}
+
+void RenderGraph::resize()
+{
+	if (recreateSwapchain)
+		recreateSwapchain();
+
+	for (auto& pass : passes)
+	{
+		if (!pass.culled && pass.resize)
+			pass.resize();
+	}
+}
+
+bool RenderGraph::isCulled(const std::string& passName)
+{
+	for (auto& pass : passes)
+	{
+		if (pass.name == passName)
+			return pass.culled;
+	}
+	return true;
+}
+
+std::string RenderGraph::toDot()
+{
+	std::stringstream dot;
+	dot << "digraph RenderGraph {\n";
+	dot << "\trankdir=LR;\n";
+	dot << "\tnode [shape=box];\n";
+
+	for (auto& pass : passes)
+	{
+		dot << "\t\"" << pass.name << "\" [label=\"" << pass.name << "\\n" << getQueueName(pass.queue);
+		if (pass.culled)
+			dot << "\\nculled\", style=dashed];\n";
+		else
+			dot << "\\n" << std::to_string(pass.lastTime / 1e6) << " ms\"];\n";
+	}
+
+	dot << "\t\"present\" [shape=ellipse];\n";
+
+	for (auto& dependency : dependencies)
+	{
+		dot << "\t\"" << passes[dependency.from].name << "\" -> \"" << passes[dependency.to].name << "\" [label=\"";
+		for (u32 i = 0; i < dependency.resources.size(); ++i)
+			dot << (i ? ", " : "") << resources[dependency.resources[i]];
+		dot << "\"];\n";
+	}
+
+	for (auto& pass : passes)
+	{
+		if (pass.writesSwapchain && !pass.culled)
+			dot << "\t\"" << pass.name << "\" -> \"present\" [label=\"" << resources[swapchainResource] << "\"];\n";
+	}
+
+	dot << "}\n";
+	return dot.str();
+}
+
+std::string RenderGraph::toJSON()
+{
+	auto accessList = [this](const std::vector<Access>& accesses) -> std::string {
+		std::string list;
+		for (auto& access : accesses)
+		{
+			if (!list.empty())
+				list += ", ";
+			list += "{ \"resource\": \"" + resources[access.resource] + "\", \"stage\": " + std::to_string(access.stage) + " }";
+		}
+		return "[" + list + "]";
+	};
+
+	std::stringstream json;
+	json << "{\n\t\"passes\": [\n";
+
+	for (u32 i = 0; i < passes.size(); ++i)
+	{
+		auto& pass = passes[i];
+		json << "\t\t{ \"name\": \"" << pass.name << "\", \"queue\": \"" << getQueueName(pass.queue) << "\", \"culled\": " << (pass.culled ? "true" : "false")
+			<< ", \"gpuTimeNs\": " << pass.lastTime << ", \"reads\": " << accessList(pass.reads) << ", \"writes\": " << accessList(pass.writes) << " }"
+			<< (i + 1 < passes.size() ? "," : "") << "\n";
+	}
+
+	json << "\t],\n\t\"dependencies\": [\n";
+
+	for (u32 i = 0; i < dependencies.size(); ++i)
+	{
+		auto& dependency = dependencies[i];
+		json << "\t\t{ \"from\": \"" << passes[dependency.from].name << "\", \"to\": \"" << passes[dependency.to].name
+			<< "\", \"waitStage\": " << dependency.waitStage << ", \"resources\": [";
+		for (u32 r = 0; r < dependency.resources.size(); ++r)
+			json << (r ? ", " : "") << "\"" << resources[dependency.resources[r]] << "\"";
+		json << "] }" << (i + 1 < dependencies.size() ? "," : "") << "\n";
+	}
+
+	json << "\t]\n}\n";
+	return json.str();
+}
+
+void RenderGraph::record(u32 passIndex, u32 frame, u32 imageIndex, vdu::QueueSubmission& submission)
+{
+	auto& pass = passes[passIndex];
+
+	for (auto& dependency : dependencies)
+	{
+		if (dependency.to == passIndex)
+			submission.addWait(dependency.semaphores[frame], dependency.waitStage);
+	}
+
+	submission.addCommands(&pass.timestampBegin[frame]);
+	pass.commands(frame, imageIndex, submission);
+	submission.addCommands(&pass.timestampEnd[frame]);
+
+	for (auto& dependency : dependencies)
+	{
+		if (dependency.from == passIndex)
+			submission.addSignal(dependency.semaphores[frame]);
+	}
+
+	pass.timed[frame] = true;
+}
+
+vdu::Queue* RenderGraph::getQueue(QueueType type)
+{
+	if (type == Compute && computeQueue)
+		return computeQueue;
+	return graphicsQueue;
+}
+
+std::string RenderGraph::getQueueName(QueueType type)
+{
+	return type == Compute && computeQueue ? "compute" : "graphics";
+}
@@ -7,11 +7,13 @@
 #include "Profiler.hpp"
 
 thread_local vdu::CommandPool Renderer::commandPool;
+thread_local vdu::CommandPool Renderer::transferCommandPool;
 thread_local std::unordered_map<vdu::Fence*, std::function<void(void)>> Renderer::fenceDelayedActions;
 
 void Renderer::initialiseDevice()
 {
 	createLogicalDevice();
+	gpuAllocator.create(&logicalDevice);
 }
 
 /*
@@ -19,11 +21,21 @@ void Renderer::initialiseDevice()
 */
 void Renderer::initialise()
 {
-	// Memory pools, samplers, and semaphores
+	// Memory pools, samplers, and fences
 	createDescriptorPool();
-	createQueryPool();
+	createMaterialTexturePool();
 	createTextureSampler();
 	createSynchroObjects();
+	if (hasReBarMemory())
+	{
+		DBG_INFO("Host visible VRAM found, placing the staging ring in device local memory");
+		stagingRing.create(&gpuAllocator, STAGING_RING_SIZE, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	}
+	else
+	{
+		stagingRing.create(&gpuAllocator, STAGING_RING_SIZE);
+	}
+	createFrameCommands();
 
 	lightManager.init();
 
@@ -39,24 +51,27 @@ void Renderer::initialise()
 	uiRenderer.vertexInputState.addBinding(VertexNoNormal::getBindingDescription());
 	uiRenderer.vertexInputState.addAttributes(VertexNoNormal::getAttributeDescriptions());
 
+	createPipelineCache();
+
 	// Shaders
 	createShaders();
 	compileShaders();
+	shaderWatcher.create(Engine::workingDirectory + "/res/shaders");
 
 	// Screen
 	{
 		createScreenDescriptorSetLayouts();
 		createScreenSwapchain();
-		createScreenPipeline();
 		createScreenDescriptorSets();
 		createScreenCommands();
 	}
 
+	// Every pass's attachments at once, so their memory can be shared
+	createAttachments();
+
 	// PBR
 	{
-		createPBRAttachments();
 		createPBRDescriptorSetLayouts();
-		createPBRPipeline();
 		createPBRDescriptorSets();
 		createPBRCommands();
 	}
@@ -66,51 +81,46 @@ void Renderer::initialise()
 	{
 		createShadowDescriptorSetLayouts();
 		createShadowRenderPass();
-		createShadowPipeline();
 		createShadowDescriptorSets();
 		createShadowCommands();
 	}
 
 	// SSAO
 	{
-		createSSAOAttachments();
 		createSSAORenderPass();
 		createSSAODescriptorSetLayouts();
-		createSSAOPipeline();
 		createSSAOFramebuffer();
 		createSSAODescriptorSets();
 		createSSAOCommands();
 	}
 
+	// Culling
+	{
+		createCullingDescriptorSetLayouts();
+		createCullingDescriptorSets();
+		createCullingCommands();
+	}
+
 	// GBuffer
 	{
-		createGBufferAttachments();
 		createGBufferRenderPass();
 		createGBufferDescriptorSetLayouts();
-		createGBufferPipeline();
 		createGBufferFramebuffers();
 		createGBufferDescriptorSets();
 		createGBufferCommands();
-
-		createGBufferNoTexAttachments();
-		createGBufferNoTexRenderPass();
-		createGBufferNoTexDescriptorSetLayouts();
-		createGBufferNoTexPipeline();
-		createGBufferNoTexFramebuffers();
-		createGBufferNoTexDescriptorSets();
-		createGBufferNoTexCommands();
 	}
 
 	// Overlays
 	{
-		uiRenderer.createOverlayAttachments();
 		uiRenderer.createOverlayRenderPass();
 		uiRenderer.createOverlayDescriptorSetLayouts();
-		uiRenderer.createOverlayPipeline();
 		uiRenderer.createOverlayFramebuffer();
 		uiRenderer.createOverlayCommands();
 	}
 
+	// Every pass's render pass, descriptor set layouts and the swapchain exist now
+	createPipelines();
+
 	createDataBuffers();
 
 	/*for (int i = 0; i < 1; ++i)
@@ -157,8 +167,7 @@ void Renderer::initialise()
 
 	lightManager.updateSunLight();
 
-	initialiseQueryPool();
-
+	createRenderGraphs();
 }
 
 /*
@@ -166,24 +175,16 @@ void Renderer::initialise()
 */
 void Renderer::cleanup()
 {
+	destroyAttachments();
+
 	// GBuffer pipeline
 	{
-		destroyGBufferAttachments();
 		destroyGBufferRenderPass();
 		destroyGBufferDescriptorSetLayouts();
 		destroyGBufferPipeline();
 		destroyGBufferFramebuffers();
 	}
 
-	// GBufferNoTex pipeline
-	{
-		destroyGBufferNoTexAttachments();
-		destroyGBufferNoTexRenderPass();
-		destroyGBufferNoTexDescriptorSetLayouts();
-		destroyGBufferNoTexPipeline();
-		destroyGBufferNoTexFramebuffers();
-	}
-
 	// Shadow pipeline
 	{
 		destroyShadowRenderPass();
@@ -193,16 +194,22 @@ void Renderer::cleanup()
 
 	// SSAO pipeline
 	{
-		destroySSAOAttachments();
+		// A variant build still uses the render pass
+		discardSSAOVariantBuild();
 		destroySSAORenderPass();
 		destroySSAODescriptorSetLayouts();
 		destroySSAOPipeline();
 		destroySSAOFramebuffer();
 	}
 
+	// Culling pipeline
+	{
+		destroyCullingDescriptorSetLayouts();
+		destroyCullingPipeline();
+	}
+
 	// PBR pipeline
 	{
-		destroyPBRAttachments();
 		destroyPBRDescriptorSetLayouts();
 		destroyPBRPipeline();
 	}
@@ -214,50 +221,60 @@ void Renderer::cleanup()
 		destroyScreenSwapchain();
 	}
 
+	// The command buffers among them go back to commandPool
+	for (u32 i = 0; i < FRAMES_IN_FLIGHT; ++i)
+		destroyRetiredObjects(i);
+
 	uiRenderer.cleanup();
 
 	descriptorPool.destroy();
 	freeableDescriptorPool.destroy();
+	destroyMaterialTexturePool();
 	commandPool.destroy();
-	queryPool.destroy();
+	transferCommandPool.destroy();
+	frameGraph.destroy();
+	consoleGraph.destroy();
+	stagingRing.destroy();
 
 	vkDestroySampler(device, textureSampler, nullptr);
 	vkDestroySampler(device, skySampler, nullptr);
 	vkDestroySampler(device, shadowSampler, nullptr);
 
-	gBufferFinishedSemaphore.destroy();
-	imageAvailableSemaphore.destroy();
-	pbrFinishedSemaphore.destroy();
-	screenFinishedSemaphore.destroy();
-	shadowFinishedSemaphore.destroy();
-	overlayFinishedSemaphore.destroy();
-	overlayCombineFinishedSemaphore.destroy();
-	ssaoFinishedSemaphore.destroy();
-
-	gBufferGroupFence.destroy();
-	pbrGroupFence.destroy();
+	for (u32 i = 0; i < FRAMES_IN_FLIGHT; ++i)
+	{
+		frameFences[i].destroy();
+		for (auto& buffer : retiredBuffers[i])
+			buffer.destroy();
+		retiredBuffers[i].clear();
+	}
 
 	cameraUBO.destroy();
-	flatPBRUBO.destroy();
-	transformUBO.destroy();
+	materialRecordBuffer.destroy();
+	transformBuffer.destroy();
 	vertexIndexBuffer.destroy();
-	drawCmdBuffer.destroy();
+	destroyDrawBuffers();
+	cullViewsUBO.destroy();
+	drawCountBuffer.destroy();
 	screenQuadBuffer.destroy();
 	ssaoConfigBuffer.destroy();
 
 	lightManager.cleanup();
 
+	shaderWatcher.destroy();
 	combineOverlaysShader.destroy();
 	overlayShader.destroy();
 	ssaoShader.destroy();
 	ssaoBlurShader.destroy();
+	cullShader.destroy();
 	pointShadowShader.destroy();
 	spotShadowShader.destroy();
 	sunShadowShader.destroy();
 	gBufferShader.destroy();
-	gBufferNoTexShader.destroy();
 	pbrShader.destroy();
 	screenShader.destroy();
+	savePipelineCache();
+	destroyPipelineCache();
+	gpuAllocator.destroy();
 	logicalDevice.destroy();
 }
 
@@ -266,120 +283,25 @@ void Renderer::cleanup()
 */
 void Renderer::render()
 {
-	/*
-		Query GPU profiling data and add it to our profiler
-	*/
-	auto timestamps = queryPool.query();
-	memcpy(Engine::gpuTimeStamps, timestamps, sizeof(u64) * NUM_GPU_TIMESTAMPS);
-	
-	PROFILE_GPU_ADD_TIME("gbuffer", Engine::gpuTimeStamps[Renderer::BEGIN_GBUFFER], Engine::gpuTimeStamps[Renderer::END_GBUFFER]);
-	PROFILE_GPU_ADD_TIME("shadow", Engine::gpuTimeStamps[Renderer::BEGIN_SHADOW], Engine::gpuTimeStamps[Renderer::END_SHADOW]);
-	PROFILE_GPU_ADD_TIME("ssao", Engine::gpuTimeStamps[Renderer::BEGIN_SSAO], Engine::gpuTimeStamps[Renderer::END_SSAO]);
-	PROFILE_GPU_ADD_TIME("pbr", Engine::gpuTimeStamps[Renderer::BEGIN_PBR], Engine::gpuTimeStamps[Renderer::END_PBR]);
-	PROFILE_GPU_ADD_TIME("overlay", Engine::gpuTimeStamps[Renderer::BEGIN_UI], Engine::gpuTimeStamps[Renderer::END_UI]);
-	PROFILE_GPU_ADD_TIME("screen", Engine::gpuTimeStamps[Renderer::BEGIN_SCREEN], Engine::gpuTimeStamps[Renderer::END_SCREEN]);
-
 	PROFILE_START("submitrender");
 
 	/*
 		Submit batched vulkan commands
-	*/
-
-	std::vector<vdu::QueueSubmission> submissionsGroup1(3);
-
-	/////////////////////////////////////////
-	/*
-		GBUFFER & SHADOWS & OVERLAYS
 
-		Completing this submission allows:
-			Re-recording gBuffers commands
-			Re-recording shadow commands
-			Re-recording overlay commands
-			Updating transforms buffer
-			Updating draw commands buffer
-			Updating material descriptors
-			Updating camera buffer (If PBR is also done)
+		The frame copies write this frame's staged buffer data into the slot's copies of the buffers, which only
+		this frame's passes read. The passes' semaphores, submission order and the barriers against the previous
+		frame's use of the attachments and cull outputs come from frameGraph.
 
-		We dont need to wait to:
-			Perform frustum culling for the next frame
-
-	*/
-	/////////////////////////////////////////
-
-	submissionsGroup1[0].addCommands(&gBufferCommandBuffer);
-	//submissionsGroup1[0].addCommands(&gBufferNoTexCommandBuffer);
-	submissionsGroup1[0].addSignal(gBufferFinishedSemaphore);
-
-	submissionsGroup1[1].addCommands(&shadowCommandBuffer);
-	submissionsGroup1[1].addSignal(shadowFinishedSemaphore);
-
-	submissionsGroup1[2].addCommands(&uiRenderer.commandBuffer);
-	submissionsGroup1[2].addSignal(overlayFinishedSemaphore);
-
-	gBufferGroupFence.reset();
-	VK_CHECK_RESULT(lGraphicsQueue.submit(submissionsGroup1, gBufferGroupFence));
-
-	/////////////////////////////////////////
-	/*
-		SSAO & PBR
-
-		Completing this submission allows:
-			Re-recording pbr commands
-			Updating light buffers
-			Updating skybox descriptor
-			Updating camera buffer (If gBuffer is also done)
-
-	*/
-	/////////////////////////////////////////
-
-	std::vector<vdu::QueueSubmission> submissionsGroup2(2);
-
-	submissionsGroup2[0].addWait(gBufferFinishedSemaphore, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
-	submissionsGroup2[0].addCommands(&ssaoCommandBuffer);
-	submissionsGroup2[0].addSignal(ssaoFinishedSemaphore);
-	
-	submissionsGroup2[1].addWait(ssaoFinishedSemaphore, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
-	submissionsGroup2[1].addWait(shadowFinishedSemaphore, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
-	submissionsGroup2[1].addCommands(&pbrCommandBuffer);
-	submissionsGroup2[1].addSignal(pbrFinishedSemaphore);
-
-	pbrGroupFence.reset();
-	VK_CHECK_RESULT(lGraphicsQueue.submit(submissionsGroup2, pbrGroupFence));
-
-	/////////////////////////////////////////
-	/*
-		SCREEN
-	*/
-	/////////////////////////////////////////
-
-	u32 imageIndex;
-	auto result = screenSwapchain.acquireNextImage(imageIndex, imageAvailableSemaphore);
-
-	if (result != VK_SUCCESS) {
-		DBG_SEVERE("Could not acquire next image");
-		return;
-	}
-
-	vdu::QueueSubmission screenSubmission;
-	screenSubmission.addWait(imageAvailableSemaphore, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
-	screenSubmission.addWait(pbrFinishedSemaphore, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
-	screenSubmission.addWait(overlayFinishedSemaphore, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
-	screenSubmission.addCommands(screenCommandBuffers.getHandle(imageIndex));
-	screenSubmission.addSignal(screenFinishedSemaphore);
-
-	VK_CHECK_RESULT(lGraphicsQueue.submit(screenSubmission));
-
-	/////////////////////////////////////////
-	/*
-		PRESENT
+		Every command buffer re-recorded per frame exists once per frame slot, the CPU only re-records a slot
+		after waiting for its fence (beginFrame). Completing the frame signals the fence, which allows:
+			Re-recording this slot's command buffers
+			Reusing this slot's semaphores and staging memory
+			Releasing model data freed while the frame was recorded
 	*/
-	/////////////////////////////////////////
 
-	vdu::QueuePresentation presentation;
-	presentation.addWait(screenFinishedSemaphore);
-	presentation.addSwapchain(screenSwapchain, imageIndex);
+	recordFrameCopies();
 
-	VK_CHECK_RESULT(lGraphicsQueue.present(presentation));
+	frameGraph.execute(frameIndex, frameFences[frameIndex]);
 
 	PROFILE_END("submitrender");
 }
@@ -391,39 +313,51 @@ void Renderer::renderJob()
 	auto& threading = Engine::threading;
 	auto& world = Engine::world;
 
-	PROFILE_START("commands");
-	_this->gBufferGroupFence.wait();
-	_this->updateMaterialDescriptors();
-
-	/// TODO: choose between differnt gBuffer shaders
-	_this->updateGBufferCommands();
-	_this->updateGBufferNoTexCommands();
-	/// /////////////////////////////////////////////
+	// Only blocks if the GPU is still running the frame that last used this slot
+	PROFILE_START("framefence");
+	_this->beginFrame();
+	PROFILE_END("framefence");
 
-	_this->updateShadowCommands(); // Mutex with engine model transform update
-	PROFILE_END("commands");
+	_this->updateShaders();
 
 	_this->lightManager.sunLight.calcProjs();
+
+	PROFILE_START("culling");
 	world.frustumCulling(&Engine::camera);
+	PROFILE_END("culling");
 
-	PROFILE_START("qwaitidle");
-	_this->lGraphicsQueue.waitIdle();
-	vkDeviceWaitIdle(_this->logicalDevice.getHandle());
-	PROFILE_END("qwaitidle");
+	// Assets loaded since the last frame go up in one submission, the frame's data is staged behind it
+	_this->submitUploadBatch();
 
 	_this->updateSkyboxDescriptor();
 
+	if (_this->vertexAllocator.getFragmentation() > VERTEX_INDEX_COMPACTION_THRESHOLD || _this->indexAllocator.getFragmentation() > VERTEX_INDEX_COMPACTION_THRESHOLD)
+		_this->compactVertexIndexBuffer();
+
 	PROFILE_START("cullingdrawbuffer");
 
+	_this->streamTransforms(); // Mutex with physics transform update
 	_this->lightManager.updateSunLight();
 	_this->uiRenderer.garbageCollect();
 	_this->executeFenceDelayedActions();
 	_this->populateDrawCmdBuffer(); // Mutex with engine model transform update
-	_this->lightManager.updateShadowDrawCommands();
+	_this->updateMaterialDescriptors(); // May grow the material record buffer
+	_this->updateDrawBufferDescriptors(); // After anything that grows the draw, transform or material record buffers
 	_this->updateCameraBuffer();
+	_this->updateCullingViews();
+	_this->updateCullingCommands();
 
 	PROFILE_END("cullingdrawbuffer");
 
+	// Recorded once the draw buffers are populated, which may have grown them or changed the draw counts
+	PROFILE_START("commands");
+	_this->updateGBufferCommands();
+
+	_this->updateShadowCommands(); // Mutex with engine model transform update
+	_this->updateSSAOCommands();
+	_this->updatePBRCommands();
+	PROFILE_END("commands");
+
 	PROFILE_START("setuprender");
 
 	_this->updateConfigs();
@@ -431,7 +365,9 @@ void Renderer::renderJob()
 	PROFILE_MUTEX("transformmutex", threading->instanceTransformMutex.lock());
 	threading->instanceTransformMutex.unlock();
 	PROFILE_MUTEX("phystogpumutex", threading->physToGPUMutex.lock());
+	_this->submitUploadBatch(); // Attachments recreated by updateConfigs
 	_this->render();
+	_this->endFrame();
 	threading->physToGPUMutex.unlock();
 
 	PROFILE_END("setuprender");
@@ -442,185 +378,175 @@ void Renderer::renderJob()
 
 void Renderer::reloadShaders()
 {
-	VK_CHECK_RESULT(vkDeviceWaitIdle(device));
-
-	gBufferShader.reload();
-	screenShader.reload();
-	pbrShader.reload();
-	overlayShader.reload();
-	combineOverlaysShader.reload();
-	ssaoShader.reload();
-	ssaoBlurShader.reload();
-	pointShadowShader.reload();
-	spotShadowShader.reload();
-	sunShadowShader.reload();
-
-	compileShaders();
-
-	destroyGBufferPipeline();
-	destroyGBufferNoTexPipeline();
-	destroyPBRPipeline();
-	destroyScreenPipeline();
-	destroyShadowPipeline();
-	destroySSAOPipeline();
-	uiRenderer.destroyOverlayPipeline();
-
-	destroyGBufferCommands();
-	destroyGBufferNoTexCommands();
-	destroyPBRCommands();
-	destroyScreenCommands();
-	destroyShadowCommands();
-	destroySSAOCommands();
-	uiRenderer.destroyOverlayCommands();
-
-	createGBufferPipeline();
-	createGBufferNoTexPipeline();
-	createPBRPipeline();
-	createScreenPipeline();
-	createShadowPipeline();
-	createSSAOPipeline();
-	uiRenderer.createOverlayPipeline();
-
-	createGBufferCommands();
-	createGBufferNoTexCommands();
-	createPBRCommands();
-	createScreenCommands();
-	createShadowCommands();
-	createSSAOCommands();
-	uiRenderer.createOverlayCommands();
-
-	updateGBufferCommands();
-	updateGBufferNoTexCommands();
-	updatePBRCommands();
-	updateScreenCommands();
-	updateShadowCommands();
-	updateSSAOCommands();
-	uiRenderer.updateOverlayCommands();
+	for (auto shader : getShaders())
+	{
+		if (std::find(changedShaders.begin(), changedShaders.end(), shader) == changedShaders.end())
+			changedShaders.push_back(shader);
+	}
 }
 
-void Renderer::updateConfigs()
+void Renderer::updateShaders()
 {
-	auto& config = Engine::config;
+	std::vector<std::string> changedFiles;
+	shaderWatcher.poll(changedFiles);
 
-	for (auto group : config.changedGroups)
+	for (auto& file : changedFiles)
 	{
-		switch (group) {
-		case EngineConfig::SSAO_Group:
-			updateSSAOConfigBuffer();
-			break;
+		for (auto shader : getShaders())
+		{
+			if (shader->readsSource(file) && std::find(changedShaders.begin(), changedShaders.end(), shader) == changedShaders.end())
+				changedShaders.push_back(shader);
 		}
 	}
 
-	for (auto special : config.changedSpecials)
-	{
-		switch (special) {
-		case EngineConfig::Render_Resolution:
-
-			// Recreate the screen pipeline and resolution dependant components
-			{
-				destroyScreenPipeline();
-				destroyScreenCommands();
-				destroyScreenSwapchain();
-
-				createScreenSwapchain();
-				createScreenCommands();
-				createScreenPipeline();
-			}
+	// Pipelines are only made from the current modules, the compile job doesn't touch them
+	selectSSAOVariant();
 
-			// Recreate the gBuffer pipeline and resoulution dependant components
-			{
-				destroyGBufferAttachments();
-				destroyGBufferRenderPass();
-				destroyGBufferFramebuffers();
-				destroyGBufferPipeline();
-				destroyGBufferCommands();
-
-				createGBufferAttachments();
-				createGBufferRenderPass();
-				createGBufferFramebuffers();
-				createGBufferPipeline();
-				createGBufferCommands();
-
-				updateGBufferCommands();
-			}
-			
-			// Recreate the SSAO pipeline and resolution dependant components
-			{
-				destroySSAOAttachments();
-				destroySSAORenderPass();
-				destroySSAOFramebuffer();
-				destroySSAODescriptorSets();
-				destroySSAOPipeline();
-				destroySSAOCommands();
-
-				createSSAOAttachments();
-				createSSAORenderPass();
-				createSSAOFramebuffer();
-				createSSAODescriptorSets();
-				createSSAOPipeline();
-				createSSAOCommands();
-
-				updateSSAODescriptorSets();
-				updateSSAOCommands();
-			}
+	// A variant build reads ssaoShader's modules, swapping waits until it's done
+	if (shaderCompileRunning || ssaoVariantBuildRunning)
+		return;
 
-			// Recreate the PBR pipeline and resolution dependant components
-			{
-				destroyPBRAttachments();
-				destroyPBRPipeline();
-				destroyPBRCommands();
+	// The last batch has finished compiling, its shaders are swapped in at this frame boundary
+	if (compiledShaders.size())
+	{
+		PROFILE_START("shaders");
 
-				createPBRAttachments();
-				createPBRPipeline();
-				createPBRCommands();
+		std::vector<ShaderPass> passes;
+		for (auto shader : compiledShaders)
+		{
+			auto pass = getShaderPass(shader);
+			if (std::find(passes.begin(), passes.end(), pass) == passes.end())
+				passes.push_back(pass);
+		}
 
-				updatePBRDescriptorSets(USED_GBUFFER);
-				
-				// We dont need to update all descriptors, just resolution dependant ones
-				auto updater = pbrDescriptorSet.makeUpdater();
+		// Pipelines keep their compiled code, the old modules can go while frames in flight run the old pipelines
+		for (auto shader : compiledShaders)
+			shader->swapPending();
+		for (auto pass : passes)
+			rebuildShaderPass(pass);
 
-				auto outputUpdater = updater->addImageUpdate("output");
-				*outputUpdater = { textureSampler, pbrOutput.getView(), VK_IMAGE_LAYOUT_GENERAL };
+		PROFILE_END("shaders");
+		DBG_INFO("Reloaded " << compiledShaders.size() << " shaders, recreated " << passes.size() << " passes in " <<
+			PROFILE_TO_MS(PROFILE_GET_LAST("shaders")) << "ms");
 
-				auto albedoUpdater = updater->addImageUpdate("albedo");
-				*albedoUpdater = { textureSampler, gBufferColourAttachment.getView(), VK_IMAGE_LAYOUT_GENERAL };
+		compiledShaders.clear();
+	}
 
-				auto normalUpdater = updater->addImageUpdate("normal");
-				*normalUpdater = { textureSampler, gBufferNormalAttachment.getView(), VK_IMAGE_LAYOUT_GENERAL };
+	if (changedShaders.empty())
+		return;
 
-				auto pbrUpdater = updater->addImageUpdate("pbr");
-				*pbrUpdater = { textureSampler, gBufferPBRAttachment.getView(), VK_IMAGE_LAYOUT_GENERAL };
+	compilingShaders.swap(changedShaders);
+	changedShaders.clear();
+	shaderCompileRunning = true;
 
-				auto depthUpdater = updater->addImageUpdate("depth");
-				*depthUpdater = { textureSampler, gBufferDepthAttachment.getView(), VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };
+	auto compileJobFunc = [this]() -> void {
+		// Unchanged sources are skipped, editors can write a file without changing it. Only SPIR-V is built here, the
+		// modules are swapped at a frame boundary so a resize can create pipelines from the current ones meanwhile
+		for (auto shader : compilingShaders)
+		{
+			if (shader->compileIfChanged())
+				compiledShaders.push_back(shader);
+		}
+		compilingShaders.clear();
+		shaderCompileRunning = false;
+	};
+	Engine::threading->addCPUJob(new Job<>(compileJobFunc));
+}
 
-				auto ssaoUpdater = updater->addImageUpdate("ssao");
-				*ssaoUpdater = { textureSampler, ssaoFinalAttachment.getView(), VK_IMAGE_LAYOUT_GENERAL };
+Renderer::ShaderPass Renderer::getShaderPass(ShaderSpec* shader)
+{
+	if (shader == &gBufferShader)
+		return GBuffer_Shader_Pass;
+	if (shader == &pointShadowShader || shader == &spotShadowShader || shader == &sunShadowShader)
+		return Shadow_Shader_Pass;
+	if (shader == &ssaoShader || shader == &ssaoBlurShader)
+		return SSAO_Shader_Pass;
+	if (shader == &cullShader)
+		return Culling_Shader_Pass;
+	if (shader == &pbrShader)
+		return PBR_Shader_Pass;
+	if (shader == &screenShader)
+		return Screen_Shader_Pass;
+	return Overlay_Shader_Pass;
+}
 
-				pbrDescriptorSet.submitUpdater(updater);
-				pbrDescriptorSet.destroyUpdater(updater);
+void Renderer::rebuildShaderPass(ShaderPass pass)
+{
+	// Layouts, render passes and descriptor sets don't depend on the shaders, only the pipelines are created again.
+	// The old ones retire with this frame, each slot's commands are recorded against the new ones as its frame comes up
+	switch (pass) {
+	case GBuffer_Shader_Pass:
+		retirePipeline(gBufferPipeline.recreate(pipelineCache));
+		gBufferCommands.markStale();
+		break;
+	case Shadow_Shader_Pass:
+		retirePipeline(pointShadowPipeline.recreate(pipelineCache));
+		retirePipeline(spotShadowPipeline.recreate(pipelineCache));
+		retirePipeline(sunShadowPipeline.recreate(pipelineCache));
+		invalidateCommands(Shadow_Pipeline_Input);
+		break;
+	case SSAO_Shader_Pass:
+		for (auto& variant : ssaoPipelines)
+			retirePipeline(variant.second->recreate(pipelineCache));
+		retirePipeline(ssaoBlurPipeline.recreate(pipelineCache));
+		invalidateCommands(SSAO_Pipeline_Input);
+		break;
+	case Culling_Shader_Pass:
+		// The culling commands are recorded every frame
+		retirePipeline(cullPipeline.recreate(pipelineCache));
+		break;
+	case PBR_Shader_Pass:
+		retirePipeline(pbrPipeline.recreate(pipelineCache));
+		pbrCommands.markStale();
+		break;
+	case Screen_Shader_Pass:
+		// Recorded once per swapchain image rather than per slot, so they are replaced instead of re-recorded
+		retirePipeline(screenPipeline.recreate(pipelineCache));
+		retiredCommandBuffers[frameIndex].push_back(screenCommandBuffers);
+		retiredCommandBuffers[frameIndex].push_back(screenCommandBuffersForConsole);
+		screenCommandBuffers = vdu::CommandBufferArray();
+		screenCommandBuffersForConsole = vdu::CommandBufferArray();
+		createScreenCommands();
+		updateScreenCommands();
+		updateScreenCommandsForConsole();
+		break;
+	case Overlay_Shader_Pass:
+		// The overlay commands are recorded every frame
+		retirePipeline(uiRenderer.pipeline.recreate(pipelineCache));
+		break;
+	}
+}
 
-				updatePBRCommands();
-			}
+void Renderer::updateConfigs()
+{
+	auto& config = Engine::config;
 
-			// Recreate the overlay pipeline and resolution dependant components
-			{
-				uiRenderer.cleanupForReInit();
+	for (auto group : config.changedGroups)
+	{
+		switch (group) {
+		case EngineConfig::SSAO_Group:
+			updateSSAOConfigBuffer();
+			break;
+		case EngineConfig::LOD_Group:
+			Engine::world.lodSettingsChanged();
+			break;
+		case EngineConfig::Limits_Group:
+			// Raised capacities are picked up by populateDrawCmdBuffer and streamTransforms, before anything is staged
+			break;
+		}
+	}
 
-				uiRenderer.createOverlayRenderPass();
-				uiRenderer.createOverlayPipeline();
-				uiRenderer.createOverlayAttachments();
-				uiRenderer.createOverlayFramebuffer();
-				uiRenderer.createOverlayCommands();
+	for (auto special : config.changedSpecials)
+	{
+		switch (special) {
+		case EngineConfig::Render_Resolution:
 
-				uiRenderer.updateOverlayCommands();
-			}
+			// Everything below is used by the frames in flight
+			waitForAllFrames();
 
-			// Update screen commands and descriptor sets
-			{
-				updateScreenDescriptorSets();
-				updateScreenCommands();
-			}
+			// The swapchain first, it sets renderResolution, then every pass that isn't culled
+			frameGraph.resize();
+			invalidateCommands(Render_Size_Input);
 
 			break;
 		}
@@ -634,13 +560,13 @@ void Renderer::updateConfigs()
 void Renderer::createShaders()
 {
 	gBufferShader.create(&logicalDevice);
-	gBufferNoTexShader.create(&logicalDevice);
 	screenShader.create(&logicalDevice);
 	pbrShader.create(&logicalDevice);
 	overlayShader.create(&logicalDevice);
 	combineOverlaysShader.create(&logicalDevice);
 	ssaoShader.create(&logicalDevice);
 	ssaoBlurShader.create(&logicalDevice);
+	cullShader.create(&logicalDevice);
 	pointShadowShader.create(&logicalDevice);
 	spotShadowShader.create(&logicalDevice);
 	sunShadowShader.create(&logicalDevice);
@@ -648,336 +574,924 @@ void Renderer::createShaders()
 
 void Renderer::compileShaders()
 {
-	gBufferShader.compile();
-	gBufferNoTexShader.compile();
-	screenShader.compile();
-	pbrShader.compile();
-	overlayShader.compile();
-	combineOverlaysShader.compile();
-	ssaoShader.compile();
-	ssaoBlurShader.compile();
-	pointShadowShader.compile();
-	spotShadowShader.compile();
-	sunShadowShader.compile();
+	auto shaders = getShaders();
+
+	PROFILE_START("shaders");
+	Engine::threading->parallelFor(u32(shaders.size()), [&shaders](u32 i) -> void {
+		shaders[i]->compileSource();
+	});
+	PROFILE_END("shaders");
+
+	DBG_INFO("Compiled " << shaders.size() << " shaders in " << PROFILE_TO_MS(PROFILE_GET_LAST("shaders")) << "ms");
 }
 
-void Renderer::addFenceDelayedAction(vdu::Fence * fe, std::function<void(void)> action)
+std::vector<ShaderSpec*> Renderer::getShaders()
 {
-	fenceDelayedActions[fe] = action;
+	return {
+		&gBufferShader, &screenShader, &pbrShader, &overlayShader, &combineOverlaysShader,
+		&ssaoShader, &ssaoBlurShader, &cullShader, &pointShadowShader, &spotShadowShader, &sunShadowShader
+	};
 }
 
-void Renderer::executeFenceDelayedActions()
+StagingUpload& Renderer::getUploadBatch()
 {
-	for (auto itr = fenceDelayedActions.begin(); itr != fenceDelayedActions.end();)
-	{
-		if (itr->first->isSignalled())
-		{
-			itr->second();
-			itr = fenceDelayedActions.erase(itr);
-		}
-		else
-		{
-			++itr;
-		}
-	}
+	if (!uploadBatch)
+		uploadBatch = new StagingUpload(this);
+
+	return *uploadBatch;
 }
 
-void Renderer::initialiseQueryPool()
+void Renderer::submitUploadBatch()
 {
-	vdu::CommandBuffer cmd;
-	cmd.allocate(&logicalDevice, &commandPool);
-	cmd.begin();
-	for (int i = 0; i < NUM_GPU_TIMESTAMPS; ++i)
-	{
-		queryPool.cmdTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, i);
-	}
-	cmd.end();
-
-	vdu::QueueSubmission submit;
-	submit.addCommands(&cmd);
+	if (!uploadBatch)
+		return;
 
-	VK_CHECK_RESULT(lGraphicsQueue.submit(submit));
-	VK_CHECK_RESULT(lGraphicsQueue.waitIdle());
+	uploadBatch->submit();
+	delete uploadBatch;
+	uploadBatch = nullptr;
 }
 
-void Renderer::populateDrawCmdBuffer()
+void Renderer::beginFrame()
 {
-	//VkDrawIndexedIndirectCommand* cmd = new VkDrawIndexedIndirectCommand[Engine::world.instancesToDraw.size()];
+	frameFences[frameIndex].wait();
 
-	VkDrawIndexedIndirectCommand* cmd = (VkDrawIndexedIndirectCommand*)drawCmdBuffer.getMemory()->map();
+	// The ring waits on the fence itself if it runs out of space, so release before the fence is reset
+	if (frameStagingSubmissions[frameIndex])
+	{
+		stagingRing.release(frameStagingSubmissions[frameIndex]);
+		frameStagingSubmissions[frameIndex] = 0;
+	}
 
-	int i = 0;
+	// Model data freed while this slot was last recorded can no longer be drawn
+	releaseFreedModelData(retiredModelData[frameIndex]);
 
-	auto tIndex = ModelInstance::toGPUTransformIndex;
+	// Nor can the buffers replaced while it was recorded be read
+	for (auto& buffer : retiredBuffers[frameIndex])
+		buffer.destroy();
+	retiredBuffers[frameIndex].clear();
+	destroyRetiredObjects(frameIndex);
 
-	for (auto& m : Engine::world.instancesToDraw)
-	{
-		glm::fvec3 modelPos = m->transform[tIndex].getTranslation();
-		float distanceToCam = glm::length(Engine::camera.getPosition() - modelPos);
+	// Nothing of this frame is staged yet, so the ring only waits on submitted data
+	std::vector<Model*> retry;
+	retry.swap(modelsAwaitingSpace);
+	for (auto model : retry)
+		model->loadToGPU();
 
-		int lodIndex = 0;
-		for (auto lim : m->model->lodLimits) /// TODO: monitor for LOD/culling/world changes, dont re-populate this when not needed
-		{
-			if (distanceToCam >= lim)
-				break;
-			++lodIndex;
-		}
+	std::vector<Texture*> retryTextures;
+	retryTextures.swap(texturesAwaitingSpace);
+	for (auto texture : retryTextures)
+		texture->loadToGPU();
 
-		auto& lodMesh = m->model->modelLODs[lodIndex];
+	frameGraph.readTimings(frameIndex);
 
-		cmd[i].firstIndex = lodMesh.firstIndex;
-		cmd[i].indexCount = lodMesh.indexDataLength;
-		cmd[i].vertexOffset = lodMesh.firstVertex;
-		cmd[i].firstInstance = (m->material->gpuIndexBase << 20) | (m->transformIndex);
-		cmd[i].instanceCount = 1; /// TODO: do we want/need a different class for real instanced drawing ?
-		++i;
-	}
+	lastReRecordedCommands = reRecordedCommands;
+	reRecordedCommands = 0;
+}
 
-	drawCmdBuffer.getMemory()->unmap();
+void Renderer::endFrame()
+{
+	// render() submitted the frame with its fence, which now guards its staging memory and the freed model data
+	frameStagingSubmissions[frameIndex] = stagingRing.submit(frameStagingOwner, frameFences[frameIndex].getHandle());
+	retiredModelData[frameIndex].swap(freedModelData);
 
-	//drawCmdBuffer.setMem(cmd, Engine::world.modelNames.size() * sizeof(VkDrawIndexedIndirectCommand), 0);
+	frameIndex = (frameIndex + 1) % FRAMES_IN_FLIGHT;
+}
 
-	//delete[] cmd;
+void Renderer::waitForAllFrames()
+{
+	for (auto& fence : frameFences)
+		fence.wait();
 }
 
-void Renderer::pushModelDataToGPU(Model & model)
+void* Renderer::stageFrameData(PerFrameBuffer& dst, VkDeviceSize dstOffset, VkDeviceSize size)
 {
-	for (auto& lodLevel : model.modelLODs)
+	auto offset = stagingRing.allocate(frameStagingOwner, size, 16);
+	if (offset == StagingRing::INVALID_OFFSET)
 	{
-		// Create staging buffers for this LODs vertices and indices
-		vdu::Buffer* stagingBufferVertex = new vdu::Buffer(vertexIndexBuffer, static_cast<VkDeviceSize>(lodLevel.vertexDataLength * sizeof(Vertex)));
-		memcpy(stagingBufferVertex->getMemory()->map(), lodLevel.vertexData, lodLevel.vertexDataLength * sizeof(Vertex));
-		stagingBufferVertex->getMemory()->unmap();
-
-		auto stagingBufferIndex = new vdu::Buffer(vertexIndexBuffer, static_cast<VkDeviceSize>(lodLevel.indexDataLength * sizeof(u32)));
-		memcpy(stagingBufferIndex->getMemory()->map(), lodLevel.indexData, lodLevel.indexDataLength * sizeof(u32));
-		stagingBufferIndex->getMemory()->unmap();
-
-		// Create the command buffer that will transfer data from the staging buffer to the device local buffer
-		auto cmd = new vdu::CommandBuffer;
-		beginTransferCommands(*cmd);
-		stagingBufferVertex->cmdCopyTo(cmd, &vertexIndexBuffer, lodLevel.vertexDataLength * sizeof(Vertex), 0, vertexInputByteOffset);
-		stagingBufferIndex->cmdCopyTo(cmd, &vertexIndexBuffer, lodLevel.indexDataLength * sizeof(u32), 0, INDEX_BUFFER_BASE + indexInputByteOffset);
-
-		// Submit the transfer commands
-		vdu::QueueSubmission submission;
-		endTransferCommands(*cmd, submission);
-		auto fence = new vdu::Fence(&logicalDevice);
-		VK_CHECK_RESULT(lTransferQueue.submit(submission, *fence));
-
-		// Delay the fence and buffer destruction until the GPU has finished the transfer operation
-		addFenceDelayedAction(fence, std::bind([](vdu::Buffer* vertexBuffer, vdu::Buffer* indexBuffer, vdu::Fence* fence) -> void {
-			fence->destroy();
-			vertexBuffer->destroy();
-			indexBuffer->destroy();
-			delete fence;
-			delete vertexBuffer;
-			delete indexBuffer;
-		}, stagingBufferVertex, stagingBufferIndex, fence));
-
-		// Let the model know where its first vertex and index are located on the GPU
-		lodLevel.firstVertex = (s32)(vertexInputByteOffset / sizeof(Vertex));
-		lodLevel.firstIndex = (u32)(indexInputByteOffset / sizeof(u32));
-
-		// Increment the offset of where the next model will be added
-		vertexInputByteOffset += lodLevel.vertexDataLength * sizeof(Vertex);
-		indexInputByteOffset += lodLevel.indexDataLength * sizeof(u32);
+		DBG_WARNING("Out of staging memory for frame data, " << size << " bytes are left for a later frame");
+		return nullptr;
 	}
+
+	frameCopies.push_back({ &dst, { offset, dstOffset, size } });
+	return stagingRing.getMapped(offset);
 }
 
-void Renderer::createDataBuffers()
+bool Renderer::stageFrameRanges(const std::vector<DirtyRange>& ranges)
 {
-	/// TODO: set appropriate size
-
-	drawCmdBuffer.setMemoryProperty(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-	drawCmdBuffer.setUsage(VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
-	drawCmdBuffer.create(&logicalDevice, sizeof(VkDrawIndexedIndirectCommand) * 1000);
-	
-	VkDeviceSize bufferSize = VERTEX_BUFFER_SIZE + INDEX_BUFFER_SIZE;
-	vertexIndexBuffer.setMemoryProperty(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-	vertexIndexBuffer.setUsage(VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
-	vertexIndexBuffer.create(&logicalDevice, bufferSize);
-
-	flatPBRUBO.setMemoryProperty(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-	flatPBRUBO.setUsage(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
-	flatPBRUBO.create(&logicalDevice, sizeof(glm::fvec4) * 2 * 100);
+	VkDeviceSize size = 0;
+	for (auto& range : ranges)
+		size += range.size;
+	if (size == 0)
+		return true;
+
+	auto offset = stagingRing.allocate(frameStagingOwner, size, 16);
+	if (offset == StagingRing::INVALID_OFFSET)
+	{
+		DBG_WARNING("Out of staging memory for frame data, " << size << " bytes are left for a later frame");
+		return false;
+	}
 
-	updateFlatMaterialBuffer();
+	// Buffer to buffer copies have no alignment requirement, the ranges are packed back to back
+	for (auto& range : ranges)
+	{
+		memcpy(stagingRing.getMapped(offset), range.src, (size_t)range.size);
+		frameCopies.push_back({ range.dst, { offset, range.dstOffset, range.size } });
+		offset += range.size;
+	}
 
-	std::vector<Vertex2D> quad;
-	quad.push_back({ { -1,-1 },{ 0,0 } });
-	quad.push_back({ { 1,1 },{ 1,1 } });
-	quad.push_back({ { -1,1 },{ 0,1 } });
-	quad.push_back({ { -1,-1 },{ 0,0 } });
-	quad.push_back({ { 1,-1 },{ 1,0 } });
-	quad.push_back({ { 1,1 },{ 1,1 } });
+	return true;
+}
 
-	screenQuadBuffer.setUsage(VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
-	screenQuadBuffer.setMemoryProperty(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-	screenQuadBuffer.create(&logicalDevice, quad.size() * sizeof(Vertex2D));
+void Renderer::createDeviceLocalBuffer(PooledBuffer& buffer, VkBufferUsageFlags usage, VkDeviceSize size)
+{
+	buffer.create(&gpuAllocator, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, size, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+}
 
-	auto stagingBuffer = new vdu::Buffer;
-	screenQuadBuffer.createStaging(*stagingBuffer);
+void Renderer::createPerFrameBuffer(PerFrameBuffer& buffer, VkBufferUsageFlags usage, VkDeviceSize size)
+{
+	// The copies catch up from each other, so they are copied from as well as to
+	buffer.create(&gpuAllocator, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, size, FRAMES_IN_FLIGHT);
+}
 
-	auto fe = new vdu::Fence;
-	fe->create(&logicalDevice);
+void Renderer::retireBuffer(PerFrameBuffer& buffer)
+{
+	// Copies staged to the old buffer are meaningless for the new one, its contents are staged again in full
+	auto stale = [&buffer](const FrameCopy& copy) -> bool { return copy.dst == &buffer; };
+	frameCopies.erase(std::remove_if(frameCopies.begin(), frameCopies.end(), stale), frameCopies.end());
+	for (auto& copies : stagedCopies)
+		copies.erase(std::remove_if(copies.begin(), copies.end(), stale), copies.end());
+
+	// The frames before this one are the last that can read the old copies, they are done once this slot comes up again
+	buffer.retire(retiredBuffers[frameIndex]);
+}
 
-	auto data = stagingBuffer->getMemory()->map();
-	memcpy(data, quad.data(), quad.size() * sizeof(Vertex2D));
-	stagingBuffer->getMemory()->unmap();
+void Renderer::retireBuffer(PooledBuffer& buffer)
+{
+	retiredBuffers[frameIndex].push_back(buffer);
+	buffer = PooledBuffer();
+}
 
-	auto cmd = new vdu::CommandBuffer;
-	beginTransferCommands(*cmd);
-	stagingBuffer->cmdCopyTo(cmd, &screenQuadBuffer);
-	vdu::QueueSubmission submission;
-	endTransferCommands(*cmd, submission);
+void Renderer::retireImage(VkImage image, VkImageView view, const GPUAllocation& allocation)
+{
+	// Uploads recorded during the frame are submitted before it, its fence covers them
+	retiredImages[frameIndex].push_back({ image, view, allocation });
+}
 
-	VK_CHECK_RESULT(lGraphicsQueue.submit(submission, *fe));
+void Renderer::retirePipeline(VkPipeline pipeline)
+{
+	// The frames before this one recorded it, they are done once this slot comes up again
+	retiredPipelines[frameIndex].push_back(pipeline);
+}
 
-	auto delayedBufferDestruct = std::bind([](vdu::Buffer* buffer, vdu::Fence* fe) -> void {
-		buffer->destroy();
-		fe->destroy();
-		delete buffer;
-		delete fe;
-	}, stagingBuffer, fe);
+void Renderer::destroyRetiredObjects(u32 slot)
+{
+	auto device = logicalDevice.getHandle();
+	for (auto& retired : retiredImages[slot])
+	{
+		if (retired.view != VK_NULL_HANDLE)
+			vkDestroyImageView(device, retired.view, nullptr);
+		vkDestroyImage(device, retired.image, nullptr);
+		gpuAllocator.free(retired.allocation);
+	}
+	retiredImages[slot].clear();
 
-	addFenceDelayedAction(fe, delayedBufferDestruct);
+	for (auto pipeline : retiredPipelines[slot])
+		vkDestroyPipeline(device, pipeline, nullptr);
+	retiredPipelines[slot].clear();
 
-	createUBOs();
+	for (auto& commandBuffers : retiredCommandBuffers[slot])
+		commandBuffers.free();
+	retiredCommandBuffers[slot].clear();
 }
 
-void Renderer::updateMaterialDescriptors()
+bool Renderer::hasReBarMemory()
 {
-	gBufferCmdsNeedUpdate = true;
-	gBufferNoTexCmdsNeedUpdate = true;
-	Engine::threading->addMaterialMutex.lock();
-
-	auto& assets = Engine::assets;
+	VkPhysicalDeviceMemoryProperties memProperties;
+	vkGetPhysicalDeviceMemoryProperties(Engine::physicalDevice->getHandle(), &memProperties);
 
-	u32 textureArrayIndex = 0, flatPBRArrayIndex = 0;
-	for (auto& material : assets.materials)
+	// Without resizable BAR the host visible part of VRAM is a 256 MB window, too small to give to the ring
+	auto wanted = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	for (u32 i = 0; i < memProperties.memoryTypeCount; ++i)
 	{
-		
-		if (material.second.data.textures.albedoSpec != nullptr) {
+		auto& type = memProperties.memoryTypes[i];
+		if ((type.propertyFlags & wanted) == wanted && memProperties.memoryHeaps[type.heapIndex].size >= REBAR_MIN_HEAP_SIZE)
+			return true;
+	}
+	return false;
+}
 
-			// This material consists of two PBR textures
+void Renderer::createFrameCommands()
+{
+	frameStagingOwner = stagingRing.newOwner();
 
-			if (!material.second.checkAvailability(Asset::AWAITING_DESCRIPTOR_UPDATE))
-			{
-				textureArrayIndex += 2;
-				continue;
-			}
+	for (u32 i = 0; i < FRAMES_IN_FLIGHT; ++i)
+	{
+		frameCopyCommandBuffer[i].allocate(&logicalDevice, &commandPool);
+		frameStagingSubmissions[i] = 0;
+	}
+}
 
-			material.second.getAvailability() &= ~Asset::AWAITING_DESCRIPTOR_UPDATE;
+void Renderer::recordFrameCopies()
+{
+	auto cmd = frameCopyCommandBuffer[frameIndex].getHandle();
 
-			auto updater = gBufferDescriptorSet.makeUpdater();
-			auto texturesUpdate = updater->addImageUpdate("textures", textureArrayIndex, 2);
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
-			texturesUpdate[0].sampler = textureSampler;
-			texturesUpdate[0].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-			texturesUpdate[1].sampler = textureSampler;
-			texturesUpdate[1].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	VK_CHECK_RESULT(vkBeginCommandBuffer(cmd, &beginInfo));
 
-			if (material.second.data.textures.albedoSpec->getHandle())
-				texturesUpdate[0].imageView = material.second.data.textures.albedoSpec->getView();
-			else
-				texturesUpdate[0].imageView = assets.getTexture("blank")->getView();
+	auto previous = (frameIndex + FRAMES_IN_FLIGHT - 1) % FRAMES_IN_FLIGHT;
 
-			if (material.second.data.textures.normalRough)
-			{
-				if (material.second.data.textures.normalRough->getView())
-					texturesUpdate[1].imageView = material.second.data.textures.normalRough->getView();
-				else
-					texturesUpdate[1].imageView = assets.getTexture("black")->getView();
-			}
-			else
-				texturesUpdate[1].imageView = assets.getTexture("black")->getView();
+	// Only the copies the earlier frames wrote, and read below, are waited for. The slot's own copies were last
+	// read by the frame whose fence beginFrame waited on
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
 
-			textureArrayIndex += 2;
+	// Catch the slot's copies up on what the frames since its last use staged. The previous slot's copy already
+	// holds all of it, as it caught up the same way, so every range is copied from there
+	bool caughtUp = false;
+	for (u32 slot = 0; slot < FRAMES_IN_FLIGHT; ++slot)
+	{
+		if (slot == frameIndex)
+			continue;
 
-			gBufferDescriptorSet.submitUpdater(updater);
-			gBufferDescriptorSet.destroyUpdater(updater);
+		for (auto& copy : stagedCopies[slot])
+		{
+			VkBufferCopy region = { copy.region.dstOffset, copy.region.dstOffset, copy.region.size };
+			vkCmdCopyBuffer(cmd, copy.dst->getHandle(previous), copy.dst->getHandle(frameIndex), 1, &region);
+			caughtUp = true;
 		}
-		else {
-
-			// This material consists of flat PBR data
-
-			/*if (!material.second.checkAvailability(Asset::AWAITING_DESCRIPTOR_UPDATE))
-			{
-				++flatPBRArrayIndex;
-				continue;
-			}
+	}
 
-			material.second.getAvailability() &= ~Asset::AWAITING_DESCRIPTOR_UPDATE;
+	// This frame's data goes over the ranges caught up
+	if (caughtUp)
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
 
-			auto updater = gBufferNoTexDescriptorSet.makeUpdater();
-			auto pbrDataUpdate = updater->addBufferUpdate("pbrdata", flatPBRArrayIndex);
+	for (auto& copy : frameCopies)
+		vkCmdCopyBuffer(cmd, stagingRing.getHandle(), copy.dst->getHandle(frameIndex), 1, &copy.region);
 
-			pbrDataUpdate->buffer = flatPBRUBO.getHandle();
-			pbrDataUpdate->offset = 0;
-			pbrDataUpdate->range = sizeof(glm::fvec4) * 2;*/
+	// Compaction moves, sources and destinations never overlap
+	if (!vertexIndexMoves.empty())
+		vkCmdCopyBuffer(cmd, vertexIndexBuffer.getHandle(), vertexIndexBuffer.getHandle(), (u32)vertexIndexMoves.size(), vertexIndexMoves.data());
 
-		}
+	// Every stage of the frame's passes that reads a staged buffer or the vertex/index buffer
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT |
+		VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+		VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_GEOMETRY_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
 
-		
-	}
+	// Replayed into the other slots as their frames come up
+	stagedCopies[frameIndex].swap(frameCopies);
+	frameCopies.clear();
+	vertexIndexMoves.clear();
 
-	Engine::threading->addMaterialMutex.unlock();
+	VK_CHECK_RESULT(vkEndCommandBuffer(cmd));
 }
 
-void Renderer::updateFlatMaterialBuffer()
+void Renderer::addFenceDelayedAction(vdu::Fence * fe, std::function<void(void)> action)
 {
-	struct PBRData {
-		glm::fvec3 c;
-		float m;
-		float r;
-		glm::fvec3 PAD;
-	};
-
-	glm::fvec3 cs[5] = { 
-		{0.9,0.5,0.2},
-		{0.5,0.9,0.4},
-		{0.3,0.2,0.9},
-		{0.6,0.6,0.5},
-		{0.2,0.7,0.1},
-	};
-
-	float ms[5] = { 0.0, 0.3, 0.5, 0.7, 0.9 };
-	float rs[5] = { 0.0, 0.3, 0.5, 0.7, 0.9 };
-
-	PBRData* b = (PBRData*)flatPBRUBO.getMemory()->map();
-
-	for (int i = 0; i < 100; ++i) {
-		b[i].c = cs[i % 5];
-		b[i].m = ms[i % 5];
-		b[i].r = rs[i % 5];
-		b[i].PAD = glm::fvec3(2, 3, 4);
-	}
-
-	b[0].c = { 1, 0, 1 };
-
-	flatPBRUBO.getMemory()->unmap();
+	fenceDelayedActions[fe] = action;
 }
 
-void Renderer::updateSkyboxDescriptor()
+void Renderer::executeFenceDelayedActions()
 {
-	if (Engine::world.skybox->checkAvailability(Asset::AWAITING_DESCRIPTOR_UPDATE)) {
+	for (auto itr = fenceDelayedActions.begin(); itr != fenceDelayedActions.end();)
+	{
+		if (itr->first->isSignalled())
+		{
+			itr->second();
+			itr = fenceDelayedActions.erase(itr);
+		}
+		else
+		{
+			++itr;
+		}
+	}
+}
+
+void Renderer::populateDrawCmdBuffer()
+{
+	auto& world = Engine::world;
+
+	auto& limits = Engine::config.render.limits;
+	bool belowConfiguredCapacity = instanceCapacity < u32(limits.getInstanceCapacity()) || drawCapacity < u32(limits.getDrawCapacity());
+
+	// Batches only change when an instance changes LOD or material, or when the draw list is rebuilt. A draw list
+	// only partly staged is built and streamed again until all of it is up
+	if (!world.drawListRebuilt && world.changedDrawRecords.empty() && !belowConfiguredCapacity && !drawUploadPending)
+		return;
+
+	// Built on the CPU and staged for the frame, earlier frames keep reading the previous contents until it starts
+	std::vector<VkDrawIndexedIndirectCommand> cmd;
+	std::vector<InstanceData> instanceData(world.instancesToDraw.size() * 2);
+	std::vector<glm::fvec4> instanceBounds(world.instancesToDraw.size() * 2);
+	cmd.reserve(world.instancesToDraw.size() * 2);
+
+	u32 instanceCount = 0;
+	u32 batchCount = 0;
+
+	// Shadow passes may use coarser LODs, so the camera and the shadow views each get their own set of batches,
+	// instances are written to instanceDataBuffer once per set
+	auto addBatches = [&](u32 ModelInstance::* lodIndex) -> void {
+		// Sort so that instances sharing a model, LOD and material are contiguous
+		std::vector<ModelInstance*> sorted(world.instancesToDraw);
+		std::sort(sorted.begin(), sorted.end(), [lodIndex](ModelInstance* a, ModelInstance* b) -> bool {
+			if (a->model != b->model)
+				return a->model < b->model;
+			if (a->*lodIndex != b->*lodIndex)
+				return a->*lodIndex < b->*lodIndex;
+			return a->material < b->material;
+		});
+
+		for (u32 i = 0; i < sorted.size(); ++i)
+		{
+			auto m = sorted[i];
+			instanceData[instanceCount] = { m->transformIndex, m->material->gpuIndexBase };
+			instanceBounds[instanceCount] = m->model->boundingSphere;
+
+			if (i > 0 && m->model == sorted[i - 1]->model && m->*lodIndex == sorted[i - 1]->*lodIndex && m->material == sorted[i - 1]->material)
+			{
+				++cmd[batchCount - 1].instanceCount;
+				++instanceCount;
+				continue;
+			}
+
+			auto& lodMesh = m->model->modelLODs[m->*lodIndex];
+
+			cmd.emplace_back();
+			cmd[batchCount].firstIndex = lodMesh.firstIndex;
+			cmd[batchCount].indexCount = lodMesh.indexDataLength;
+			cmd[batchCount].vertexOffset = lodMesh.firstVertex;
+			cmd[batchCount].firstInstance = instanceCount;
+			cmd[batchCount].instanceCount = 1;
+			++batchCount;
+			++instanceCount;
+		}
+	};
+
+	addBatches(&ModelInstance::lodIndex);
+	u32 shadowBatchBase = batchCount;
+	u32 shadowInstances = instanceCount;
+	addBatches(&ModelInstance::shadowLodIndex);
+
+	// Growing recreates the buffers empty, which is fine as all of their contents are staged below
+	u32 requiredInstances = glm::max(instanceCount, u32(limits.getInstanceCapacity()));
+	u32 requiredDraws = glm::max(batchCount, u32(limits.getDrawCapacity()));
+	u32 oldInstanceCapacity = instanceCapacity;
+	u32 oldDrawCapacity = drawCapacity;
+	if (!growDrawBuffers(requiredInstances, requiredDraws))
+		return; // Keep drawing the previous draw list
+	bool grown = instanceCapacity != oldInstanceCapacity || drawCapacity != oldDrawCapacity;
+
+	// A rebuilt draw list is mostly the same as the last one, only the batches and instances that moved are copied.
+	// The batches and instances only make sense together, so they are staged all at once or left for the next frame
+	std::vector<DirtyRange> ranges;
+	findDirtyRanges(drawCmdBuffer, cmd.data(), batchCount, uploadedDrawCmds, ranges);
+	findDirtyRanges(instanceDataBuffer, instanceData.data(), instanceCount, uploadedInstanceData, ranges);
+	findDirtyRanges(instanceBoundsBuffer, instanceBounds.data(), instanceCount, uploadedInstanceBounds, ranges);
+	drawUploadPending = !stageFrameRanges(ranges);
+	if (!drawUploadPending)
+	{
+		markUploaded(cmd.data(), batchCount, uploadedDrawCmds);
+		markUploaded(instanceData.data(), instanceCount, uploadedInstanceData);
+		markUploaded(instanceBounds.data(), instanceCount, uploadedInstanceBounds);
+	}
+
+	u32 publishedDraws = batchCount;
+	u32 publishedShadowDrawBase = shadowBatchBase;
+	if (drawUploadPending)
+	{
+		// The counts stay with the previous draw list, unless growing left the new buffers without it
+		if (!grown)
+			return;
+
+		publishedDraws = 0;
+		publishedShadowDrawBase = 0;
+		drawInstanceCount = 0;
+		shadowInstanceBase = 0;
+	}
+	else
+	{
+		drawInstanceCount = instanceCount;
+		shadowInstanceBase = shadowInstances;
+	}
+
+	// The draw counts are baked into the recorded command buffers
+	if (publishedDraws != drawCount || publishedShadowDrawBase != shadowDrawBase)
+	{
+		drawCount = publishedDraws;
+		shadowDrawBase = publishedShadowDrawBase;
+		invalidateCommands(Draw_Buffers_Input);
+	}
+}
+
+bool Renderer::pushModelDataToGPU(Model & model)
+{
+	// Reserve space for every LOD first so a model is either fully uploaded or not at all
+	auto allocateLODs = [this, &model]() -> bool {
+		for (u32 i = 0; i < model.modelLODs.size(); ++i)
+		{
+			auto& lodLevel = model.modelLODs[i];
+			u64 firstVertex = vertexAllocator.allocate(lodLevel.vertexDataLength);
+			u64 firstIndex = indexAllocator.allocate(lodLevel.indexDataLength);
+
+			if (firstVertex == BufferSubAllocator::INVALID_OFFSET || firstIndex == BufferSubAllocator::INVALID_OFFSET)
+			{
+				if (firstVertex != BufferSubAllocator::INVALID_OFFSET)
+					vertexAllocator.free(firstVertex);
+				if (firstIndex != BufferSubAllocator::INVALID_OFFSET)
+					indexAllocator.free(firstIndex);
+				for (u32 j = 0; j < i; ++j)
+				{
+					vertexAllocator.free(model.modelLODs[j].firstVertex);
+					indexAllocator.free(model.modelLODs[j].firstIndex);
+				}
+				return false;
+			}
+
+			// Let the model know where its first vertex and index are located on the GPU
+			lodLevel.firstVertex = (s32)firstVertex;
+			lodLevel.firstIndex = (u32)firstIndex;
+		}
+		return true;
+	};
+
+	if (!allocateLODs())
+	{
+		// The space may only be split into holes or still held by frames in flight, try again once some of it is back
+		bool freeing = compactVertexIndexBuffer() || !freedModelData.empty();
+		for (auto& retired : retiredModelData)
+			freeing |= !retired.empty();
+
+		if (freeing)
+			modelsAwaitingSpace.push_back(&model);
+		else
+			DBG_SEVERE("Out of vertex/index buffer memory uploading model " << model.getName());
+		return false;
+	}
+
+	auto& upload = getUploadBatch();
+	for (auto& lodLevel : model.modelLODs)
+	{
+		if (!upload.copyToBuffer(vertexIndexBuffer, u64(lodLevel.firstVertex) * sizeof(Vertex), lodLevel.vertexData, lodLevel.vertexDataLength * sizeof(Vertex)) ||
+			!upload.copyToBuffer(vertexIndexBuffer, INDEX_BUFFER_BASE + u64(lodLevel.firstIndex) * sizeof(u32), lodLevel.indexData, lodLevel.indexDataLength * sizeof(u32)))
+		{
+			// The copies already recorded still run with the upload, the space is given back once the frame has finished
+			freeModelDataFromGPU(model);
+			modelsAwaitingSpace.push_back(&model);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void Renderer::freeModelDataFromGPU(Model & model)
+{
+	for (auto& lodLevel : model.modelLODs)
+		freedModelData.push_back({ u64(lodLevel.firstVertex), u64(lodLevel.firstIndex) });
+}
+
+void Renderer::releaseFreedModelData(std::vector<std::pair<u64, u64>>& freed)
+{
+	for (auto& lod : freed)
+	{
+		if (lod.first != BufferSubAllocator::INVALID_OFFSET)
+			vertexAllocator.free(lod.first);
+		if (lod.second != BufferSubAllocator::INVALID_OFFSET)
+			indexAllocator.free(lod.second);
+	}
+	freed.clear();
+}
+
+bool Renderer::compactVertexIndexBuffer()
+{
+	auto vertexMoves = vertexAllocator.compact(VERTEX_INDEX_COMPACTION_BYTES_PER_FRAME / sizeof(Vertex));
+	auto indexMoves = indexAllocator.compact(VERTEX_INDEX_COMPACTION_BYTES_PER_FRAME / sizeof(u32));
+
+	if (vertexMoves.empty() && indexMoves.empty())
+		return false;
+
+	// Destination offset and whether a model LOD still points at the source
+	std::unordered_map<u64, std::pair<u64, bool>> vertexRemap, indexRemap;
+	for (auto& m : vertexMoves)
+		vertexRemap[m.srcOffset] = { m.dstOffset, false };
+	for (auto& m : indexMoves)
+		indexRemap[m.srcOffset] = { m.dstOffset, false };
+
+	for (auto& model : Engine::assets.models)
+	{
+		if (!model.second.checkAvailability(Asset::ON_GPU))
+			continue;
+
+		for (auto& lodLevel : model.second.modelLODs)
+		{
+			auto v = vertexRemap.find(u64(lodLevel.firstVertex));
+			if (v != vertexRemap.end())
+			{
+				lodLevel.firstVertex = (s32)v->second.first;
+				v->second.second = true;
+			}
+			auto i = indexRemap.find(u64(lodLevel.firstIndex));
+			if (i != indexRemap.end())
+			{
+				lodLevel.firstIndex = (u32)i->second.first;
+				i->second.second = true;
+			}
+		}
+	}
 
-		auto updater = pbrDescriptorSet.makeUpdater();
-		auto skyboxUpdater = updater->addImageUpdate("skybox");
-		*skyboxUpdater = { 
-			skySampler, 
-			Engine::assets.getTexture(Engine::world.skybox->getName())->getView(), 
-			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL 
+	// The source ranges may still be drawn by frames in flight, they retire with this frame. Moves of ranges that
+	// were already freed are not copied and their destinations retire too
+	auto addCopies = [this](std::vector<BufferSubAllocator::Move>& moves, std::unordered_map<u64, std::pair<u64, bool>>& remap,
+		VkDeviceSize base, VkDeviceSize elementSize, bool vertex) -> void {
+		auto retire = [this, vertex](u64 offset) -> void {
+			u64 none = BufferSubAllocator::INVALID_OFFSET;
+			freedModelData.push_back(vertex ? std::make_pair(offset, none) : std::make_pair(none, offset));
 		};
 
-		pbrDescriptorSet.submitUpdater(updater);
-		pbrDescriptorSet.destroyUpdater(updater);
+		for (auto& m : moves)
+		{
+			retire(m.srcOffset);
+			if (remap[m.srcOffset].second)
+				vertexIndexMoves.push_back({ base + m.srcOffset * elementSize, base + m.dstOffset * elementSize, m.size * elementSize });
+			else
+				retire(m.dstOffset);
+		}
+	};
+	addCopies(vertexMoves, vertexRemap, 0, sizeof(Vertex), true);
+	addCopies(indexMoves, indexRemap, INDEX_BUFFER_BASE, sizeof(u32), false);
+
+	// Draw batches hold the old offsets, rebuild them this frame (if culling already ran) and on the next culling pass
+	Engine::world.drawListRebuilt = true;
+	Engine::world.membershipChanged();
+
+	DBG_INFO("Compacting vertex/index buffer, moved " << vertexMoves.size() << " vertex and " << indexMoves.size() << " index ranges");
+	return true;
+}
+
+void Renderer::createDataBuffers()
+{
+	drawCount = 0;
+	shadowDrawBase = 0;
+	drawInstanceCount = 0;
+	shadowInstanceBase = 0;
+	drawUploadPending = false;
+
+	// Grown by populateDrawCmdBuffer as the scene needs more
+	instanceCapacity = Engine::config.render.limits.getInstanceCapacity();
+	drawCapacity = Engine::config.render.limits.getDrawCapacity();
+	createDrawBuffers();
+
+	// Culling inputs and per view outputs
+	createPerFrameBuffer(cullViewsUBO, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, sizeof(CullViewsUBOData));
+
+	drawCountBuffer.create(&gpuAllocator, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, sizeof(u32) * CULL_MAX_VIEWS, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	
+	VkDeviceSize bufferSize = VERTEX_BUFFER_SIZE + INDEX_BUFFER_SIZE;
+	vertexIndexBuffer.create(&gpuAllocator, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, bufferSize, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	vertexAllocator.init(VERTEX_BUFFER_SIZE / sizeof(Vertex));
+	indexAllocator.init(INDEX_BUFFER_SIZE / sizeof(u32));
+
+	materialRecords.grow(MATERIAL_RECORD_INITIAL_CAPACITY);
+	createPerFrameBuffer(materialRecordBuffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, sizeof(MaterialRecord) * materialRecords.getCapacity());
+
+	std::vector<Vertex2D> quad;
+	quad.push_back({ { -1,-1 },{ 0,0 } });
+	quad.push_back({ { 1,1 },{ 1,1 } });
+	quad.push_back({ { -1,1 },{ 0,1 } });
+	quad.push_back({ { -1,-1 },{ 0,0 } });
+	quad.push_back({ { 1,-1 },{ 1,0 } });
+	quad.push_back({ { 1,1 },{ 1,1 } });
+
+	screenQuadBuffer.create(&gpuAllocator, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, quad.size() * sizeof(Vertex2D), VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	// Nothing else holds the ring before the first frame
+	if (!getUploadBatch().copyToBuffer(screenQuadBuffer, 0, quad.data(), quad.size() * sizeof(Vertex2D)))
+		DBG_SEVERE("Could not stage the screen quad");
+
+	createUBOs();
+}
+
+void Renderer::createDrawBuffers()
+{
+	createPerFrameBuffer(drawCmdBuffer, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, sizeof(VkDrawIndexedIndirectCommand) * drawCapacity);
+	createPerFrameBuffer(instanceDataBuffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, sizeof(InstanceData) * instanceCapacity);
+	createPerFrameBuffer(instanceBoundsBuffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, sizeof(glm::fvec4) * instanceCapacity);
+
+	// New buffers hold nothing, populateDrawCmdBuffer streams everything again
+	uploadedDrawCmds.clear();
+	uploadedInstanceData.clear();
+	uploadedInstanceBounds.clear();
+
+	// Per view outputs of the culling pass, the capacities are the strides between views
+	visibilityBuffer.create(&gpuAllocator, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, sizeof(u32) * instanceCapacity * CULL_MAX_VIEWS, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	visibleInstanceBuffer.create(&gpuAllocator, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, sizeof(InstanceData) * instanceCapacity * CULL_MAX_VIEWS, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	instanceRankBuffer.create(&gpuAllocator, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, sizeof(u32) * instanceCapacity * CULL_MAX_VIEWS, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	blockRankBuffer.create(&gpuAllocator, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, sizeof(u32) * getCullBlockCapacity() * CULL_MAX_VIEWS, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	batchDrawCmdBuffer.create(&gpuAllocator, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, sizeof(VkDrawIndexedIndirectCommand) * drawCapacity * CULL_MAX_VIEWS, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	culledDrawCmdBuffer.create(&gpuAllocator, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, sizeof(VkDrawIndexedIndirectCommand) * drawCapacity * CULL_MAX_VIEWS, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+}
+
+void Renderer::destroyDrawBuffers()
+{
+	drawCmdBuffer.destroy();
+	instanceDataBuffer.destroy();
+	instanceBoundsBuffer.destroy();
+	visibilityBuffer.destroy();
+	visibleInstanceBuffer.destroy();
+	instanceRankBuffer.destroy();
+	blockRankBuffer.destroy();
+	batchDrawCmdBuffer.destroy();
+	culledDrawCmdBuffer.destroy();
+}
+
+// Smallest capacity reached by repeatedly growing capacity by factor that holds required, 0 if that is over max
+static u32 grownCapacity(u32 capacity, u32 required, u32 max, float factor)
+{
+	if (required > max)
+		return 0;
+
+	u64 grown = glm::max(capacity, 1u);
+	while (grown < required)
+		grown = u64(double(grown) * factor) + 1;
+
+	return u32(glm::min(grown, u64(max)));
+}
+
+bool Renderer::growDrawBuffers(u32 instances, u32 draws)
+{
+	if (instances <= instanceCapacity && draws <= drawCapacity)
+		return true;
+
+	auto& limits = Engine::config.render.limits;
+	u32 newInstanceCapacity = glm::max(instanceCapacity, grownCapacity(instanceCapacity, instances, limits.getMaxInstances(), limits.getGrowthFactor()));
+	u32 newDrawCapacity = glm::max(drawCapacity, grownCapacity(drawCapacity, draws, limits.getMaxDraws(), limits.getGrowthFactor()));
+
+	if (newInstanceCapacity < instances || newDrawCapacity < draws)
+	{
+		DBG_WARNING("Draw buffers can't grow to " << instances << " instances and " << draws << " draws, the limits are "
+			<< limits.getMaxInstances() << " and " << limits.getMaxDraws());
+		return false;
+	}
+
+	// The frames in flight keep reading the old buffers through their own descriptor sets
+	retireBuffer(drawCmdBuffer);
+	retireBuffer(instanceDataBuffer);
+	retireBuffer(instanceBoundsBuffer);
+	retireBuffer(visibilityBuffer);
+	retireBuffer(visibleInstanceBuffer);
+	retireBuffer(instanceRankBuffer);
+	retireBuffer(blockRankBuffer);
+	retireBuffer(batchDrawCmdBuffer);
+	retireBuffer(culledDrawCmdBuffer);
+
+	instanceCapacity = newInstanceCapacity;
+	drawCapacity = newDrawCapacity;
+
+	createDrawBuffers();
+	++drawBuffersVersion;
+
+	DBG_INFO("Draw buffers grown to " << instanceCapacity << " instances and " << drawCapacity << " draws");
+	return true;
+}
+
+bool Renderer::growTransformBuffer(u32 transforms)
+{
+	if (transforms <= transformCapacity)
+		return true;
+
+	auto& limits = Engine::config.render.limits;
+	u32 newCapacity = grownCapacity(transformCapacity, transforms, limits.getMaxTransforms(), limits.getGrowthFactor());
+
+	if (newCapacity == 0)
+	{
+		DBG_WARNING("Transform buffer can't grow to " << transforms << " transforms, the limit is " << limits.getMaxTransforms());
+		return false;
+	}
+
+	retireBuffer(transformBuffer);
+
+	transformCapacity = newCapacity;
+
+	createPerFrameBuffer(transformBuffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, sizeof(glm::fmat4) * transformCapacity);
+	++drawBuffersVersion;
+
+	DBG_INFO("Transform buffer grown to " << transformCapacity << " transforms");
+	return true;
+}
+
+void Renderer::updateDrawBufferDescriptors()
+{
+	if (drawBufferDescriptorVersions[frameIndex] == drawBuffersVersion)
+		return;
+	drawBufferDescriptorVersions[frameIndex] = drawBuffersVersion;
+
+	// Only the buffer bindings, the gBuffer sets also hold material descriptors that must be kept
+	auto rebind = [this](vdu::DescriptorSet& set) -> void {
+		auto updater = set.makeUpdater();
+		*updater->addBufferUpdate("transforms") = { transformBuffer.getHandle(frameIndex), 0, VK_WHOLE_SIZE };
+		*updater->addBufferUpdate("instances") = { visibleInstanceBuffer.getHandle(), 0, VK_WHOLE_SIZE };
+		set.submitUpdater(updater);
+		set.destroyUpdater(updater);
+	};
+
+	// The slot's last frame has finished, no other frame uses its sets
+	rebind(gBufferDescriptorSet[frameIndex]);
+	auto updater = gBufferDescriptorSet[frameIndex].makeUpdater();
+	*updater->addBufferUpdate("materials") = { materialRecordBuffer.getHandle(frameIndex), 0, VK_WHOLE_SIZE };
+	gBufferDescriptorSet[frameIndex].submitUpdater(updater);
+	gBufferDescriptorSet[frameIndex].destroyUpdater(updater);
+
+	rebind(shadowDescriptorSet[frameIndex]);
+	rebind(spotShadowDescriptorSet[frameIndex]);
+	updateCullingDescriptorSet(frameIndex);
+
+	// Updating a descriptor set invalidates the command buffers it is bound in, culling commands are recorded every frame
+	invalidateCommands(GBuffer_Descriptors_Input);
+	invalidateCommands(Shadow_Descriptors_Input);
+	invalidateCommands(Draw_Buffers_Input);
+}
+
+void Renderer::queueMaterialDescriptorUpdate(Material* material)
+{
+	dirtyMaterialsMutex.lock();
+	dirtyMaterials.push_back(material);
+	dirtyMaterialsMutex.unlock();
+}
+
+void Renderer::updateMaterialDescriptors()
+{
+	std::vector<Material*> materials;
+
+	dirtyMaterialsMutex.lock();
+	materials.swap(dirtyMaterials);
+	dirtyMaterialsMutex.unlock();
+
+	// Textures still waiting for staging space, their materials are tried again next frame
+	std::vector<Material*> waiting;
+	auto loading = [](Texture* texture) -> bool { return texture && texture->checkAvailability(Asset::LOADING_TO_GPU); };
+
+	for (auto material : materials)
+	{
+		if (!material->flat && (loading(material->data.textures.albedoSpec) || loading(material->data.textures.normalRough)))
+		{
+			waiting.push_back(material);
+			continue;
+		}
+
+		material->getAvailability() &= ~Asset::AWAITING_DESCRIPTOR_UPDATE;
 
-		Engine::world.skybox->getAvailability() &= ~Asset::LOADING_TO_GPU;
+		u32 recordIndex = material->gpuIndexBase / 2;
+		if (material->gpuIndexBase + 2 > materialTextureCapacity || !growMaterialRecordBuffer(recordIndex + 1))
+		{
+			DBG_WARNING("Material index " << recordIndex << " is past the capacity of " << materialTextureCapacity / 2 << " materials, it stays flat white");
+			continue;
+		}
+
+		if (material->flat)
+		{
+			auto& pbrData = material->data.pbrData;
+			materialRecords.set(recordIndex, { pbrData.colour, pbrData.metallic, pbrData.roughness, 0, glm::fvec2(0) });
+			continue;
+		}
+
+		materialRecords.set(recordIndex, { glm::fvec3(1), 0.f, 1.f, 1, glm::fvec2(0) });
+
+		// Every slot's set gets the textures once its frame comes up, before the slot's copy of the record does
+		for (auto& pending : pendingMaterialDescriptors)
+		{
+			if (std::find(pending.begin(), pending.end(), material) == pending.end())
+				pending.push_back(material);
+		}
+	}
+
+	if (waiting.size())
+	{
+		dirtyMaterialsMutex.lock();
+		dirtyMaterials.insert(dirtyMaterials.end(), waiting.begin(), waiting.end());
+		dirtyMaterialsMutex.unlock();
+	}
+
+	// Copied by the cull pass's frame copies before the gBuffer pass reads them, nothing is re-recorded. Records that
+	// don't fit in the staging ring go up next frame
+	streamDirtyRanges(materialRecordBuffer, materialRecords.getData(), materialRecords.getCapacity(), uploadedMaterialRecords);
+
+	auto& pending = pendingMaterialDescriptors[frameIndex];
+	if (pending.empty())
+		return;
+
+	auto& assets = Engine::assets;
+
+	// Every pending material's pair of textures goes into one vkUpdateDescriptorSets call
+	std::vector<VkDescriptorImageInfo> imageInfos(pending.size() * 2);
+	std::vector<VkWriteDescriptorSet> descriptorWrites;
+	descriptorWrites.reserve(pending.size());
+
+	for (auto material : pending)
+	{
+		auto& textures = material->data.textures;
+
+		auto info = &imageInfos[descriptorWrites.size() * 2];
 
-		updatePBRCommands();
+		info[0].sampler = textureSampler;
+		info[0].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		info[1].sampler = textureSampler;
+		info[1].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+		if (textures.albedoSpec && textures.albedoSpec->getView())
+			info[0].imageView = textures.albedoSpec->getView();
+		else
+			info[0].imageView = assets.getTexture("blank")->getView();
+
+		if (textures.normalRough && textures.normalRough->getView())
+			info[1].imageView = textures.normalRough->getView();
+		else
+			info[1].imageView = assets.getTexture("black")->getView();
+
+		VkWriteDescriptorSet write = {};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = materialTextureSet[frameIndex];
+		write.dstBinding = 0;
+		write.dstArrayElement = material->gpuIndexBase;
+		write.descriptorCount = 2;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		write.pImageInfo = info;
+
+		descriptorWrites.push_back(write);
+	}
+	pending.clear();
+
+	// Only this slot's set, its last frame has finished with it. The binding is update after bind, the recorded
+	// gBuffer commands pick the new textures up without being re-recorded
+	vkUpdateDescriptorSets(device, static_cast<u32>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+}
+
+bool Renderer::growMaterialRecordBuffer(u32 records)
+{
+	if (records <= materialRecords.getCapacity())
+		return true;
+
+	u32 newCapacity = grownCapacity(materialRecords.getCapacity(), records, materialTextureCapacity / 2, Engine::config.render.limits.getGrowthFactor());
+	if (newCapacity == 0)
+	{
+		DBG_WARNING("Material records can't grow to " << records << ", the material texture array holds " << materialTextureCapacity / 2 << " materials");
+		return false;
 	}
+
+	// The frames in flight keep reading the old buffer through their own descriptor sets
+	retireBuffer(materialRecordBuffer);
+	materialRecords.grow(newCapacity);
+	createPerFrameBuffer(materialRecordBuffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, sizeof(MaterialRecord) * materialRecords.getCapacity());
+	++drawBuffersVersion;
+
+	uploadedMaterialRecords.clear();
+
+	DBG_INFO("Material records grown to " << materialRecords.getCapacity());
+	return true;
+}
+
+void Renderer::updateSkyboxDescriptor()
+{
+	auto skybox = Engine::world.skybox;
+
+	// A skybox waiting for staging space keeps the flag until it is on the GPU
+	if (skybox->checkAvailability(Asset::AWAITING_DESCRIPTOR_UPDATE) && skybox->checkAvailability(Asset::ON_GPU))
+	{
+		skybox->getAvailability() &= ~(Asset::AWAITING_DESCRIPTOR_UPDATE | Asset::LOADING_TO_GPU);
+		for (auto& pending : skyboxDescriptorPending)
+			pending = true;
+	}
+
+	if (!skyboxDescriptorPending[frameIndex])
+		return;
+	skyboxDescriptorPending[frameIndex] = false;
+
+	// Only this slot's set, its last frame has finished with it
+	auto& set = pbrDescriptorSet[frameIndex];
+	auto updater = set.makeUpdater();
+	auto skyboxUpdater = updater->addImageUpdate("skybox");
+	*skyboxUpdater = { 
+		skySampler, 
+		Engine::assets.getTexture(skybox->getName())->getView(), 
+		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL 
+	};
+
+	set.submitUpdater(updater);
+	set.destroyUpdater(updater);
+
+	invalidateCommands(PBR_Descriptors_Input);
 }
 
 /*
@@ -990,44 +1504,337 @@ void Renderer::createLogicalDevice()
 	VkPhysicalDeviceFeatures pdf = {};
 	pdf.samplerAnisotropy = VK_TRUE;
 	pdf.multiDrawIndirect = VK_TRUE;
+	pdf.drawIndirectFirstInstance = VK_TRUE;
 	pdf.shaderStorageImageExtendedFormats = VK_TRUE;
 	pdf.geometryShader = VK_TRUE;
 
 	auto& dev = Engine::physicalDevice;
 	auto qFams = dev->getQueueFamilies();
 
-	lGraphicsQueue = qFams[0].createQueue(1.f);
-	lTransferQueue = qFams[0].createQueue(1.f);
+	u32 familyCount;
+	vkGetPhysicalDeviceQueueFamilyProperties(dev->getHandle(), &familyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> familyProperties(familyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(dev->getHandle(), &familyCount, familyProperties.data());
+
+	// Prefer families that only have the requested capabilities, those map to separate hardware (DMA engines, async compute)
+	auto findFamily = [&familyProperties](VkQueueFlags required, VkQueueFlags excluded) -> u32 {
+		for (u32 i = 0; i < familyProperties.size(); ++i)
+			if ((familyProperties[i].queueFlags & required) == required && !(familyProperties[i].queueFlags & excluded) && familyProperties[i].queueCount > 0)
+				return i;
+		return ~u32(0);
+	};
+
+	graphicsQueueFamily = findFamily(VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT, 0);
+	transferQueueFamily = findFamily(VK_QUEUE_TRANSFER_BIT, VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT);
+
+	if (graphicsQueueFamily == ~u32(0))
+		DBG_SEVERE("No queue family supports both graphics and compute");
+
+	if (transferQueueFamily == ~u32(0))
+	{
+		DBG_INFO("No dedicated transfer queue family, uploads share the graphics family");
+		transferQueueFamily = graphicsQueueFamily;
+	}
+
+	lGraphicsQueue = qFams[graphicsQueueFamily].createQueue(1.f);
+	lTransferQueue = qFams[transferQueueFamily].createQueue(1.f);
+
+	// Dedicated transfer queues may only copy image regions aligned to this
+	transferImageGranularity = familyProperties[transferQueueFamily].minImageTransferGranularity;
+
+	// The render graph's async compute passes run here (see RenderGraph::setQueues), with no compute only family they
+	// run on the graphics queue and lComputeQueue is never created
+	computeQueueFamily = findFamily(VK_QUEUE_COMPUTE_BIT, VK_QUEUE_GRAPHICS_BIT);
+	if (computeQueueFamily != ~u32(0))
+		lComputeQueue = qFams[computeQueueFamily].createQueue(1.f);
+	else
+		computeQueueFamily = graphicsQueueFamily;
 
 	logicalDevice.addExtension(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+
+	// Culled draws use the GPU written draw count when available
+	u32 extensionCount;
+	vkEnumerateDeviceExtensionProperties(dev->getHandle(), nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> extensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(dev->getHandle(), nullptr, &extensionCount, extensions.data());
+
+	bool drawIndirectCount = false;
+	for (auto& e : extensions)
+		if (!strcmp(e.extensionName, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME))
+			drawIndirectCount = true;
+
+	if (drawIndirectCount)
+		logicalDevice.addExtension(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+	else
+		DBG_WARNING("VK_KHR_draw_indirect_count not supported, culled batches will be drawn with zero instances");
+
+	// The material texture array is partially bound and written after it is bound (see materialTextureSet)
+	bool descriptorIndexing = false, maintenance3 = false;
+	for (auto& e : extensions)
+	{
+		if (!strcmp(e.extensionName, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME))
+			descriptorIndexing = true;
+		if (!strcmp(e.extensionName, VK_KHR_MAINTENANCE3_EXTENSION_NAME))
+			maintenance3 = true;
+	}
+
+	if (!descriptorIndexing || !maintenance3)
+		DBG_SEVERE("VK_EXT_descriptor_indexing not supported");
+
+	auto instance = Engine::vulkanInstance.getInstanceHandle();
+	auto getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2KHR");
+	auto getProperties2 = (PFN_vkGetPhysicalDeviceProperties2KHR)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceProperties2KHR");
+
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT supportedIndexing = {};
+	supportedIndexing.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+	VkPhysicalDeviceFeatures2 supported = {};
+	supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	supported.pNext = &supportedIndexing;
+	getFeatures2(dev->getHandle(), &supported);
+
+	if (!supportedIndexing.runtimeDescriptorArray || !supportedIndexing.descriptorBindingPartiallyBound ||
+		!supportedIndexing.descriptorBindingVariableDescriptorCount || !supportedIndexing.descriptorBindingSampledImageUpdateAfterBind ||
+		!supportedIndexing.shaderSampledImageArrayNonUniformIndexing)
+		DBG_SEVERE("The device can't partially bind or update after bind a sampled image array");
+
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexing = {};
+	indexing.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+	indexing.runtimeDescriptorArray = VK_TRUE;
+	indexing.descriptorBindingPartiallyBound = VK_TRUE;
+	indexing.descriptorBindingVariableDescriptorCount = VK_TRUE;
+	indexing.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+	indexing.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+
+	VkPhysicalDeviceFeatures2 features = {};
+	features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	features.pNext = &indexing;
+	features.features = pdf;
+
+	// A combined image sampler counts as both a sampled image and a sampler, only the fragment stage reads the array
+	VkPhysicalDeviceDescriptorIndexingPropertiesEXT indexingLimits = {};
+	indexingLimits.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+	VkPhysicalDeviceProperties2 properties = {};
+	properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+	properties.pNext = &indexingLimits;
+	getProperties2(dev->getHandle(), &properties);
+
+	materialTextureCapacity = std::min({ u32(MATERIAL_TEXTURE_LIMIT),
+		indexingLimits.maxDescriptorSetUpdateAfterBindSampledImages, indexingLimits.maxDescriptorSetUpdateAfterBindSamplers,
+		indexingLimits.maxPerStageDescriptorUpdateAfterBindSampledImages, indexingLimits.maxPerStageDescriptorUpdateAfterBindSamplers,
+		indexingLimits.maxPerStageUpdateAfterBindResources - 8 }); // The fragment stage's other bindings and colour attachments count too
+	materialTextureCapacity &= ~1u; // Whole materials
+	DBG_INFO("Material texture array holds " << materialTextureCapacity << " textures");
+
+	logicalDevice.addExtension(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+	logicalDevice.addExtension(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+
 	logicalDevice.addLayer("VK_LAYER_LUNARG_standard_validation");
-	logicalDevice.addQueue(&lGraphicsQueue);
-	logicalDevice.addQueue(&lTransferQueue);
+	logicalDevice.addQueue(&lGraphicsQueue, graphicsQueueFamily);
+	logicalDevice.addQueue(&lTransferQueue, transferQueueFamily);
+	if (computeQueueFamily != graphicsQueueFamily)
+		logicalDevice.addQueue(&lComputeQueue, computeQueueFamily);
 
-	logicalDevice.setEnabledDeviceFeatures(pdf);
+	logicalDevice.setEnabledDeviceFeatures(features);
 
 	logicalDevice.create(Engine::physicalDevice);
 
 	graphicsQueue = lGraphicsQueue.getHandle();
 	presentQueue = lGraphicsQueue.getHandle();
-	computeQueue = lGraphicsQueue.getHandle();
+	computeQueue = computeQueueFamily != graphicsQueueFamily ? lComputeQueue.getHandle() : lGraphicsQueue.getHandle();
 	transferQueue = lTransferQueue.getHandle();
 
 	device = logicalDevice.getHandle();
+
+	cmdDrawIndexedIndirectCount = drawIndirectCount ? (PFN_vkCmdDrawIndexedIndirectCountKHR)vkGetDeviceProcAddr(device, "vkCmdDrawIndexedIndirectCountKHR") : nullptr;
+}
+
+void Renderer::createPipelines()
+{
+	std::vector<std::function<void(void)>> pipelineCreates = {
+		[this]() -> void { createGBufferPipeline(); },
+		[this]() -> void { createPBRPipeline(); },
+		[this]() -> void { createScreenPipeline(); },
+		[this]() -> void { createShadowPipeline(); },
+		[this]() -> void { createSSAOPipeline(); },
+		[this]() -> void { createCullingPipeline(); },
+		[this]() -> void { uiRenderer.createOverlayPipeline(); }
+	};
+
+	// A warm start only looks the pipelines up in the loaded cache
+	std::string profile = pipelineCacheWarm ? "pipelineswarm" : "pipelinescold";
+
+	PROFILE_START(profile);
+	Engine::threading->parallelFor(static_cast<u32>(pipelineCreates.size()), [&pipelineCreates](u32 i) -> void {
+		pipelineCreates[i]();
+	});
+	PROFILE_END(profile);
+
+	DBG_INFO("Created " << pipelineCreates.size() << " pipeline groups in " << PROFILE_TO_MS(PROFILE_GET_LAST(profile)) << "ms, " <<
+		(pipelineCacheWarm ? "warm" : "cold") << " pipeline cache");
+}
+
+// Pipeline cache file layout:
+//	u32 magic, u32 version, u32 vendorID, u32 deviceID, u32 driverVersion, u8[VK_UUID_SIZE] pipelineCacheUUID,
+//	u64 data size, u8[data size] from vkGetPipelineCacheData
+#define PIPELINE_CACHE_PATH "/cache/pipelines.bin"
+#define PIPELINE_CACHE_MAGIC 0x48435050 // "PPCH"
+#define PIPELINE_CACHE_VERSION 1
+
+void Renderer::createPipelineCache()
+{
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(Engine::physicalDevice->getHandle(), &properties);
+
+	std::vector<u8> data;
+
+	std::error_code error;
+	File file;
+	if (fs::exists(Engine::workingDirectory + PIPELINE_CACHE_PATH, error) && file.open(PIPELINE_CACHE_PATH, File::Mode(File::binary | File::in)))
+	{
+		u32 magic, version, vendorID, deviceID, driverVersion;
+		u8 uuid[VK_UUID_SIZE];
+		u64 size;
+		file.read(magic);
+		file.read(version);
+		file.read(vendorID);
+		file.read(deviceID);
+		file.read(driverVersion);
+		file.readArray(uuid, VK_UUID_SIZE);
+		file.read(size);
+
+		// Some drivers crash on data another device or driver version wrote, rather than rejecting it
+		if (file.fstream() && magic == PIPELINE_CACHE_MAGIC && version == PIPELINE_CACHE_VERSION && vendorID == properties.vendorID &&
+			deviceID == properties.deviceID && driverVersion == properties.driverVersion && !memcmp(uuid, properties.pipelineCacheUUID, VK_UUID_SIZE) &&
+			size <= u64(file.getSize()))
+		{
+			data.resize(size);
+			file.readArray(data.data(), u32(size));
+			if (!file.fstream())
+			{
+				DBG_WARNING("Truncated pipeline cache " << PIPELINE_CACHE_PATH);
+				data.clear();
+			}
+		}
+		else
+		{
+			DBG_INFO("Pipeline cache was saved by another device or driver, starting an empty one");
+		}
+	}
+
+	VkPipelineCacheCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	createInfo.initialDataSize = data.size();
+	createInfo.pInitialData = data.data();
+
+	VK_CHECK_RESULT(vkCreatePipelineCache(device, &createInfo, nullptr, &pipelineCache));
+
+	pipelineCacheWarm = data.size() > 0;
+}
+
+void Renderer::savePipelineCache()
+{
+	size_t size;
+	VK_CHECK_RESULT(vkGetPipelineCacheData(device, pipelineCache, &size, nullptr));
+	std::vector<u8> data(size);
+	VK_CHECK_RESULT(vkGetPipelineCacheData(device, pipelineCache, &size, data.data()));
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(Engine::physicalDevice->getHandle(), &properties);
+
+	std::error_code error;
+	fs::create_directories(fs::path(Engine::workingDirectory + PIPELINE_CACHE_PATH).parent_path(), error);
+
+	File file;
+	if (!file.create(PIPELINE_CACHE_PATH, File::Mode(File::binary | File::out | File::trunc)))
+	{
+		DBG_WARNING("Could not write pipeline cache " << PIPELINE_CACHE_PATH);
+		return;
+	}
+
+	file.write<u32>(PIPELINE_CACHE_MAGIC);
+	file.write<u32>(PIPELINE_CACHE_VERSION);
+	file.write<u32>(properties.vendorID);
+	file.write<u32>(properties.deviceID);
+	file.write<u32>(properties.driverVersion);
+	file.writeArray(properties.pipelineCacheUUID, VK_UUID_SIZE);
+	file.write<u64>(size);
+	file.writeArray(data.data(), u32(size));
+}
+
+void Renderer::destroyPipelineCache()
+{
+	vkDestroyPipelineCache(device, pipelineCache, nullptr);
+	pipelineCache = VK_NULL_HANDLE;
 }
 
 void Renderer::createPerThreadCommandPools()
 {
+	auto& qFams = Engine::physicalDevice->getQueueFamilies();
+
 	commandPool.setFlags(VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
-	commandPool.setQueueFamily(&Engine::physicalDevice->getQueueFamilies().front());
+	commandPool.setQueueFamily(&qFams[Engine::renderer->graphicsQueueFamily]);
 	commandPool.create(&Engine::renderer->logicalDevice);
+
+	transferCommandPool.setFlags(VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+	transferCommandPool.setQueueFamily(&qFams[Engine::renderer->transferQueueFamily]);
+	transferCommandPool.create(&Engine::renderer->logicalDevice);
 }
 
-void Renderer::createQueryPool()
+u64 Renderer::getInputVersions(const std::vector<CommandInput>& inputs)
 {
-	queryPool.setQueryCount(NUM_GPU_TIMESTAMPS);
-	queryPool.setQueryType(VK_QUERY_TYPE_TIMESTAMP);
-	queryPool.create(&logicalDevice);
+	u64 versions = 0;
+	for (auto input : inputs)
+		versions += commandInputVersions[input];
+	return versions;
+}
+
+bool Renderer::needsRecording(RecordedCommands& commands)
+{
+	u64 versions = getInputVersions(commands.inputs);
+	if (commands.recordedWith[frameIndex] == versions)
+		return false;
+
+	commands.recordedWith[frameIndex] = versions;
+	++reRecordedCommands;
+	return true;
+}
+
+void Renderer::prepareSecondaryCommands(SecondaryCommandSet set, u32 slotCount)
+{
+	auto& buffers = secondaryCommandBuffers[set][frameIndex];
+	if (buffers.size() < slotCount)
+		buffers.resize(slotCount, VK_NULL_HANDLE);
+}
+
+VkCommandBuffer Renderer::beginSecondaryCommands(SecondaryCommandSet set, u32 slot, VkRenderPass renderPass, VkFramebuffer framebuffer)
+{
+	auto& cmd = secondaryCommandBuffers[set][frameIndex][slot];
+
+	if (cmd == VK_NULL_HANDLE)
+	{
+		VkCommandBufferAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = commandPool.getHandle();
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		allocInfo.commandBufferCount = 1;
+
+		VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &allocInfo, &cmd));
+	}
+
+	VkCommandBufferInheritanceInfo inheritanceInfo = {};
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.renderPass = renderPass;
+	inheritanceInfo.subpass = 0;
+	inheritanceInfo.framebuffer = framebuffer;
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+	beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+	VK_CHECK_RESULT(vkBeginCommandBuffer(cmd, &beginInfo));
+
+	return cmd;
 }
 
 void Renderer::createTextureSampler()
@@ -1094,18 +1901,15 @@ void Renderer::createTextureSampler()
 */
 void Renderer::createUBOs()
 {
-	cameraUBO.setMemoryProperty(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-	cameraUBO.setUsage(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
-	cameraUBO.create(&logicalDevice, sizeof(CameraUBOData));
+	// Written through stageFrameData
+	createPerFrameBuffer(cameraUBO, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, sizeof(CameraUBOData));
 
-	// 8 MB of transforms can support around 125k model instances
-	transformUBO.setMemoryProperty(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-	transformUBO.setUsage(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
-	transformUBO.create(&logicalDevice, 8 * 1024 * 1024);
+	// A storage buffer, uniform buffer ranges are too small for large scenes. Grown by streamTransforms
+	transformCapacity = Engine::config.render.limits.getTransformCapacity();
+	createPerFrameBuffer(transformBuffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, sizeof(glm::fmat4) * transformCapacity);
+	transformData.resize(transformCapacity);
 
-	ssaoConfigBuffer.setMemoryProperty(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-	ssaoConfigBuffer.setUsage(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
-	ssaoConfigBuffer.create(&logicalDevice, sizeof(SSAOConfig));
+	ssaoConfigBuffer.create(&gpuAllocator, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, sizeof(SSAOConfig));
 }
 
 /*
@@ -1113,16 +1917,18 @@ void Renderer::createUBOs()
 */
 void Renderer::createDescriptorPool()
 {
-	descriptorPool.addPoolCount(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 20);
+	// The sets reading staged buffers exist once per frame in flight
+	descriptorPool.addPoolCount(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 20 * FRAMES_IN_FLIGHT);
 	descriptorPool.addPoolCount(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1100);
-	descriptorPool.addPoolCount(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1430);
-	descriptorPool.addPoolCount(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 13);
-	descriptorPool.addSetCount(20);
+	descriptorPool.addPoolCount(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 430 * FRAMES_IN_FLIGHT);
+	descriptorPool.addPoolCount(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 13 * FRAMES_IN_FLIGHT);
+	descriptorPool.addPoolCount(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 23 * FRAMES_IN_FLIGHT);
+	descriptorPool.addSetCount(21 * FRAMES_IN_FLIGHT);
 
 	descriptorPool.create(&logicalDevice);
 
 	freeableDescriptorPool.addPoolCount(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 200);
-	freeableDescriptorPool.addPoolCount(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3);
+	freeableDescriptorPool.addPoolCount(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3 * FRAMES_IN_FLIGHT);
 	freeableDescriptorPool.addSetCount(200);
 	freeableDescriptorPool.setFreeable(true);
 
@@ -1130,27 +1936,251 @@ void Renderer::createDescriptorPool()
 }
 
 /*
-@brief	Create Vulkan semaphores
+@brief	Create the frame fences, the semaphores belong to the render graphs
 */
 void Renderer::createSynchroObjects()
 {
-	VkSemaphoreCreateInfo semaphoreInfo = {};
-	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	// Signalled, so the first use of every slot goes straight through
+	for (u32 i = 0; i < FRAMES_IN_FLIGHT; ++i)
+		frameFences[i].create(&logicalDevice, true);
+}
+
+/*
+@brief	Declare the passes of a frame and what they read and write
+@note	Declared in execution order. The cull pass goes first, its frame copies fill the frame's own buffer copies and
+		move vertex data, so it also declares the transfers on the culled draws for the barrier before it
+*/
+void Renderer::createAttachments()
+{
+	// The images only, their memory is bound once every lifetime is known
+	createGBufferAttachments();
+	createSSAOAttachments();
+	createPBRAttachments();
+	uiRenderer.createOverlayAttachments();
+
+	attachmentAllocator.clear();
+
+	std::vector<std::pair<Texture*, u32>> placed;
+	auto place = [&](Texture& attachment, FrameStep firstUse, FrameStep lastUse) -> void {
+		auto requirements = attachment.getMemoryRequirements();
+		u32 slot = attachmentAllocator.place(firstUse, lastUse, requirements.size, requirements.alignment, requirements.memoryTypeBits);
+		placed.push_back({ &attachment, slot });
+	};
+
+	// In order of first use. SSAO's targets are dead once the next blur has read them, the G-buffer once PBR has
+	place(gBufferColourAttachment, GBuffer_Step, PBR_Step);
+	place(gBufferNormalAttachment, GBuffer_Step, PBR_Step);
+	place(gBufferPBRAttachment, GBuffer_Step, PBR_Step);
+	place(gBufferDepthAttachment, GBuffer_Step, PBR_Step);
+	place(ssaoColourAttachment, SSAO_Step, SSAO_Blur_Step);
+	place(ssaoBlurAttachment, SSAO_Blur_Step, SSAO_Final_Step);
+	place(ssaoFinalAttachment, SSAO_Final_Step, PBR_Step);
+	place(pbrOutput, PBR_Step, Screen_Step);
+	place(uiRenderer.uiTexture, Overlay_Step, Screen_Step);
+	place(uiRenderer.uiDepthTexture, Overlay_Step, Overlay_Step);
+
+	auto& slots = attachmentAllocator.getSlots();
+	attachmentMemory.resize(slots.size());
+	for (u32 i = 0; i < slots.size(); ++i)
+	{
+		VkMemoryRequirements requirements = { slots[i].size, slots[i].alignment, slots[i].memoryTypeBits };
+		attachmentMemory[i] = gpuAllocator.allocateImage(requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true);
+		if (!attachmentMemory[i].isValid())
+			DBG_SEVERE("Out of device memory for attachments, " << slots[i].size << " bytes");
+	}
+
+	for (auto& attachment : placed)
+	{
+		auto& memory = attachmentMemory[attachment.second];
+		attachment.first->bindMemory(memory.memory, memory.offset);
+	}
+
+	DBG_INFO("Attachments share " << slots.size() << " allocations of " << (attachmentAllocator.getSlotSize() >> 20) << " MB, "
+		<< (attachmentAllocator.getPlacedSize() >> 20) << " MB without aliasing");
+}
+
+void Renderer::destroyAttachments()
+{
+	destroyGBufferAttachments();
+	destroySSAOAttachments();
+	destroyPBRAttachments();
+	uiRenderer.destroyOverlayAttachments();
+
+	for (auto& memory : attachmentMemory)
+		gpuAllocator.free(memory);
+	attachmentMemory.clear();
+}
+
+void Renderer::createRenderGraphs()
+{
+	auto& graph = frameGraph;
+
+	auto culledDraws = graph.addResource("culled draws", RenderGraph::Buffer);
+	auto gBuffer = graph.addResource("gbuffer");
+	auto shadowMaps = graph.addResource("shadow maps");
+	auto overlay = graph.addResource("overlay");
+	auto ssao = graph.addResource("ssao");
+	auto hdr = graph.addResource("pbr output");
+	auto swapchain = graph.addSwapchain("swapchain", &screenSwapchain, [this]() -> void {
+		destroyScreenPipeline();
+		destroyScreenCommands();
+		destroyScreenSwapchain();
 
-	gBufferFinishedSemaphore.create(&logicalDevice);
-	imageAvailableSemaphore.create(&logicalDevice);
-	pbrFinishedSemaphore.create(&logicalDevice);
-	screenFinishedSemaphore.create(&logicalDevice);
-	shadowFinishedSemaphore.create(&logicalDevice);
-	overlayFinishedSemaphore.create(&logicalDevice);
-	overlayCombineFinishedSemaphore.create(&logicalDevice);
-	ssaoFinishedSemaphore.create(&logicalDevice);
+		createScreenSwapchain();
 
-	gBufferGroupFence.create(&logicalDevice, true);
-	pbrGroupFence.create(&logicalDevice, true);
+		// Before any pass, the passes' framebuffers and descriptors use them
+		destroyAttachments();
+		createAttachments();
+	});
+
+	// createAttachments decides which attachments share memory, so all of them are ordered as one resource
+	graph.alias(ssao, gBuffer);
+	graph.alias(hdr, gBuffer);
+	graph.alias(overlay, gBuffer);
+
+	graph.addPass("cull")
+		.write(culledDraws, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT)
+		.setCommands([this](u32 frame, u32, vdu::QueueSubmission& submission) -> void {
+			submission.addCommands(&frameCopyCommandBuffer[frame]);
+			submission.addCommands(&cullCommandBuffer[frame]);
+		});
+
+	graph.addPass("gbuffer")
+		.read(culledDraws, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT)
+		.write(gBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT)
+		.setCommands([this](u32 frame, u32, vdu::QueueSubmission& submission) -> void {
+			submission.addCommands(&gBufferCommandBuffer[frame]);
+		})
+		.setResize([this]() -> void {
+			destroyGBufferRenderPass();
+			destroyGBufferFramebuffers();
+			destroyGBufferPipeline();
+			destroyGBufferCommands();
+
+			createGBufferRenderPass();
+			createGBufferFramebuffers();
+			createGBufferPipeline();
+			createGBufferCommands();
+
+			updateGBufferCommands();
+		});
+
+	graph.addPass("shadow")
+		.read(culledDraws, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT)
+		.write(shadowMaps, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT)
+		.setCommands([this](u32 frame, u32, vdu::QueueSubmission& submission) -> void {
+			submission.addCommands(&shadowCommandBuffer[frame]);
+		});
+
+	// SSAO always reads the textured gbuffer's depth
+	graph.addPass("ssao")
+		.read(gBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT)
+		.write(ssao, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT)
+		.setCommands([this](u32 frame, u32, vdu::QueueSubmission& submission) -> void {
+			submission.addCommands(&ssaoCommandBuffer[frame]);
+		})
+		.setResize([this]() -> void {
+			discardSSAOVariantBuild();
+			destroySSAORenderPass();
+			destroySSAOFramebuffer();
+			destroySSAODescriptorSets();
+			destroySSAOPipeline();
+			destroySSAOCommands();
+
+			createSSAORenderPass();
+			createSSAOFramebuffer();
+			createSSAODescriptorSets();
+			createSSAOPipeline();
+			createSSAOCommands();
+
+			updateSSAODescriptorSets();
+			updateSSAOCommands();
+		});
+
+	graph.addPass("pbr")
+		.read(gBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT)
+		.read(ssao, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT)
+		.read(shadowMaps, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT)
+		.write(hdr, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT)
+		.setCommands([this](u32 frame, u32, vdu::QueueSubmission& submission) -> void {
+			submission.addCommands(&pbrCommandBuffer[frame]);
+		})
+		.setResize([this]() -> void {
+			destroyPBRPipeline();
+			destroyPBRCommands();
+
+			createPBRPipeline();
+			createPBRCommands();
+
+			updatePBRDescriptorSets(gBufferAttachments);
+			updatePBRCommands();
+		});
+
+	// After PBR, it reuses the G-buffer's memory
+	graph.addPass("overlay")
+		.write(overlay, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT)
+		.setCommands([this](u32 frame, u32, vdu::QueueSubmission& submission) -> void {
+			submission.addCommands(&uiRenderer.commandBuffers[frame]);
+		})
+		.setResize([this]() -> void {
+			uiRenderer.cleanupForReInit();
+
+			uiRenderer.createOverlayRenderPass();
+			uiRenderer.createOverlayPipeline();
+			uiRenderer.createOverlayFramebuffer();
+			uiRenderer.createOverlayCommands();
+
+			uiRenderer.updateOverlayCommands();
+		});
+
+	// The swapchain was recreated before any pass, its resolution dependant objects are made here once the
+	// attachments it samples exist
+	graph.addPass("screen")
+		.read(hdr, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT)
+		.read(overlay, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT)
+		.write(swapchain, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT)
+		.setCommands([this](u32, u32 imageIndex, vdu::QueueSubmission& submission) -> void {
+			submission.addCommands(screenCommandBuffers.getHandle(imageIndex));
+		})
+		.setResize([this]() -> void {
+			createScreenCommands();
+			createScreenPipeline();
+
+			updateScreenDescriptorSets();
+			updateScreenCommands();
+		});
+
+	graph.setQueues(&lGraphicsQueue, computeQueueFamily != graphicsQueueFamily ? &lComputeQueue : nullptr);
+	graph.compile(&logicalDevice, &commandPool, FRAMES_IN_FLIGHT);
+
+	// The console shown while the engine starts up, on its own semaphores so it never touches the frame slots
+	auto consoleOverlay = consoleGraph.addResource("overlay");
+	auto consoleSwapchain = consoleGraph.addSwapchain("swapchain", &screenSwapchain, nullptr);
+
+	consoleGraph.addPass("overlay")
+		.write(consoleOverlay, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT)
+		.setCommands([this](u32 frame, u32, vdu::QueueSubmission& submission) -> void {
+			submission.addCommands(&uiRenderer.commandBuffers[frame]);
+		});
+
+	consoleGraph.addPass("screen")
+		.read(consoleOverlay, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT)
+		.write(consoleSwapchain, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT)
+		.setCommands([this](u32, u32 imageIndex, vdu::QueueSubmission& submission) -> void {
+			submission.addCommands(screenCommandBuffersForConsole.getHandle(imageIndex));
+		});
+
+	consoleGraph.setQueues(&lGraphicsQueue, nullptr);
+	consoleGraph.compile(&logicalDevice, &commandPool, FRAMES_IN_FLIGHT);
 }
 
 void Renderer::beginTransferCommands(vdu::CommandBuffer& cmd)
+{
+	cmd.allocate(&logicalDevice, &transferCommandPool);
+	cmd.begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+}
+
+void Renderer::beginGraphicsCommands(vdu::CommandBuffer& cmd)
 {
 	cmd.allocate(&logicalDevice, &commandPool);
 	cmd.begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
@@ -1185,9 +2215,9 @@ void Renderer::updateCameraBuffer()
 	cameraUBOData.pos = Engine::camera.getPosition();
 	cameraUBOData.viewRays = Engine::camera.getViewRays();
 
-	void* data = cameraUBO.getMemory()->map();
-	memcpy(data, &cameraUBOData, sizeof(cameraUBOData));
-	cameraUBO.getMemory()->unmap();
+	void* data = stageFrameData(cameraUBO, 0, sizeof(cameraUBOData));
+	if (data)
+		memcpy(data, &cameraUBOData, sizeof(cameraUBOData));
 }
 
 /*
@@ -1195,28 +2225,87 @@ void Renderer::updateCameraBuffer()
 */
 void Renderer::updateTransformBuffer()
 {
-	//gBufferGroupFence.wait();
-
 	//PROFILE_MUTEX("transformmutex", Engine::threading->instanceTransformMutex.lock());
 
 	auto tIndex = ModelInstance::toGPUTransformIndex;
+	auto& limits = Engine::config.render.limits;
 
-	glm::fmat4* transform = (glm::fmat4*)transformUBO.getMemory()->map();
-
-	int i = 0;
+	// Only instances whose transform changed since they were last uploaded are written,
+	// the GPU worker streams them to transformBuffer with the next frame (streamTransforms)
 	for (auto& m : Engine::world.instancesToDraw)
 	{
-		transform[m->transformIndex] = m->transform[tIndex].getTransformMat();
-		++i;
-	}
+		if (m->uploadedVersion == m->changeVersion)
+			continue;
 
-	transformUBO.getMemory()->unmap();
+		// The GPU buffer follows the size of transformData
+		if (m->transformIndex >= transformData.size())
+		{
+			u32 size = grownCapacity(u32(transformData.size()), m->transformIndex + 1, limits.getMaxTransforms(), limits.getGrowthFactor());
+			if (size == 0)
+				continue;
+			transformData.resize(size);
+		}
+
+		transformData[m->transformIndex] = m->transform[tIndex].getTransformMat();
+		dirtyTransforms.push_back(m->transformIndex);
+		m->uploadedVersion = m->changeVersion;
+	}
 
 	//Engine::threading->instanceTransformMutex.unlock();
 
 	ModelInstance::toGPUTransformIndex = tIndex == 0 ? 1 : 0;
 }
 
+/*
+@brief	Stage the transforms changed since the last frame
+*/
+void Renderer::streamTransforms()
+{
+	// Dirty transforms this close together go up in one copy along with the unchanged ones between them
+	const u32 maxGap = 8;
+	const u32 maxCopy = u32(STAGING_RING_MAX_CHUNK / sizeof(glm::fmat4));
+
+	PROFILE_MUTEX("phystoenginemutex", Engine::threading->physToEngineMutex.lock());
+
+	u32 requiredTransforms = glm::max(u32(transformData.size()), u32(Engine::config.render.limits.getTransformCapacity()));
+	if (requiredTransforms > transformCapacity)
+	{
+		u32 oldCapacity = transformCapacity;
+		if (growTransformBuffer(requiredTransforms))
+		{
+			// The new buffer starts empty, everything the old one held goes up again
+			transformData.resize(transformCapacity);
+			dirtyTransforms.reserve(dirtyTransforms.size() + oldCapacity);
+			for (u32 i = 0; i < oldCapacity; ++i)
+				dirtyTransforms.push_back(i);
+		}
+	}
+
+	std::sort(dirtyTransforms.begin(), dirtyTransforms.end());
+	dirtyTransforms.erase(std::unique(dirtyTransforms.begin(), dirtyTransforms.end()), dirtyTransforms.end());
+
+	u32 streamed = 0;
+	while (streamed < dirtyTransforms.size())
+	{
+		u32 first = dirtyTransforms[streamed];
+		u32 end = streamed + 1;
+		while (end < dirtyTransforms.size() && dirtyTransforms[end] - dirtyTransforms[end - 1] <= maxGap && dirtyTransforms[end] - first < maxCopy)
+			++end;
+		u32 count = dirtyTransforms[end - 1] - first + 1;
+
+		void* data = stageFrameData(transformBuffer, u64(first) * sizeof(glm::fmat4), u64(count) * sizeof(glm::fmat4));
+		if (!data)
+			break; // The rest stays dirty until the next frame
+
+		memcpy(data, &transformData[first], count * sizeof(glm::fmat4));
+		streamed = end;
+	}
+
+	dirtyTransforms.erase(dirtyTransforms.begin(), dirtyTransforms.begin() + streamed);
+
+	Engine::threading->physToEngineMutex.unlock();
+}
+
 void Renderer::updateSSAOConfigBuffer()
 {
 	Engine::console->postMessage("Updating SSAO config buffer", glm::fvec3(0.1, 0.1, 0.9));
@@ -1238,9 +2327,10 @@ void Renderer::updateSSAOConfigBuffer()
 										(1.f - p[0][2]) / p[0][0],
 										(1.f + p[1][2]) / p[1][1]);
 
-	void* data = ssaoConfigBuffer.getMemory()->map();
-	memcpy(data, &ssaoConfigData, sizeof(ssaoConfigData));
-	ssaoConfigBuffer.getMemory()->unmap();
+	// Rarely changes, so rather than staging it per frame we wait for the frames reading it
+	waitForAllFrames();
+
+	ssaoConfigBuffer.write(0, &ssaoConfigData, sizeof(ssaoConfigData));
 }
 
 void Renderer::setImageLayout(VkCommandBuffer cmdbuffer, Texture& tex, VkImageLayout oldImageLayout, VkImageLayout newImageLayout, VkPipelineStageFlags srcStageMask, VkPipelineStageFlags dstStageMask)
@@ -0,0 +1,60 @@
+#include "PCH.hpp"
+#include "RingAllocator.hpp"
+
+void RingAllocator::init(u64 pCapacity)
+{
+	capacity = pCapacity;
+	head = 0;
+	tail = 0;
+	blocks.clear();
+	pendingSubmissions.clear();
+}
+
+u64 RingAllocator::allocate(u64 owner, u64 size, u64 alignment)
+{
+	if (size == 0 || size > capacity)
+		return INVALID_OFFSET;
+
+	retire();
+
+	u64 offset = head % capacity;
+	u64 alignedOffset = (offset + alignment - 1) / alignment * alignment;
+	u64 start = head - offset + alignedOffset;
+
+	// Allocations are contiguous, if it doesn't fit before the end the rest of the buffer is skipped
+	if (alignedOffset + size > capacity)
+		start = head - offset + capacity;
+
+	if (start + size - tail > capacity)
+		return INVALID_OFFSET;
+
+	head = start + size;
+	blocks.push_back({ owner, head, 0 });
+	return start % capacity;
+}
+
+void RingAllocator::submit(u64 owner, u64 submission)
+{
+	for (auto& block : blocks)
+	{
+		if (block.owner == owner && block.submission == 0)
+			block.submission = submission;
+	}
+
+	pendingSubmissions.insert(submission);
+}
+
+void RingAllocator::release(u64 submission)
+{
+	pendingSubmissions.erase(submission);
+	retire();
+}
+
+void RingAllocator::retire()
+{
+	while (!blocks.empty() && blocks.front().submission != 0 && pendingSubmissions.count(blocks.front().submission) == 0)
+	{
+		tail = blocks.front().end;
+		blocks.pop_front();
+	}
+}
@@ -10,6 +10,7 @@ void Renderer::createSSAOAttachments()
 	tci.format = VK_FORMAT_R8G8B8A8_UNORM;
 	tci.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 	tci.usageFlags = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+	tci.aliased = true;
 
 	ssaoColourAttachment.loadToGPU(&tci);
 
@@ -73,14 +74,7 @@ void Renderer::createSSAOPipeline()
 	ssaoPipelineLayout.addDescriptorSetLayout(&ssaoDescriptorSetLayout);
 	ssaoPipelineLayout.create(&logicalDevice);
 
-	ssaoPipeline.addViewport({ 0.f, 0.f, (float)renderResolution.width, (float)renderResolution.height, 0.f, 1.f }, { 0, 0, renderResolution.width, renderResolution.height });
-	ssaoPipeline.setVertexInputState(&ssaoVertexInputState);
-	ssaoPipeline.setShaderProgram(&ssaoShader);
-	ssaoPipeline.setPipelineLayout(&ssaoPipelineLayout);
-	ssaoPipeline.setRenderPass(&ssaoRenderPass);
-	ssaoPipeline.setMaxDepthBounds(Engine::maxDepth);
-	ssaoPipeline.setCullMode(VK_CULL_MODE_FRONT_BIT);
-	ssaoPipeline.create(&logicalDevice);
+	createSSAOVariant();
 
 	ssaoBlurPipelineLayout.addDescriptorSetLayout(&ssaoBlurDescriptorSetLayout);
 	ssaoBlurPipelineLayout.addPushConstantRange( { VK_SHADER_STAGE_FRAGMENT_BIT,0,sizeof(glm::ivec2) });
@@ -89,11 +83,111 @@ void Renderer::createSSAOPipeline()
 	ssaoBlurPipeline.addViewport({ 0.f, 0.f, (float)renderResolution.width, (float)renderResolution.height, 0.f, 1.f }, { 0, 0, renderResolution.width, renderResolution.height });
 	ssaoBlurPipeline.setVertexInputState(&ssaoVertexInputState);
 	ssaoBlurPipeline.setShaderProgram(&ssaoBlurShader);
-	ssaoBlurPipeline.setPipelineLayout(&ssaoBlurPipelineLayout);
-	ssaoBlurPipeline.setRenderPass(&ssaoBlurRenderPass);
+	ssaoBlurPipeline.setPipelineLayout(ssaoBlurPipelineLayout.getHandle());
+	ssaoBlurPipeline.setRenderPass(ssaoBlurRenderPass.getHandle(), 1);
 	ssaoBlurPipeline.setMaxDepthBounds(Engine::maxDepth);
 	ssaoBlurPipeline.setCullMode(VK_CULL_MODE_FRONT_BIT);
-	ssaoBlurPipeline.create(&logicalDevice);
+	ssaoBlurPipeline.create(&logicalDevice, pipelineCache);
+}
+
+u64 Renderer::getSSAOVariantKey()
+{
+	const auto& ssao = Engine::config.render.ssao;
+	return (u64(u32(ssao.getSamples())) << 32) | u32(ssao.getSpiralTurns());
+}
+
+GraphicsPipeline* Renderer::prepareSSAOVariant(u64 key)
+{
+	auto pipeline = new GraphicsPipeline();
+
+	pipeline->addViewport({ 0.f, 0.f, (float)renderResolution.width, (float)renderResolution.height, 0.f, 1.f }, { 0, 0, renderResolution.width, renderResolution.height });
+	pipeline->setVertexInputState(&ssaoVertexInputState);
+	pipeline->setShaderProgram(&ssaoShader);
+	pipeline->setPipelineLayout(ssaoPipelineLayout.getHandle());
+	pipeline->setRenderPass(ssaoRenderPass.getHandle(), 1);
+	pipeline->setMaxDepthBounds(Engine::maxDepth);
+	pipeline->setCullMode(VK_CULL_MODE_FRONT_BIT);
+	// The sample loop's bound, see ssao.glsl
+	pipeline->setSpecializationConstant(0, s32(key >> 32));
+	pipeline->setSpecializationConstant(1, s32(u32(key)));
+
+	return pipeline;
+}
+
+void Renderer::createSSAOVariant()
+{
+	u64 key = getSSAOVariantKey();
+
+	auto pipeline = prepareSSAOVariant(key);
+	pipeline->create(&logicalDevice, pipelineCache);
+	ssaoPipelines[key] = pipeline;
+
+	ssaoPipeline = pipeline;
+	ssaoPipelineKey = key;
+	invalidateCommands(SSAO_Pipeline_Input);
+}
+
+void Renderer::buildSSAOVariant(u64 key)
+{
+	ssaoVariantBuild.key = key;
+	ssaoVariantBuild.pipeline = prepareSSAOVariant(key);
+	ssaoVariantBuildRunning = true;
+
+	auto buildJobFunc = [this]() -> void {
+		// Only the driver's specialization of the cached SPIR-V, nothing is compiled from GLSL
+		ssaoVariantBuild.pipeline->create(&logicalDevice, pipelineCache);
+
+		std::lock_guard<std::mutex> lock(ssaoVariantBuildMutex);
+		ssaoVariantBuildRunning = false;
+		ssaoVariantBuilt.notify_all();
+	};
+	Engine::threading->addCPUJob(new Job<>(buildJobFunc));
+}
+
+void Renderer::discardSSAOVariantBuild()
+{
+	{
+		std::unique_lock<std::mutex> lock(ssaoVariantBuildMutex);
+		ssaoVariantBuilt.wait(lock, [this]() -> bool { return !ssaoVariantBuildRunning; });
+	}
+
+	// Made for the render pass and resolution about to be destroyed
+	if (ssaoVariantBuild.pipeline)
+	{
+		ssaoVariantBuild.pipeline->destroy();
+		delete ssaoVariantBuild.pipeline;
+		ssaoVariantBuild.pipeline = nullptr;
+	}
+}
+
+void Renderer::selectSSAOVariant()
+{
+	// A finished build joins the cache, it's switched to below if the settings still ask for it
+	if (!ssaoVariantBuildRunning && ssaoVariantBuild.pipeline)
+	{
+		ssaoPipelines[ssaoVariantBuild.key] = ssaoVariantBuild.pipeline;
+		ssaoVariantBuild.pipeline = nullptr;
+	}
+
+	u64 key = getSSAOVariantKey();
+	if (key == ssaoPipelineKey)
+		return;
+
+	// Each frame's SSAO commands are re-recorded when it comes up again, the frames in flight keep the old
+	// variant, which stays cached
+	auto itr = ssaoPipelines.find(key);
+	if (itr == ssaoPipelines.end())
+	{
+		// The current variant is bound until the build finishes. One build at a time, settings changed in the
+		// meantime are built once it has
+		if (!ssaoVariantBuildRunning)
+			buildSSAOVariant(key);
+		return;
+	}
+
+	ssaoPipeline = itr->second;
+	ssaoPipelineKey = key;
+	invalidateCommands(SSAO_Pipeline_Input);
 }
 
 void Renderer::createSSAOFramebuffer()
@@ -110,7 +204,8 @@ void Renderer::createSSAOFramebuffer()
 
 void Renderer::createSSAODescriptorSets()
 {
-	ssaoDescriptorSet.allocate(&logicalDevice, &ssaoDescriptorSetLayout, &freeableDescriptorPool);
+	for (auto& set : ssaoDescriptorSet)
+		set.allocate(&logicalDevice, &ssaoDescriptorSetLayout, &freeableDescriptorPool);
 
 	ssaoBlurDescriptorSet.allocate(&logicalDevice, &ssaoBlurDescriptorSetLayout, &freeableDescriptorPool);
 
@@ -119,36 +214,42 @@ void Renderer::createSSAODescriptorSets()
 
 void Renderer::createSSAOCommands()
 {
-	ssaoCommandBuffer.allocate(&logicalDevice, &commandPool);
+	for (auto& cmd : ssaoCommandBuffer)
+		cmd.allocate(&logicalDevice, &commandPool);
+	ssaoCommands.markStale();
 }
 
 void Renderer::updateSSAODescriptorSets()
 {
 	Engine::console->postMessage("Updating ssao descriptor set!", glm::fvec3(0.1, 0.1, 0.9));
 
-	auto updater = ssaoDescriptorSet.makeUpdater();
+	// A set per frame slot for its copy of the camera buffer
+	for (u32 i = 0; i < FRAMES_IN_FLIGHT; ++i)
+	{
+		auto updater = ssaoDescriptorSet[i].makeUpdater();
 
-	auto configUpdate = updater->addBufferUpdate("config");
+		auto configUpdate = updater->addBufferUpdate("config");
 
-	configUpdate->buffer = ssaoConfigBuffer.getHandle();
-	configUpdate->offset = 0;
-	configUpdate->range = VK_WHOLE_SIZE;
+		configUpdate->buffer = ssaoConfigBuffer.getHandle();
+		configUpdate->offset = 0;
+		configUpdate->range = VK_WHOLE_SIZE;
 
-	auto cameraUpdate = updater->addBufferUpdate("camera");
+		auto cameraUpdate = updater->addBufferUpdate("camera");
 
-	cameraUpdate->buffer = cameraUBO.getHandle();
-	cameraUpdate->offset = 0;
-	cameraUpdate->range = VK_WHOLE_SIZE;
+		cameraUpdate->buffer = cameraUBO.getHandle(i);
+		cameraUpdate->offset = 0;
+		cameraUpdate->range = VK_WHOLE_SIZE;
 
-	auto depthUpdate = updater->addImageUpdate("depth");
-	depthUpdate->imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	depthUpdate->imageView = gBufferDepthAttachment.getView();
-	depthUpdate->sampler = textureSampler;
+		auto depthUpdate = updater->addImageUpdate("depth");
+		depthUpdate->imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		depthUpdate->imageView = gBufferDepthAttachment.getView();
+		depthUpdate->sampler = textureSampler;
 
-	ssaoDescriptorSet.submitUpdater(updater);
-	ssaoDescriptorSet.destroyUpdater(updater);
+		ssaoDescriptorSet[i].submitUpdater(updater);
+		ssaoDescriptorSet[i].destroyUpdater(updater);
+	}
 
-	updater = ssaoBlurDescriptorSet.makeUpdater();
+	auto updater = ssaoBlurDescriptorSet.makeUpdater();
 
 	auto sourceUpdate = updater->addImageUpdate("source");
 
@@ -173,7 +274,11 @@ void Renderer::updateSSAODescriptorSets()
 
 void Renderer::updateSSAOCommands()
 {
-	auto cmd = ssaoCommandBuffer.getHandle();
+	// Bakes in the selected variant, each frame's copy is re-recorded when its frame comes up after a switch
+	if (!needsRecording(ssaoCommands))
+		return;
+
+	auto cmd = ssaoCommandBuffer[frameIndex].getHandle();
 
 	VkCommandBufferBeginInfo beginInfo = {};
 	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
@@ -181,8 +286,6 @@ void Renderer::updateSSAOCommands()
 
 	VK_CHECK_RESULT(vkBeginCommandBuffer(cmd, &beginInfo));
 
-	queryPool.cmdTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, BEGIN_SSAO);
-
 	VkRenderPassBeginInfo renderPassInfo = {};
 	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
 	renderPassInfo.renderPass = ssaoRenderPass.getHandle();
@@ -197,9 +300,9 @@ void Renderer::updateSSAOCommands()
 
 	vkCmdBeginRenderPass(cmd, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, ssaoPipeline.getHandle());
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, ssaoPipeline->getHandle());
 
-	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, ssaoPipelineLayout.getHandle(), 0, 1, &ssaoDescriptorSet.getHandle(), 0, nullptr);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, ssaoPipelineLayout.getHandle(), 0, 1, &ssaoDescriptorSet[frameIndex].getHandle(), 0, nullptr);
 
 	VkBuffer vertexBuffers[] = { screenQuadBuffer.getHandle() };
 	VkDeviceSize offsets[] = { 0 };
@@ -227,6 +330,9 @@ void Renderer::updateSSAOCommands()
 
 	vkCmdEndRenderPass(cmd);
 
+	// ssaoFinalAttachment may reuse ssaoColourAttachment's memory, the horizontal blur has to be done reading it
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+
 	renderPassInfo.framebuffer = ssaoFinalFramebuffer.getHandle();
 
 	vkCmdBeginRenderPass(cmd, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
@@ -250,8 +356,6 @@ void Renderer::updateSSAOCommands()
 
 	//gBufferDepthLinearAttachment.cmdTransitionLayout(ssaoCommandBuffer, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
 
-	queryPool.cmdTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, END_SSAO);
-
 	VK_CHECK_RESULT(vkEndCommandBuffer(cmd));
 }
 
@@ -278,7 +382,13 @@ void Renderer::destroySSAODescriptorSetLayouts()
 void Renderer::destroySSAOPipeline()
 {
 	ssaoPipelineLayout.destroy();
-	ssaoPipeline.destroy();
+	for (auto& pipeline : ssaoPipelines)
+	{
+		pipeline.second->destroy();
+		delete pipeline.second;
+	}
+	ssaoPipelines.clear();
+	ssaoPipeline = nullptr;
 
 	ssaoBlurPipelineLayout.destroy();
 	ssaoBlurPipeline.destroy();
@@ -293,12 +403,14 @@ void Renderer::destroySSAOFramebuffer()
 
 void Renderer::destroySSAODescriptorSets()
 {
-	ssaoDescriptorSet.free();
+	for (auto& set : ssaoDescriptorSet)
+		set.free();
 	ssaoBlurDescriptorSet.free();
 	ssaoFinalDescriptorSet.free();
 }
 
 void Renderer::destroySSAOCommands()
 {
-	ssaoCommandBuffer.free();
+	for (auto& cmd : ssaoCommandBuffer)
+		cmd.free();
 }
@@ -27,9 +27,9 @@ void Renderer::createScreenPipeline()
 	screenPipeline.setShaderProgram(&screenShader);
 	screenPipeline.setVertexInputState(&screenVertexInputState);
 	screenPipeline.addViewport({ 0.f, 0.f, (float)renderResolution.width, (float)renderResolution.height, 0.f, 1.f }, { 0, 0, renderResolution.width, renderResolution.height });
-	screenPipeline.setPipelineLayout(&screenPipelineLayout);
-	screenPipeline.setSwapchain(&screenSwapchain);
-	screenPipeline.create(&logicalDevice);
+	screenPipeline.setPipelineLayout(screenPipelineLayout.getHandle());
+	screenPipeline.setRenderPass(screenSwapchain.getRenderPass().getHandle(), 1);
+	screenPipeline.create(&logicalDevice, pipelineCache);
 }
 
 void Renderer::createScreenDescriptorSets()
@@ -74,8 +74,6 @@ void Renderer::updateScreenCommands()
 
 		VK_CHECK_RESULT(vkBeginCommandBuffer(screenCommandBuffers.getHandle(i), &beginInfo));
 
-		queryPool.cmdTimestamp(screenCommandBuffers.getHandle(i), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, BEGIN_SCREEN);
-
 		VkRenderPassBeginInfo renderPassInfo = {};
 		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
 		renderPassInfo.renderPass = screenSwapchain.getRenderPass().getHandle();
@@ -104,8 +102,6 @@ void Renderer::updateScreenCommands()
 
 		//setImageLayout(screenCommandBuffers.getHandle(i), pbrOutput, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
 
-		queryPool.cmdTimestamp(screenCommandBuffers.getHandle(i), VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, END_SCREEN);
-
 		VK_CHECK_RESULT(vkEndCommandBuffer(screenCommandBuffers.getHandle(i)));
 	}
 }
@@ -120,8 +116,6 @@ void Renderer::updateScreenCommandsForConsole()
 
 		VK_CHECK_RESULT(vkBeginCommandBuffer(screenCommandBuffersForConsole.getHandle(i), &beginInfo));
 
-		queryPool.cmdTimestamp(screenCommandBuffersForConsole.getHandle(i), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, BEGIN_SCREEN);
-
 		VkRenderPassBeginInfo renderPassInfo = {};
 		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
 		renderPassInfo.renderPass = screenSwapchain.getRenderPass().getHandle();
@@ -148,8 +142,6 @@ void Renderer::updateScreenCommandsForConsole()
 
 		vkCmdEndRenderPass(screenCommandBuffersForConsole.getHandle(i));
 
-		queryPool.cmdTimestamp(screenCommandBuffersForConsole.getHandle(i), VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, END_SCREEN);
-
 		VK_CHECK_RESULT(vkEndCommandBuffer(screenCommandBuffersForConsole.getHandle(i)));
 	}
 }
@@ -9,6 +9,8 @@
 #include "Engine.hpp"
 #include "Window.hpp"
 #include "EngineConfig.hpp"
+#include "Renderer.hpp"
+#include "Profiler.hpp"
 
 using namespace chaiscript;
 
@@ -197,6 +199,7 @@ void ScriptEnv::initChai()
 			{ constructor<AssetStore()>() },
 			{ { fun(&AssetStore::getMaterial), "getMaterial" },
 			{ fun(&AssetStore::getModel), "getModel" },
+			{ fun(&AssetStore::unloadAsset), "unloadAsset" },
 			{ fun(addMaterialFlat), "addMaterial" } }
 		);
 		chai.add(m);
@@ -266,6 +269,51 @@ void ScriptEnv::initChai()
 	chai.add(fun([]()->u64 { return Engine::clock.now(); }), "getCurrentTime");
 	chai.add(fun([]()->Camera& { return Engine::camera; }), "getCamera");
 	chai.add(fun([]()->World& { return Engine::world; }), "getWorld");
+	chai.add(fun([]()->void {
+		auto& allocator = Engine::renderer->gpuAllocator;
+		Engine::console->postMessage("GPU memory, " + std::to_string(allocator.getDeviceMemoryCount()) + " VkDeviceMemory allocations", glm::fvec3(0.9, 0.9, 0.9));
+		for (auto& pool : allocator.getStats())
+		{
+			Engine::console->postMessage(pool.name + ": " + std::to_string(pool.deviceMemoryCount) + " blocks, " + std::to_string(pool.allocationCount) + " allocations, "
+				+ std::to_string(pool.used / 1024) + " / " + std::to_string(pool.reserved / 1024) + " KB", glm::fvec3(0.9, 0.9, 0.9));
+		}
+	}), "printGPUMemoryStats");
+	chai.add(fun([]()->void {
+		// Running averages over the last RUNNING_AVERAGE_COUNT samples, the tags are preallocated by Engine::init
+		const char* cpuTags[] = { "cullingdrawbuffer", "commands", "submitrender", "scripts" };
+		const char* gpuTags[] = { "cull", "gbuffer", "shadow", "ssao", "pbr", "overlay", "screen" };
+		auto post = [](const std::string& group, const char* tag) -> void {
+			Engine::console->postMessage(group + " " + tag + ": " + std::to_string(PROFILE_TO_MS(PROFILE_GET_RUNNING_AVERAGE(tag))) + "ms avg, "
+				+ std::to_string(PROFILE_TO_MS(PROFILE_GET_RUNNING_MIN(tag))) + " min, " + std::to_string(PROFILE_TO_MS(PROFILE_GET_RUNNING_MAX(tag))) + " max",
+				glm::fvec3(0.9, 0.9, 0.9));
+		};
+		for (auto tag : cpuTags)
+			post("CPU", tag);
+		for (auto tag : gpuTags)
+			post("GPU", tag);
+	}), "printFrameTimings");
+	chai.add(fun([]()->void {
+		// Only one of the pipeline tags has a sample, depending on whether the pipeline cache was loaded from disk
+		const char* tags[] = { "pipelinescold", "pipelineswarm" };
+		for (auto tag : tags)
+			Engine::console->postMessage(std::string("Startup ") + tag + ": " + std::to_string(PROFILE_TO_MS(PROFILE_GET_LAST(tag))) + "ms", glm::fvec3(0.9, 0.9, 0.9));
+	}), "printStartupTimings");
+	chai.add(fun([]()->void {
+		auto& graph = Engine::renderer->frameGraph;
+		std::pair<std::string, std::string> dumps[] = { { "rendergraph.dot", graph.toDot() }, { "rendergraph.json", graph.toJSON() } };
+		for (auto& dump : dumps)
+		{
+			File file;
+			file.create("/" + dump.first, File::Mode(File::out | File::trunc));
+			if (!file.isOpen())
+			{
+				Engine::console->postMessage("Could not write " + dump.first, ERROR_COL);
+				continue;
+			}
+			file.fstream() << dump.second;
+			Engine::console->postMessage("Render graph written to " + dump.first, glm::fvec3(0.9, 0.9, 0.9));
+		}
+	}), "dumpRenderGraph");
 
 	{
 		ModulePtr m = ModulePtr(new Module());
@@ -281,12 +329,41 @@ void ScriptEnv::initChai()
 		);
 		chai.add(m);
 	}
+	{
+		ModulePtr m = ModulePtr(new Module());
+		utility::add_class<EngineConfig::Render::LOD>(*m,
+			"EngineConfig::Render::LOD",
+			{  },
+			{ { fun(&EngineConfig::Render::LOD::setErrorThreshold), "setErrorThreshold" },
+			  { fun(&EngineConfig::Render::LOD::setBias), "setBias" },
+			  { fun(&EngineConfig::Render::LOD::setShadowBias), "setShadowBias" },
+			  { fun(&EngineConfig::Render::LOD::setHysteresis), "setHysteresis" }, }
+		);
+		chai.add(m);
+	}
+	{
+		ModulePtr m = ModulePtr(new Module());
+		utility::add_class<EngineConfig::Render::Limits>(*m,
+			"EngineConfig::Render::Limits",
+			{  },
+			{ { fun(&EngineConfig::Render::Limits::setInstanceCapacity), "setInstanceCapacity" },
+			  { fun(&EngineConfig::Render::Limits::setDrawCapacity), "setDrawCapacity" },
+			  { fun(&EngineConfig::Render::Limits::setTransformCapacity), "setTransformCapacity" },
+			  { fun(&EngineConfig::Render::Limits::setMaxInstances), "setMaxInstances" },
+			  { fun(&EngineConfig::Render::Limits::setMaxDraws), "setMaxDraws" },
+			  { fun(&EngineConfig::Render::Limits::setMaxTransforms), "setMaxTransforms" },
+			  { fun(&EngineConfig::Render::Limits::setGrowthFactor), "setGrowthFactor" }, }
+		);
+		chai.add(m);
+	}
 	{
 		ModulePtr m = ModulePtr(new Module());
 		utility::add_class<EngineConfig::Render>(*m,
 			"EngineConfig::Render",
 			{ },
 			{ { fun(&EngineConfig::Render::ssao), "ssao" },
+			  { fun(&EngineConfig::Render::lod), "lod" },
+			  { fun(&EngineConfig::Render::limits), "limits" },
 			  { fun(&EngineConfig::Render::setResolution), "setResolution"} }
 		);
 		chai.add(m);
@@ -0,0 +1,376 @@
+#include "PCH.hpp"
+#include "ShaderSpecs.hpp"
+#include "Filesystem.hpp"
+#include "File.hpp"
+#include "shaderc/shaderc.hpp"
+
+// SPIR-V cache layout:
+//	u32 magic, u32 version, u64 key, u32 module count
+//	per module: u32 stage, u32 word count, u32[word count]
+#define SHADER_CACHE_MAGIC 0x56505343 // "CSPV"
+#define SHADER_CACHE_VERSION 1 // Bump when the compile options change
+
+namespace
+{
+	// FNV-1a, std::hash isn't guaranteed to be the same between runs and the key is kept on disk
+	u64 hashBytes(u64 hash, const void* data, size_t size)
+	{
+		auto bytes = static_cast<const u8*>(data);
+		for (size_t i = 0; i < size; ++i)
+		{
+			hash ^= bytes[i];
+			hash *= 0x100000001b3ull;
+		}
+		return hash;
+	}
+
+	u64 hashString(u64 hash, const std::string& string)
+	{
+		// The length keeps "ab" + "c" apart from "a" + "bc"
+		u64 length = string.size();
+		hash = hashBytes(hash, &length, sizeof(length));
+		return hashBytes(hash, string.data(), string.size());
+	}
+
+	bool readShaderFile(const std::string& name, std::string& text)
+	{
+		File file;
+		if (!file.open("/res/shaders/" + name, File::Mode(File::binary | File::in)))
+			return false;
+
+		std::stringstream source;
+		source << file.fstream().rdbuf();
+		text = source.str();
+		return true;
+	}
+
+	// Names in the #include "name" lines of a source
+	std::vector<std::string> findIncludes(const std::string& text)
+	{
+		std::vector<std::string> names;
+		std::istringstream lines(text);
+		std::string line;
+		while (std::getline(lines, line))
+		{
+			size_t start = line.find_first_not_of(" \t");
+			if (start == std::string::npos || line.compare(start, 8, "#include") != 0)
+				continue;
+
+			size_t open = line.find_first_of("\"<", start + 8);
+			if (open == std::string::npos)
+				continue;
+			size_t close = line.find_first_of("\">", open + 1);
+			if (close != std::string::npos)
+				names.push_back(line.substr(open + 1, close - open - 1));
+		}
+		return names;
+	}
+
+	// Serves #include from res/shaders, the same files readSources hashed
+	class ShaderIncluder : public shaderc::CompileOptions::IncluderInterface
+	{
+	public:
+		shaderc_include_result* GetInclude(const char* requestedSource, shaderc_include_type type, const char* requestingSource, size_t includeDepth) override
+		{
+			auto include = new Include;
+			include->name = requestedSource;
+			if (!readShaderFile(include->name, include->content))
+			{
+				// An empty name tells shaderc the include failed, the content is the error
+				include->content = "Could not read res/shaders/" + include->name;
+				include->name.clear();
+			}
+
+			include->result.source_name = include->name.data();
+			include->result.source_name_length = include->name.size();
+			include->result.content = include->content.data();
+			include->result.content_length = include->content.size();
+			include->result.user_data = include;
+			return &include->result;
+		}
+
+		void ReleaseInclude(shaderc_include_result* result) override
+		{
+			delete static_cast<Include*>(result->user_data);
+		}
+
+	private:
+		struct Include
+		{
+			shaderc_include_result result;
+			std::string name;
+			std::string content;
+		};
+	};
+}
+
+void ShaderSpec::destroy()
+{
+	destroyModules();
+	includes.clear();
+	compiledHash = 0;
+	pending = {};
+	hasPending = false;
+}
+
+void ShaderSpec::compileSource()
+{
+	Build result;
+	if (!build(false, result))
+	{
+		DBG_SEVERE("Could not build " << sourceName);
+		return;
+	}
+
+	apply(result);
+}
+
+bool ShaderSpec::compileIfChanged()
+{
+	hasPending = build(true, pending);
+	return hasPending;
+}
+
+void ShaderSpec::swapPending()
+{
+	if (!hasPending)
+		return;
+
+	apply(pending);
+	pending = {};
+	hasPending = false;
+}
+
+bool ShaderSpec::readsSource(const std::string& fileName) const
+{
+	return fileName == sourceName || std::find(includes.begin(), includes.end(), fileName) != includes.end();
+}
+
+bool ShaderSpec::build(bool onlyIfChanged, Build& result) const
+{
+	std::string source;
+	std::vector<std::string> sourceIncludes;
+	u64 sourceHash;
+	if (!readSources(source, sourceIncludes, sourceHash))
+	{
+		DBG_WARNING("Could not read " << sourceName << " or a file it includes");
+		return false;
+	}
+
+	if (onlyIfChanged && sourceHash == compiledHash)
+		return false;
+
+	u64 key = makeCacheKey(sourceHash);
+
+	if (!loadCache(key, result.code))
+	{
+		// The modules built last stay in use
+		if (!compile(source, result.code))
+			return false;
+		saveCache(key, result.code);
+	}
+
+	result.includes = sourceIncludes;
+	result.hash = sourceHash;
+	return true;
+}
+
+void ShaderSpec::apply(const Build& result)
+{
+	createModules(result.code);
+
+	includes = result.includes;
+	compiledHash = result.hash;
+}
+
+bool ShaderSpec::readSources(std::string& source, std::vector<std::string>& sourceIncludes, u64& hash) const
+{
+	if (!readShaderFile(sourceName, source))
+		return false;
+
+	hash = hashString(0xcbf29ce484222325ull, source);
+
+	// Breadth first, each file once, in the order they are found so the hash is stable
+	std::vector<std::string> pending = findIncludes(source);
+	for (size_t i = 0; i < pending.size(); ++i)
+	{
+		auto& name = pending[i];
+		if (name == sourceName || std::find(sourceIncludes.begin(), sourceIncludes.end(), name) != sourceIncludes.end())
+			continue;
+
+		std::string text;
+		if (!readShaderFile(name, text))
+			return false;
+
+		sourceIncludes.push_back(name);
+		hash = hashString(hashString(hash, name), text);
+
+		auto nested = findIncludes(text);
+		pending.insert(pending.end(), nested.begin(), nested.end());
+	}
+
+	return true;
+}
+
+u64 ShaderSpec::makeCacheKey(u64 sourceHash) const
+{
+	u64 key = sourceHash;
+
+	for (auto& module : modules)
+		key = hashBytes(key, &module.stage, sizeof(module.stage));
+
+	// shaderc doesn't report its own version, the SPIR-V it generates changes with its glslang
+	u32 spvVersion, spvRevision;
+	shaderc_get_spv_version(&spvVersion, &spvRevision);
+	key = hashBytes(key, &spvVersion, sizeof(spvVersion));
+	key = hashBytes(key, &spvRevision, sizeof(spvRevision));
+
+	return key;
+}
+
+bool ShaderSpec::loadCache(u64 key, ModuleCode& code) const
+{
+	auto cachePath = "/cache/shaders/" + sourceName + ".spv";
+
+	std::error_code error;
+	if (!fs::exists(Engine::workingDirectory + cachePath, error))
+		return false;
+
+	File file;
+	if (!file.open(std::string(cachePath), File::Mode(File::binary | File::in)))
+		return false;
+
+	u32 magic, version, moduleCount;
+	u64 cachedKey;
+	file.read(magic);
+	file.read(version);
+	file.read(cachedKey);
+	file.read(moduleCount);
+
+	if (magic != SHADER_CACHE_MAGIC || version != SHADER_CACHE_VERSION || cachedKey != key || moduleCount != modules.size())
+		return false;
+
+	code.resize(moduleCount);
+	for (u32 i = 0; i < moduleCount; ++i)
+	{
+		u32 stage, wordCount;
+		file.read(stage);
+		file.read(wordCount);
+		if (stage != u32(modules[i].stage) || !file.fstream())
+			return false;
+
+		code[i].resize(wordCount);
+		file.readArray(code[i].data(), wordCount);
+	}
+
+	if (!file.fstream())
+	{
+		DBG_WARNING("Truncated SPIR-V cache " << cachePath);
+		return false;
+	}
+
+	return true;
+}
+
+void ShaderSpec::saveCache(u64 key, const ModuleCode& code) const
+{
+	auto cachePath = "/cache/shaders/" + sourceName + ".spv";
+
+	std::error_code error;
+	fs::create_directories(fs::path(Engine::workingDirectory + cachePath).parent_path(), error);
+
+	File file;
+	if (!file.create(std::string(cachePath), File::Mode(File::binary | File::out | File::trunc)))
+	{
+		DBG_WARNING("Could not write SPIR-V cache " << cachePath);
+		return;
+	}
+
+	file.write<u32>(SHADER_CACHE_MAGIC);
+	file.write<u32>(SHADER_CACHE_VERSION);
+	file.write<u64>(key);
+	file.write<u32>(u32(code.size()));
+
+	for (u32 i = 0; i < code.size(); ++i)
+	{
+		file.write<u32>(u32(modules[i].stage));
+		file.write<u32>(u32(code[i].size()));
+		file.writeArray(code[i].data(), u32(code[i].size()));
+	}
+}
+
+bool ShaderSpec::compile(const std::string& source, ModuleCode& code) const
+{
+	shaderc::Compiler compiler;
+	code.resize(modules.size());
+
+	for (u32 i = 0; i < modules.size(); ++i)
+	{
+		shaderc::CompileOptions options;
+		options.SetIncluder(std::make_unique<ShaderIncluder>());
+
+		shaderc_shader_kind kind;
+		switch (modules[i].stage) {
+		case VK_SHADER_STAGE_VERTEX_BIT:
+			kind = shaderc_glsl_vertex_shader;
+			options.AddMacroDefinition("VERTEX");
+			break;
+		case VK_SHADER_STAGE_GEOMETRY_BIT:
+			kind = shaderc_glsl_geometry_shader;
+			options.AddMacroDefinition("GEOMETRY");
+			break;
+		case VK_SHADER_STAGE_FRAGMENT_BIT:
+			kind = shaderc_glsl_fragment_shader;
+			options.AddMacroDefinition("FRAGMENT");
+			break;
+		default:
+			kind = shaderc_glsl_compute_shader;
+			options.AddMacroDefinition("COMPUTE");
+			break;
+		}
+
+		auto result = compiler.CompileGlslToSpv(source, kind, sourceName.c_str(), options);
+		if (result.GetCompilationStatus() != shaderc_compilation_status_success)
+		{
+			DBG_WARNING("Could not compile " << sourceName << ":\n" << result.GetErrorMessage());
+			return false;
+		}
+
+		code[i].assign(result.cbegin(), result.cend());
+	}
+
+	return true;
+}
+
+void ShaderSpec::createModules(const ModuleCode& code)
+{
+	destroyModules();
+
+	for (u32 i = 0; i < modules.size(); ++i)
+	{
+		VkShaderModuleCreateInfo createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+		createInfo.codeSize = code[i].size() * sizeof(u32);
+		createInfo.pCode = code[i].data();
+
+		VK_CHECK_RESULT(vkCreateShaderModule(device, &createInfo, nullptr, &modules[i].module));
+
+		VkPipelineShaderStageCreateInfo stage = {};
+		stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		stage.stage = modules[i].stage;
+		stage.module = modules[i].module;
+		stage.pName = "main";
+		stages.push_back(stage);
+	}
+}
+
+void ShaderSpec::destroyModules()
+{
+	for (auto& module : modules)
+	{
+		if (module.module != VK_NULL_HANDLE)
+			vkDestroyShaderModule(device, module.module, nullptr);
+		module.module = VK_NULL_HANDLE;
+	}
+	stages.clear();
+}
@@ -1,6 +1,7 @@
 #include "PCH.hpp"
 #include "Renderer.hpp"
 #include "Profiler.hpp"
+#include "Threading.hpp"
 
 void Renderer::createShadowRenderPass()
 {
@@ -15,13 +16,15 @@ void Renderer::createShadowDescriptorSetLayouts()
 {
 	auto& dsl = shadowDescriptorSetLayout;
 
-	dsl.addBinding("transforms", vdu::DescriptorType::UniformBuffer, 0, 1, vdu::ShaderStage::Vertex);
+	dsl.addBinding("transforms", vdu::DescriptorType::StorageBuffer, 0, 1, vdu::ShaderStage::Vertex);
+	dsl.addBinding("instances", vdu::DescriptorType::StorageBuffer, 1, 1, vdu::ShaderStage::Vertex);
 	dsl.create(&logicalDevice);
 
 	auto& sdsl = spotShadowDescriptorSetLayout;
 
-	sdsl.addBinding("transforms", vdu::DescriptorType::UniformBuffer, 0, 1, vdu::ShaderStage::Vertex);
+	sdsl.addBinding("transforms", vdu::DescriptorType::StorageBuffer, 0, 1, vdu::ShaderStage::Vertex);
 	sdsl.addBinding("spot_lights", vdu::DescriptorType::UniformBuffer, 1, 1, vdu::ShaderStage::Vertex);
+	sdsl.addBinding("instances", vdu::DescriptorType::StorageBuffer, 2, 1, vdu::ShaderStage::Vertex);
 	sdsl.create(&logicalDevice);
 }
 
@@ -31,205 +34,268 @@ void Renderer::createShadowPipeline()
 	pointShadowPipelineLayout.addDescriptorSetLayout(&shadowDescriptorSetLayout);
 	pointShadowPipelineLayout.create(&logicalDevice);
 	pointShadowPipeline.setShaderProgram(&pointShadowShader);
-	pointShadowPipeline.setPipelineLayout(&pointShadowPipelineLayout);
+	pointShadowPipeline.setPipelineLayout(pointShadowPipelineLayout.getHandle());
 	pointShadowPipeline.setVertexInputState(&defaultVertexInputState);
 	pointShadowPipeline.addViewport({ 0.f, 0.f, 1024.f, 1024.f, 0.f, 1.f }, { 0, 0, 1024, 1024 });
 	pointShadowPipeline.setMaxDepthBounds(Engine::maxDepth);
-	pointShadowPipeline.setRenderPass(&shadowRenderPass);
-	pointShadowPipeline.create(&logicalDevice);
+	pointShadowPipeline.setRenderPass(shadowRenderPass.getHandle(), 0);
+	pointShadowPipeline.create(&logicalDevice, pipelineCache);
 
+	spotShadowPipelineLayout.addPushConstantRange({ VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(u32) });
 	spotShadowPipelineLayout.addDescriptorSetLayout(&spotShadowDescriptorSetLayout);
 	spotShadowPipelineLayout.create(&logicalDevice);
 	spotShadowPipeline.setShaderProgram(&spotShadowShader);
-	spotShadowPipeline.setPipelineLayout(&spotShadowPipelineLayout);
+	spotShadowPipeline.setPipelineLayout(spotShadowPipelineLayout.getHandle());
 	spotShadowPipeline.setVertexInputState(&defaultVertexInputState);
 	spotShadowPipeline.addViewport({ 0.f, 0.f, 512.f, 512.f, 0.f, 1.f }, { 0, 0, 512, 512 });
 	spotShadowPipeline.setMaxDepthBounds(Engine::maxDepth);
-	spotShadowPipeline.setRenderPass(&shadowRenderPass);
-	spotShadowPipeline.create(&logicalDevice);
+	spotShadowPipeline.setRenderPass(shadowRenderPass.getHandle(), 0);
+	spotShadowPipeline.create(&logicalDevice, pipelineCache);
 
 	sunShadowPipelineLayout.addPushConstantRange({ VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(glm::fmat4) });
 	sunShadowPipelineLayout.addDescriptorSetLayout(&shadowDescriptorSetLayout);
 	sunShadowPipelineLayout.create(&logicalDevice);
 	sunShadowPipeline.setShaderProgram(&sunShadowShader);
-	sunShadowPipeline.setPipelineLayout(&sunShadowPipelineLayout);
+	sunShadowPipeline.setPipelineLayout(sunShadowPipelineLayout.getHandle());
 	sunShadowPipeline.setVertexInputState(&defaultVertexInputState);
 	sunShadowPipeline.addViewport({ 0.f, 0.f, 1280.f, 720.f, 0.f, 1.f }, { 0, 0, 1280, 720 });
 	sunShadowPipeline.setMaxDepthBounds(Engine::maxDepth);
-	sunShadowPipeline.setRenderPass(&shadowRenderPass);
-	sunShadowPipeline.create(&logicalDevice);
+	sunShadowPipeline.setRenderPass(shadowRenderPass.getHandle(), 0);
+	sunShadowPipeline.create(&logicalDevice, pipelineCache);
 }
 
 void Renderer::createShadowDescriptorSets()
 {
-	shadowDescriptorSet.allocate(&logicalDevice, &shadowDescriptorSetLayout, &descriptorPool);
-	spotShadowDescriptorSet.allocate(&logicalDevice, &spotShadowDescriptorSetLayout, &descriptorPool);
+	for (u32 i = 0; i < FRAMES_IN_FLIGHT; ++i)
+	{
+		shadowDescriptorSet[i].allocate(&logicalDevice, &shadowDescriptorSetLayout, &descriptorPool);
+		spotShadowDescriptorSet[i].allocate(&logicalDevice, &spotShadowDescriptorSetLayout, &descriptorPool);
+	}
 }
 
 void Renderer::updateShadowDescriptorSets()
 {
-	auto updater = shadowDescriptorSet.makeUpdater();
+	for (u32 i = 0; i < FRAMES_IN_FLIGHT; ++i)
+	{
+		auto updater = shadowDescriptorSet[i].makeUpdater();
+
+		auto transformsUpdate = updater->addBufferUpdate("transforms");
+
+		transformsUpdate->buffer = transformBuffer.getHandle(i);
+		transformsUpdate->offset = 0;
+		transformsUpdate->range = VK_WHOLE_SIZE;
 
-	auto transformsUpdate = updater->addBufferUpdate("transforms");
+		auto instancesUpdate = updater->addBufferUpdate("instances");
+		*instancesUpdate = { visibleInstanceBuffer.getHandle(), 0, VK_WHOLE_SIZE };
 
-	transformsUpdate->buffer = transformUBO.getHandle();
-	transformsUpdate->offset = 0;
-	transformsUpdate->range = sizeof(glm::fmat4) * 1000;
+		shadowDescriptorSet[i].submitUpdater(updater);
+		shadowDescriptorSet[i].destroyUpdater(updater);
 
-	shadowDescriptorSet.submitUpdater(updater);
-	shadowDescriptorSet.destroyUpdater(updater);
+		updater = spotShadowDescriptorSet[i].makeUpdater();
 
-	updater = spotShadowDescriptorSet.makeUpdater();
+		transformsUpdate = updater->addBufferUpdate("transforms");
 
-	transformsUpdate = updater->addBufferUpdate("transforms");
+		transformsUpdate->buffer = transformBuffer.getHandle(i);
+		transformsUpdate->offset = 0;
+		transformsUpdate->range = VK_WHOLE_SIZE;
 
-	transformsUpdate->buffer = transformUBO.getHandle();
-	transformsUpdate->offset = 0;
-	transformsUpdate->range = sizeof(glm::fmat4) * 1000;
+		auto spotLightsUpdate = updater->addBufferUpdate("spot_lights");
 
-	auto spotLightsUpdate = updater->addBufferUpdate("spot_lights");
+		spotLightsUpdate->buffer = lightManager.spotLightsBuffer.getHandle(i);
+		spotLightsUpdate->offset = 0;
+		spotLightsUpdate->range = sizeof(SpotLight::GPUData) * 150;
 
-	spotLightsUpdate->buffer = lightManager.spotLightsBuffer.getHandle();
-	spotLightsUpdate->offset = 0;
-	spotLightsUpdate->range = sizeof(SpotLight::GPUData) * 150;
+		instancesUpdate = updater->addBufferUpdate("instances");
+		*instancesUpdate = { visibleInstanceBuffer.getHandle(), 0, VK_WHOLE_SIZE };
 
-	shadowDescriptorSet.submitUpdater(updater);
-	shadowDescriptorSet.destroyUpdater(updater);
+		spotShadowDescriptorSet[i].submitUpdater(updater);
+		spotShadowDescriptorSet[i].destroyUpdater(updater);
+	}
+
+	invalidateCommands(Shadow_Descriptors_Input);
 }
 
 void Renderer::createShadowCommands()
 {
-	shadowCommandBuffer.allocate(&logicalDevice, &commandPool);
+	for (auto& cmd : shadowCommandBuffer)
+		cmd.allocate(&logicalDevice, &commandPool);
+	shadowCommands.markStale();
 }
 
 void Renderer::updateShadowCommands()
 {	
-	//PROFILE_START("shadowfence");
-	//vkWaitForFences(device, 1, &shadowFence, true, std::numeric_limits<u64>::max());
-	//PROFILE_END("shadowfence");
-
 	//bufferFreeMutex.lock();
 	//shadowCommandBuffer.reset();
 	//bufferFreeMutex.unlock();
 	
 	//createShadowCommands();
-	
-	auto cmd = shadowCommandBuffer.getHandle();
 
-	VkCommandBufferBeginInfo beginInfo = {};
-	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+	auto& pointLights = lightManager.pointLights;
+	auto& spotLights = lightManager.spotLights;
+	auto& sunLight = lightManager.sunLight;
+
+	// A render pass per slot, the point lights first, then the spot lights, then the sun's cascades
+	u32 pointLightCount = static_cast<u32>(pointLights.size());
+	u32 spotLightCount = static_cast<u32>(spotLights.size());
+	u32 slotCount = pointLightCount + spotLightCount + 3;
+
+	auto getFramebuffer = [&](u32 slot) -> VkFramebuffer {
+		if (slot < pointLightCount)
+			return *pointLights[slot].shadowFBO;
+		if (slot < pointLightCount + spotLightCount)
+			return *spotLights[slot - pointLightCount].shadowFBO;
+		return sunLight.shadowFBO[slot - pointLightCount - spotLightCount];
+	};
+
+	auto getExtent = [&](u32 slot) -> VkExtent2D {
+		if (slot < pointLightCount)
+			return { 1024, 1024 };
+		if (slot < pointLightCount + spotLightCount)
+			return { 512, 512 };
+		return { 1280, 720 };
+	};
+
+	// What each slot's render pass bakes in, slots that were recorded with the same are kept as they are
+	auto getPush = [&](u32 slot) -> glm::fmat4 {
+		glm::fmat4 push(0.f);
+		if (slot < pointLightCount)
+		{
+			auto pos = pointLights[slot].getPosition();
+			push[0] = glm::fvec4(pos.x, pos.y, pos.z, pointLights[slot].getRadius());
+		}
+		else if (slot < pointLightCount + spotLightCount)
+			push[0][0] = float(slot - pointLightCount);
+		else
+			push = sunLight.getProjView()[slot - pointLightCount - spotLightCount];
+		return push;
+	};
+
+	u64 inputs = getInputVersions(shadowCommands.inputs);
+	auto& keys = shadowSlotKeys[frameIndex];
+
+	// Removed lights leave render passes the primary buffer must no longer begin
+	bool slotsChanged = keys.size() != slotCount;
+	keys.resize(slotCount, { VK_NULL_HANDLE, glm::fmat4(0.f), ~0ull });
+
+	std::vector<bool> staleSlots(slotCount, false);
+	u32 staleSlotCount = 0;
+	for (u32 slot = 0; slot < slotCount; ++slot)
+	{
+		ShadowSlotKey key = { getFramebuffer(slot), getPush(slot), inputs };
+		if (key.framebuffer == keys[slot].framebuffer && key.push == keys[slot].push && key.inputs == keys[slot].inputs)
+			continue;
 
-	VK_CHECK_RESULT(vkBeginCommandBuffer(cmd, &beginInfo));
-	queryPool.cmdTimestamp(shadowCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, BEGIN_SHADOW);
+		keys[slot] = key;
+		staleSlots[slot] = true;
+		++staleSlotCount;
+	}
 
-	for (auto& l : lightManager.pointLights)
+	// The primary buffer has to be re-recorded as well when any secondary one it executes is
+	bool recordPrimary = needsRecording(shadowCommands);
+	if (!recordPrimary && (slotsChanged || staleSlotCount))
 	{
-		VkRenderPassBeginInfo renderPassInfo = {};
-		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-		renderPassInfo.renderPass = shadowRenderPass.getHandle();
-		renderPassInfo.framebuffer = *l.shadowFBO;
-		renderPassInfo.renderArea.offset = { 0, 0 };
-		renderPassInfo.renderArea.extent.width = 1024;
-		renderPassInfo.renderArea.extent.height = 1024;
+		recordPrimary = true;
+		++reRecordedCommands;
+	}
 
-		std::array<VkClearValue, 1> clearValues = {};
-		clearValues[0].depthStencil = { 1.0f, 0 };
-		renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
-		renderPassInfo.pClearValues = clearValues.data();
+	if (!recordPrimary)
+		return;
+
+	reRecordedCommands += staleSlotCount;
 
-		vkCmdBeginRenderPass(cmd, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+	// Every stale light's render pass is recorded on a record worker
+	prepareSecondaryCommands(Shadow_Secondary, slotCount);
 
-		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pointShadowPipeline.getHandle());
+	Engine::threading->parallelFor(slotCount, [&](u32 slot) -> void {
+		if (!staleSlots[slot])
+			return;
 
-		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pointShadowPipelineLayout.getHandle(), 0, 1, &shadowDescriptorSet.getHandle(), 0, nullptr);
+		auto cmd = beginSecondaryCommands(Shadow_Secondary, slot, shadowRenderPass.getHandle(), getFramebuffer(slot));
 
 		VkBuffer vertexBuffers[] = { vertexIndexBuffer.getHandle() };
 		VkDeviceSize offsets[] = { 0 };
-		vkCmdBindVertexBuffers(cmd, 0, 1, vertexBuffers, offsets);
-		vkCmdBindIndexBuffer(cmd, vertexIndexBuffer.getHandle(), INDEX_BUFFER_BASE, VK_INDEX_TYPE_UINT32);
-
-		auto pos = l.getPosition();
-		glm::fvec4 push(pos.x, pos.y, pos.z, l.getRadius());
-
-		vkCmdPushConstants(cmd, pointShadowPipelineLayout.getHandle(), VK_SHADER_STAGE_GEOMETRY_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(glm::fvec4), &push);
-		vkCmdDrawIndexedIndirect(cmd, drawCmdBuffer.getHandle(), 0, Engine::world.instancesToDraw.size(), sizeof(VkDrawIndexedIndirectCommand));
-
-		vkCmdEndRenderPass(cmd);
-	}
 
-	for (auto& l : lightManager.spotLights)
-	{
-		VkRenderPassBeginInfo renderPassInfo = {};
-		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-		renderPassInfo.renderPass = shadowRenderPass.getHandle();
-		renderPassInfo.framebuffer = *l.shadowFBO;
-		renderPassInfo.renderArea.offset = { 0, 0 };
-		renderPassInfo.renderArea.extent.width = 512;
-		renderPassInfo.renderArea.extent.height = 512;
+		if (slot < pointLightCount)
+		{
+			auto& l = pointLights[slot];
 
-		std::array<VkClearValue, 1> clearValues = {};
-		clearValues[0].depthStencil = { 1.f, 0 };
-		renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
-		renderPassInfo.pClearValues = clearValues.data();
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pointShadowPipeline.getHandle());
 
-		vkCmdBeginRenderPass(cmd, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pointShadowPipelineLayout.getHandle(), 0, 1, &shadowDescriptorSet[frameIndex].getHandle(), 0, nullptr);
 
-		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, spotShadowPipeline.getHandle());
+			vkCmdBindVertexBuffers(cmd, 0, 1, vertexBuffers, offsets);
+			vkCmdBindIndexBuffer(cmd, vertexIndexBuffer.getHandle(), INDEX_BUFFER_BASE, VK_INDEX_TYPE_UINT32);
 
-		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, spotShadowPipelineLayout.getHandle(), 0, 1, &spotShadowDescriptorSet.getHandle(), 0, nullptr);
+			auto pos = l.getPosition();
+			glm::fvec4 push(pos.x, pos.y, pos.z, l.getRadius());
 
-		VkBuffer vertexBuffers[] = { vertexIndexBuffer.getHandle() };
-		VkDeviceSize offsets[] = { 0 };
-		vkCmdBindVertexBuffers(cmd, 0, 1, vertexBuffers, offsets);
-		vkCmdBindIndexBuffer(cmd, vertexIndexBuffer.getHandle(), INDEX_BUFFER_BASE, VK_INDEX_TYPE_UINT32);
+			vkCmdPushConstants(cmd, pointShadowPipelineLayout.getHandle(), VK_SHADER_STAGE_GEOMETRY_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(glm::fvec4), &push);
+			cmdDrawCulled(cmd, getPointLightCullView(slot));
+		}
+		else if (slot < pointLightCount + spotLightCount)
+		{
+			u32 spotLightIndex = slot - pointLightCount;
 
-		vkCmdDrawIndexedIndirect(cmd, l.getDrawCommandsBuffer()->getHandle(), 0, Engine::world.instancesToDraw.size(), sizeof(VkDrawIndexedIndirectCommand));
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, spotShadowPipeline.getHandle());
 
-		vkCmdEndRenderPass(cmd);
-	}
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, spotShadowPipelineLayout.getHandle(), 0, 1, &spotShadowDescriptorSet[frameIndex].getHandle(), 0, nullptr);
 
-	{
-		auto l = lightManager.sunLight;
+			vkCmdBindVertexBuffers(cmd, 0, 1, vertexBuffers, offsets);
+			vkCmdBindIndexBuffer(cmd, vertexIndexBuffer.getHandle(), INDEX_BUFFER_BASE, VK_INDEX_TYPE_UINT32);
 
-		for (auto cascadeIndex = 0; cascadeIndex < 3; ++cascadeIndex)
+			vkCmdPushConstants(cmd, spotShadowPipelineLayout.getHandle(), VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(u32), &spotLightIndex);
+			cmdDrawCulled(cmd, getSpotLightCullView(spotLightIndex));
+		}
+		else
 		{
-			VkRenderPassBeginInfo renderPassInfo = {};
-			renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-			renderPassInfo.renderPass = shadowRenderPass.getHandle();
-			renderPassInfo.framebuffer = l.shadowFBO[cascadeIndex];
-			renderPassInfo.renderArea.offset = { 0, 0 };
-			renderPassInfo.renderArea.extent.width = 1280;
-			renderPassInfo.renderArea.extent.height = 720;
-
-			std::array<VkClearValue, 1> clearValues = {};
-			clearValues[0].depthStencil = { 1.f, 0 };
-			renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
-			renderPassInfo.pClearValues = clearValues.data();
-
-			vkCmdBeginRenderPass(cmd, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+			u32 cascadeIndex = slot - pointLightCount - spotLightCount;
 
 			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, sunShadowPipeline.getHandle());
 
-			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, sunShadowPipelineLayout.getHandle(), 0, 1, &shadowDescriptorSet.getHandle(), 0, nullptr);
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, sunShadowPipelineLayout.getHandle(), 0, 1, &shadowDescriptorSet[frameIndex].getHandle(), 0, nullptr);
 
-			VkBuffer vertexBuffers[] = { vertexIndexBuffer.getHandle() };
-			VkDeviceSize offsets[] = { 0 };
 			vkCmdBindVertexBuffers(cmd, 0, 1, vertexBuffers, offsets);
 			vkCmdBindIndexBuffer(cmd, vertexIndexBuffer.getHandle(), INDEX_BUFFER_BASE, VK_INDEX_TYPE_UINT32);
 
 			float push[(4 * 4)];
-			glm::fmat4 pv = *l.getProjView();
+			glm::fmat4 pv = sunLight.getProjView()[cascadeIndex];
 			memcpy(push, &pv, sizeof(glm::fmat4));
 
 			vkCmdPushConstants(cmd, sunShadowPipelineLayout.getHandle(), VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(glm::fmat4), &push);
-			vkCmdDrawIndexedIndirect(cmd, drawCmdBuffer.getHandle(), 0, Engine::world.instancesToDraw.size(), sizeof(VkDrawIndexedIndirectCommand));
-
-			vkCmdEndRenderPass(cmd);
+			cmdDrawCulled(cmd, CULL_VIEW_SUN_BASE + cascadeIndex);
 		}
-	}
 
-	queryPool.cmdTimestamp(shadowCommandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, END_SHADOW);
+		VK_CHECK_RESULT(vkEndCommandBuffer(cmd));
+	});
+
+	// The primary buffer only begins each render pass and executes its slot
+	auto& shadowCmd = shadowCommandBuffer[frameIndex];
+	auto cmd = shadowCmd.getHandle();
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+
+	VK_CHECK_RESULT(vkBeginCommandBuffer(cmd, &beginInfo));
+
+	for (u32 slot = 0; slot < slotCount; ++slot)
+	{
+		VkRenderPassBeginInfo renderPassInfo = {};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		renderPassInfo.renderPass = shadowRenderPass.getHandle();
+		renderPassInfo.framebuffer = getFramebuffer(slot);
+		renderPassInfo.renderArea.offset = { 0, 0 };
+		renderPassInfo.renderArea.extent = getExtent(slot);
+
+		std::array<VkClearValue, 1> clearValues = {};
+		clearValues[0].depthStencil = { 1.0f, 0 };
+		renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+		renderPassInfo.pClearValues = clearValues.data();
+
+		vkCmdBeginRenderPass(cmd, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+		vkCmdExecuteCommands(cmd, 1, &secondaryCommandBuffers[Shadow_Secondary][frameIndex][slot]);
+		vkCmdEndRenderPass(cmd);
+	}
 
 	VK_CHECK_RESULT(vkEndCommandBuffer(cmd));
 }
@@ -258,10 +324,15 @@ void Renderer::destroyShadowPipeline()
 
 void Renderer::destroyShadowDescriptorSets()
 {
-	shadowDescriptorSet.free();
+	for (u32 i = 0; i < FRAMES_IN_FLIGHT; ++i)
+	{
+		shadowDescriptorSet[i].free();
+		spotShadowDescriptorSet[i].free();
+	}
 }
 
 void Renderer::destroyShadowCommands()
 {
-	shadowCommandBuffer.free();
+	for (auto& cmd : shadowCommandBuffer)
+		cmd.free();
 }
@@ -0,0 +1,284 @@
+#include "PCH.hpp"
+#include "StagingRing.hpp"
+#include "Renderer.hpp"
+
+void StagingRing::create(GPUAllocator* allocator, VkDeviceSize pCapacity, VkMemoryPropertyFlags memoryProperties)
+{
+	device = allocator->getDevice();
+	ring.init(pCapacity);
+
+	buffer.create(allocator, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, pCapacity, memoryProperties);
+}
+
+void StagingRing::destroy()
+{
+	buffer.destroy();
+	ring.init(0);
+	pendingSubmissions.clear();
+}
+
+VkDeviceSize StagingRing::allocate(u64 owner, VkDeviceSize size, VkDeviceSize alignment)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	if (size == 0 || size > ring.getCapacity())
+		return INVALID_OFFSET;
+
+	while (true)
+	{
+		u64 offset = ring.allocate(owner, size, alignment);
+		if (offset != INVALID_OFFSET)
+			return offset;
+
+		// Blocks are given back in order, so the oldest one has to be submitted before anything can be waited on
+		u64 submission = ring.getOldestSubmission();
+		if (submission == 0)
+			return INVALID_OFFSET;
+
+		// release() keeps the fence alive until every waiter is done with it
+		auto& pending = pendingSubmissions[submission];
+		VkFence fence = pending.fence;
+		++pending.waiters;
+
+		lock.unlock();
+		VK_CHECK_RESULT(vkWaitForFences(device, 1, &fence, VK_TRUE, std::numeric_limits<u64>::max()));
+		lock.lock();
+
+		// The fence has signalled, nothing reads the space any more
+		ring.release(submission);
+		auto waited = pendingSubmissions.find(submission);
+		if (--waited->second.waiters == 0)
+			waitersDone.notify_all();
+	}
+}
+
+u64 StagingRing::submit(u64 owner, VkFence fence)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	u64 submission = nextSubmission++;
+	ring.submit(owner, submission);
+	pendingSubmissions[submission] = { fence, 0 };
+	return submission;
+}
+
+void StagingRing::release(u64 submission)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	waitersDone.wait(lock, [this, submission]() -> bool {
+		auto pending = pendingSubmissions.find(submission);
+		return pending == pendingSubmissions.end() || pending->second.waiters == 0;
+	});
+
+	pendingSubmissions.erase(submission);
+	ring.release(submission);
+}
+
+StagingUpload::StagingUpload(Renderer* pRenderer) : renderer(pRenderer), cmd(nullptr), hasStaged(false), finished(false)
+{
+	owner = renderer->stagingRing.newOwner();
+	ownershipTransfer = renderer->transferQueueFamily != renderer->graphicsQueueFamily;
+
+	graphicsCmd = new vdu::CommandBuffer;
+	renderer->beginGraphicsCommands(*graphicsCmd);
+
+	begin();
+}
+
+StagingUpload::~StagingUpload()
+{
+	if (cmd)
+	{
+		DBG_WARNING("Staging upload was never submitted, submitting it now");
+		submit();
+	}
+}
+
+VkDeviceSize StagingUpload::stage(const void* data, VkDeviceSize size, VkDeviceSize alignment)
+{
+	auto& ring = renderer->stagingRing;
+
+	if (size == 0 || size > STAGING_RING_MAX_CHUNK)
+	{
+		DBG_SEVERE("Can't stage " << size << " bytes in one piece, the staging ring allows 1 to " << STAGING_RING_MAX_CHUNK);
+		return StagingRing::INVALID_OFFSET;
+	}
+
+	VkDeviceSize offset;
+	while ((offset = ring.allocate(owner, size, alignment)) == StagingRing::INVALID_OFFSET)
+	{
+		// Our own unsubmitted data may be what holds the ring
+		if (!hasStaged)
+		{
+			// Another owner's, the frame's data is only submitted with the frame on this same thread so waiting for it never ends
+			DBG_WARNING("Staging ring is held by data that is not submitted yet, " << size << " bytes have to be staged in a later frame");
+			return StagingRing::INVALID_OFFSET;
+		}
+
+		flush();
+	}
+
+	memcpy(ring.getMapped(offset), data, (size_t)size);
+	hasStaged = true;
+
+	return offset;
+}
+
+bool StagingUpload::copyToBuffer(PooledBuffer& dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size)
+{
+	auto src = static_cast<const char*>(data);
+
+	for (VkDeviceSize copied = 0; copied < size; copied += STAGING_RING_MAX_CHUNK)
+	{
+		VkDeviceSize chunkSize = std::min<VkDeviceSize>(size - copied, STAGING_RING_MAX_CHUNK);
+
+		VkBufferCopy region = {};
+		region.srcOffset = stage(src + copied, chunkSize);
+		if (region.srcOffset == StagingRing::INVALID_OFFSET)
+			return false;
+		region.dstOffset = dstOffset + copied;
+		region.size = chunkSize;
+
+		vkCmdCopyBuffer(cmd->getHandle(), getBufferHandle(), dst.getHandle(), 1, &region);
+	}
+
+	transferBufferOwnership(dst.getHandle(), dstOffset, size);
+	return true;
+}
+
+void StagingUpload::transferBufferOwnership(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size)
+{
+	// Within one family the semaphore between the two submissions already orders the copies before any use
+	if (!ownershipTransfer)
+		return;
+
+	VkBufferMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcQueueFamilyIndex = renderer->transferQueueFamily;
+	barrier.dstQueueFamilyIndex = renderer->graphicsQueueFamily;
+	barrier.buffer = buffer;
+	barrier.offset = offset;
+	barrier.size = size;
+
+	// Release
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = 0;
+	vkCmdPipelineBarrier(cmd->getHandle(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+	// Acquire
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+	vkCmdPipelineBarrier(graphicsCmd->getHandle(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+void StagingUpload::transferImageOwnership(VkImage image, VkImageLayout layout, const VkImageSubresourceRange& range)
+{
+	if (!ownershipTransfer)
+		return;
+
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcQueueFamilyIndex = renderer->transferQueueFamily;
+	barrier.dstQueueFamilyIndex = renderer->graphicsQueueFamily;
+	barrier.oldLayout = layout;
+	barrier.newLayout = layout;
+	barrier.image = image;
+	barrier.subresourceRange = range;
+
+	// Release
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = 0;
+	vkCmdPipelineBarrier(cmd->getHandle(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	// Acquire, mip generation both reads and writes the image
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(graphicsCmd->getHandle(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+VkBuffer StagingUpload::getBufferHandle()
+{
+	return renderer->stagingRing.getHandle();
+}
+
+void StagingUpload::submit()
+{
+	finished = true;
+	flush();
+}
+
+void StagingUpload::begin()
+{
+	cmd = new vdu::CommandBuffer;
+	renderer->beginTransferCommands(*cmd);
+}
+
+void StagingUpload::flush()
+{
+	vdu::QueueSubmission submission;
+	renderer->endTransferCommands(*cmd, submission);
+
+	auto fence = new vdu::Fence(&renderer->logicalDevice);
+	vdu::Semaphore* transfersDone = nullptr;
+	vdu::CommandBuffer* finalGraphicsCmd = nullptr;
+
+	if (finished)
+	{
+		// The graphics commands run once every transfer of the upload has finished
+		transfersDone = new vdu::Semaphore;
+		transfersDone->create(&renderer->logicalDevice);
+		submission.addSignal(*transfersDone);
+		VK_CHECK_RESULT(renderer->lTransferQueue.submit(submission));
+
+		// Frames only wait for their own frame copies, so the uploads are made visible to every later use here
+		VkMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+		vkCmdPipelineBarrier(graphicsCmd->getHandle(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+			VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_GEOMETRY_SHADER_BIT |
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+			0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+		vdu::QueueSubmission graphicsSubmission;
+		graphicsSubmission.addWait(*transfersDone, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+		renderer->endTransferCommands(*graphicsCmd, graphicsSubmission);
+		VK_CHECK_RESULT(renderer->lGraphicsQueue.submit(graphicsSubmission, *fence));
+
+		finalGraphicsCmd = graphicsCmd;
+		graphicsCmd = nullptr;
+	}
+	else
+	{
+		VK_CHECK_RESULT(renderer->lTransferQueue.submit(submission, *fence));
+	}
+
+	u64 ringSubmission = renderer->stagingRing.submit(owner, fence->getHandle());
+
+	// Hand the ring space back and free the command buffers once the GPU has read the staged data
+	renderer->addFenceDelayedAction(fence, std::bind([](StagingRing* ring, u64 ringSubmission, vdu::CommandBuffer* cmd, vdu::CommandBuffer* graphicsCmd, vdu::Semaphore* semaphore, vdu::Fence* fence) -> void {
+		ring->release(ringSubmission);
+		cmd->free();
+		delete cmd;
+		if (graphicsCmd)
+		{
+			graphicsCmd->free();
+			delete graphicsCmd;
+		}
+		if (semaphore)
+		{
+			semaphore->destroy();
+			delete semaphore;
+		}
+		fence->destroy();
+		delete fence;
+	}, &renderer->stagingRing, ringSubmission, cmd, finalGraphicsCmd, transfersDone, fence));
+
+	hasStaged = false;
+	cmd = nullptr;
+
+	// Recording carries on in a new command buffer until submit() is called
+	if (!finished)
+		begin();
+}
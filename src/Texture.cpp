@@ -3,7 +3,7 @@
 #include "Engine.hpp"
 #include "Renderer.hpp"
 
-Texture::Texture() : vdu::Texture() {}
+Texture::Texture() : vdu::Texture(), aliased(false) {}
 
 void Texture::loadToRAM(void * pCreateStruct, AllocFunc alloc)
 {
@@ -97,6 +97,7 @@ void Texture::loadToGPU(void * pCreateStruct)
 	{
 		setProperties(*ci);
 		isMipped = ci->genMipMaps;
+		aliased = ci->aliased;
 	}
 
 	const auto r = Engine::renderer;
@@ -113,52 +114,35 @@ void Texture::loadToGPU(void * pCreateStruct)
 		m_numMipLevels = m_maxMipLevel + 1;
 
 		m_usageFlags |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-		create(&r->logicalDevice);
+		createImage();
 
-		auto cmd = new vdu::CommandBuffer;
-		r->beginTransferCommands(*cmd);
+		auto& upload = r->getUploadBatch();
 		//r->setImageLayout(cmd->getHandle(), *this, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
-		cmdTransitionLayout(*cmd, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
-
-		vdu::Buffer* stagingBuffers = new vdu::Buffer[m_layers];
+		cmdTransitionLayout(*upload.getCommandBuffer(), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
 
+		VkDeviceSize layerSize = size / m_layers;
 		for (int i = 0; i < m_layers; ++i)
 		{
-			VkDeviceSize layerSize = size / m_layers;
-			stagingBuffers[i].createStaging(&r->logicalDevice, layerSize);
-			memcpy(stagingBuffers[i].getMemory()->map(), img[i].m_data.data(), (size_t)layerSize);
-			stagingBuffers[i].getMemory()->unmap();
-			stagingBuffers[i].cmdCopyTo(cmd, this, 0, 0, i, 1);
+			if (!stageLayer(upload, i, img[i].m_data.data(), u32(layerSize / (m_width * m_height))))
+			{
+				// Still in RAM, staged again from the start next frame
+				abandonUpload();
+				r->texturesAwaitingSpace.push_back(this);
+				return;
+			}
 		}
 
+		upload.transferImageOwnership(getHandle(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, getFullRange());
+
 		if (isMipped)
 		{
-			cmdGenerateMipMaps(cmd);
+			cmdGenerateMipMaps(upload.getGraphicsCommandBuffer());
 		}
 		else
 		{
-			cmdTransitionLayout(*cmd, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, m_layout, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+			cmdTransitionLayout(*upload.getGraphicsCommandBuffer(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, m_layout, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
 			//r->setImageLayout(cmd->getHandle(), *this, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, m_layout, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
 		}
-
-		vdu::QueueSubmission submission;
-		r->endTransferCommands(*cmd, submission);
-
-		auto fe = new vdu::Fence(&r->logicalDevice);
-		VK_CHECK_RESULT(r->lTransferQueue.submit(submission, *fe));
-
-		auto delayedBufferDestructionFunc = std::bind([](vdu::Fence* fe, vdu::Buffer* buff, u32 layers, vdu::CommandBuffer* cmd) -> void {
-			for (u32 i = 0; i < layers; ++i) {
-				buff[i].destroy();
-			}
-			fe->destroy();
-			cmd->free();
-			delete[] buff;
-			delete fe;
-			delete cmd;
-		}, fe, stagingBuffers, m_layers, cmd);
-
-		r->addFenceDelayedAction(fe, delayedBufferDestructionFunc);
 	}
 	else
 	{
@@ -183,54 +167,39 @@ void Texture::loadToGPU(void * pCreateStruct)
 		if (ci->pData)
 			m_usageFlags |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
 
-		create(&r->logicalDevice);
+		createImage();
 
 		if (ci->pData)
 		{
-			auto cmd = new vdu::CommandBuffer;
-			r->beginTransferCommands(*cmd);
+			auto& upload = r->getUploadBatch();
 
-			auto stagingBuffer = new vdu::Buffer;
-			stagingBuffer->createStaging(&r->logicalDevice, size);
-			memcpy(stagingBuffer->getMemory()->map(), ci->pData, (size_t)size);
-			stagingBuffer->getMemory()->unmap();
 			m_usageFlags |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-			cmdTransitionLayout(*cmd, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+			cmdTransitionLayout(*upload.getCommandBuffer(), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
 			//r->setImageLayout(cmd, *this, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
-			stagingBuffer->cmdCopyTo(cmd, this);
+			if (!stageLayer(upload, 0, ci->pData, getBytesPerPixel()))
+			{
+				// pData isn't kept, so there is nothing to stage again
+				DBG_SEVERE("Could not stage texture " << name);
+				abandonUpload();
+				availability &= ~LOADING_TO_GPU;
+				return;
+			}
+
+			upload.transferImageOwnership(getHandle(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, getFullRange());
 
 			if (isMipped)
 			{
-				cmdGenerateMipMaps(cmd);
+				cmdGenerateMipMaps(upload.getGraphicsCommandBuffer());
 			}
 			else
 			{
-				cmdTransitionLayout(*cmd, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, m_layout, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+				cmdTransitionLayout(*upload.getGraphicsCommandBuffer(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, m_layout, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
 				//r->setImageLayout(cmd, *this, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, m_layout, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
 			}
-
-			vdu::QueueSubmission submission;
-			r->endTransferCommands(*cmd, submission);
-
-			auto fe = new vdu::Fence(&r->logicalDevice);
-			VK_CHECK_RESULT(r->lTransferQueue.submit(submission, *fe));
-
-			auto delayedBufferDestructionFunc = std::bind([](vdu::Fence* fe, vdu::Buffer* buff, vdu::CommandBuffer* cmd) -> void {
-				buff->destroy();
-				fe->destroy();
-				cmd->free();
-				delete buff;
-				delete fe;
-				delete cmd;
-			}, fe, stagingBuffer, cmd);
-
-			r->addFenceDelayedAction(fe, delayedBufferDestructionFunc);
 		}
-		else
+		else if (!aliased)
 		{
-			auto cmd = new vdu::CommandBuffer;
-			r->beginTransferCommands(*cmd);
-
+			// Aliased attachments have no memory yet, their passes transition them from undefined every frame
 			VkPipelineStageFlagBits dstStage;
 
 			switch (m_layout)
@@ -256,22 +225,8 @@ void Texture::loadToGPU(void * pCreateStruct)
 				break;
 			}
 
-			cmdTransitionLayout(*cmd, VK_IMAGE_LAYOUT_UNDEFINED, m_layout, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage);
+			cmdTransitionLayout(*r->getUploadBatch().getGraphicsCommandBuffer(), VK_IMAGE_LAYOUT_UNDEFINED, m_layout, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage);
 			//r->setImageLayout(cmd, *this, VK_IMAGE_LAYOUT_UNDEFINED, m_layout, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage);
-
-			vdu::QueueSubmission submission;
-			r->endTransferCommands(*cmd, submission);
-			auto fe = new vdu::Fence(&r->logicalDevice);
-			VK_CHECK_RESULT(r->lTransferQueue.submit(submission, *fe));
-
-			auto delayedBufferDestructionFunc = std::bind([](vdu::Fence* fe, vdu::CommandBuffer* cmd) -> void {
-				cmd->free();
-				fe->destroy();
-				delete cmd;
-				delete fe;
-			}, fe, cmd);
-
-			r->addFenceDelayedAction(fe, delayedBufferDestructionFunc);
 		}
 	}
 
@@ -281,6 +236,139 @@ void Texture::loadToGPU(void * pCreateStruct)
 	Engine::renderer->gBufferDescriptorSetNeedsUpdate = true;
 }
 
+bool Texture::stageLayer(StagingUpload& upload, u32 layer, const void* data, u32 bytesPerPixel)
+{
+	VkDeviceSize rowPitch = VkDeviceSize(m_width) * bytesPerPixel;
+	u32 rowsPerChunk = glm::max(u32(STAGING_RING_MAX_CHUNK / rowPitch), 1u);
+
+	// Dedicated transfer queues can only copy row ranges starting at a multiple of their granularity, 0 means whole images only
+	u32 granularity = Engine::renderer->transferImageGranularity.height;
+	if (granularity == 0)
+		rowsPerChunk = m_height;
+	else if (rowsPerChunk > granularity)
+		rowsPerChunk -= rowsPerChunk % granularity;
+	else
+		rowsPerChunk = granularity;
+
+	// Copy offsets must be a multiple of both the texel size and 4
+	VkDeviceSize alignment = bytesPerPixel * 4;
+
+	for (u32 row = 0; row < m_height; row += rowsPerChunk)
+	{
+		u32 rows = glm::min(rowsPerChunk, m_height - row);
+
+		VkBufferImageCopy region = {};
+		region.bufferOffset = upload.stage(static_cast<const char*>(data) + row * rowPitch, rows * rowPitch, alignment);
+		if (region.bufferOffset == StagingRing::INVALID_OFFSET)
+			return false;
+		region.bufferRowLength = 0;
+		region.bufferImageHeight = 0;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = 0;
+		region.imageSubresource.baseArrayLayer = layer;
+		region.imageSubresource.layerCount = 1;
+		region.imageOffset = { 0, s32(row), 0 };
+		region.imageExtent = { m_width, rows, 1 };
+
+		vkCmdCopyBufferToImage(upload.getCommandBuffer()->getHandle(), upload.getBufferHandle(), getHandle(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+	}
+
+	return true;
+}
+
+void Texture::abandonUpload()
+{
+	// The upload still runs the transition and copies recorded so far, the image outlives them
+	Engine::renderer->retireImage(m_image, m_imageView, allocation);
+	m_image = VK_NULL_HANDLE;
+	m_imageView = VK_NULL_HANDLE;
+	allocation = GPUAllocation();
+}
+
+void Texture::createImage()
+{
+	const auto r = Engine::renderer;
+	VkDevice device = r->logicalDevice.getHandle();
+
+	VkImageCreateInfo imageInfo = {};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.flags = m_layers == 6 ? VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT : 0;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = m_format;
+	imageInfo.extent = { m_width, m_height, 1 };
+	imageInfo.mipLevels = m_numMipLevels;
+	imageInfo.arrayLayers = m_layers;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.usage = m_usageFlags;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	VK_CHECK_RESULT(vkCreateImage(device, &imageInfo, nullptr, &m_image));
+
+	m_logicalDevice = &r->logicalDevice;
+	m_memory = VK_NULL_HANDLE;
+	m_imageView = VK_NULL_HANDLE;
+
+	if (aliased)
+		return;
+
+	VkMemoryRequirements requirements = getMemoryRequirements();
+
+	// Attachments are recreated on resize, the large ones are kept out of the blocks so they don't fragment them
+	bool renderTarget = (m_usageFlags & (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT)) != 0;
+	allocation = r->gpuAllocator.allocateImage(requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, renderTarget);
+	if (!allocation.isValid())
+	{
+		DBG_SEVERE("Out of device memory for texture " << name << ", " << requirements.size << " bytes");
+		return;
+	}
+	VK_CHECK_RESULT(vkBindImageMemory(device, m_image, allocation.memory, allocation.offset));
+
+	createView();
+}
+
+void Texture::createView()
+{
+	VkImageViewCreateInfo viewInfo = {};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = m_image;
+	viewInfo.viewType = m_layers == 6 ? VK_IMAGE_VIEW_TYPE_CUBE : (m_layers > 1 ? VK_IMAGE_VIEW_TYPE_2D_ARRAY : VK_IMAGE_VIEW_TYPE_2D);
+	viewInfo.format = m_format;
+	viewInfo.subresourceRange = { m_aspectFlags, 0, m_numMipLevels, 0, m_layers };
+	VK_CHECK_RESULT(vkCreateImageView(Engine::renderer->logicalDevice.getHandle(), &viewInfo, nullptr, &m_imageView));
+}
+
+void Texture::bindMemory(VkDeviceMemory memory, VkDeviceSize offset)
+{
+	VK_CHECK_RESULT(vkBindImageMemory(Engine::renderer->logicalDevice.getHandle(), m_image, memory, offset));
+	createView();
+}
+
+VkMemoryRequirements Texture::getMemoryRequirements() const
+{
+	VkMemoryRequirements requirements;
+	vkGetImageMemoryRequirements(Engine::renderer->logicalDevice.getHandle(), m_image, &requirements);
+	return requirements;
+}
+
+void Texture::destroy()
+{
+	// vdu frees m_memory, which is null, along with the image and view. Aliased textures have no allocation
+	vdu::Texture::destroy();
+	Engine::renderer->gpuAllocator.free(allocation);
+}
+
+VkImageSubresourceRange Texture::getFullRange() const
+{
+	VkImageSubresourceRange range = {};
+	range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	range.baseMipLevel = 0;
+	range.levelCount = m_numMipLevels;
+	range.baseArrayLayer = 0;
+	range.layerCount = m_layers;
+	return range;
+}
+
 void Texture::cleanupRAM(FreeFunc fr)
 {
 	/// TODO: free image resources
@@ -4,10 +4,11 @@
 #include "Renderer.hpp"
 #include "Profiler.hpp"
 
-Threading::Threading(int pNumThreads)
+Threading::Threading(int pNumThreads, int pNumAssetThreads)
 {
-	/// TODO: spawn extra threads from pNumThreads ?
 	initCompulsoryWorkers();
+	initRecordWorkers(pNumThreads);
+	initAssetWorkers(pNumAssetThreads);
 }
 
 Threading::~Threading()
@@ -47,6 +48,47 @@ void Threading::addDiskIOJob(JobBase * jobToAdd)
 	m_diskIOWorker->pushJob(jobToAdd);
 }
 
+void Threading::parallelFor(u32 count, const std::function<void(u32)>& func)
+{
+	parallelFor(m_recordWorkers, count, func);
+}
+
+void Threading::assetParallelFor(u32 count, const std::function<void(u32)>& func)
+{
+	parallelFor(m_assetWorkers, count, func);
+}
+
+void Threading::parallelFor(const std::vector<WorkerThread*>& workers, u32 count, const std::function<void(u32)>& func)
+{
+	u32 remaining = count;
+	std::mutex remainingMutex;
+	std::condition_variable finished;
+
+	for (u32 i = 0; i < count; ++i)
+	{
+		workers[i % workers.size()]->pushJob(new Job<>([&func, &remaining, &remainingMutex, &finished, i]() -> void {
+			func(i);
+
+			// Notified under the lock, parallelFor may return and destroy finished as soon as it is released
+			std::lock_guard<std::mutex> lock(remainingMutex);
+			if (--remaining == 0)
+				finished.notify_one();
+		}));
+	}
+
+	std::unique_lock<std::mutex> lock(remainingMutex);
+	finished.wait(lock, [&remaining]() -> bool { return remaining == 0; });
+}
+
+void Threading::wakeWorkers()
+{
+	for (auto w : m_workerThreads)
+	{
+		if (w)
+			w->wake();
+	}
+}
+
 void Threading::initCompulsoryWorkers()
 {
 	// Create CPU worker
@@ -62,6 +104,7 @@ void Threading::initCompulsoryWorkers()
 			vkQueueWaitIdle(Engine::renderer->lGraphicsQueue.getHandle());
 			vkQueueWaitIdle(Engine::renderer->lTransferQueue.getHandle());
 			Engine::renderer->commandPool.destroy();
+			Engine::renderer->transferCommandPool.destroy();
 		},
 		"cpu");
 	
@@ -80,7 +123,11 @@ void Threading::initCompulsoryWorkers()
 			Engine::renderer->lGraphicsQueue.waitIdle();
 			Engine::renderer->lTransferQueue.waitIdle();
 			Engine::renderer->commandPool.destroy();
+			Engine::renderer->transferCommandPool.destroy();
 			m_gpuWorker = nullptr;
+
+			for (auto w : m_recordWorkers)
+				w->wake();
 		},
 		"gpu");
 
@@ -96,6 +143,43 @@ void Threading::initCompulsoryWorkers()
 	m_workerThreads.push_back(m_diskIOWorker);
 }
 
+void Threading::initRecordWorkers(int count)
+{
+	// Always at least one so parallelFor has somewhere to run
+	count = std::max(count, 1);
+
+	m_recordWorkers.reserve(count);
+	for (int i = 0; i < count; ++i)
+	{
+		m_recordWorkers.push_back(new WorkerThread(
+			[]()->void { Engine::renderer->createPerThreadCommandPools(); },
+			[this, i]()->void {
+				// The GPU worker can hand out recording until it has closed, and the pools have to outlive its submissions
+				auto worker = m_recordWorkers[i];
+				while (worker->runNextJob() || m_gpuWorker)
+				{
+					worker->waitForJob([this]() -> bool { return !m_gpuWorker; });
+				}
+				Engine::renderer->commandPool.destroy();
+				Engine::renderer->transferCommandPool.destroy();
+			},
+			"record" + std::to_string(i)));
+		m_workerThreads.push_back(m_recordWorkers.back());
+	}
+}
+
+void Threading::initAssetWorkers(int count)
+{
+	count = std::max(count, 1);
+
+	m_assetWorkers.reserve(count);
+	for (int i = 0; i < count; ++i)
+	{
+		m_assetWorkers.push_back(new WorkerThread([]()->void { }, []()->void { }, "asset" + std::to_string(i)));
+		m_workerThreads.push_back(m_assetWorkers.back());
+	}
+}
+
 void Threading::freeJob(JobBase * jobToFree)
 {
 	m_jobsFreeMutex.lock();
@@ -137,6 +221,7 @@ void Threading::WorkerThread::pushJob(JobBase * job)
 	m_jobsQueue.push(job);
 
 	m_jobsQueueMutex.unlock();
+	m_jobsArrived.notify_one();
 }
 
 bool Threading::WorkerThread::popJob(JobBase *& job)
@@ -168,25 +253,50 @@ void Threading::WorkerThread::run()
 
 	m_initFunc();
 
-	JobBase* job;
-	bool readyToTerminate = false;
-	//s64 timeUntilNextJob = std::numeric_limits<s64>::max();
-	while (!readyToTerminate)
+	// Jobs left in the queue are still run once the engine stops
+	while (runNextJob() || Engine::engineRunning)
 	{
-		if (popJob(job))
-		{
-			PROFILE_START("thread_" + getThisThreadIDString());
-			Engine::renderer->executeFenceDelayedActions(); // Any externally synced vulkan objects created on this thread should be destroyed from this thread
-			job->run();
-			m_totalJobsFinished++;
-			PROFILE_END("thread_" + getThisThreadIDString());
-		}
-		else
-		{
-			readyToTerminate = !Engine::engineRunning;
-			std::this_thread::yield();
-		}
+		waitForJob([]() -> bool { return !Engine::engineRunning; });
 	}
 
 	m_closeFunc();
 }
+
+void Threading::WorkerThread::waitForJob(const std::function<bool(void)>& stop)
+{
+	std::unique_lock<std::mutex> lock(m_jobsQueueMutex);
+	m_jobsArrived.wait(lock, [this, &stop]() -> bool { return !m_jobsQueue.empty() || stop(); });
+}
+
+void Threading::WorkerThread::wake()
+{
+	// Taking the lock orders this after a waiter's check of stop(), so it is either seen there or notified
+	std::lock_guard<std::mutex> lock(m_jobsQueueMutex);
+	m_jobsArrived.notify_all();
+}
+
+void Threading::WorkerThread::waitForAllJobsToFinish()
+{
+	std::unique_lock<std::mutex> lock(m_jobsQueueMutex);
+	m_jobsFinished.wait(lock, [this]() -> bool { return allJobsFinished(); });
+}
+
+bool Threading::WorkerThread::runNextJob()
+{
+	JobBase* job;
+	if (!popJob(job))
+		return false;
+
+	PROFILE_START("thread_" + getThisThreadIDString());
+	Engine::renderer->executeFenceDelayedActions(); // Any externally synced vulkan objects created on this thread should be destroyed from this thread
+	job->run();
+	m_totalJobsFinished++;
+	PROFILE_END("thread_" + getThisThreadIDString());
+
+	if (allJobsFinished())
+	{
+		std::lock_guard<std::mutex> lock(m_jobsQueueMutex);
+		m_jobsFinished.notify_all();
+	}
+	return true;
+}
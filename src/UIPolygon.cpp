@@ -5,19 +5,17 @@
 
 void UIPolygon::reserveBuffer(int numVerts)
 {
-	vertsBuffer.setMemoryProperty(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-	vertsBuffer.setUsage(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
-	vertsBuffer.create(&Engine::renderer->logicalDevice, numVerts * sizeof(Vertex2D));
+	vertsBuffer.create(&Engine::renderer->gpuAllocator, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, numVerts * sizeof(Vertex2D));
 }
 
-void UIPolygon::render(vdu::CommandBuffer& cmd)
+void UIPolygon::render(VkCommandBuffer cmd)
 {
 	if (drawable)
 	{
 		VkDeviceSize offsets[] = { 0 };
 		VkBuffer buffer[] = { vertsBuffer.getHandle() };
-		vkCmdBindVertexBuffers(cmd.getHandle(), 0, 1, buffer, offsets);
-		vkCmdDraw(cmd.getHandle(), verts.size(), 1, 0, 0);
+		vkCmdBindVertexBuffers(cmd, 0, 1, buffer, offsets);
+		vkCmdDraw(cmd, verts.size(), 1, 0, 0);
 	}
 }
 
@@ -35,8 +33,7 @@ void UIPolygon::setTexture(Texture * tex)
 void UIPolygon::setVerts(std::vector<Vertex2D>& v)
 {
 	verts = v;
-	memcpy(vertsBuffer.getMemory()->map(), verts.data(), verts.size() * sizeof(Vertex2D));
-	vertsBuffer.getMemory()->unmap();
+	vertsBuffer.write(0, verts.data(), verts.size() * sizeof(Vertex2D));
 	drawable = true;
 }
 
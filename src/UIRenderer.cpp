@@ -9,7 +9,7 @@ void UIRenderer::cleanup()
 {
 	destroyOverlayRenderPass();
 	destroyOverlayPipeline();
-	destroyOverlayAttachmentsFramebuffers();
+	destroyOverlayFramebuffer();
 	destroyOverlayDescriptorSetLayouts();
 
 	std::for_each(uiGroups.begin(), uiGroups.end(), [](UIElementGroup* uiGroup) -> void { delete uiGroup; });
@@ -20,12 +20,22 @@ void UIRenderer::cleanupForReInit()
 {
 	destroyOverlayRenderPass();
 	destroyOverlayPipeline();
-	destroyOverlayAttachmentsFramebuffers();
+	destroyOverlayFramebuffer();
 	destroyOverlayCommands();
 }
 
 void UIRenderer::garbageCollect()
 {
+	Engine::threading->layersMutex.lock();
+	bool garbage = std::any_of(uiGroups.begin(), uiGroups.end(), [](UIElementGroup* uiGroup) -> bool { return !uiGroup->elementsToRemove.empty(); });
+	Engine::threading->layersMutex.unlock();
+
+	if (!garbage)
+		return;
+
+	// Removed elements may still be drawn by frames in flight
+	Engine::renderer->waitForAllFrames();
+
 	for (auto uiGroup : uiGroups) {
 		uiGroup->garbageCollect();
 	}
@@ -73,6 +83,7 @@ void UIRenderer::createOverlayAttachments()
 	tci.format = VK_FORMAT_R8G8B8A8_UNORM;
 	tci.layout = VK_IMAGE_LAYOUT_GENERAL;
 	tci.usageFlags = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	tci.aliased = true;
 
 	uiTexture.loadToGPU(&tci);
 
@@ -93,13 +104,14 @@ void UIRenderer::createOverlayFramebuffer()
 
 void UIRenderer::createOverlayRenderPass()
 {
+	// Both are cleared every frame and share memory with the G-buffer, see Renderer::createAttachments
 	auto combinedInfo = overlayRenderPass.addColourAttachment(&uiTexture, "ui");
-	combinedInfo->setInitialLayout(VK_IMAGE_LAYOUT_GENERAL);
+	combinedInfo->setInitialLayout(VK_IMAGE_LAYOUT_UNDEFINED);
 	combinedInfo->setFinalLayout(VK_IMAGE_LAYOUT_GENERAL);
 	combinedInfo->setUsageLayout(VK_IMAGE_LAYOUT_GENERAL);
 
 	auto depthInfo = overlayRenderPass.setDepthAttachment(&uiDepthTexture);
-	depthInfo->setInitialLayout(VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+	depthInfo->setInitialLayout(VK_IMAGE_LAYOUT_UNDEFINED);
 	depthInfo->setFinalLayout(VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
 	depthInfo->setUsageLayout(VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
 
@@ -122,18 +134,17 @@ void UIRenderer::createOverlayPipeline()
 	colourBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
 	colourBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
 
-	pipeline.setAttachmentColorBlendState("ui", colourBlendAttachment);
-
 	pipeline.addViewport({ 0.f, 0.f, (float)Engine::renderer->renderResolution.width, (float)Engine::renderer->renderResolution.height, 0.f, 1.f }, { 0, 0, Engine::renderer->renderResolution.width, Engine::renderer->renderResolution.height });
 	pipeline.setVertexInputState(&Engine::renderer->screenVertexInputState);
 	pipeline.setShaderProgram(&Engine::renderer->overlayShader);
-	pipeline.setPipelineLayout(&pipelineLayout);
-	pipeline.setRenderPass(&overlayRenderPass);
+	pipeline.setPipelineLayout(pipelineLayout.getHandle());
+	pipeline.setRenderPass(overlayRenderPass.getHandle(), 1);
+	pipeline.setColourBlendState(0, colourBlendAttachment);
 	pipeline.setDepthTest(VK_FALSE);
 	pipeline.setCullMode(VK_CULL_MODE_NONE);
 	pipeline.setMaxDepthBounds(10.f);
 	pipeline.addDynamicState(VK_DYNAMIC_STATE_SCISSOR);
-	pipeline.create(&Engine::renderer->logicalDevice);
+	pipeline.create(&Engine::renderer->logicalDevice, Engine::renderer->pipelineCache);
 }
 
 void UIRenderer::createOverlayDescriptorSetLayouts()
@@ -144,14 +155,14 @@ void UIRenderer::createOverlayDescriptorSetLayouts()
 
 void UIRenderer::createOverlayCommands()
 {
-	commandBuffer.allocate(&Engine::renderer->logicalDevice, &Engine::renderer->commandPool);
-	commandBuffer.allocate(&Engine::renderer->logicalDevice, &Engine::renderer->commandPool);
+	commandBuffers.resize(FRAMES_IN_FLIGHT);
+	for (auto& commandBuffer : commandBuffers)
+		commandBuffer.allocate(&Engine::renderer->logicalDevice, &Engine::renderer->commandPool);
 }
 
 void UIRenderer::updateOverlayCommands()
 {
-	/// TODO: if we have a layer that updates every frame, we re-write all commands
-	/// Can we avoid this by using secondary command buffers for layers
+	/// TODO: every group is still re-recorded each frame, only the secondary command buffers of groups that changed need to be
 
 	Engine::threading->layersMutex.lock();
 
@@ -168,39 +179,23 @@ void UIRenderer::updateOverlayCommands()
 		return;
 	}*/
 
-	VkCommandBufferBeginInfo beginInfo = {};
-	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-
-	auto cmd = commandBuffer.getHandle();
-
-	VK_CHECK_RESULT(vkBeginCommandBuffer(cmd, &beginInfo));
-
-	VkRenderPassBeginInfo renderPassInfo = {};
-	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-	renderPassInfo.renderPass = overlayRenderPass.getHandle();
-	renderPassInfo.framebuffer = framebuffer.getHandle();
-	renderPassInfo.renderArea.offset = { 0, 0 };
-	renderPassInfo.renderArea.extent.width = Engine::renderer->renderResolution.width;
-	renderPassInfo.renderArea.extent.height = Engine::renderer->renderResolution.height;
-
-	std::array<VkClearValue, 2> clearValues = {};
-	clearValues[0].color = { 0, 0, 0, 0 };
-	clearValues[1].depthStencil = { 1.0f, 0 };
+	auto& renderer = Engine::renderer;
 
-	renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
-	renderPassInfo.pClearValues = clearValues.data();
-
-	Engine::renderer->queryPool.cmdTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, Renderer::BEGIN_UI);
+	// Each drawn group is recorded into its own secondary command buffer on a record worker
+	std::vector<UIElementGroup*> drawnGroups;
+	for (auto group : uiGroups)
+	{
+		if (group->doDraw())
+			drawnGroups.push_back(group);
+	}
 
-	vkCmdBeginRenderPass(cmd, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+	renderer->prepareSecondaryCommands(Renderer::Overlay_Secondary, static_cast<u32>(drawnGroups.size()));
 
-	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.getHandle());
+	Engine::threading->parallelFor(static_cast<u32>(drawnGroups.size()), [&](u32 slot) -> void {
+		auto cmd = renderer->beginSecondaryCommands(Renderer::Overlay_Secondary, slot, overlayRenderPass.getHandle(), framebuffer.getHandle());
+		auto group = drawnGroups[slot];
 
-	for (auto group : uiGroups)
-	{
-		if (!group->doDraw())
-			continue;
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.getHandle());
 
 		group->sortByDepths();
 
@@ -234,13 +229,42 @@ void UIRenderer::updateOverlayCommands()
 			VkDescriptorSet descSet = element->getDescriptorSet().getHandle();
 			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout.getHandle(), 0, 1, &descSet, 0, nullptr);
 
-			element->render(commandBuffer);
+			element->render(cmd);
 		}
-	}
 
-	vkCmdEndRenderPass(cmd);
+		VK_CHECK_RESULT(vkEndCommandBuffer(cmd));
+	});
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+
+	auto cmd = commandBuffers[renderer->frameIndex].getHandle();
+
+	VK_CHECK_RESULT(vkBeginCommandBuffer(cmd, &beginInfo));
+
+	VkRenderPassBeginInfo renderPassInfo = {};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassInfo.renderPass = overlayRenderPass.getHandle();
+	renderPassInfo.framebuffer = framebuffer.getHandle();
+	renderPassInfo.renderArea.offset = { 0, 0 };
+	renderPassInfo.renderArea.extent.width = renderer->renderResolution.width;
+	renderPassInfo.renderArea.extent.height = renderer->renderResolution.height;
+
+	std::array<VkClearValue, 2> clearValues = {};
+	clearValues[0].color = { 0, 0, 0, 0 };
+	clearValues[1].depthStencil = { 1.0f, 0 };
 
-	Engine::renderer->queryPool.cmdTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, Renderer::END_UI);
+	renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+	renderPassInfo.pClearValues = clearValues.data();
+
+	// Groups are executed in the order they were created, like they were drawn before
+	vkCmdBeginRenderPass(cmd, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+	if (!drawnGroups.empty())
+		vkCmdExecuteCommands(cmd, static_cast<u32>(drawnGroups.size()), renderer->secondaryCommandBuffers[Renderer::Overlay_Secondary][renderer->frameIndex].data());
+
+	vkCmdEndRenderPass(cmd);
 
 	VK_CHECK_RESULT(vkEndCommandBuffer(cmd));
 
@@ -249,7 +273,9 @@ void UIRenderer::updateOverlayCommands()
 
 void UIRenderer::destroyOverlayCommands()
 {
-	commandBuffer.free();
+	for (auto& commandBuffer : commandBuffers)
+		commandBuffer.free();
+	commandBuffers.clear();
 }
 
 void UIRenderer::destroyOverlayDescriptorSetLayouts()
@@ -268,9 +294,13 @@ void UIRenderer::destroyOverlayPipeline()
 	pipeline.destroy();
 }
 
-void UIRenderer::destroyOverlayAttachmentsFramebuffers()
+void UIRenderer::destroyOverlayAttachments()
 {
 	uiTexture.destroy();
 	uiDepthTexture.destroy();
+}
+
+void UIRenderer::destroyOverlayFramebuffer()
+{
 	framebuffer.destroy();
 }
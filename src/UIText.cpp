@@ -9,11 +9,9 @@ Text::Text() : UIElement(UIElement::Text)
 	drawable = false;
 	
 	/// TODO: Were guessing upper bound. Implement a more sophistocated approach
-	vertsBuffer.setMemoryProperty(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-	vertsBuffer.setUsage(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
-	vertsBuffer.create(&Engine::renderer->logicalDevice, 2000 * 6 * sizeof(Vertex2D));
-	memset(vertsBuffer.getMemory()->map(), 0, 2000 * 6 * sizeof(Vertex2D));
-	vertsBuffer.getMemory()->unmap();
+	vertsBuffer.create(&Engine::renderer->gpuAllocator, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, 2000 * 6 * sizeof(Vertex2D));
+	memset(vertsBuffer.getMapped(), 0, 2000 * 6 * sizeof(Vertex2D));
+	vertsBuffer.flush();
 }
 
 void Text::Style::setFont(Font * pFont)
@@ -151,22 +149,20 @@ void Text::update()
 
 	drawUpdate = true;
 
-	char* data = (char*)vertsBuffer.getMemory()->map();
-	memcpy(data, verts.data(), verts.size() * sizeof(Vertex2D));
-	vertsBuffer.getMemory()->unmap();
+	vertsBuffer.write(0, verts.data(), verts.size() * sizeof(Vertex2D));
 
 	drawingMutex.unlock();
 }
 
-void Text::render(vdu::CommandBuffer& cmd)
+void Text::render(VkCommandBuffer cmd)
 {
 	drawingMutex.lock();
 	if (drawable)
 	{
 		VkDeviceSize offsets[] = { 0 };
 		VkBuffer buffer[] = { vertsBuffer.getHandle() };
-		vkCmdBindVertexBuffers(cmd.getHandle(), 0, 1, buffer, offsets);
-		vkCmdDraw(cmd.getHandle(), verts.size(), 1, 0, 0);
+		vkCmdBindVertexBuffers(cmd, 0, 1, buffer, offsets);
+		vkCmdDraw(cmd, verts.size(), 1, 0, 0);
 	}
 	drawingMutex.unlock();
 }
@@ -6,9 +6,10 @@
 #include "Profiler.hpp"
 
 // list of vectors of instanaces
-// vector.size = 100
+// vector.size = INSTANCES_PER_BLOCK
 // To insert:
-//	Find first vector in list with size < 100 and push_back()
+//	Take the next slot of the newest vector (the list front), push a new vector to the front when it is full.
+//	Slots are handed out in order so an instance's slot number is its transform index
 
 ModelInstance* World::addModelInstance(std::string modelName, std::string instanceName)
 {
@@ -19,38 +20,28 @@ ModelInstance* World::addModelInstance(std::string modelName, std::string instan
 		return nullptr; // Instance exists
 	}
 
-	int transformIndex = allInstances.size() * 100; // Dependant on list<vector<>> the instance is in
-
-	ModelInstance* insertPosition = nullptr;
-	for (auto listInsert = allInstances.begin(); listInsert != allInstances.end(); ++listInsert)
+	u32 transformIndex = usedInstanceSlots;
+	if (transformIndex >= u32(Engine::config.render.limits.getMaxTransforms()))
 	{
-		for (auto itr = listInsert->begin(); itr != listInsert->end(); ++itr)
-		{
-			transformIndex++;
-			if (itr->name.length() == 0)
-			{
-				insertPosition = &(*itr);
-				break;
-			}
-		}
-		if (insertPosition)
-			break;
+		DBG_WARNING("Can't add model instance " << instanceName << ", the transform limit is " << Engine::config.render.limits.getMaxTransforms());
+		Engine::threading->addingModelInstanceMutex.unlock();
+		return nullptr;
 	}
 
-	if (!insertPosition)
-	{
-		allInstances.push_front(std::vector<ModelInstance>(100)); /// TODO: variable size of vector ?
-		insertPosition = &allInstances.front().front();
-	}
+	if (transformIndex % INSTANCES_PER_BLOCK == 0)
+		allInstances.push_front(std::vector<ModelInstance>(INSTANCES_PER_BLOCK));
+
+	ModelInstance* insertPosition = &allInstances.front()[transformIndex % INSTANCES_PER_BLOCK];
+	++usedInstanceSlots;
 
 	auto m = Engine::assets.getModel(modelName); /// TODO: error if model doesnt exist !
 	insertPosition->name = instanceName;
 	insertPosition->setModel(m);
 	insertPosition->transformIndex = transformIndex;
 	modelNames.insert(std::make_pair(instanceName, insertPosition));
+	membershipChanged();
 
-	Engine::renderer->gBufferCmdsNeedUpdate = true;
-	Engine::renderer->gBufferNoTexCmdsNeedUpdate = true;
+	// The recorded draws pick the instance up from the draw buffers, they only change if the draw counts do
 
 	Engine::threading->addingModelInstanceMutex.unlock();
 
@@ -144,19 +135,84 @@ void World::setSkybox(const std::string & skyboxName)
 void World::frustumCulling(Camera * cam)
 {
 	/// TODO: actual culling, for now we draw everything thats available on the GPU
-	/// It would also be good to only perform culling when changes in the scene cross the frustum, if that is more perfomant ?
 
-	instancesToDraw.clear();
+	// Culling is temporally coherent: instancesToDraw is only rebuilt when world membership changes, and LODs are
+	// only re-selected for instances that changed, or for all instances when the camera has moved
+
+	changedDrawRecords.clear();
+	drawListRebuilt = false;
+
+	auto tIndex = ModelInstance::toGPUTransformIndex;
+	glm::fvec3 camPos = cam->getPosition();
+
+	// LOD selection is shared by all passes and done once per instance, shadow passes get their own bias on top
+	auto& lodConfig = Engine::config.render.lod;
+	float projScale = float(Engine::config.render.getResolution().y) / (2.f * glm::tan(cam->getFOV() * 0.5f));
+	float errorThreshold = lodConfig.getErrorThreshold() * glm::exp2(lodConfig.getBias());
+	float shadowErrorThreshold = errorThreshold * glm::exp2(lodConfig.getShadowBias());
+	float hysteresis = lodConfig.getHysteresis();
+
+	auto selectLOD = [&](ModelInstance* m) -> void {
+		auto& t = m->transform[tIndex];
+		glm::fvec3 modelPos = t.getTranslation();
+		glm::fvec3 scale = t.getScale();
+		float maxScale = glm::max(scale.x, glm::max(scale.y, scale.z));
+		float distanceToCam = glm::max(glm::length(camPos - modelPos) - m->model->boundingSphere.w * maxScale, 0.001f);
+
+		float pixelsPerUnit = projScale * maxScale / distanceToCam;
+		m->lodIndex = m->model->selectLOD(pixelsPerUnit, m->lodIndex, errorThreshold, hysteresis);
+		m->shadowLodIndex = m->model->selectLOD(pixelsPerUnit, m->shadowLodIndex, shadowErrorThreshold, hysteresis);
+	};
 
-	for (auto& vecs : allInstances)
+	if (culledMembershipVersion != membershipVersion)
 	{
-		for (auto& instance : vecs)
+		culledMembershipVersion = membershipVersion;
+		culledCameraChangeCount = cam->getChangeCount();
+		drawListRebuilt = true;
+
+		// The physics thread walks instancesToDraw when uploading transforms
+		PROFILE_MUTEX("phystoenginemutex", Engine::threading->physToEngineMutex.lock());
+		instancesToDraw.clear();
+
+		for (auto& vecs : allInstances)
+		{
+			for (auto& instance : vecs)
+			{
+				if (!instance.model)
+					continue;
+				if (!instance.model->checkAvailability(Asset::ON_GPU))
+					continue;
+				instance.culledVersion = instance.changeVersion;
+				instance.culledMaterial = instance.material;
+				selectLOD(&instance);
+				instancesToDraw.push_back(&instance);
+			}
+		}
+		Engine::threading->physToEngineMutex.unlock();
+		return;
+	}
+
+	bool reselectAll = culledCameraChangeCount != cam->getChangeCount() || lodSettingsDirty;
+	culledCameraChangeCount = cam->getChangeCount();
+	lodSettingsDirty = false;
+
+	for (u32 i = 0; i < instancesToDraw.size(); ++i)
+	{
+		auto m = instancesToDraw[i];
+		bool instanceChanged = m->culledVersion != m->changeVersion;
+
+		if (!instanceChanged && !reselectAll)
+			continue;
+
+		m->culledVersion = m->changeVersion;
+
+		// Transforms are read from the transform buffer, so only a LOD or material change affects the draw batches
+		u32 lodIndex = m->lodIndex, shadowLodIndex = m->shadowLodIndex;
+		selectLOD(m);
+		if (lodIndex != m->lodIndex || shadowLodIndex != m->shadowLodIndex || m->material != m->culledMaterial)
 		{
-			if (!instance.model)
-				continue;
-			if (!instance.model->checkAvailability(Asset::ON_GPU))
-				continue;
-			instancesToDraw.push_back(&instance);
+			m->culledMaterial = m->material;
+			changedDrawRecords.push_back(i);
 		}
 	}
 }
@@ -0,0 +1,70 @@
+#include "Test.hpp"
+#include "AttachmentAllocator.hpp"
+
+/*
+	Exercises the placement the renderer's attachments are aliased with: only attachments whose lifetimes don't
+	overlap share a slot, a slot that is already large enough is preferred and otherwise the one that grows least.
+*/
+
+static const u32 ALL_TYPES = ~0u;
+
+static void testOverlap()
+{
+	AttachmentAllocator a;
+
+	TEST_CHECK_EQUAL(a.place(0, 2, 100, 16, ALL_TYPES), 0u);
+	TEST_CHECK_EQUAL(a.place(1, 3, 100, 16, ALL_TYPES), 1u);
+
+	// Lifetimes are inclusive, a first use on the step slot 0 is last used in still overlaps
+	TEST_CHECK_EQUAL(a.place(2, 4, 100, 16, ALL_TYPES), 2u);
+	TEST_CHECK_EQUAL(a.place(3, 5, 100, 16, ALL_TYPES), 0u);
+	TEST_CHECK_EQUAL(a.getSlots().size(), size_t(3));
+	TEST_CHECK_EQUAL(a.getSlots()[0].lastUse, 5u);
+
+	TEST_CHECK_EQUAL(a.getPlacedSize(), 400ull);
+	TEST_CHECK_EQUAL(a.getSlotSize(), 300ull);
+}
+
+static void testBestFit()
+{
+	AttachmentAllocator a;
+
+	a.place(0, 0, 400, 16, ALL_TYPES);
+	a.place(0, 0, 100, 16, ALL_TYPES);
+	a.place(0, 0, 200, 16, ALL_TYPES);
+
+	// Smallest that is large enough
+	TEST_CHECK_EQUAL(a.place(1, 1, 150, 16, ALL_TYPES), 2u);
+	TEST_CHECK_EQUAL(a.getSlots()[2].size, 200ull);
+
+	// None is, the largest grows least
+	TEST_CHECK_EQUAL(a.place(1, 1, 800, 64, ALL_TYPES), 0u);
+	TEST_CHECK_EQUAL(a.getSlots()[0].size, 800ull);
+	TEST_CHECK_EQUAL(a.getSlots()[0].alignment, 64ull);
+	TEST_CHECK_EQUAL(a.getSlotSize(), 1100ull);
+}
+
+static void testMemoryTypes()
+{
+	AttachmentAllocator a;
+
+	a.place(0, 0, 100, 16, 0x3);
+	TEST_CHECK_EQUAL(a.place(1, 1, 100, 16, 0x4), 1u);
+
+	// Shares the slot with the types both allow
+	TEST_CHECK_EQUAL(a.place(2, 2, 100, 16, 0x6), 0u);
+	TEST_CHECK_EQUAL(a.getSlots()[0].memoryTypeBits, 0x2u);
+
+	a.clear();
+	TEST_CHECK(a.getSlots().empty());
+	TEST_CHECK_EQUAL(a.getPlacedSize(), 0ull);
+}
+
+int main()
+{
+	testOverlap();
+	testBestFit();
+	testMemoryTypes();
+
+	return TEST_RESULT();
+}
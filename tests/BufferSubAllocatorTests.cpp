@@ -0,0 +1,160 @@
+#include "Test.hpp"
+#include "BufferSubAllocator.hpp"
+
+/*
+	Exercises the free-list bookkeeping the vertex/index buffer and GPUAllocator rely on: best-fit placement,
+	coalescing on free, and incremental compaction keeping sources allocated until the caller frees them.
+*/
+
+static const u64 INVALID = BufferSubAllocator::INVALID_OFFSET;
+
+static void testAllocate()
+{
+	BufferSubAllocator a;
+	a.init(100);
+
+	TEST_CHECK_EQUAL(a.allocate(0), INVALID);
+	TEST_CHECK_EQUAL(a.allocate(101), INVALID);
+
+	TEST_CHECK_EQUAL(a.allocate(10), 0ull);
+	TEST_CHECK_EQUAL(a.allocate(20), 10ull);
+	TEST_CHECK_EQUAL(a.allocate(70), 30ull);
+	TEST_CHECK_EQUAL(a.getUsed(), 100ull);
+	TEST_CHECK_EQUAL(a.getFreeRangeCount(), 0u);
+	TEST_CHECK_EQUAL(a.allocate(1), INVALID);
+	TEST_CHECK_EQUAL(a.getFragmentation(), 0.f);
+}
+
+static void testBestFit()
+{
+	BufferSubAllocator a;
+	a.init(100);
+
+	// Holes of 10 at 0, 5 at 20 and 15 at 35, the tail at 60 is 40
+	u64 o[6];
+	u64 sizes[] = { 10, 10, 5, 10, 15, 10 };
+	for (int i = 0; i < 6; ++i)
+		o[i] = a.allocate(sizes[i]);
+	a.free(o[0]);
+	a.free(o[2]);
+	a.free(o[4]);
+
+	TEST_CHECK_EQUAL(a.getFreeRangeCount(), 4u);
+	TEST_CHECK_EQUAL(a.getLargestFreeRange(), 40ull);
+
+	TEST_CHECK_EQUAL(a.allocate(5), 20ull); // Exact fit
+	TEST_CHECK_EQUAL(a.allocate(9), 0ull); // Smallest that fits, ahead of the 15
+	TEST_CHECK_EQUAL(a.allocate(12), 35ull);
+	TEST_CHECK_EQUAL(a.allocate(20), 60ull); // Only the tail is large enough
+}
+
+static void testCoalesce()
+{
+	BufferSubAllocator a;
+	a.init(40);
+
+	u64 o0 = a.allocate(10);
+	u64 o1 = a.allocate(10);
+	u64 o2 = a.allocate(10);
+	u64 o3 = a.allocate(10);
+
+	a.free(o0);
+	a.free(o2);
+	TEST_CHECK_EQUAL(a.getFreeRangeCount(), 2u);
+	TEST_CHECK_EQUAL(a.getFragmentation(), 0.5f);
+
+	// Merges with the ranges before and after it
+	a.free(o1);
+	TEST_CHECK_EQUAL(a.getFreeRangeCount(), 1u);
+	TEST_CHECK_EQUAL(a.getLargestFreeRange(), 30ull);
+	TEST_CHECK_EQUAL(a.getFragmentation(), 0.f);
+
+	a.free(o3);
+	TEST_CHECK_EQUAL(a.getLargestFreeRange(), 40ull);
+	TEST_CHECK_EQUAL(a.getUsed(), 0ull);
+	TEST_CHECK_EQUAL(a.getAllocationCount(), 0u);
+
+	// Unknown offsets are ignored
+	a.free(5);
+	TEST_CHECK_EQUAL(a.getUsed(), 0ull);
+}
+
+static void testCompact()
+{
+	BufferSubAllocator a;
+	a.init(100);
+
+	u64 o[5];
+	for (int i = 0; i < 5; ++i)
+		o[i] = a.allocate(10);
+	a.free(o[0]);
+	a.free(o[2]);
+
+	// The last allocation moves into the first hole, the one before it into the next
+	auto moves = a.compact(~0ull);
+	TEST_CHECK_EQUAL(moves.size(), size_t(2));
+	if (moves.size() == 2)
+	{
+		TEST_CHECK_EQUAL(moves[0].srcOffset, 40ull);
+		TEST_CHECK_EQUAL(moves[0].dstOffset, 0ull);
+		TEST_CHECK_EQUAL(moves[0].size, 10ull);
+		TEST_CHECK_EQUAL(moves[1].srcOffset, 30ull);
+		TEST_CHECK_EQUAL(moves[1].dstOffset, 20ull);
+	}
+
+	// Sources stay allocated until they are freed
+	TEST_CHECK_EQUAL(a.getUsed(), 50ull);
+	TEST_CHECK_EQUAL(a.allocate(60), INVALID);
+	for (auto& m : moves)
+		a.free(m.srcOffset);
+
+	TEST_CHECK_EQUAL(a.getUsed(), 30ull);
+	TEST_CHECK_EQUAL(a.getFreeRangeCount(), 1u);
+	TEST_CHECK_EQUAL(a.getLargestFreeRange(), 70ull);
+	TEST_CHECK_EQUAL(a.allocate(70), 30ull);
+
+	// Nothing left to move
+	TEST_CHECK(a.compact(~0ull).empty());
+}
+
+static void testCompactBudget()
+{
+	BufferSubAllocator a;
+	a.init(100);
+
+	u64 o[6];
+	for (int i = 0; i < 6; ++i)
+		o[i] = a.allocate(10);
+	a.free(o[0]);
+	a.free(o[1]);
+	a.free(o[2]);
+
+	// Stops once the budget is used up, at least one move is always made
+	auto moves = a.compact(5);
+	TEST_CHECK_EQUAL(moves.size(), size_t(1));
+	if (moves.size() == 1)
+	{
+		TEST_CHECK_EQUAL(moves[0].srcOffset, 50ull);
+		TEST_CHECK_EQUAL(moves[0].dstOffset, 0ull);
+	}
+
+	// Allocations with no hole before them that fits are left alone
+	BufferSubAllocator b;
+	b.init(100);
+	u64 p0 = b.allocate(5);
+	b.allocate(20);
+	b.allocate(20);
+	b.free(p0);
+	TEST_CHECK(b.compact(~0ull).empty());
+}
+
+int main()
+{
+	testAllocate();
+	testBestFit();
+	testCoalesce();
+	testCompact();
+	testCompactBudget();
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,180 @@
+#include "Test.hpp"
+#include "Culling.hpp"
+
+/*
+	Runs cullReference over a fixed scene and compares every output buffer with expected values worked out by hand.
+	cull.glsl is not dispatched, the tests are device free, so this checks the CPU reference only.
+
+	The scene only uses small dyadic values, so every product and sum in sphereInView is exact and the expected values
+	don't depend on rounding. Entries the passes must not write keep the SENTINEL they were cleared to. Instances 4
+	and 6 touch a plane, exactly at distance == -radius, and stay visible.
+*/
+
+static const u32 SENTINEL = ~0u;
+static const u32 VIEW_COUNT = 3;
+static const u32 INSTANCE_COUNT = 9;
+static const u32 BATCH_COUNT = 4;
+static const u32 SHADOW_INSTANCE_BASE = 5;
+static const u32 SHADOW_BATCH_BASE = 2;
+static const u32 INSTANCE_STRIDE = 16;
+static const u32 DRAW_STRIDE = 8;
+
+static glm::fmat4 makeTransform(glm::fvec3 c0, glm::fvec3 c1, glm::fvec3 c2, glm::fvec3 translation)
+{
+	return glm::fmat4(glm::fvec4(c0, 0.f), glm::fvec4(c1, 0.f), glm::fvec4(c2, 0.f), glm::fvec4(translation, 1.f));
+}
+
+static CullViewsUBOData makeViews()
+{
+	CullViewsUBOData cull = {};
+
+	// Camera: the box |x|, |y|, |z| <= 4
+	cull.views[0].planes[0] = glm::fvec4(1, 0, 0, 4);
+	cull.views[0].planes[1] = glm::fvec4(-1, 0, 0, 4);
+	cull.views[0].planes[2] = glm::fvec4(0, 1, 0, 4);
+	cull.views[0].planes[3] = glm::fvec4(0, -1, 0, 4);
+	cull.views[0].planes[4] = glm::fvec4(0, 0, 1, 4);
+	cull.views[0].planes[5] = glm::fvec4(0, 0, -1, 4);
+
+	// A point light's bounds
+	cull.views[1] = CullView::fromSphere(glm::fvec3(10, 0, 0), 2.f);
+
+	// CULL_VIEW_ALL style, all planes zero accepts everything
+	for (auto& p : cull.views[2].planes)
+		p = glm::fvec4(0.f);
+
+	cull.viewCount = VIEW_COUNT;
+	cull.instanceCount = INSTANCE_COUNT;
+	cull.batchCount = BATCH_COUNT;
+	cull.shadowInstanceBase = SHADOW_INSTANCE_BASE;
+	cull.shadowBatchBase = SHADOW_BATCH_BASE;
+	cull.instanceStride = INSTANCE_STRIDE;
+	cull.drawStride = DRAW_STRIDE;
+	return cull;
+}
+
+static bool operator==(const InstanceData& a, const InstanceData& b)
+{
+	return a.transformIndex == b.transformIndex && a.materialIndex == b.materialIndex;
+}
+
+static bool operator==(const VkDrawIndexedIndirectCommand& a, const VkDrawIndexedIndirectCommand& b)
+{
+	return a.indexCount == b.indexCount && a.instanceCount == b.instanceCount && a.firstIndex == b.firstIndex &&
+		a.vertexOffset == b.vertexOffset && a.firstInstance == b.firstInstance;
+}
+
+static std::ostream& operator<<(std::ostream& os, const InstanceData& d)
+{
+	return os << "{ " << d.transformIndex << ", " << d.materialIndex << " }";
+}
+
+static std::ostream& operator<<(std::ostream& os, const VkDrawIndexedIndirectCommand& c)
+{
+	return os << "{ " << c.indexCount << ", " << c.instanceCount << ", " << c.firstIndex << ", " << c.vertexOffset << ", " << c.firstInstance << " }";
+}
+
+int main()
+{
+	auto cull = makeViews();
+
+	glm::fmat4 transforms[] = {
+		makeTransform({ 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 }, { 0, 0, 0 }), // Identity
+		makeTransform({ 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 }, { 6, 0, 0 }),
+		makeTransform({ 2, 0, 0 }, { 0, 2, 0 }, { 0, 0, 2 }, { 0, 0, 3 }), // Uniform scale
+		makeTransform({ 1, 0, 0 }, { 0, 3, 0 }, { 0, 0, 1 }, { 0, 7, 0 }), // Non-uniform scale, the largest axis counts
+		makeTransform({ 0, 1, 0 }, { -1, 0, 0 }, { 0, 0, 1 }, { 10, -3.5f, 0 }) // Quarter turn about z
+	};
+
+	InstanceData instanceData[INSTANCE_COUNT] = {
+		{ 0, 0 }, { 1, 2 }, { 2, 4 }, { 3, 6 }, { 0, 8 }, // Camera
+		{ 4, 0 }, { 1, 2 }, { 0, 4 }, { 3, 6 } // Shadows
+	};
+
+	glm::fvec4 instanceBounds[INSTANCE_COUNT] = {
+		{ 0, 0, 0, 1 }, // Inside
+		{ 0, 0, 0, 1 }, // 2 behind x <= 4 with radius 1
+		{ 0, 0, 0, 0.5f }, // Inside
+		{ 0, 0, 0, 0.25f }, // 3 behind y <= 4 with radius 0.75
+		{ 0, 0, -5.5f, 1.5f }, // Exactly touching z >= -4
+		{ 0, 0, 0, 1 }, // Light: 1.5 behind y >= -2 with radius 1. All: inside
+		{ 1, 0, 0, 1 }, // Light: exactly touching x >= 8. All: inside
+		{ 0, 0, 0, 0.5f }, // Light: 8 behind x >= 8. All: inside
+		{ 3, 0, 0, 1 } // Light: 5 behind x >= 8 with radius 3. All: inside
+	};
+
+	VkDrawIndexedIndirectCommand batches[BATCH_COUNT] = {
+		{ 36, 3, 0, 0, 0 },
+		{ 37, 2, 100, 10, 3 },
+		{ 38, 2, 200, 20, 5 },
+		{ 39, 2, 300, 30, 7 }
+	};
+
+	const InstanceData noInstance = { SENTINEL, SENTINEL };
+	const VkDrawIndexedIndirectCommand noCommand = { SENTINEL, SENTINEL, SENTINEL, s32(SENTINEL), SENTINEL };
+
+	std::vector<u32> visibility(VIEW_COUNT * INSTANCE_STRIDE, SENTINEL);
+	std::vector<InstanceData> visibleInstances(VIEW_COUNT * INSTANCE_STRIDE, noInstance);
+	std::vector<VkDrawIndexedIndirectCommand> batchCommands(VIEW_COUNT * DRAW_STRIDE, noCommand);
+	std::vector<VkDrawIndexedIndirectCommand> culledCommands(VIEW_COUNT * DRAW_STRIDE, noCommand);
+	std::vector<u32> drawCounts(CULL_MAX_VIEWS, SENTINEL);
+
+	cullReference(cull, transforms, instanceData, instanceBounds, batches, visibility.data(), visibleInstances.data(),
+		batchCommands.data(), culledCommands.data(), drawCounts.data());
+
+	// Hand-derived expected values, CULL_PASS_VISIBILITY
+	std::vector<u32> expectedVisibility(VIEW_COUNT * INSTANCE_STRIDE, SENTINEL);
+	u32 cameraVisibility[] = { 1, 0, 1, 0, 1 };
+	u32 lightVisibility[] = { 0, 1, 0, 0 };
+	u32 allVisibility[] = { 1, 1, 1, 1 };
+	for (u32 i = 0; i < SHADOW_INSTANCE_BASE; ++i)
+		expectedVisibility[i] = cameraVisibility[i];
+	for (u32 i = SHADOW_INSTANCE_BASE; i < INSTANCE_COUNT; ++i)
+	{
+		expectedVisibility[INSTANCE_STRIDE + i] = lightVisibility[i - SHADOW_INSTANCE_BASE];
+		expectedVisibility[2 * INSTANCE_STRIDE + i] = allVisibility[i - SHADOW_INSTANCE_BASE];
+	}
+
+	// CULL_PASS_COMPACT_INSTANCES, visible instances packed from the start of their batch
+	std::vector<InstanceData> expectedVisibleInstances(VIEW_COUNT * INSTANCE_STRIDE, noInstance);
+	expectedVisibleInstances[0] = instanceData[0];
+	expectedVisibleInstances[1] = instanceData[2];
+	expectedVisibleInstances[3] = instanceData[4];
+	expectedVisibleInstances[INSTANCE_STRIDE + 5] = instanceData[6];
+	for (u32 i = SHADOW_INSTANCE_BASE; i < INSTANCE_COUNT; ++i)
+		expectedVisibleInstances[2 * INSTANCE_STRIDE + i] = instanceData[i];
+
+	std::vector<VkDrawIndexedIndirectCommand> expectedBatchCommands(VIEW_COUNT * DRAW_STRIDE, noCommand);
+	expectedBatchCommands[0] = { 36, 2, 0, 0, 0 };
+	expectedBatchCommands[1] = { 37, 1, 100, 10, 3 };
+	expectedBatchCommands[DRAW_STRIDE + 2] = { 38, 1, 200, 20, INSTANCE_STRIDE + 5 };
+	expectedBatchCommands[DRAW_STRIDE + 3] = { 39, 0, 300, 30, INSTANCE_STRIDE + 7 };
+	expectedBatchCommands[2 * DRAW_STRIDE + 2] = { 38, 2, 200, 20, 2 * INSTANCE_STRIDE + 5 };
+	expectedBatchCommands[2 * DRAW_STRIDE + 3] = { 39, 2, 300, 30, 2 * INSTANCE_STRIDE + 7 };
+
+	// CULL_PASS_COMPACT_DRAWS, non-empty batches packed from the start of the view
+	std::vector<VkDrawIndexedIndirectCommand> expectedCulledCommands(VIEW_COUNT * DRAW_STRIDE, noCommand);
+	expectedCulledCommands[0] = expectedBatchCommands[0];
+	expectedCulledCommands[1] = expectedBatchCommands[1];
+	expectedCulledCommands[DRAW_STRIDE] = expectedBatchCommands[DRAW_STRIDE + 2];
+	expectedCulledCommands[2 * DRAW_STRIDE] = expectedBatchCommands[2 * DRAW_STRIDE + 2];
+	expectedCulledCommands[2 * DRAW_STRIDE + 1] = expectedBatchCommands[2 * DRAW_STRIDE + 3];
+
+	std::vector<u32> expectedDrawCounts(CULL_MAX_VIEWS, SENTINEL);
+	expectedDrawCounts[0] = 2;
+	expectedDrawCounts[1] = 1;
+	expectedDrawCounts[2] = 2;
+
+	for (u32 i = 0; i < visibility.size(); ++i)
+		TEST_CHECK_EQUAL(visibility[i], expectedVisibility[i]);
+	for (u32 i = 0; i < visibleInstances.size(); ++i)
+		TEST_CHECK_EQUAL(visibleInstances[i], expectedVisibleInstances[i]);
+	for (u32 i = 0; i < batchCommands.size(); ++i)
+		TEST_CHECK_EQUAL(batchCommands[i], expectedBatchCommands[i]);
+	for (u32 i = 0; i < culledCommands.size(); ++i)
+		TEST_CHECK_EQUAL(culledCommands[i], expectedCulledCommands[i]);
+	for (u32 i = 0; i < drawCounts.size(); ++i)
+		TEST_CHECK_EQUAL(drawCounts[i], expectedDrawCounts[i]);
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,75 @@
+#include "Test.hpp"
+#include "MaterialRecords.hpp"
+
+/*
+	Exercises the CPU copy of the material record buffer: growing keeps the written records and adds flat white ones,
+	and a material whose record is past the end reads as flat white, as gbuffer.glsl shades it.
+*/
+
+static bool operator==(const MaterialRecord& a, const MaterialRecord& b)
+{
+	return a.colour == b.colour && a.metallic == b.metallic && a.roughness == b.roughness && a.textured == b.textured;
+}
+
+static std::ostream& operator<<(std::ostream& os, const MaterialRecord& r)
+{
+	return os << "{ (" << r.colour.x << ", " << r.colour.y << ", " << r.colour.z << "), " << r.metallic << ", " << r.roughness << ", " << r.textured << " }";
+}
+
+static const MaterialRecord RED = { glm::fvec3(1, 0, 0), 0.5f, 0.25f, 0, glm::fvec2(0) };
+static const MaterialRecord TEXTURED = { glm::fvec3(1), 0.f, 1.f, 1, glm::fvec2(0) };
+
+static void testPastTheEnd()
+{
+	MaterialRecords records;
+	TEST_CHECK_EQUAL(records.read(0), MaterialRecord::flatWhite());
+
+	records.grow(4);
+	TEST_CHECK_EQUAL(records.getCapacity(), 4u);
+	for (u32 i = 0; i < 4; ++i)
+		TEST_CHECK_EQUAL(records.read(i * 2), MaterialRecord::flatWhite());
+
+	// Two textures per material, both of a material's indices read its record
+	records.set(3, RED);
+	TEST_CHECK_EQUAL(records.read(6), RED);
+	TEST_CHECK_EQUAL(records.read(7), RED);
+
+	// Record 4 is the first past the end
+	TEST_CHECK_EQUAL(records.read(8), MaterialRecord::flatWhite());
+	TEST_CHECK_EQUAL(records.read(~0u), MaterialRecord::flatWhite());
+}
+
+static void testGrow()
+{
+	MaterialRecords records;
+	records.grow(2);
+	records.set(0, RED);
+	records.set(1, TEXTURED);
+
+	records.grow(5);
+	TEST_CHECK_EQUAL(records.getCapacity(), 5u);
+	TEST_CHECK_EQUAL(records.read(0), RED);
+	TEST_CHECK_EQUAL(records.read(2), TEXTURED);
+	for (u32 i = 2; i < 5; ++i)
+		TEST_CHECK_EQUAL(records.read(i * 2), MaterialRecord::flatWhite());
+
+	// A material added past the old end is written once the records have grown to it
+	records.set(4, RED);
+	TEST_CHECK_EQUAL(records.read(8), RED);
+
+	// Never shrinks
+	records.grow(3);
+	TEST_CHECK_EQUAL(records.getCapacity(), 5u);
+	TEST_CHECK_EQUAL(records.read(8), RED);
+
+	// The data is what gets streamed to the buffer
+	TEST_CHECK_EQUAL(records.getData()[1], TEXTURED);
+}
+
+int main()
+{
+	testPastTheEnd();
+	testGrow();
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,116 @@
+#include "Test.hpp"
+#include "RingAllocator.hpp"
+
+/*
+	Exercises the staging ring's bookkeeping: alignment, wrapping around the end, running full and giving space
+	back strictly in order even when submissions are released out of order.
+*/
+
+static const u64 INVALID = RingAllocator::INVALID_OFFSET;
+
+static void testAllocate()
+{
+	RingAllocator r;
+	r.init(256);
+
+	TEST_CHECK_EQUAL(r.allocate(1, 0, 16), INVALID);
+	TEST_CHECK_EQUAL(r.allocate(1, 257, 16), INVALID);
+
+	TEST_CHECK_EQUAL(r.allocate(1, 10, 16), 0ull);
+	TEST_CHECK_EQUAL(r.allocate(1, 10, 16), 16ull); // Aligned up, the padding counts as used
+	TEST_CHECK_EQUAL(r.allocate(2, 4, 4), 28ull);
+	TEST_CHECK_EQUAL(r.getUsed(), 32ull);
+}
+
+static void testFullAndRelease()
+{
+	RingAllocator r;
+	r.init(256);
+
+	TEST_CHECK_EQUAL(r.allocate(1, 128, 16), 0ull);
+	TEST_CHECK_EQUAL(r.allocate(2, 128, 16), 128ull);
+
+	// Nothing submitted, there is nothing to wait for
+	TEST_CHECK_EQUAL(r.allocate(3, 16, 16), INVALID);
+	TEST_CHECK_EQUAL(r.getOldestSubmission(), 0ull);
+
+	r.submit(2, 20);
+	TEST_CHECK_EQUAL(r.getOldestSubmission(), 0ull); // Owner 1 still holds the tail
+	r.submit(1, 10);
+	TEST_CHECK_EQUAL(r.getOldestSubmission(), 10ull);
+
+	// Space comes back in order, 20 finishing first frees nothing until 10 has too
+	r.release(20);
+	TEST_CHECK_EQUAL(r.allocate(3, 16, 16), INVALID);
+	TEST_CHECK_EQUAL(r.getOldestSubmission(), 10ull);
+
+	r.release(10);
+	TEST_CHECK_EQUAL(r.getUsed(), 0ull);
+	TEST_CHECK_EQUAL(r.getOldestSubmission(), 0ull);
+
+	// Positions carry on from the head
+	TEST_CHECK_EQUAL(r.allocate(3, 16, 16), 0ull);
+	TEST_CHECK_EQUAL(r.getUsed(), 16ull);
+
+	r.release(10);
+	TEST_CHECK_EQUAL(r.getUsed(), 16ull);
+}
+
+static void testWrap()
+{
+	RingAllocator r;
+	r.init(256);
+
+	TEST_CHECK_EQUAL(r.allocate(1, 100, 16), 0ull);
+	TEST_CHECK_EQUAL(r.allocate(2, 100, 16), 112ull);
+	r.submit(1, 1);
+	r.submit(2, 2);
+
+	// 44 bytes are left before the end, a 64 byte block skips them and waits for the start to come back
+	TEST_CHECK_EQUAL(r.allocate(3, 64, 16), INVALID);
+	TEST_CHECK_EQUAL(r.getOldestSubmission(), 1ull);
+
+	r.release(1);
+	TEST_CHECK_EQUAL(r.allocate(3, 64, 16), 0ull);
+	TEST_CHECK_EQUAL(r.getUsed(), 220ull); // From the end of the first block, padding included
+
+	// The skipped end belongs to the block after it
+	r.release(2);
+	TEST_CHECK_EQUAL(r.getUsed(), 44ull + 64ull);
+	TEST_CHECK_EQUAL(r.getOldestSubmission(), 0ull);
+
+	r.submit(3, 3);
+	r.release(3);
+	TEST_CHECK_EQUAL(r.getUsed(), 0ull);
+}
+
+static void testOwners()
+{
+	RingAllocator r;
+	r.init(64);
+
+	// A submit only takes the owner's blocks made since its last submit
+	r.allocate(1, 16, 16);
+	r.allocate(2, 16, 16);
+	r.submit(1, 1);
+	r.allocate(1, 16, 16);
+	r.submit(1, 2);
+	r.submit(2, 3);
+
+	r.release(1);
+	TEST_CHECK_EQUAL(r.getUsed(), 32ull); // Owner 2's block is next and still pending
+	r.release(3);
+	TEST_CHECK_EQUAL(r.getUsed(), 16ull);
+	r.release(2);
+	TEST_CHECK_EQUAL(r.getUsed(), 0ull);
+}
+
+int main()
+{
+	testAllocate();
+	testFullAndRelease();
+	testWrap();
+	testOwners();
+
+	return TEST_RESULT();
+}
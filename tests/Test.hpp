@@ -0,0 +1,22 @@
+#pragma once
+#include "PCH.hpp"
+
+/*
+	@brief	Checks shared by the tests in this directory
+	@note	Each test is its own executable linking only the engine sources it exercises, nothing creates a device.
+			A failed check is reported and counted, main returns TEST_RESULT() so ctest sees the failure
+*/
+static u32 testFailures = 0;
+
+#define TEST_CHECK(expr) { \
+	if (!(expr)) { \
+		std::cout << __FILE__ << " Line: " << __LINE__ << " check failed: " << #expr << std::endl; \
+		++testFailures; } }
+
+#define TEST_CHECK_EQUAL(a, b) { \
+	auto _a = (a); auto _b = (b); \
+	if (!(_a == _b)) { \
+		std::cout << __FILE__ << " Line: " << __LINE__ << " check failed: " << #a << " == " << #b << " (" << _a << " != " << _b << ")" << std::endl; \
+		++testFailures; } }
+
+#define TEST_RESULT() (testFailures == 0 ? 0 : 1)